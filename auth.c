@@ -24,6 +24,7 @@
 #include "common.h"
 
 #include <http_request.h>
+#include <http_protocol.h>
 
 #include "irods/pamAuthRequest.h"
 #include "irods/getMiscSvrInfo.h"
@@ -43,7 +44,7 @@ static apr_status_t rods_conn_cleanup (void *mem);
 static authn_status GetIRodsConnection2 (request_rec *req_p, apr_pool_t *pool_p,
 		rcComm_t **connection_pp, const char *username_s, const char *password_s);
 
-static int do_rods_login_pam (request_rec *r, rcComm_t *rods_conn,
+static int do_rods_login_pam (apr_pool_t *pool, rcComm_t *rods_conn,
 		const char *password, int ttl, char **tmp_password);
 
 
@@ -89,7 +90,7 @@ static apr_status_t rods_conn_cleanup (void *mem)
 /**
  * \brief Perform an iRODS PAM login, return a temporary password.
  *
- * \param[in]  r            request record
+ * \param[in]  pool         memory pool for allocations and logging
  * \param[in]  rods_conn
  * \param[in]  password
  * \param[in]  ttl          temporary password ttl
@@ -97,29 +98,29 @@ static apr_status_t rods_conn_cleanup (void *mem)
  *
  * \return an iRODS status code (0 on success)
  */
-static int do_rods_login_pam (request_rec *r, rcComm_t *rods_conn,
+static int do_rods_login_pam (apr_pool_t *pool, rcComm_t *rods_conn,
 		const char *password, int ttl, char **tmp_password)
 {
 
 	// Perform a PAM login. The connection must be encrypted at this point.
 
-	pamAuthRequestInp_t auth_req_params = { .pamPassword = apr_pstrdup (r->pool,
+	pamAuthRequestInp_t auth_req_params = { .pamPassword = apr_pstrdup (pool,
 			password),
-			.pamUser = apr_pstrdup (r->pool, rods_conn->proxyUser.userName),
+			.pamUser = apr_pstrdup (pool, rods_conn->proxyUser.userName),
 			.timeToLive = ttl };
 
 	pamAuthRequestOut_t *auth_req_result = NULL;
 	int status = rcPamAuthRequest (rods_conn, &auth_req_params, &auth_req_result);
 	if (status)
 		{
-			ap_log_rerror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, r,
+			ap_log_perror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, pool,
 					"rcPamAuthRequest failed: %d = %s", status,
 					get_rods_error_msg (status));
 			sslEnd (rods_conn);
 			return status;
 		}
 
-	*tmp_password = apr_pstrdup (r->pool, auth_req_result->irodsPamPassword);
+	*tmp_password = apr_pstrdup (pool, auth_req_result->irodsPamPassword);
 
 	// Who owns auth_req_result? I guess that's us.
 	// Better not forget to free its contents too.
@@ -136,14 +137,21 @@ static int do_rods_login_pam (request_rec *r, rcComm_t *rods_conn,
 static authn_status rods_login (request_rec *r, const char *username,
 		const char *password, rcComm_t **rods_conn)
 {
-	authn_status result = AUTH_USER_NOT_FOUND;
 	// Get config.
 	davrods_dir_conf_t *conf = ap_get_module_config (r->per_dir_config,
 			&davrods_module);
 
+	return LoginToIRods (conf, username, password, rods_conn, r->pool);
+}
+
+authn_status LoginToIRods (const davrods_dir_conf_t *conf, const char *username,
+		const char *password, rcComm_t **rods_conn, apr_pool_t *pool)
+{
+	authn_status result = AUTH_USER_NOT_FOUND;
+
 	if (conf)
 		{
-			ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
+			ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, pool,
 					"Connecting to iRODS using address <%s:%d>, username <%s> and zone <%s>",
 					conf->rods_host, conf->rods_port, username, conf->rods_zone);
 
@@ -152,7 +160,7 @@ static authn_status rods_login (request_rec *r, const char *username,
 			//setenv("IRODS_ENVIRONMENT_FILE", "/dev/null", 1);
 			setenv ("IRODS_ENVIRONMENT_FILE", conf->rods_env_file, 1);
 
-			ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
+			ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, pool,
 					"Using iRODS env file at <%s>", getenv ("IRODS_ENVIRONMENT_FILE"));
 
 			rErrMsg_t rods_errmsg;
@@ -161,13 +169,13 @@ static authn_status rods_login (request_rec *r, const char *username,
 
 			if (*rods_conn)
 				{
-					ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
+					ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, pool,
 							"Succesfully connected to iRODS zone '%s'", conf->rods_zone);
 
 					miscSvrInfo_t *server_info = NULL;
 					rcGetMiscSvrInfo (*rods_conn, &server_info);
 
-					ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
+					ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, pool,
 							"Server version: %s", server_info->relVersion);
 
 					// Whether to use SSL for the entire connection.
@@ -184,14 +192,14 @@ static authn_status rods_login (request_rec *r, const char *username,
 							// Negotiation was disabled or resulted in CS_NEG_USE_TCP (i.e. no SSL).
 						}
 
-					ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
+					ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, pool,
 							"SSL negotiation result: <%s>: %s",
 							(*rods_conn)->negotiation_results,
 							useSsl ?
 									"will use SSL for the entire connection" :
 									"will NOT use SSL (if using PAM, SSL will only be used during auth)");
 
-					ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
+					ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, pool,
 							"Is SSL currently on? (ssl* = %d, ssl_on = %d)"
 									" (ignore ssl_on, it seems 4.x does not update it after SSL is turned on automatically during rcConnect)",
 							(*rods_conn)->ssl ? 1 : 0, (*rods_conn)->ssl_on);
@@ -204,7 +212,7 @@ static authn_status rods_login (request_rec *r, const char *username,
 
 							if (!(*rods_conn)->ssl)
 								{
-									ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, r,
+									ap_log_perror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, pool,
 											"SSL should have been turned on at this point (negotiation result was <%s>)."
 													" Aborting for security reasons.",
 											(*rods_conn)->negotiation_results);
@@ -223,19 +231,19 @@ static authn_status rods_login (request_rec *r, const char *username,
 									// In this situation we don't know if we should stop
 									// SSL after PAM auth or keep it on, so we fail
 									// instead.
-									ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, r,
+									ap_log_perror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, pool,
 											"SSL should NOT have been turned on at this point (negotiation result was <%s>). Aborting.",
 											(*rods_conn)->negotiation_results);
 
 									return HTTP_INTERNAL_SERVER_ERROR;
 								}
-							ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
+							ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, pool,
 									"Enabling SSL for PAM auth");
 
 							int status = sslStart (*rods_conn);
 							if (status)
 								{
-									ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, r,
+									ap_log_perror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, pool,
 											"sslStart for PAM failed: %d = %s", status,
 											get_rods_error_msg (status));
 
@@ -243,7 +251,7 @@ static authn_status rods_login (request_rec *r, const char *username,
 								}
 						}
 
-					ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r, "Logging in");
+					ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, pool, "Logging in");
 
 					// clientLoginWithPassword()'s signature specifies a WRITABLE password parameter.
 					// I don't expect it to actually write to this field, but we'll play it
@@ -251,24 +259,24 @@ static authn_status rods_login (request_rec *r, const char *username,
 					if (strlen (password) > 63)
 						{
 							// iRODS 4.1 appears to limit password length to 50 characters.
-							ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, r,
+							ap_log_perror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, pool,
 									"Password exceeds length limits (%lu vs 63)",
 									strlen (password));
 							return HTTP_INTERNAL_SERVER_ERROR;
 						}
 					// This password field will be destroyed at the end of the HTTP request.
-					char *password_buf = apr_pstrdup (r->pool, password);
+					char *password_buf = apr_pstrdup (pool, password);
 
 					int status = 0;
 
 					if (conf->rods_auth_scheme == DAVRODS_AUTH_PAM)
 						{
 							char *tmp_password = NULL;
-							status = do_rods_login_pam (r, *rods_conn, password_buf,
+							status = do_rods_login_pam (pool, *rods_conn, password_buf,
 									conf->rods_auth_ttl, &tmp_password);
 							if (!status)
 								{
-									password_buf = apr_pstrdup (r->pool, tmp_password);
+									password_buf = apr_pstrdup (pool, tmp_password);
 
 									// Login using the received temporary password.
 									status = clientLoginWithPassword (*rods_conn, password_buf);
@@ -283,12 +291,12 @@ static authn_status rods_login (request_rec *r, const char *username,
 						{
 							// This shouldn't happen.
 							status = APR_EGENERAL;
-							ap_log_rerror (APLOG_MARK, APLOG_DEBUG, status, r, "Unimplemented auth scheme");
+							ap_log_perror (APLOG_MARK, APLOG_DEBUG, status, pool, "Unimplemented auth scheme");
 						}
 
 					if (status)
 						{
-							ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
+							ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, pool,
 									"Login failed: %d = %s", status, get_rods_error_msg (status));
 							result = AUTH_DENIED;
 
@@ -298,7 +306,7 @@ static authn_status rods_login (request_rec *r, const char *username,
 						}
 					else
 						{
-							ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
+							ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, pool,
 									"Login succesful");
 							result = AUTH_GRANTED;
 
@@ -306,13 +314,13 @@ static authn_status rods_login (request_rec *r, const char *username,
 							// thereof) demanded plain TCP for the rest of the connection.
 							if (!useSsl && (*rods_conn)->ssl)
 								{
-									ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, r,
+									ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_SUCCESS, pool,
 											"Disabling SSL (was used for PAM only)");
 
 									if (conf->rods_auth_scheme != DAVRODS_AUTH_PAM)
 										{
 											// This should not happen.
-											ap_log_rerror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, r,
+											ap_log_perror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, pool,
 													"SSL was turned on, but not for PAM."
 															" This conflicts with the negotiation result (%s)!",
 													(*rods_conn)->negotiation_results);
@@ -320,7 +328,7 @@ static authn_status rods_login (request_rec *r, const char *username,
 									status = sslEnd (*rods_conn);
 									if (status)
 										{
-											ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, r,
+											ap_log_perror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, pool,
 													"sslEnd failed after PAM auth: %d = %s", status,
 													get_rods_error_msg (status));
 
@@ -331,7 +339,7 @@ static authn_status rods_login (request_rec *r, const char *username,
 				}
 			else
 				{
-					ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, r,
+					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, pool,
 							"Could not connect to iRODS using address <%s:%d>,"
 									" username <%s> and zone <%s>. iRODS says: '%s'",
 							conf->rods_host, conf->rods_port, username, conf->rods_zone,
@@ -343,7 +351,7 @@ static authn_status rods_login (request_rec *r, const char *username,
 		} /* if (conf) */
 	else
 		{
-			ap_log_rerror (APLOG_MARK, APLOG_DEBUG, APR_EGENERAL, r,
+			ap_log_perror (APLOG_MARK, APLOG_DEBUG, APR_EGENERAL, pool,
 					"Failed to get module config");
 		}
 
@@ -477,6 +485,39 @@ apr_status_t GetSessionAuth (request_rec *req_p, const char **user_ss, const cha
 }
 
 
+apr_status_t GetIRodsCredentialsForRequest (request_rec *req_p, const davrods_dir_conf_t *conf_p, const char **username_ss, const char **password_ss)
+{
+	apr_status_t status = APR_EGENERAL;
+	const char *username_s = NULL;
+	const char *password_s = NULL;
+
+	/* Try any form-based session first, then HTTP Basic auth and finally the public user */
+	if ((GetSessionAuth (req_p, &username_s, &password_s, NULL) == APR_SUCCESS) && username_s && password_s)
+		{
+			status = APR_SUCCESS;
+		}
+	else if ((ap_get_basic_auth_pw (req_p, &password_s) == OK) && (req_p -> user) && password_s)
+		{
+			username_s = req_p -> user;
+			status = APR_SUCCESS;
+		}
+	else if (conf_p -> davrods_public_username_s)
+		{
+			username_s = conf_p -> davrods_public_username_s;
+			password_s = conf_p -> davrods_public_password_s ? conf_p -> davrods_public_password_s : "";
+			status = APR_SUCCESS;
+		}
+
+	if (status == APR_SUCCESS)
+		{
+			*username_ss = username_s;
+			*password_ss = password_s;
+		}
+
+	return status;
+}
+
+
 authn_status GetIRodsConnection (request_rec *req_p, rcComm_t **connection_pp,
 		const char *username_s, const char *password_s)
 {
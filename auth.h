@@ -24,6 +24,7 @@
 
 #include "mod_auth.h"
 #include "mod_davrods.h"
+#include "config.h"
 
 #include "irods/rodsConnect.h"
 
@@ -55,4 +56,33 @@ apr_status_t RodsLogout (request_rec *req_p);
 apr_status_t GetSessionAuth (request_rec *req_p, const char **user_ss, const char **password_ss, const char **hash_ss);
 
 
+/**
+ * Get the iRODS username and password that a request is using. These are
+ * taken from the session, then from HTTP Basic auth and, if neither of those
+ * are available, the configured public user.
+ *
+ * @param req_p The request.
+ * @param conf_p The module configuration for the request.
+ * @param username_ss Where the username will be stored.
+ * @param password_ss Where the password will be stored.
+ * @return APR_SUCCESS if the credentials were found, APR_EGENERAL otherwise.
+ */
+apr_status_t GetIRodsCredentialsForRequest (request_rec *req_p, const davrods_dir_conf_t *conf_p, const char **username_ss, const char **password_ss);
+
+
+/**
+ * Connect to iRODS and log in without needing a request. This is used
+ * for the connections that are made by background threads.
+ *
+ * @param conf_p The module configuration with the server details.
+ * @param username_s The iRODS username.
+ * @param password_s The password for the user.
+ * @param connection_pp Where the connection will be stored upon success.
+ * The caller is responsible for calling rcDisconnect() on it.
+ * @param pool_p The memory pool to use for temporary allocations and logging.
+ * @return AUTH_GRANTED upon success.
+ */
+authn_status LoginToIRods (const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s, rcComm_t **connection_pp, apr_pool_t *pool_p);
+
+
 #endif /* _RODS_AUTH_H */
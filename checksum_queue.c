@@ -0,0 +1,805 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * checksum_queue.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+
+#include "apr_hash.h"
+#include "apr_strings.h"
+#include "apr_time.h"
+
+#if APR_HAS_THREADS
+#include "apr_thread_cond.h"
+#include "apr_thread_mutex.h"
+#include "apr_thread_proc.h"
+#endif
+
+#include "http_log.h"
+
+#include "irods/rodsClient.h"
+
+#include "checksum_queue.h"
+#include "listing_cache.h"
+#include "auth.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+#if APR_HAS_THREADS
+
+/*
+ * Each request is allocated with malloc rather than from a pool since
+ * it outlives the http request that added it and is freed by whichever
+ * thread calculates its checksum.
+ */
+typedef struct ChecksumRequest
+{
+	char *cr_path_s;
+	char *cr_username_s;
+	char *cr_password_s;
+
+	/*
+	 * A copy of the server details. Only the fields that LoginToIRods()
+	 * uses are valid since the original configuration belongs to the request.
+	 */
+	davrods_dir_conf_t cr_conf;
+
+	struct ChecksumRequest *cr_next_p;
+} ChecksumRequest;
+
+
+/*
+ * A data object whose checksum couldn't be calculated, which isn't
+ * queued again until fc_retry_time.
+ */
+typedef struct FailedChecksum
+{
+	char *fc_path_s;
+	apr_time_t fc_retry_time;
+} FailedChecksum;
+
+
+/*
+ * One of the threads that calculate the checksums. Its connection
+ * is kept here so that it can be shut down if the child process
+ * exits whilst the thread is waiting for the server.
+ */
+typedef struct ChecksumWorker
+{
+	apr_thread_t *cw_thread_p;
+	rcComm_t *cw_connection_p;
+} ChecksumWorker;
+
+#endif
+
+
+/*
+ * STATIC VARIABLES
+ */
+
+static int s_checksum_threads = 2;
+
+static int s_checksum_queue_size = 1024;
+
+/* How long to wait before trying a failed checksum again */
+static apr_interval_time_t s_checksum_retry_delay = APR_TIME_C (600) * APR_USEC_PER_SEC;
+
+/*
+ * How long a child process that is exiting waits for the threads to
+ * finish once their connections have been shut down.
+ */
+static const apr_interval_time_t S_SHUTDOWN_WAIT = APR_TIME_C (5) * APR_USEC_PER_SEC;
+
+
+#if APR_HAS_THREADS
+/*
+ * Everything that the threads use is allocated from this pool rather
+ * than the child's one, since a thread that is stuck talking to the
+ * server might still be running when the child's pool is destroyed.
+ */
+static apr_pool_t *s_queue_pool_p = NULL;
+
+static ChecksumWorker *s_workers_p = NULL;
+
+/* Guards everything below it */
+static apr_thread_mutex_t *s_queue_mutex_p = NULL;
+
+/* Signalled when a request is queued or the threads need to stop */
+static apr_thread_cond_t *s_work_cond_p = NULL;
+
+/* Signalled when a thread stops */
+static apr_thread_cond_t *s_stopped_cond_p = NULL;
+
+/* The paths of the queued data objects, so that each is only added once */
+static apr_hash_t *s_pending_paths_p = NULL;
+
+/* The FailedChecksums for the paths that aren't to be queued again yet */
+static apr_hash_t *s_failed_paths_p = NULL;
+
+static ChecksumRequest *s_first_request_p = NULL;
+static ChecksumRequest *s_last_request_p = NULL;
+
+static int s_num_queued_requests = 0;
+
+static int s_num_running_workers = 0;
+
+static bool s_shutdown_flag = false;
+#endif
+
+
+/*
+ * STATIC DECLARATIONS
+ */
+
+#if APR_HAS_THREADS
+static ChecksumRequest *AllocateChecksumRequest (const char *path_s, const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s);
+
+static void FreeChecksumRequest (ChecksumRequest *request_p);
+
+static ChecksumRequest *WaitForChecksumRequest (void);
+
+static bool IsSameIRodsUser (const ChecksumRequest *request_p, const ChecksumRequest *previous_p);
+
+static bool HasChecksumFailedRecently (const char *path_s, const apr_time_t now);
+
+static void AddFailedChecksum (const char *path_s);
+
+static void RemoveExpiredFailedChecksums (const apr_time_t now);
+
+static void SetWorkerConnection (ChecksumWorker *worker_p, rcComm_t *connection_p);
+
+static void *APR_THREAD_FUNC RunChecksumWorker (apr_thread_t *thread_p, void *data_p);
+
+static apr_status_t StopChecksumWorkers (void *data_p);
+
+static void ClearChecksumQueue (void);
+#endif
+
+
+/*
+ * API DEFINITIONS
+ */
+
+apr_status_t InitChecksumQueue (apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	#if APR_HAS_THREADS
+	if (s_checksum_queue_size > 0)
+		{
+			status = apr_pool_create (&s_queue_pool_p, NULL);
+
+			if (status == APR_SUCCESS)
+				{
+					apr_threadattr_t *attr_p = NULL;
+
+					apr_pool_tag (s_queue_pool_p, "checksum_queue");
+
+					s_pending_paths_p = apr_hash_make (s_queue_pool_p);
+					s_failed_paths_p = apr_hash_make (s_queue_pool_p);
+					s_workers_p = (ChecksumWorker *) apr_pcalloc (s_queue_pool_p, s_checksum_threads * sizeof (ChecksumWorker));
+
+					if (! (s_pending_paths_p && s_failed_paths_p && s_workers_p))
+						{
+							status = APR_ENOMEM;
+						}
+
+					if (status == APR_SUCCESS)
+						{
+							status = apr_thread_mutex_create (&s_queue_mutex_p, APR_THREAD_MUTEX_DEFAULT, s_queue_pool_p);
+						}
+
+					if (status == APR_SUCCESS)
+						{
+							status = apr_thread_cond_create (&s_work_cond_p, s_queue_pool_p);
+						}
+
+					if (status == APR_SUCCESS)
+						{
+							status = apr_thread_cond_create (&s_stopped_cond_p, s_queue_pool_p);
+						}
+
+					/*
+					 * The threads are detached so that the child process never has to
+					 * wait for one that is still reading a large file on the server.
+					 */
+					if (status == APR_SUCCESS)
+						{
+							status = apr_threadattr_create (&attr_p, s_queue_pool_p);
+						}
+
+					if (status == APR_SUCCESS)
+						{
+							status = apr_threadattr_detach_set (attr_p, 1);
+						}
+
+					if (status == APR_SUCCESS)
+						{
+							int i;
+
+							apr_pool_cleanup_register (pool_p, NULL, StopChecksumWorkers, apr_pool_cleanup_null);
+
+							for (i = 0; (i < s_checksum_threads) && (status == APR_SUCCESS); ++ i)
+								{
+									ChecksumWorker *worker_p = s_workers_p + i;
+
+									apr_thread_mutex_lock (s_queue_mutex_p);
+									++ s_num_running_workers;
+									apr_thread_mutex_unlock (s_queue_mutex_p);
+
+									status = apr_thread_create (& (worker_p -> cw_thread_p), attr_p, RunChecksumWorker, worker_p, s_queue_pool_p);
+
+									if (status != APR_SUCCESS)
+										{
+											ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to start checksum thread %d", i + 1);
+
+											apr_thread_mutex_lock (s_queue_mutex_p);
+											-- s_num_running_workers;
+											apr_thread_mutex_unlock (s_queue_mutex_p);
+										}
+								}
+
+							/* Carry on with however many threads did start */
+							if (s_num_running_workers > 0)
+								{
+									status = APR_SUCCESS;
+								}
+						}
+					else
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to create checksum queue");
+
+							apr_pool_destroy (s_queue_pool_p);
+							s_queue_pool_p = NULL;
+							s_queue_mutex_p = NULL;
+						}
+
+				}		/* if (status == APR_SUCCESS) */
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to create checksum queue pool");
+					s_queue_pool_p = NULL;
+				}
+		}		/* if (s_checksum_queue_size > 0) */
+	#else
+	ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, APR_ENOTIMPL, pool_p, "Background checksums need APR thread support so are disabled");
+	#endif
+
+	return status;
+}
+
+
+bool QueueChecksum (const char *path_s, const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s)
+{
+	bool queued_flag = false;
+
+	#if APR_HAS_THREADS
+	if (s_queue_mutex_p && path_s && username_s && password_s)
+		{
+			apr_thread_mutex_lock (s_queue_mutex_p);
+
+			if (apr_hash_get (s_pending_paths_p, path_s, APR_HASH_KEY_STRING))
+				{
+					queued_flag = true;
+				}
+			else if ((s_num_queued_requests < s_checksum_queue_size) && (s_num_running_workers > 0) && (!s_shutdown_flag) && (!HasChecksumFailedRecently (path_s, apr_time_now ())))
+				{
+					ChecksumRequest *request_p = AllocateChecksumRequest (path_s, conf_p, username_s, password_s);
+
+					if (request_p)
+						{
+							if (s_last_request_p)
+								{
+									s_last_request_p -> cr_next_p = request_p;
+								}
+							else
+								{
+									s_first_request_p = request_p;
+								}
+
+							s_last_request_p = request_p;
+							++ s_num_queued_requests;
+
+							apr_hash_set (s_pending_paths_p, request_p -> cr_path_s, APR_HASH_KEY_STRING, request_p);
+							apr_thread_cond_signal (s_work_cond_p);
+
+							queued_flag = true;
+						}
+				}
+
+			apr_thread_mutex_unlock (s_queue_mutex_p);
+		}
+	#endif
+
+	return queued_flag;
+}
+
+
+const char *SetChecksumThreads (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *error_s = NULL;
+	apr_int64_t num_threads = apr_atoi64 (arg_p);
+
+	if ((num_threads > 0) && (num_threads <= INT_MAX))
+		{
+			s_checksum_threads = (int) num_threads;
+		}
+	else
+		{
+			error_s = "The number of checksum threads must be greater than zero";
+		}
+
+	return error_s;
+}
+
+
+const char *SetChecksumQueueSize (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *error_s = NULL;
+	apr_int64_t queue_size = apr_atoi64 (arg_p);
+
+	if ((queue_size >= 0) && (queue_size <= INT_MAX))
+		{
+			s_checksum_queue_size = (int) queue_size;
+		}
+	else
+		{
+			error_s = "The size of the checksum queue must be zero or greater";
+		}
+
+	return error_s;
+}
+
+
+const char *SetChecksumRetryDelay (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *error_s = NULL;
+	apr_int64_t delay = apr_atoi64 (arg_p);
+
+	if ((delay >= 0) && (delay <= INT_MAX))
+		{
+			s_checksum_retry_delay = apr_time_from_sec (delay);
+		}
+	else
+		{
+			error_s = "The checksum retry delay must be a number of seconds, or 0 to try again straight away";
+		}
+
+	return error_s;
+}
+
+
+/*
+ * STATIC DEFINITIONS
+ */
+
+#if APR_HAS_THREADS
+
+static ChecksumRequest *AllocateChecksumRequest (const char *path_s, const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s)
+{
+	ChecksumRequest *request_p = (ChecksumRequest *) calloc (1, sizeof (ChecksumRequest));
+
+	if (request_p)
+		{
+			request_p -> cr_conf = *conf_p;
+
+			request_p -> cr_path_s = strdup (path_s);
+			request_p -> cr_username_s = strdup (username_s);
+			request_p -> cr_password_s = strdup (password_s);
+			request_p -> cr_conf.rods_host = conf_p -> rods_host ? strdup (conf_p -> rods_host) : NULL;
+			request_p -> cr_conf.rods_zone = conf_p -> rods_zone ? strdup (conf_p -> rods_zone) : NULL;
+			request_p -> cr_conf.rods_env_file = conf_p -> rods_env_file ? strdup (conf_p -> rods_env_file) : NULL;
+
+			if (! ((request_p -> cr_path_s) && (request_p -> cr_username_s) && (request_p -> cr_password_s)
+				&& ((request_p -> cr_conf.rods_host) || (! (conf_p -> rods_host)))
+				&& ((request_p -> cr_conf.rods_zone) || (! (conf_p -> rods_zone)))
+				&& ((request_p -> cr_conf.rods_env_file) || (! (conf_p -> rods_env_file)))))
+				{
+					FreeChecksumRequest (request_p);
+					request_p = NULL;
+				}
+		}
+
+	return request_p;
+}
+
+
+static void FreeChecksumRequest (ChecksumRequest *request_p)
+{
+	free (request_p -> cr_path_s);
+	free (request_p -> cr_username_s);
+	free (request_p -> cr_password_s);
+	free ((char *) (request_p -> cr_conf.rods_host));
+	free ((char *) (request_p -> cr_conf.rods_zone));
+	free ((char *) (request_p -> cr_conf.rods_env_file));
+	free (request_p);
+}
+
+
+/*
+ * Wait for the next request and take it from the front of the queue.
+ * Its path stays in s_pending_paths_p until its checksum has been
+ * calculated so that it isn't queued again in the meantime. This
+ * returns NULL once the threads need to stop.
+ */
+static ChecksumRequest *WaitForChecksumRequest (void)
+{
+	ChecksumRequest *request_p = NULL;
+
+	apr_thread_mutex_lock (s_queue_mutex_p);
+
+	while ((!s_first_request_p) && (!s_shutdown_flag))
+		{
+			apr_thread_cond_wait (s_work_cond_p, s_queue_mutex_p);
+		}
+
+	if (!s_shutdown_flag)
+		{
+			request_p = s_first_request_p;
+			s_first_request_p = request_p -> cr_next_p;
+
+			if (!s_first_request_p)
+				{
+					s_last_request_p = NULL;
+				}
+
+			request_p -> cr_next_p = NULL;
+			-- s_num_queued_requests;
+		}
+
+	apr_thread_mutex_unlock (s_queue_mutex_p);
+
+	return request_p;
+}
+
+
+static bool IsSameIRodsUser (const ChecksumRequest *request_p, const ChecksumRequest *previous_p)
+{
+	bool same_flag = false;
+
+	if (previous_p)
+		{
+			if ((strcmp (request_p -> cr_username_s, previous_p -> cr_username_s) == 0) && (strcmp (request_p -> cr_password_s, previous_p -> cr_password_s) == 0))
+				{
+					const char *host_s = request_p -> cr_conf.rods_host ? request_p -> cr_conf.rods_host : "";
+					const char *previous_host_s = previous_p -> cr_conf.rods_host ? previous_p -> cr_conf.rods_host : "";
+
+					if ((strcmp (host_s, previous_host_s) == 0) && (request_p -> cr_conf.rods_port == previous_p -> cr_conf.rods_port))
+						{
+							same_flag = true;
+						}
+				}
+		}
+
+	return same_flag;
+}
+
+
+/*
+ * Check whether the checksum for a path failed too recently to try
+ * again, forgetting the failure if it has expired. s_queue_mutex_p
+ * must be held.
+ */
+static bool HasChecksumFailedRecently (const char *path_s, const apr_time_t now)
+{
+	bool failed_flag = false;
+	FailedChecksum *failed_p = (FailedChecksum *) apr_hash_get (s_failed_paths_p, path_s, APR_HASH_KEY_STRING);
+
+	if (failed_p)
+		{
+			if (failed_p -> fc_retry_time > now)
+				{
+					failed_flag = true;
+				}
+			else
+				{
+					apr_hash_set (s_failed_paths_p, failed_p -> fc_path_s, APR_HASH_KEY_STRING, NULL);
+					free (failed_p -> fc_path_s);
+					free (failed_p);
+				}
+		}
+
+	return failed_flag;
+}
+
+
+/*
+ * Remember that the checksum for a path failed. There are never more
+ * failures kept than the size of the queue, so once that is reached any
+ * further ones are forgotten straight away. s_queue_mutex_p must be held.
+ */
+static void AddFailedChecksum (const char *path_s)
+{
+	if (s_checksum_retry_delay > 0)
+		{
+			const apr_time_t now = apr_time_now ();
+
+			if ((int) apr_hash_count (s_failed_paths_p) >= s_checksum_queue_size)
+				{
+					RemoveExpiredFailedChecksums (now);
+				}
+
+			if (((int) apr_hash_count (s_failed_paths_p) < s_checksum_queue_size) && (!apr_hash_get (s_failed_paths_p, path_s, APR_HASH_KEY_STRING)))
+				{
+					FailedChecksum *failed_p = (FailedChecksum *) malloc (sizeof (FailedChecksum));
+
+					if (failed_p)
+						{
+							failed_p -> fc_path_s = strdup (path_s);
+
+							if (failed_p -> fc_path_s)
+								{
+									failed_p -> fc_retry_time = now + s_checksum_retry_delay;
+									apr_hash_set (s_failed_paths_p, failed_p -> fc_path_s, APR_HASH_KEY_STRING, failed_p);
+								}
+							else
+								{
+									free (failed_p);
+								}
+						}
+				}
+		}
+}
+
+
+/*
+ * Forget the failures that have expired, or all of them if now is 0.
+ * s_queue_mutex_p must be held.
+ */
+static void RemoveExpiredFailedChecksums (const apr_time_t now)
+{
+	apr_hash_index_t *index_p = apr_hash_first (NULL, s_failed_paths_p);
+
+	while (index_p)
+		{
+			FailedChecksum *failed_p = NULL;
+
+			apr_hash_this (index_p, NULL, NULL, (void **) &failed_p);
+			index_p = apr_hash_next (index_p);
+
+			if ((now == 0) || (failed_p -> fc_retry_time <= now))
+				{
+					apr_hash_set (s_failed_paths_p, failed_p -> fc_path_s, APR_HASH_KEY_STRING, NULL);
+					free (failed_p -> fc_path_s);
+					free (failed_p);
+				}
+		}
+}
+
+
+/*
+ * Swap the worker's connection for a new one, or NULL, disconnecting
+ * the old one. This is done under the lock so that StopChecksumWorkers ()
+ * never shuts down a connection that has already gone.
+ */
+static void SetWorkerConnection (ChecksumWorker *worker_p, rcComm_t *connection_p)
+{
+	rcComm_t *old_connection_p;
+
+	apr_thread_mutex_lock (s_queue_mutex_p);
+	old_connection_p = worker_p -> cw_connection_p;
+	worker_p -> cw_connection_p = connection_p;
+	apr_thread_mutex_unlock (s_queue_mutex_p);
+
+	if (old_connection_p)
+		{
+			rcDisconnect (old_connection_p);
+		}
+}
+
+
+/*
+ * Each thread keeps calculating checksums until the child process exits.
+ * Its connection to iRODS is reused for as long as the requests are for
+ * the same user.
+ */
+static void *APR_THREAD_FUNC RunChecksumWorker (apr_thread_t *thread_p, void *data_p)
+{
+	ChecksumWorker *worker_p = (ChecksumWorker *) data_p;
+	apr_pool_t *pool_p = NULL;
+
+	/* Pools aren't thread-safe so each thread has its own */
+	if (apr_pool_create (&pool_p, NULL) == APR_SUCCESS)
+		{
+			ChecksumRequest *previous_p = NULL;
+			ChecksumRequest *request_p;
+
+			apr_pool_tag (pool_p, "checksums");
+
+			while ((request_p = WaitForChecksumRequest ()) != NULL)
+				{
+					bool success_flag = false;
+
+					if ((!IsSameIRodsUser (request_p, previous_p)) || (! (worker_p -> cw_connection_p)))
+						{
+							rcComm_t *connection_p = NULL;
+
+							SetWorkerConnection (worker_p, NULL);
+							apr_pool_clear (pool_p);
+
+							if (LoginToIRods (& (request_p -> cr_conf), request_p -> cr_username_s, request_p -> cr_password_s, &connection_p, pool_p) == AUTH_GRANTED)
+								{
+									SetWorkerConnection (worker_p, connection_p);
+								}
+							else
+								{
+									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to connect to iRODS as \"%s\" to calculate checksums", request_p -> cr_username_s);
+								}
+						}
+
+					if (worker_p -> cw_connection_p)
+						{
+							dataObjInp_t obj_inp;
+							char *checksum_s = NULL;
+							int rods_status;
+
+							memset (&obj_inp, 0, sizeof (dataObjInp_t));
+							apr_cpystrn (obj_inp.objPath, request_p -> cr_path_s, MAX_NAME_LEN);
+
+							rods_status = rcDataObjChksum (worker_p -> cw_connection_p, &obj_inp, &checksum_s);
+
+							if (rods_status >= 0)
+								{
+									/* Cached listings still show this checksum as pending */
+									InvalidateCachedListingsForObject (request_p -> cr_path_s, pool_p);
+									success_flag = true;
+
+									if (checksum_s)
+										{
+											free (checksum_s);
+										}
+								}
+							else
+								{
+									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to rcDataObjChksum for \"%s\": %d", request_p -> cr_path_s, rods_status);
+
+									/* The connection may have been lost, so make a new one for the next request */
+									SetWorkerConnection (worker_p, NULL);
+								}
+						}
+
+					apr_thread_mutex_lock (s_queue_mutex_p);
+
+					apr_hash_set (s_pending_paths_p, request_p -> cr_path_s, APR_HASH_KEY_STRING, NULL);
+
+					/* Show it as missing rather than pending, and don't ask the server again for a while */
+					if ((!success_flag) && (!s_shutdown_flag))
+						{
+							AddFailedChecksum (request_p -> cr_path_s);
+						}
+
+					apr_thread_mutex_unlock (s_queue_mutex_p);
+
+					if (previous_p)
+						{
+							FreeChecksumRequest (previous_p);
+						}
+
+					previous_p = request_p;
+				}		/* while ((request_p = WaitForChecksumRequest ()) != NULL) */
+
+			if (previous_p)
+				{
+					FreeChecksumRequest (previous_p);
+				}
+
+			SetWorkerConnection (worker_p, NULL);
+			apr_pool_destroy (pool_p);
+		}		/* if (apr_pool_create (&pool_p, NULL) == APR_SUCCESS) */
+
+	apr_thread_mutex_lock (s_queue_mutex_p);
+	-- s_num_running_workers;
+	apr_thread_cond_signal (s_stopped_cond_p);
+	apr_thread_mutex_unlock (s_queue_mutex_p);
+
+	return NULL;
+}
+
+
+/*
+ * Tell the threads to stop and shut down the connections of any that
+ * are waiting for the server, since a checksum of a large file can take
+ * hours, and then wait a short while for them to finish. If any are
+ * still running after that, their memory is left for the process to
+ * reclaim when it exits.
+ */
+static apr_status_t StopChecksumWorkers (void *data_p)
+{
+	if (s_queue_mutex_p)
+		{
+			const apr_time_t deadline = apr_time_now () + S_SHUTDOWN_WAIT;
+			apr_time_t now;
+			int num_running_workers;
+			int i;
+
+			apr_thread_mutex_lock (s_queue_mutex_p);
+
+			s_shutdown_flag = true;
+
+			for (i = 0; i < s_checksum_threads; ++ i)
+				{
+					rcComm_t *connection_p = (s_workers_p + i) -> cw_connection_p;
+
+					if (connection_p)
+						{
+							shutdown (connection_p -> sock, SHUT_RDWR);
+						}
+				}
+
+			apr_thread_cond_broadcast (s_work_cond_p);
+
+			while ((s_num_running_workers > 0) && ((now = apr_time_now ()) < deadline))
+				{
+					apr_thread_cond_timedwait (s_stopped_cond_p, s_queue_mutex_p, deadline - now);
+				}
+
+			num_running_workers = s_num_running_workers;
+
+			apr_thread_mutex_unlock (s_queue_mutex_p);
+
+			if (num_running_workers == 0)
+				{
+					ClearChecksumQueue ();
+				}
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, APR_TIMEUP, NULL, "%d checksum threads are still running as the child process exits", num_running_workers);
+				}
+		}
+
+	return APR_SUCCESS;
+}
+
+
+static void ClearChecksumQueue (void)
+{
+	ChecksumRequest *request_p = s_first_request_p;
+
+	while (request_p)
+		{
+			ChecksumRequest *next_p = request_p -> cr_next_p;
+
+			FreeChecksumRequest (request_p);
+			request_p = next_p;
+		}
+
+	RemoveExpiredFailedChecksums (0);
+
+	s_first_request_p = NULL;
+	s_last_request_p = NULL;
+	s_num_queued_requests = 0;
+	s_pending_paths_p = NULL;
+	s_failed_paths_p = NULL;
+	s_workers_p = NULL;
+	s_queue_mutex_p = NULL;
+	s_work_cond_p = NULL;
+	s_stopped_cond_p = NULL;
+
+	apr_pool_destroy (s_queue_pool_p);
+	s_queue_pool_p = NULL;
+}
+
+#endif		/* #if APR_HAS_THREADS */
@@ -0,0 +1,86 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * checksum_queue.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef CHECKSUM_QUEUE_H_
+#define CHECKSUM_QUEUE_H_
+
+#include <stdbool.h>
+
+#include "apr_pools.h"
+
+#include "httpd.h"
+#include "http_config.h"
+
+#include "config.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create the per-child queue and threads that calculate the checksums
+ * of data objects in the background. This should be called once from
+ * the child_init hook.
+ *
+ * @param pool_p The child's memory pool. When this is destroyed, the
+ * threads are told to stop and their connections are shut down, but the
+ * child only waits a few seconds for them to finish.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t InitChecksumQueue (apr_pool_t *pool_p);
+
+
+/**
+ * Ask for the checksum of a data object to be calculated and registered
+ * in the iCAT in the background. This returns straight away rather than
+ * waiting for the server to read the whole file.
+ *
+ * A data object that is already waiting in the queue is only added once,
+ * and one whose checksum failed is not added again until the delay set by
+ * DavRodsChecksumRetryDelay has passed.
+ *
+ * @param path_s The full path of the data object.
+ * @param conf_p The module configuration with the iRODS server details.
+ * @param username_s The iRODS user to calculate the checksum as.
+ * @param password_s The password for the iRODS user.
+ * @return <code>true</code> if the checksum is now pending, <code>false</code>
+ * if it could not be queued, e.g. if the queue is full or it failed recently,
+ * in which case it should be shown as missing.
+ */
+bool QueueChecksum (const char *path_s, const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s);
+
+
+const char *SetChecksumThreads (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetChecksumQueueSize (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetChecksumRetryDelay (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CHECKSUM_QUEUE_H_ */
@@ -1,6 +1,29 @@
 var G_METADATA_API_URL_S = "/wheat/api/metadata/";
 var G_ROOT_URL_S = "/eirods_dav_files/";
 
+/* The most ids to ask for the metadata of in a single request */
+var G_METADATA_BATCH_SIZE = 100;
+
+/* The most batches of metadata to ask for at the same time */
+var G_MAX_METADATA_REQUESTS = 2;
+
+/* The metadata requests that are still running, keyed by iRODS id */
+var g_pending_metadata_requests = {};
+
+/*
+ * The ids whose batches have finished, whether or not they succeeded, so they
+ * are not asked for again. ShowMetadata () gets any that are still missing.
+ */
+var g_requested_metadata_ids = {};
+
+/* The number of metadata requests that are still running */
+var g_num_metadata_requests = 0;
+
+/* The metadata cells that are prefetched as they scroll into view */
+var g_metadata_cells = null;
+
+var g_prefetch_timer = null;
+
 $(document).ready (function () {
 
   var listings_table = $("#listings_table");
@@ -10,6 +33,12 @@ $(document).ready (function () {
 
   if ($(listings_table).hasClass ("ajax")) {
     AddMetadataToggleButtons (metadata_cells, CallGetMetadata, true);
+
+    /* Get the metadata for the rows in or near the viewport as they come into view */
+    g_metadata_cells = metadata_cells;
+    PrefetchMetadata ();
+
+    $(window).on ("scroll resize", ScheduleMetadataPrefetch);
   } else {
     AddMetadataToggleButtons (metadata_cells, null, true);
   
@@ -607,6 +636,99 @@ function PopulateAutoCompleteList (list_id, input_box_id, values_array) {
 
 
 
+function ScheduleMetadataPrefetch () {
+	if (g_prefetch_timer === null) {
+		g_prefetch_timer = setTimeout (function () {
+			g_prefetch_timer = null;
+			PrefetchMetadata ();
+		}, 200);
+	}
+}
+
+
+/*
+ * Ask for the metadata of the rows that are within a screen's height of the
+ * viewport, a batch at a time, with no more than G_MAX_METADATA_REQUESTS
+ * requests running at once. Each request that finishes starts the next one.
+ */
+function PrefetchMetadata () {
+	var num_slots = G_MAX_METADATA_REQUESTS - g_num_metadata_requests;
+
+	if ((g_metadata_cells !== null) && (num_slots > 0)) {
+		var window_height = $(window).height ();
+		var top = $(window).scrollTop () - window_height;
+		var bottom = top + (3 * window_height);
+		var max_num_ids = num_slots * G_METADATA_BATCH_SIZE;
+		var ids = [];
+		var cells = {};
+		var i;
+
+		$(g_metadata_cells).filter (":visible").each (function () {
+			var table_row = $(this).parent ();
+			var row_top = $(table_row).offset ().top;
+
+			if (row_top > bottom) {
+				/* The rows are in page order so the rest are further down */
+				return false;
+			}
+
+			if (row_top + $(table_row).outerHeight () >= top) {
+				var irods_id = $(table_row).attr ("id");
+
+				if (irods_id && ($(this).find ("div.metadata_container").length === 0) && !(irods_id in g_pending_metadata_requests) && !(irods_id in g_requested_metadata_ids)) {
+					ids.push (irods_id);
+					cells [irods_id] = $(this);
+
+					if (ids.length >= max_num_ids) {
+						return false;
+					}
+				}
+			}
+
+			return true;
+		});
+
+		for (i = 0; i < ids.length; i += G_METADATA_BATCH_SIZE) {
+			GetMetadataForIds (ids.slice (i, i + G_METADATA_BATCH_SIZE), cells);
+		}
+	}
+}
+
+
+function GetMetadataForIds (ids, cells) {
+	var rest_url = G_METADATA_API_URL_S + "get?edit=false&output_format=html&ids=" + encodeURIComponent (ids.join (","));
+	var request;
+
+	++ g_num_metadata_requests;
+
+	request = $.ajax (rest_url, {
+		dataType: "json"
+	}).done (function (data, status) {
+		if (status == "success") {
+			$.each (data, function (irods_id, metadata_html) {
+				var table_cell = cells [irods_id];
+
+				if (table_cell && ($(table_cell).find ("div.metadata_container").length === 0)) {
+					$(table_cell).append (metadata_html);
+				}
+			});
+		}
+	}).always (function () {
+		$.each (ids, function (index, irods_id) {
+			delete g_pending_metadata_requests [irods_id];
+			g_requested_metadata_ids [irods_id] = true;
+		});
+
+		-- g_num_metadata_requests;
+		PrefetchMetadata ();
+	});
+
+	$.each (ids, function (index, irods_id) {
+		g_pending_metadata_requests [irods_id] = request;
+	});
+}
+
+
 function ShowMetadata (table_cell, irods_id, name_s) {
 	var container = $(table_cell).find ("div.metadata_container");
 
@@ -614,6 +736,11 @@ function ShowMetadata (table_cell, irods_id, name_s) {
 	if ($(container).length > 0) {
 		var metadata_list = $(container).clone ();
 		PopulateMetadataViewer ($(metadata_list).html (), name_s);
+	} else if (irods_id in g_pending_metadata_requests) {
+		/* Wait for the batch that this row is in rather than asking for it again */
+		g_pending_metadata_requests [irods_id].always (function () {
+			ShowMetadata (table_cell, irods_id, name_s);
+		});
 	} else {
 
 		/* Download the data */
@@ -27,6 +27,7 @@
 #include "auth.h"
 #include "curl_util.h"
 #include "meta.h"
+#include "section_cache.h"
 
 
 #ifdef DAVRODS_ENABLE_PROVIDER_LOCALLOCK
@@ -41,6 +42,7 @@
 
 #include "apr_buckets.h"
 #include "apr_escape.h"
+#include "apr_hash.h"
 
 #include <irods/rodsClient.h>
 
@@ -50,7 +52,15 @@
 APLOG_USE_MODULE(davrods);
 
 
-static char *ParseURIForVariables (const char *uri_s, char *current_id_s, rcComm_t *connection_p, request_rec *req_p, apr_pool_t *pool_p);
+/*
+ * The key for the table of the http(s) sections that have been got for a request
+ */
+static const char * const S_WEB_SECTIONS_KEY_S = "davrods_web_sections";
+
+
+static char *ParseURIForVariables (const char *uri_s, char *current_id_s, rcComm_t *connection_p, request_rec *req_p, apr_pool_t *pool_p, apr_array_header_t **metadata_array_pp);
+
+static apr_hash_t *GetWebSectionsForRequest (request_rec *req_p);
 
 
 // Common utility functions {{{
@@ -149,76 +159,173 @@ apr_status_t PrintBasicStringToBucketBrigade (const char *value_s, apr_bucket_br
 
 apr_status_t PrintFileToBucketBrigade (const char *filename_s, apr_bucket_brigade *brigade_p, request_rec *req_p, const char *file_s, const int line)
 {
-	apr_status_t status = APR_EGENERAL;
-	FILE *in_f = fopen (filename_s, "r");
+	/*
+	 * The file is only read again when it changes and its contents are
+	 * shared with the brigade rather than being copied into it.
+	 */
+	apr_status_t status = AddFileSectionToBrigade (filename_s, brigade_p, req_p -> pool);
 
-	if (in_f)
+	if (status != APR_SUCCESS)
 		{
-			int loop = 1;
+			ap_log_rerror (file_s, line, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to get contents of %s", filename_s);
+		}
+
+	return status;
+}
+
 
-			while (loop)
+
+apr_status_t PrintWebResponseToBucketBrigade (const char *uri_s, char *current_id_s, apr_bucket_brigade *brigade_p, rcComm_t *connection_p, request_rec *req_p, const char *file_s, const int line)
+{
+	apr_status_t status = APR_SUCCESS;
+	apr_hash_t *sections_p = GetWebSectionsForRequest (req_p);
+
+	if (sections_p)
+		{
+			const char *result_s = (const char *) apr_hash_get (sections_p, uri_s, APR_HASH_KEY_STRING);
+
+			/* If the section wasn't got along with the others for this page, get it now */
+			if (!result_s)
 				{
-					#define BUFFER_SIZE (1025)
+					FetchWebSections (&uri_s, 1, current_id_s, connection_p, req_p);
+					result_s = (const char *) apr_hash_get (sections_p, uri_s, APR_HASH_KEY_STRING);
+				}
 
-					char buffer_s [BUFFER_SIZE];
-					size_t num_read	= fread (buffer_s, 1, BUFFER_SIZE - 1, in_f);
+			if (result_s && (*result_s != '\0'))
+				{
+					PrintBasicStringToBucketBrigade (result_s, brigade_p, req_p, file_s, line);
+				}
+		}
+
+	return status;
+}
+
+
+apr_status_t FetchWebSections (const char **uris_ss, const size_t num_uris, char *current_id_s, rcComm_t *connection_p, request_rec *req_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	apr_hash_t *sections_p = GetWebSectionsForRequest (req_p);
+
+	if (sections_p)
+		{
+			WebRequest *requests_p = (WebRequest *) apr_pcalloc (req_p -> pool, num_uris * sizeof (WebRequest));
+			const char **section_uris_ss = (const char **) apr_pcalloc (req_p -> pool, num_uris * sizeof (const char *));
+			char **stale_bodies_ss = (char **) apr_pcalloc (req_p -> pool, num_uris * sizeof (char *));
+
+			if (requests_p && section_uris_ss && stale_bodies_ss)
+				{
+					apr_array_header_t *metadata_array_p = NULL;
+					size_t num_requests = 0;
+					size_t i;
 
-					if ((num_read == BUFFER_SIZE) || (ferror (in_f) == 0))
+					for (i = 0; i < num_uris; ++ i)
 						{
-							status = apr_brigade_write (brigade_p, NULL, NULL, buffer_s, num_read);
+							const char *uri_s = * (uris_ss + i);
 
-							if (status != APR_SUCCESS)
+							if (!apr_hash_get (sections_p, uri_s, APR_HASH_KEY_STRING))
 								{
-									ap_log_rerror (file_s, line, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to store %s from file", buffer_s, filename_s);
-									loop = 0;
-								}
-						}
-					else
-						{
-							loop = 0;
-							ap_log_rerror (file_s, line, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to get contents of %s", filename_s);
-						}
+									/* Any metadata for the variables is only got once for all of the sections */
+									char *parsed_uri_s = ParseURIForVariables (uri_s, current_id_s, connection_p, req_p, req_p -> pool, &metadata_array_p);
+
+									/* Mark the section as done so a failure isn't retried for this page */
+									apr_hash_set (sections_p, uri_s, APR_HASH_KEY_STRING, "");
 
-					if (feof (in_f) != 0)
+									if (parsed_uri_s)
+										{
+											char *etag_s = NULL;
+											char *body_s = GetCachedSection (parsed_uri_s, &etag_s, req_p -> pool);
+
+											if (body_s && !etag_s)
+												{
+													apr_hash_set (sections_p, uri_s, APR_HASH_KEY_STRING, body_s);
+												}
+											else
+												{
+													WebRequest *request_p = requests_p + num_requests;
+
+													request_p -> wr_uri_s = parsed_uri_s;
+													request_p -> wr_etag_s = etag_s;
+
+													* (section_uris_ss + num_requests) = uri_s;
+													* (stale_bodies_ss + num_requests) = body_s;
+
+													++ num_requests;
+												}
+										}
+
+								}		/* if (!apr_hash_get (sections_p, uri_s, APR_HASH_KEY_STRING)) */
+
+						}		/* for (i = 0; i < num_uris; ++ i) */
+
+
+					if (num_requests > 0)
 						{
-							loop = 0;
-						}
+							/* Get all of the uncached sections at the same time */
+							CallGetRequests (requests_p, num_requests, req_p, req_p -> pool);
 
-				}
+							for (i = 0; i < num_requests; ++ i)
+								{
+									const WebRequest *request_p = requests_p + i;
+									char *body_s = * (stale_bodies_ss + i);
 
-			fclose (in_f);
-		}
-	else
-		{
-			ap_log_rerror (file_s, line, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to open %s", filename_s);
-		}
+									if ((request_p -> wr_http_status >= 200) && (request_p -> wr_http_status < 300) && (request_p -> wr_body_s))
+										{
+											body_s = request_p -> wr_body_s;
+											CacheSection (request_p -> wr_uri_s, body_s, request_p -> wr_response_etag_s, request_p -> wr_cache_control_s, req_p -> pool);
+										}
+									else if ((request_p -> wr_http_status == 304) && body_s)
+										{
+											RefreshCachedSection (request_p -> wr_uri_s, request_p -> wr_cache_control_s, req_p -> pool);
+										}
+									else if (!body_s)
+										{
+											/* Fall back to whatever the server sent since there is no stale copy to use instead */
+											body_s = request_p -> wr_body_s;
+										}
+
+									if (body_s)
+										{
+											apr_hash_set (sections_p, * (section_uris_ss + i), APR_HASH_KEY_STRING, body_s);
+										}
+
+								}		/* for (i = 0; i < num_requests; ++ i) */
+
+						}		/* if (num_requests > 0) */
+
+					status = APR_SUCCESS;
+				}		/* if (requests_p && section_uris_ss && stale_bodies_ss) */
+
+		}		/* if (sections_p) */
 
 	return status;
 }
 
 
-
-apr_status_t PrintWebResponseToBucketBrigade (const char *uri_s, char *current_id_s, apr_bucket_brigade *brigade_p, rcComm_t *connection_p, request_rec *req_p, const char *file_s, const int line)
+static apr_hash_t *GetWebSectionsForRequest (request_rec *req_p)
 {
-	apr_status_t status = APR_SUCCESS;
-	char *parsed_uri_s = ParseURIForVariables (uri_s, current_id_s, connection_p, req_p, req_p -> pool);
+	apr_hash_t *sections_p = NULL;
+	void *ptr = NULL;
 
-	if (parsed_uri_s)
+	if ((apr_pool_userdata_get (&ptr, S_WEB_SECTIONS_KEY_S, req_p -> pool) == APR_SUCCESS) && ptr)
 		{
-			char *result_s = SimpleCallGetRequest (req_p, req_p -> pool, parsed_uri_s);
+			sections_p = (apr_hash_t *) ptr;
+		}
+	else
+		{
+			sections_p = apr_hash_make (req_p -> pool);
 
-			if (result_s)
+			if (sections_p)
 				{
-					PrintBasicStringToBucketBrigade (result_s, brigade_p, req_p, __FILE__, __LINE__);
+					apr_pool_userdata_setn (sections_p, S_WEB_SECTIONS_KEY_S, apr_pool_cleanup_null, req_p -> pool);
 				}
 		}
 
-	return status;
+	return sections_p;
 }
 
 
 
-static char *ParseURIForVariables (const char *uri_s, char *current_id_s, rcComm_t *connection_p, request_rec *req_p, apr_pool_t *pool_p)
+static char *ParseURIForVariables (const char *uri_s, char *current_id_s, rcComm_t *connection_p, request_rec *req_p, apr_pool_t *pool_p, apr_array_header_t **metadata_array_pp)
 {
 	apr_status_t status;
 	char *result_s = NULL;
@@ -236,7 +343,7 @@ static char *ParseURIForVariables (const char *uri_s, char *current_id_s, rcComm
 	if (buffer_p)
 		{
 			bool success_flag = true;
-			apr_array_header_t *metadata_array_p = NULL;
+			apr_array_header_t *metadata_array_p = *metadata_array_pp;
 
 			while (success_flag && ((current_var_start_p = strstr (prev_p, var_start_s)) != NULL))
 				{
@@ -276,6 +383,7 @@ static char *ParseURIForVariables (const char *uri_s, char *current_id_s, rcComm
 															if (!metadata_array_p)
 																{
 																	metadata_array_p = GetMetadataArrayForId (current_id_s, connection_p, req_p, pool_p);
+																	*metadata_array_pp = metadata_array_p;
 																}
 
 															if (metadata_array_p)
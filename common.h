@@ -63,6 +63,23 @@ apr_status_t PrintFileToBucketBrigade (const char *filename_s, apr_bucket_brigad
 apr_status_t PrintWebResponseToBucketBrigade (const char *uri_s, char *current_id_s, apr_bucket_brigade *brigade_p, rcComm_t *connection_p, request_rec *req_p, const char *file_s, const int line);
 
 
+/**
+ * Get a number of http(s) sections for a request in one go so that any
+ * that aren't cached are downloaded at the same time rather than one after
+ * another. The results are kept with the request for when each section
+ * is printed by PrintWebResponseToBucketBrigade().
+ *
+ * @param uris_ss The addresses of the sections. These can use the @{id} and
+ * @{metadata:key} variables.
+ * @param num_uris The number of addresses.
+ * @param current_id_s The iRODS id of the collection being displayed.
+ * @param connection_p The connection to the iRODS server.
+ * @param req_p The incoming request.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t FetchWebSections (const char **uris_ss, const size_t num_uris, char *current_id_s, rcComm_t *connection_p, request_rec *req_p);
+
+
 rcComm_t *GetIRODSConnectionFromPool (apr_pool_t *pool_p);
 
 rcComm_t *GetIRODSConnectionForPublicUser (request_rec *req_p, apr_pool_t *davrods_pool_p, davrods_dir_conf_t *conf_p);
@@ -22,6 +22,12 @@
 #include "config.h"
 #include "theme.h"
 #include "common.h"
+#include "metadata_cache.h"
+#include "metadata_import.h"
+#include "listing_cache.h"
+#include "checksum_queue.h"
+#include "section_cache.h"
+#include "parallel_query.h"
 
 #include <apr_strings.h>
 
@@ -144,6 +150,10 @@ void *davrods_merge_dir_config(apr_pool_t *p, void *_parent, void *_child) {
 
     conf_p -> eirods_dav_views_path_s = MergeConfigStrings (parent_p -> eirods_dav_views_path_s, child_p -> eirods_dav_views_path_s, S_DEFAULT_SEARCH_PATH_S);
 
+    conf_p -> eirods_dav_listing_specific_query_s = MergeConfigStrings (parent_p -> eirods_dav_listing_specific_query_s, child_p -> eirods_dav_listing_specific_query_s, NULL);
+    conf_p -> eirods_dav_search_specific_query_s = MergeConfigStrings (parent_p -> eirods_dav_search_specific_query_s, child_p -> eirods_dav_search_specific_query_s, NULL);
+    conf_p -> eirods_dav_facet_specific_query_s = MergeConfigStrings (parent_p -> eirods_dav_facet_specific_query_s, child_p -> eirods_dav_facet_specific_query_s, NULL);
+
 
   	conf_p -> exposed_roots_per_user_p = MergeAPRTables (parent_p -> exposed_roots_per_user_p, child_p -> exposed_roots_per_user_p, p);
 
@@ -682,5 +692,115 @@ const command_rec davrods_directives[] = {
 				NULL, ACCESS_CONF, "Image for the Frictionless Data Packages"
 		),
 
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "FDCacheDir", SetFDCacheDir,
+				NULL, ACCESS_CONF, "The local directory to cache the generated Frictionless Data Packages in"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "MetadataCacheTTL", SetMetadataCacheTTL,
+				NULL, RSRC_CONF, "The number of seconds to cache the metadata for each iRODS object, 0 turns the cache off"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "MetadataCacheSize", SetMetadataCacheSize,
+				NULL, RSRC_CONF, "The maximum number of iRODS objects to cache the metadata for in each child process"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "MetadataFacetCacheTTL", SetMetadataFacetCacheTTL,
+				NULL, RSRC_CONF, "The number of seconds to cache the results of each metadata facets query, 0 turns the cache off"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ListingSpecificQuery", SetListingSpecificQuery,
+				NULL, ACCESS_CONF, "The alias of a registered specific query that lists a collection along with the AVUs of its contents"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "SearchSpecificQuery", SetSearchSpecificQuery,
+				NULL, ACCESS_CONF, "The alias of a registered specific query that gets the listing details of the objects matching a metadata key and value"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "FacetSpecificQuery", SetFacetSpecificQuery,
+				NULL, ACCESS_CONF, "The alias of a registered specific query that counts the distinct data objects and collections for each value of a metadata key"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "MetadataImportDirectory", SetMetadataImportDirectory,
+				NULL, RSRC_CONF, "The local directory used to store the manifests, status and error reports of metadata import jobs"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "MetadataImportThreads", SetMetadataImportThreads,
+				NULL, RSRC_CONF, "The maximum number of threads in each child process that run metadata import jobs"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "MetadataImportConnections", SetMetadataImportConnections,
+				NULL, RSRC_CONF, "The number of iRODS connections that each metadata import job uses"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ListingFlushRows", SetListingFlushRows,
+				NULL, RSRC_CONF, "The number of rows of a themed listing to print before sending them to the client"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ListingFlushBytes", SetListingFlushBytes,
+				NULL, RSRC_CONF, "The number of bytes of a themed listing to buffer before sending them to the client"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ListingPageSize", SetListingPageSize,
+				NULL, RSRC_CONF, "The number of entries on each page of a themed listing, or 0 to list whole collections"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ListingCacheTTL", SetListingCacheTTL,
+				NULL, RSRC_CONF, "The number of seconds to cache the rendered rows of a themed listing for, or 0 to turn the cache off"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ListingCacheSize", SetListingCacheSize,
+				NULL, RSRC_CONF, "The maximum number of bytes of rendered listings to cache in each child process"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ListingCacheDir", SetListingCacheDir,
+				NULL, RSRC_CONF, "A local directory to share the cached rendered listings between the child processes in"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ChecksumThreads", SetChecksumThreads,
+				NULL, RSRC_CONF, "The number of threads in each child process that calculate missing checksums in the background"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ChecksumQueueSize", SetChecksumQueueSize,
+				NULL, RSRC_CONF, "The maximum number of data objects in each child process waiting for their checksums to be calculated"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "ChecksumRetryDelay", SetChecksumRetryDelay,
+				NULL, RSRC_CONF, "The number of seconds before a data object whose checksum failed is queued again"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "TreeWalkConnections", SetTreeWalkConnections,
+				NULL, RSRC_CONF, "The number of iRODS connections that each request may use to query the subcollections of a tree at the same time for datapackages and metadata exports"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "SectionCacheTTL", SetSectionCacheTTL,
+				NULL, RSRC_CONF, "The longest number of seconds to cache the http(s) sections of themed listings for, or 0 to turn the cache off"
+		),
+
+		AP_INIT_TAKE1(
+				DAVRODS_CONFIG_PREFIX "SectionCacheSize", SetSectionCacheSize,
+				NULL, RSRC_CONF, "The maximum number of bytes of http(s) sections to cache in each child process"
+		),
+
 		{ NULL }
 };
@@ -83,6 +83,10 @@ typedef struct davrods_dir_conf {
 
     const char *eirods_dav_views_path_s;
 
+    const char *eirods_dav_listing_specific_query_s;
+    const char *eirods_dav_search_specific_query_s;
+    const char *eirods_dav_facet_specific_query_s;
+
 } davrods_dir_conf_t;
 
 extern const command_rec davrods_directives[];
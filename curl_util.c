@@ -46,6 +46,7 @@
 #include "curl_util.h"
 
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 
 #include <curl/easy.h>
@@ -53,8 +54,13 @@
 #include "httpd.h"
 #include "http_log.h"
 
+#include "apr_lib.h"
 #include "apr_strings.h"
 
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
+
 #include "common.h"
 
 
@@ -74,6 +80,27 @@ typedef struct CURLParam
 } CURLParam;
 
 
+/*
+ * STATIC VARIABLES
+ */
+
+/* The data that the CURL handles in this child share with each other */
+static CURLSH *s_share_p = NULL;
+
+/* The idle CURL handles that are waiting to be reused */
+static CURL **s_idle_handles_pp = NULL;
+static size_t s_num_idle_handles = 0;
+
+static const size_t S_MAX_IDLE_HANDLES = 16;
+
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *s_handles_mutex_p = NULL;
+
+/* A lock for each type of data in the share */
+static apr_thread_mutex_t *s_share_mutexes_p [CURL_LOCK_DATA_LAST];
+#endif
+
+
 
 
 
@@ -188,6 +215,95 @@ static bool SetCurlUtilHeader (CurlUtil *tool_p, const char *key_s, const char *
 static size_t WriteToMemoryCallback (char *response_data_p, size_t block_size, size_t num_blocks, void *store_p);
 
 
+static CURL *GetPooledCurl (void);
+
+static apr_status_t ClearCurlPool (void *data_p);
+
+#if APR_HAS_THREADS
+static void LockSharedData (CURL *curl_p, curl_lock_data data, curl_lock_access access, void *user_p);
+
+static void UnlockSharedData (CURL *curl_p, curl_lock_data data, void *user_p);
+#endif
+
+
+static size_t WriteHeaderCallback (char *header_s, size_t block_size, size_t num_blocks, void *request_p);
+
+
+static char *GetHeaderValue (const char *header_s, const size_t header_length, const char *name_s, apr_pool_t *pool_p);
+
+
+/**
+ * Set up the CurlUtil of a WebRequest so that it is ready to be
+ * added to a multi handle.
+ *
+ * @param request_p The WebRequest to set up.
+ * @return <code>true</code> upon success or <code>false</code> upon error.
+ */
+static bool PrepareWebRequest (WebRequest *request_p);
+
+
+
+apr_status_t InitCurlUtil (apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	s_idle_handles_pp = (CURL **) apr_pcalloc (pool_p, S_MAX_IDLE_HANDLES * sizeof (CURL *));
+
+	if (s_idle_handles_pp)
+		{
+			#if APR_HAS_THREADS
+			int i;
+
+			status = apr_thread_mutex_create (&s_handles_mutex_p, APR_THREAD_MUTEX_DEFAULT, pool_p);
+
+			for (i = 0; (i < CURL_LOCK_DATA_LAST) && (status == APR_SUCCESS); ++ i)
+				{
+					status = apr_thread_mutex_create (& (s_share_mutexes_p [i]), APR_THREAD_MUTEX_DEFAULT, pool_p);
+				}
+			#endif
+
+			if (status == APR_SUCCESS)
+				{
+					s_share_p = curl_share_init ();
+
+					if (s_share_p)
+						{
+							#if APR_HAS_THREADS
+							curl_share_setopt (s_share_p, CURLSHOPT_LOCKFUNC, LockSharedData);
+							curl_share_setopt (s_share_p, CURLSHOPT_UNLOCKFUNC, UnlockSharedData);
+							#endif
+
+							curl_share_setopt (s_share_p, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+							curl_share_setopt (s_share_p, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+							/* Sharing connections needs libcurl 7.57.0 or later */
+							#if LIBCURL_VERSION_NUM >= 0x073900
+							curl_share_setopt (s_share_p, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+							#endif
+						}
+					else
+						{
+							/* The handles can still be reused without sharing their data */
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to create curl share");
+						}
+
+					apr_pool_cleanup_register (pool_p, pool_p, ClearCurlPool, apr_pool_cleanup_null);
+				}
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to create curl pool mutexes");
+					s_idle_handles_pp = NULL;
+				}
+		}
+	else
+		{
+			status = APR_ENOMEM;
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to create curl pool");
+		}
+
+	return status;
+}
+
 
 CurlUtil *AllocateCurlUtil (request_rec *req_p, apr_pool_t *pool_p)
 {
@@ -251,7 +367,7 @@ void FreeCurlUtil (CurlUtil *curl_tool_p)
 
 static bool SetupCurl (CurlUtil *tool_p, apr_pool_t *pool_p)
 {
-	tool_p -> ct_curl_p = curl_easy_init ();
+	tool_p -> ct_curl_p = GetPooledCurl ();
 
 	if (tool_p -> ct_curl_p)
 		{
@@ -283,10 +399,144 @@ static bool SetupCurl (CurlUtil *tool_p, apr_pool_t *pool_p)
 }
 
 
+/*
+ * Get an idle CURL handle from the pool, or a new one if there aren't any,
+ * that is set up to use the shared data.
+ */
+static CURL *GetPooledCurl (void)
+{
+	CURL *curl_p = NULL;
+
+	#if APR_HAS_THREADS
+	if (s_handles_mutex_p)
+		{
+			apr_thread_mutex_lock (s_handles_mutex_p);
+		}
+	#endif
+
+	if (s_num_idle_handles > 0)
+		{
+			-- s_num_idle_handles;
+			curl_p = * (s_idle_handles_pp + s_num_idle_handles);
+		}
+
+	#if APR_HAS_THREADS
+	if (s_handles_mutex_p)
+		{
+			apr_thread_mutex_unlock (s_handles_mutex_p);
+		}
+	#endif
+
+	if (!curl_p)
+		{
+			curl_p = curl_easy_init ();
+		}
+
+	if (curl_p && s_share_p)
+		{
+			curl_easy_setopt (curl_p, CURLOPT_SHARE, s_share_p);
+		}
+
+	return curl_p;
+}
+
+
+/*
+ * Put a CURL handle back in the pool so that its connections can be
+ * reused, or clean it up if the pool is full.
+ */
 static void FreeCurl (CURL *curl_p)
 {
-	curl_easy_cleanup (curl_p);
+	bool pooled_flag = false;
+
+	if (curl_p)
+		{
+			/*
+			 * Clear the options that point at the CurlUtil's buffers
+			 * and headers. The shared connections are kept open.
+			 */
+			curl_easy_reset (curl_p);
+
+			#if APR_HAS_THREADS
+			if (s_handles_mutex_p)
+				{
+					apr_thread_mutex_lock (s_handles_mutex_p);
+				}
+			#endif
+
+			if (s_idle_handles_pp && (s_num_idle_handles < S_MAX_IDLE_HANDLES))
+				{
+					* (s_idle_handles_pp + s_num_idle_handles) = curl_p;
+					++ s_num_idle_handles;
+					pooled_flag = true;
+				}
+
+			#if APR_HAS_THREADS
+			if (s_handles_mutex_p)
+				{
+					apr_thread_mutex_unlock (s_handles_mutex_p);
+				}
+			#endif
+
+			if (!pooled_flag)
+				{
+					curl_easy_cleanup (curl_p);
+				}
+		}
+}
+
+
+static apr_status_t ClearCurlPool (void *data_p)
+{
+	apr_pool_t *pool_p = (apr_pool_t *) data_p;
+	size_t i;
+
+	for (i = 0; i < s_num_idle_handles; ++ i)
+		{
+			curl_easy_cleanup (* (s_idle_handles_pp + i));
+		}
+
+	s_num_idle_handles = 0;
+	s_idle_handles_pp = NULL;
+
+	/* The share can only be cleaned up once no handles are using it */
+	if (s_share_p)
+		{
+			if (curl_share_cleanup (s_share_p) != CURLSHE_OK)
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, APR_EGENERAL, pool_p, "Failed to clean up curl share");
+				}
+
+			s_share_p = NULL;
+		}
+
+	#if APR_HAS_THREADS
+	s_handles_mutex_p = NULL;
+	memset (s_share_mutexes_p, 0, CURL_LOCK_DATA_LAST * sizeof (apr_thread_mutex_t *));
+	#endif
+
+	return APR_SUCCESS;
+}
+
+
+#if APR_HAS_THREADS
+static void LockSharedData (CURL *curl_p, curl_lock_data data, curl_lock_access access, void *user_p)
+{
+	if ((data >= 0) && (data < CURL_LOCK_DATA_LAST) && (s_share_mutexes_p [data]))
+		{
+			apr_thread_mutex_lock (s_share_mutexes_p [data]);
+		}
+}
+
+
+static void UnlockSharedData (CURL *curl_p, curl_lock_data data, void *user_p)
+{
+	if ((data >= 0) && (data < CURL_LOCK_DATA_LAST) && (s_share_mutexes_p [data]))
+		{
+			apr_thread_mutex_unlock (s_share_mutexes_p [data]);
+		}
 }
+#endif
 
 
 char *SimpleCallGetRequest (request_rec *req_p, apr_pool_t *pool_p, const char *uri_s)
@@ -331,6 +581,131 @@ char *CallGetRequest (CurlUtil *tool_p, const char *uri_s)
 }
 
 
+bool CallGetRequests (WebRequest *requests_p, const size_t num_requests, request_rec *req_p, apr_pool_t *pool_p)
+{
+	bool success_flag = false;
+	CURLM *multi_p = curl_multi_init ();
+
+	if (multi_p)
+		{
+			WebRequest *request_p = requests_p;
+			CURLMsg *message_p;
+			int num_messages;
+			int num_running = 0;
+			size_t i;
+
+			success_flag = true;
+
+			for (i = 0; i < num_requests; ++ i, ++ request_p)
+				{
+					request_p -> wr_http_status = 0;
+					request_p -> wr_body_s = NULL;
+					request_p -> wr_response_etag_s = NULL;
+					request_p -> wr_cache_control_s = NULL;
+					request_p -> wr_tool_p = AllocateCurlUtil (req_p, pool_p);
+
+					if (request_p -> wr_tool_p)
+						{
+							bool added_flag = false;
+
+							if (PrepareWebRequest (request_p))
+								{
+									CURLMcode res = curl_multi_add_handle (multi_p, request_p -> wr_tool_p -> ct_curl_p);
+
+									if (res == CURLM_OK)
+										{
+											added_flag = true;
+										}
+									else
+										{
+											ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to add request for \"%s\", %s", request_p -> wr_uri_s, curl_multi_strerror (res));
+										}
+								}
+
+							if (!added_flag)
+								{
+									FreeCurlUtil (request_p -> wr_tool_p);
+									request_p -> wr_tool_p = NULL;
+								}
+						}
+
+				}		/* for (i = 0; i < num_requests; ++ i, ++ request_p) */
+
+
+			/* Run all of the transfers until every one of them has finished */
+			do
+				{
+					CURLMcode res = curl_multi_perform (multi_p, &num_running);
+
+					if ((res == CURLM_OK) && (num_running > 0))
+						{
+							res = curl_multi_wait (multi_p, NULL, 0, 1000, NULL);
+						}
+
+					if (res != CURLM_OK)
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to run web requests, %s", curl_multi_strerror (res));
+							success_flag = false;
+							num_running = 0;
+						}
+				}
+			while (num_running > 0);
+
+
+			while ((message_p = curl_multi_info_read (multi_p, &num_messages)) != NULL)
+				{
+					if (message_p -> msg == CURLMSG_DONE)
+						{
+							char *private_p = NULL;
+
+							curl_easy_getinfo (message_p -> easy_handle, CURLINFO_PRIVATE, &private_p);
+
+							if (private_p)
+								{
+									WebRequest *done_p = (WebRequest *) private_p;
+
+									if (message_p -> data.result == CURLE_OK)
+										{
+											curl_easy_getinfo (message_p -> easy_handle, CURLINFO_RESPONSE_CODE, & (done_p -> wr_http_status));
+
+											/* A 304 has no body since the cached one is still valid */
+											if (done_p -> wr_http_status != 304)
+												{
+													done_p -> wr_body_s = GetCurlUtilData (done_p -> wr_tool_p);
+												}
+										}
+									else
+										{
+											ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get data from \"%s\", %s", done_p -> wr_uri_s, curl_easy_strerror (message_p -> data.result));
+										}
+								}
+
+						}		/* if (message_p -> msg == CURLMSG_DONE) */
+
+				}		/* while ((message_p = curl_multi_info_read (multi_p, &num_messages)) != NULL) */
+
+
+			for (i = 0, request_p = requests_p; i < num_requests; ++ i, ++ request_p)
+				{
+					if (request_p -> wr_tool_p)
+						{
+							curl_multi_remove_handle (multi_p, request_p -> wr_tool_p -> ct_curl_p);
+							FreeCurlUtil (request_p -> wr_tool_p);
+							request_p -> wr_tool_p = NULL;
+						}
+				}
+
+			curl_multi_cleanup (multi_p);
+		}		/* if (multi_p) */
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to create curl multi handle");
+		}
+
+	return success_flag;
+}
+
+
 bool SetUriForCurlUtil (CurlUtil *tool_p, const char * const uri_s)
 {
 	bool success_flag = false;
@@ -560,3 +935,115 @@ static size_t WriteToMemoryCallback (char *response_data_s, size_t block_size, s
 
 	return result;
 }
+
+
+static bool PrepareWebRequest (WebRequest *request_p)
+{
+	bool success_flag = false;
+	CurlUtil *tool_p = request_p -> wr_tool_p;
+
+	if (SetUriForCurlUtil (tool_p, request_p -> wr_uri_s))
+		{
+			curl_write_callback header_fn = WriteHeaderCallback;
+			const CURLParam params [] =
+				{
+					{ CURLOPT_PRIVATE, (const char *) request_p },
+					{ CURLOPT_HEADERFUNCTION, (const char *) header_fn },
+					{ CURLOPT_HEADERDATA, (const char *) request_p },
+					{ CURLOPT_LASTENTRY, (const char *) NULL }
+				};
+
+			const CURLParam *param_p = params;
+
+			success_flag = true;
+
+			while (success_flag && (param_p -> cp_value_s))
+				{
+					if (curl_easy_setopt (tool_p -> ct_curl_p, param_p -> cp_opt, (void *) param_p -> cp_value_s) == CURLE_OK)
+						{
+							++ param_p;
+						}
+					else
+						{
+							success_flag = false;
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, tool_p -> ct_pool_p,  "Failed to to set CURL option \"%d\" for \"%s\"", param_p -> cp_opt, request_p -> wr_uri_s);
+						}
+				}
+
+			if (success_flag && (request_p -> wr_etag_s))
+				{
+					if (SetCurlUtilHeader (tool_p, "If-None-Match", request_p -> wr_etag_s))
+						{
+							success_flag = (curl_easy_setopt (tool_p -> ct_curl_p, CURLOPT_HTTPHEADER, tool_p -> ct_headers_list_p) == CURLE_OK);
+						}
+					else
+						{
+							success_flag = false;
+						}
+				}
+		}
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, tool_p -> ct_pool_p,  "Failed to set CurlUtil to call \"%s\"", request_p -> wr_uri_s);
+		}
+
+	return success_flag;
+}
+
+
+static size_t WriteHeaderCallback (char *header_s, size_t block_size, size_t num_blocks, void *request_p)
+{
+	size_t total_size = block_size * num_blocks;
+	WebRequest *web_request_p = (WebRequest *) request_p;
+	apr_pool_t *pool_p = web_request_p -> wr_tool_p -> ct_pool_p;
+
+	if ((total_size > 5) && (strncmp (header_s, "HTTP/", 5) == 0))
+		{
+			/* This is the start of a new response, e.g. after a redirect, so forget any earlier headers */
+			web_request_p -> wr_response_etag_s = NULL;
+			web_request_p -> wr_cache_control_s = NULL;
+		}
+	else
+		{
+			char *value_s = GetHeaderValue (header_s, total_size, "ETag", pool_p);
+
+			if (value_s)
+				{
+					web_request_p -> wr_response_etag_s = value_s;
+				}
+			else if ((value_s = GetHeaderValue (header_s, total_size, "Cache-Control", pool_p)) != NULL)
+				{
+					web_request_p -> wr_cache_control_s = value_s;
+				}
+		}
+
+	return total_size;
+}
+
+
+static char *GetHeaderValue (const char *header_s, const size_t header_length, const char *name_s, apr_pool_t *pool_p)
+{
+	char *value_s = NULL;
+	const size_t name_length = strlen (name_s);
+
+	/* The header isn't null-terminated so only look at its given length */
+	if ((header_length > name_length) && (* (header_s + name_length) == ':') && (strncasecmp (header_s, name_s, name_length) == 0))
+		{
+			const char *start_p = header_s + name_length + 1;
+			const char *end_p = header_s + header_length;
+
+			while ((start_p < end_p) && (apr_isspace (*start_p)))
+				{
+					++ start_p;
+				}
+
+			while ((end_p > start_p) && (apr_isspace (* (end_p - 1))))
+				{
+					-- end_p;
+				}
+
+			value_s = apr_pstrndup (pool_p, start_p, end_p - start_p);
+		}
+
+	return value_s;
+}
@@ -79,6 +79,37 @@ typedef struct CurlUtil
 } CurlUtil;
 
 
+/**
+ * A GET request that can be run alongside others using CallGetRequests().
+ */
+typedef struct WebRequest
+{
+	/** The address to get. */
+	const char *wr_uri_s;
+
+	/**
+	 * If this is set, it is sent as the If-None-Match header so that
+	 * an unchanged response comes back as a 304 without a body.
+	 */
+	const char *wr_etag_s;
+
+	/** The HTTP status code of the response or 0 if the request failed. */
+	long wr_http_status;
+
+	/** The body of the response or <code>NULL</code> if there wasn't one. */
+	char *wr_body_s;
+
+	/** The ETag header of the response or <code>NULL</code> if there wasn't one. */
+	char *wr_response_etag_s;
+
+	/** The Cache-Control header of the response or <code>NULL</code> if there wasn't one. */
+	char *wr_cache_control_s;
+
+	/** @private */
+	CurlUtil *wr_tool_p;
+} WebRequest;
+
+
 
 
 #ifdef __cplusplus
@@ -86,6 +117,20 @@ typedef struct CurlUtil
 #endif
 
 
+/**
+ * Set up the per-child pool of CURL handles that are reused between
+ * requests. These share their DNS cache, TLS sessions and open connections
+ * so that repeated calls to the same servers don't need a new lookup and
+ * handshake each time. This should be called once from the child_init
+ * hook after curl_global_init().
+ *
+ * @param pool_p The child's memory pool. The handles will be cleaned up
+ * when this pool is destroyed.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t InitCurlUtil (apr_pool_t *pool_p);
+
+
 /**
  * Allocate a CurlUtil.
  *
@@ -117,6 +162,24 @@ char *SimpleCallGetRequest (request_rec *req_p, apr_pool_t *pool_p, const char *
 char *CallGetRequest (CurlUtil *tool_p, const char *uri_s);
 
 
+/**
+ * Run a number of GET requests at the same time and wait for all of them
+ * to finish, so the time taken is that of the slowest request rather than
+ * the sum of them all.
+ *
+ * @param requests_p The array of requests to run. Each one's wr_uri_s and
+ * wr_etag_s must be set and the rest of its fields will be filled in with
+ * its response.
+ * @param num_requests The number of requests in the array.
+ * @param req_p The incoming request that these are being run for.
+ * @param pool_p The memory pool to allocate the responses from.
+ * @return <code>true</code> if the requests were run, <code>false</code> if
+ * they could not be started. Each request's wr_http_status shows whether it
+ * succeeded.
+ */
+bool CallGetRequests (WebRequest *requests_p, const size_t num_requests, request_rec *req_p, apr_pool_t *pool_p);
+
+
 
 /**
  * Get the URL encoded version of a string.
@@ -21,11 +21,16 @@
  */
 
 #include "apr_strings.h"
+#include "apr_file_io.h"
+#include "apr_md5.h"
 
 #include "frictionless_data_package.h"
 #include "meta.h"
 #include "repo.h"
 #include "theme.h"
+#include "checksum_queue.h"
+#include "auth.h"
+#include "query_utils.h"
 
 #include "httpd.h"
 #include "http_protocol.h"
@@ -35,12 +40,122 @@
 #include "jansson.h"
 
 
+/*
+ * A file in the disk cache that is being written. It goes to a temporary
+ * file that is renamed once it is complete, so that other requests never
+ * see a partly written file. The file is NULL if there isn't one.
+ */
+typedef struct CacheFile
+{
+	apr_file_t *cf_file_p;
+	char *cf_temp_path_s;
+	const char *cf_path_s;
+	apr_pool_t *cf_pool_p;
+} CacheFile;
+
+
+/*
+ * The output for a data package as it is being generated. As well as
+ * going to the client, it can be copied to the disk cache and into iRODS.
+ */
+typedef struct DataPackageStream
+{
+	ap_filter_t *dps_output_p;
+	apr_bucket_brigade *dps_bb_p;
+	apr_pool_t *dps_pool_p;
+
+	/*
+	 * The number of resources generated so far, which doesn't
+	 * include any sent from the partial results on disk.
+	 */
+	apr_size_t dps_num_resources;
+
+	/* Has any resource been written yet? */
+	bool dps_resources_flag;
+
+	/*
+	 * Has any of the package been written to the output filters?
+	 * If so, it may have been sent already and we can no longer
+	 * reply with an error.
+	 */
+	bool dps_sent_flag;
+
+	/* The disk copy */
+	CacheFile dps_cache_file;
+
+	/*
+	 * Should the resources be kept on disk for each collection so that
+	 * only those collections that have changed need to be regenerated?
+	 */
+	bool dps_partials_flag;
+
+	/* The partial results for the collection currently being generated */
+	CacheFile *dps_partial_p;
+
+	/* The iRODS copy */
+	bool dps_rods_open_flag;
+	rcComm_t *dps_rods_conn_p;
+	const char *dps_rods_path_s;
+	openedDataObjInp_t dps_rods_handle;
+	char *dps_rods_buffer_s;
+	apr_size_t dps_rods_buffer_length;
+} DataPackageStream;
+
+
+/*
+ * The state of the scan of a collection tree
+ * for the resources in a data package.
+ */
+typedef struct ResourcesScan
+{
+	DataPackageStream *rs_stream_p;
+	struct dav_resource_private *rs_davrods_resource_p;
+
+	/*
+	 * The credentials to calculate any missing checksums as,
+	 * or NULL if they are not available.
+	 */
+	const char *rs_username_s;
+	const char *rs_password_s;
+
+	/*
+	 * The AVUs needed for the tabular schemas keyed by data object id,
+	 * or NULL if they could not be got in bulk.
+	 */
+	apr_hash_t *rs_tabular_metadata_p;
+} ResourcesScan;
+
+
 /*
  * Static declarations
  */
 
 static const char * const S_DATA_PACKAGE_S = "datapackage.json";
 
+/*
+ * The key of the AVU on a saved datapackage.json that records the
+ * fingerprint of the collection tree that it was generated from.
+ */
+static const char * const S_FINGERPRINT_KEY_S = "datapackage_fingerprint";
+
+/*
+ * The AVUs that GetTabularSchema () uses, i.e. the column headings
+ * and the "<column>_type" keys.
+ */
+static const char * const S_TABULAR_KEYS_CONDITION_S = "= 'column_headings' || like '%_type'";
+
+/*
+ * How many resources to write before passing them on
+ * to the client rather than holding on to them.
+ */
+static const apr_size_t S_RESOURCES_PER_FLUSH = 256;
+
+/*
+ * The size of the writes when saving a generated
+ * datapackage.json into iRODS.
+ */
+#define S_IRODS_BLOCK_SIZE (1024 * 1024)
+
 
 static const char *S_TYPES_SS [] =
 {
@@ -60,15 +175,11 @@ static const char *GetJSONString (const json_t *json_p, const char * const key_s
 
 static bool SetJSONString (json_t *json_p, const char * const key_s, const char * const value_s, apr_pool_t *pool_p);
 
-static json_t *GetResources (const dav_resource *resource_p);
+static apr_status_t WriteResources (DataPackageStream *stream_p, const dav_resource *resource_p);
 
-static bool AddResources (json_t *fd_p, const dav_resource *resource_p);
+static apr_status_t AddResource (const IRodsObject *irods_obj_p, void *data_p, apr_pool_t *pool_p);
 
-static bool AddResource (collEnt_t * const entry_p, json_t *resources_p, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p);
-
-static json_t *PopulateResourceFromDataObject (collEnt_t * const entry_p, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p);
-
-static json_t *PopulateResourceFromCollection (collEnt_t * const entry_p,  rcComm_t *connection_p, const char *data_package_root_path_s, apr_pool_t *pool_p);
+static json_t *PopulateResourceFromDataObject (const IRodsObject *irods_obj_p, ResourcesScan *scan_p, apr_pool_t *pool_p);
 
 static bool AddLicense (json_t *resource_p, const char *name_s, const char *url_s, apr_pool_t *pool_p);
 
@@ -82,9 +193,41 @@ static const char *GetRelativePath (const char *data_package_root_path_s, const
 
 static char *GetMetadataValue (const char *full_key_s, const apr_table_t *metadata_table_p, apr_pool_t *pool_p);
 
-static bool CacheDataPackageToDisk (const char *collection_s, const char *package_data_s, const char *output_path_s, apr_pool_t *pool_p);
+static bool GenerateDataPackage (const dav_resource *resource_p, ap_filter_t *output_p, const char *fingerprint_s, const char *cache_path_s);
+
+static char *GetDiskCachePath (const struct dav_resource_private *davrods_resource_p, const char *collection_s, apr_pool_t *pool_p);
+
+static apr_file_t *OpenCachedFile (const char *cache_path_s, const char *fingerprint_s, apr_pool_t *pool_p);
+
+static bool SendDataPackageFromDisk (const char *cache_path_s, const char *fingerprint_s, ap_filter_t *output_p, apr_pool_t *pool_p);
+
+static apr_status_t WriteCollectionResources (const char *collection_s, const char *fingerprint_s, void *data_p, apr_pool_t *pool_p);
+
+static bool SendPartialFromDisk (DataPackageStream *stream_p, const char *partial_path_s, const char *fingerprint_s, apr_status_t *status_p, apr_pool_t *pool_p);
+
+static bool OpenDataPackageStream (DataPackageStream *stream_p, const dav_resource *resource_p, ap_filter_t *output_p, const char *fingerprint_s, const char *cache_path_s);
+
+static bool CloseDataPackageStream (DataPackageStream *stream_p, const bool complete_flag, const char *fingerprint_s);
+
+static apr_status_t WriteToDataPackageStream (DataPackageStream *stream_p, const char *data_s, apr_size_t length);
+
+static apr_status_t WriteIndentedJSON (DataPackageStream *stream_p, const json_t *json_p, const char *indent_s);
+
+static apr_status_t WriteDataPackageHeader (DataPackageStream *stream_p, const json_t *dp_p);
 
-static bool CacheDataPackageToIRODS (const char *collection_s, char *package_data_s, rcComm_t *rods_conn_p, apr_pool_t *pool_p);
+static apr_status_t FlushDataPackageStream (DataPackageStream *stream_p);
+
+static bool OpenCacheFile (CacheFile *cache_file_p, const char *cache_path_s, const char *fingerprint_s, apr_pool_t *pool_p);
+
+static void WriteCacheFile (CacheFile *cache_file_p, const char *data_s, const apr_size_t length);
+
+static void CloseCacheFile (CacheFile *cache_file_p, const bool keep_flag);
+
+static void StartIRODSCopy (DataPackageStream *stream_p, const char *full_path_to_collection_s, rcComm_t *rods_conn_p);
+
+static bool WriteIRODSCopyBuffer (DataPackageStream *stream_p);
+
+static void FinishIRODSCopy (DataPackageStream *stream_p, const bool keep_flag, const char *fingerprint_s);
 
 static bool IsTabularPackage (const char *name_s);
 
@@ -175,195 +318,803 @@ dav_error *DeliverFDDataPackage (const dav_resource *resource_p, ap_filter_t *ou
 	bool success_flag = false;
 	dav_error *res_p = NULL;
 	struct dav_resource_private *davrods_resource_p = (struct dav_resource_private *) resource_p -> info;
+	const struct HtmlTheme *theme_p = davrods_resource_p -> conf -> theme_p;
 	apr_pool_t *pool_p = resource_p -> pool;
 	request_rec *req_p = resource_p -> info -> r;
+	const size_t data_package_length = strlen (S_DATA_PACKAGE_S);
+	const size_t path_length = strlen (davrods_resource_p -> rods_path);
+	char *fingerprint_s = NULL;
+	char *cache_path_s = NULL;
 
-	apr_bucket_brigade *bb_p = apr_brigade_create (pool_p, output_p -> c -> bucket_alloc);
+	/*
+	 * If we are replacing a stale saved copy, the path is for
+	 * the datapackage.json rather than for its collection.
+	 */
+	if ((path_length > data_package_length) && (strcmp (davrods_resource_p -> rods_path + path_length - data_package_length, S_DATA_PACKAGE_S) == 0)
+		&& (* (davrods_resource_p -> rods_path + path_length - data_package_length - 1) == '/'))
+		{
+			char *slash_s = davrods_resource_p -> rods_path + path_length - data_package_length - 1;
+
+			/* Keep the slash for the root collection */
+			* ((slash_s == davrods_resource_p -> rods_path) ? slash_s + 1 : slash_s) = '\0';
+		}
 
 	ap_set_content_type (req_p, CONTENT_TYPE_JSON_S);
 
-	if (bb_p)
+	if ((theme_p -> ht_fd_cache_dir_s) || (theme_p -> ht_fd_save_datapackages_flag > 0))
 		{
-			json_t *dp_p = json_object ();
+			fingerprint_s = GetCollectionTreeFingerprint (davrods_resource_p -> rods_path, S_DATA_PACKAGE_S, davrods_resource_p -> rods_conn, pool_p);
 
-			if (dp_p)
+			if (!fingerprint_s)
 				{
-					char *collection_id_s = GetCollectionId (davrods_resource_p -> rods_path, davrods_resource_p -> rods_conn, pool_p);
+					ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, APR_EGENERAL, req_p, "Failed to get fingerprint for \"%s\" so it will not be cached", davrods_resource_p -> rods_path);
+				}
+		}
+
+	if (fingerprint_s && (theme_p -> ht_fd_cache_dir_s))
+		{
+			cache_path_s = GetDiskCachePath (davrods_resource_p, NULL, pool_p);
+
+			if (cache_path_s)
+				{
+					success_flag = SendDataPackageFromDisk (cache_path_s, fingerprint_s, output_p, pool_p);
+				}
+		}
+
+	if (!success_flag)
+		{
+			success_flag = GenerateDataPackage (resource_p, output_p, fingerprint_s, cache_path_s);
+		}
+
+	if (!success_flag)
+		{
+			res_p = dav_new_error (pool_p, HTTP_NOT_FOUND, 0, 0, "Failed to get file.");
+		}
+
+	return res_p;
+}
 
-					if (collection_id_s)
+
+bool IsSavedFDDataPackageStale (const dav_resource *resource_p)
+{
+	bool stale_flag = false;
+	struct dav_resource_private *davrods_resource_p = (struct dav_resource_private *) resource_p -> info;
+
+	if (davrods_resource_p -> conf -> theme_p -> ht_fd_save_datapackages_flag > 0)
+		{
+			apr_pool_t *pool_p = resource_p -> pool;
+			char *collection_s = apr_pstrdup (pool_p, davrods_resource_p -> rods_path);
+			char *data_s = collection_s ? strrchr (collection_s, '/') : NULL;
+
+			if (data_s)
+				{
+					const int select_columns_p [] = { COL_META_DATA_ATTR_VALUE, -1 };
+					const int where_columns_p [] = { COL_COLL_NAME, COL_DATA_NAME, COL_META_DATA_ATTR_NAME };
+					const char *where_values_ss [] = { collection_s, S_DATA_PACKAGE_S, S_FINGERPRINT_KEY_S };
+					genQueryOut_t *results_p = NULL;
+
+					/* The path can be for either the collection or the datapackage.json within it */
+					if (strcmp (data_s + 1, S_DATA_PACKAGE_S) == 0)
 						{
-							apr_table_t *metadata_p = GetMetadataAsTable (davrods_resource_p -> rods_conn, COLL_OBJ_T, collection_id_s, NULL, davrods_resource_p -> rods_env -> rodsZone, pool_p);
+							*data_s = '\0';
 
-							if (metadata_p)
+							if (*collection_s == '\0')
 								{
-									const struct HtmlTheme *theme_p = davrods_resource_p -> conf -> theme_p;
-									apr_status_t status;
+									where_values_ss [0] = "/";
+								}
+						}
 
-									/* the local collection name */
-									const char *collection_s = strrchr (davrods_resource_p -> rods_path, '/');
+					results_p = RunQuery (davrods_resource_p -> rods_conn, select_columns_p, where_columns_p, where_values_ss, NULL, 3, 0, pool_p);
 
-									if (collection_s)
+					/*
+					 * A datapackage.json without a fingerprint wasn't saved
+					 * by us, so it is always served as it is.
+					 */
+					if (results_p)
+						{
+							if ((results_p -> rowCnt > 0) && (results_p -> attriCnt == 1))
+								{
+									char *fingerprint_s = GetCollectionTreeFingerprint (where_values_ss [0], S_DATA_PACKAGE_S, davrods_resource_p -> rods_conn, pool_p);
+
+									if (fingerprint_s)
 										{
-											/* move past the last slash */
-											++ collection_s;
+											stale_flag = (strcmp (fingerprint_s, results_p -> sqlResult [0].value) != 0);
+										}
+								}
 
-											/*
-											 * Are we at the end of the string?
-											 */
-											if (*collection_s == '\0')
-												{
-													collection_s = NULL;
-												}
+							freeGenQueryOut (&results_p);
+						}
+				}
+		}
+
+	return stale_flag;
+}
+
+
+static bool GenerateDataPackage (const dav_resource *resource_p, ap_filter_t *output_p, const char *fingerprint_s, const char *cache_path_s)
+{
+	bool success_flag = false;
+	struct dav_resource_private *davrods_resource_p = (struct dav_resource_private *) resource_p -> info;
+	apr_pool_t *pool_p = resource_p -> pool;
+	request_rec *req_p = resource_p -> info -> r;
+	json_t *dp_p = json_object ();
+
+	if (dp_p)
+		{
+			char *collection_id_s = GetCollectionId (davrods_resource_p -> rods_path, davrods_resource_p -> rods_conn, pool_p);
+
+			if (collection_id_s)
+				{
+					apr_table_t *metadata_p = GetMetadataAsTable (davrods_resource_p -> rods_conn, COLL_OBJ_T, collection_id_s, NULL, davrods_resource_p -> rods_env -> rodsZone, pool_p);
+
+					if (metadata_p)
+						{
+							const struct HtmlTheme *theme_p = davrods_resource_p -> conf -> theme_p;
+							apr_status_t status;
+
+							/* the local collection name */
+							const char *collection_s = strrchr (davrods_resource_p -> rods_path, '/');
+
+							if (collection_s)
+								{
+									/* move past the last slash */
+									++ collection_s;
+
+									/*
+									 * Are we at the end of the string?
+									 */
+									if (*collection_s == '\0')
+										{
+											collection_s = NULL;
 										}
+								}
 
-									status = BuildDataPackage (dp_p, metadata_p, collection_s, theme_p, pool_p);
+							status = BuildDataPackage (dp_p, metadata_p, collection_s, theme_p, pool_p);
 
-									if (status == APR_SUCCESS)
+							if (status == APR_SUCCESS)
+								{
+									DataPackageStream stream;
+
+									if (OpenDataPackageStream (&stream, resource_p, output_p, fingerprint_s, cache_path_s))
 										{
-											if (AddResources (dp_p, resource_p))
-												{
-													apr_status_t apr_status;
-													char *dp_s = json_dumps (dp_p, JSON_INDENT (2));
+											/*
+											 * Send the package fields first and then each of the
+											 * resources as they are found, so only a single resource
+											 * is ever held in memory.
+											 */
+											status = WriteDataPackageHeader (&stream, dp_p);
 
-													if (dp_s)
-														{
-															if ( (apr_status = apr_brigade_puts (bb_p, NULL, NULL, dp_s)) == APR_SUCCESS)
-																{
-																	if ( (apr_status = ap_pass_brigade (output_p, bb_p)) == APR_SUCCESS)
-																		{
-																			success_flag = true;
-																		}
-																	else
-																		{
-																			ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "ap_pass_brigade failed for \"%s\" at brigade \"%s\"", dp_s, davrods_resource_p -> rods_path);
-																		}
-																}
-															else
-																{
-																	ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "Failed to write \"%s\" to brigade \"%s\"", dp_s, davrods_resource_p -> rods_path);
-																}
+											if (status == APR_SUCCESS)
+												{
+													status = WriteResources (&stream, resource_p);
+												}
 
-															if (theme_p -> ht_fd_save_datapackages_flag > 0)
-																{
-																	CacheDataPackageToIRODS (davrods_resource_p -> rods_path, dp_s, davrods_resource_p -> rods_conn, pool_p);
-																}
+											if (status == APR_SUCCESS)
+												{
+													const char *end_s = (stream.dps_resources_flag) ? "\n  ]\n}" : "]\n}";
 
-															free (dp_s);
-														}
-													else
-														{
-															ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "Failed to dump JSON for \"%s\"", davrods_resource_p -> rods_path);
-														}
+													status = WriteToDataPackageStream (&stream, end_s, strlen (end_s));
+												}
 
-												}		/* if (AddResources (dp_p, resource_p)) */
-											else
+											if (status != APR_SUCCESS)
 												{
-													ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "AddResources failed for \"%s\"", davrods_resource_p -> rods_path);
+													ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to write the datapackage for \"%s\" after %" APR_SIZE_T_FMT " resources", davrods_resource_p -> rods_path, stream.dps_num_resources);
 												}
+
+											/*
+											 * Once some of the package has been sent, we can no longer
+											 * send an error response, so the client is left with
+											 * incomplete JSON instead.
+											 */
+											success_flag = CloseDataPackageStream (&stream, (status == APR_SUCCESS), fingerprint_s) || (stream.dps_sent_flag);
 										}
 									else
 										{
-											ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "BuildDataPackage failed for \"%s\"", davrods_resource_p -> rods_path);
+											ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "Failed to create output stream for \"%s\"", davrods_resource_p -> rods_path);
 										}
-
-								}		/* if (metadata_p) */
+								}
 							else
 								{
-									ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "GetMetadataAsTable failed for \"%s\"", davrods_resource_p -> rods_path);
+									ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "BuildDataPackage failed for \"%s\"", davrods_resource_p -> rods_path);
 								}
 
-						}		/* if (collection_id_s) */
+						}		/* if (metadata_p) */
 					else
 						{
-							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "GetCollectionId failed for \"%s\"", davrods_resource_p -> rods_path);
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "GetMetadataAsTable failed for \"%s\"", davrods_resource_p -> rods_path);
+						}
+
+				}		/* if (collection_id_s) */
+			else
+				{
+					ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "GetCollectionId failed for \"%s\"", davrods_resource_p -> rods_path);
+				}
+
+			json_decref (dp_p);
+		}		/* if (dp_p) */
+	else
+		{
+			ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "Failed to create output json for \"%s\"", davrods_resource_p -> rods_path);
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Set up the stream to the client along with any copies
+ * for the disk cache and for saving into iRODS.
+ */
+static bool OpenDataPackageStream (DataPackageStream *stream_p, const dav_resource *resource_p, ap_filter_t *output_p, const char *fingerprint_s, const char *cache_path_s)
+{
+	bool success_flag = false;
+	struct dav_resource_private *davrods_resource_p = (struct dav_resource_private *) resource_p -> info;
+	apr_pool_t *pool_p = resource_p -> pool;
+
+	memset (stream_p, 0, sizeof (DataPackageStream));
+
+	stream_p -> dps_output_p = output_p;
+	stream_p -> dps_pool_p = pool_p;
+	stream_p -> dps_bb_p = apr_brigade_create (pool_p, output_p -> c -> bucket_alloc);
+
+	if (stream_p -> dps_bb_p)
+		{
+			if (cache_path_s && fingerprint_s)
+				{
+					OpenCacheFile (& (stream_p -> dps_cache_file), cache_path_s, fingerprint_s, pool_p);
+					stream_p -> dps_partials_flag = true;
+				}
+
+			if (davrods_resource_p -> conf -> theme_p -> ht_fd_save_datapackages_flag > 0)
+				{
+					StartIRODSCopy (stream_p, davrods_resource_p -> rods_path, davrods_resource_p -> rods_conn);
+				}
+
+			success_flag = true;
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * Send anything left to the client and then keep the copies if the whole
+ * package was written or throw them away if not. This returns true if the
+ * rest of the package was sent successfully.
+ */
+static bool CloseDataPackageStream (DataPackageStream *stream_p, const bool complete_flag, const char *fingerprint_s)
+{
+	bool success_flag = false;
+
+	if (ap_pass_brigade (stream_p -> dps_output_p, stream_p -> dps_bb_p) == APR_SUCCESS)
+		{
+			success_flag = complete_flag;
+		}
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, stream_p -> dps_pool_p, "ap_pass_brigade failed for the end of the datapackage");
+		}
+
+	apr_brigade_destroy (stream_p -> dps_bb_p);
+
+	CloseCacheFile (& (stream_p -> dps_cache_file), success_flag);
+	FinishIRODSCopy (stream_p, success_flag, fingerprint_s);
+
+	return success_flag;
+}
+
+
+static apr_status_t WriteToDataPackageStream (DataPackageStream *stream_p, const char *data_s, apr_size_t length)
+{
+	apr_status_t status = apr_brigade_write (stream_p -> dps_bb_p, ap_filter_flush, stream_p -> dps_output_p, data_s, length);
+
+	if (status == APR_SUCCESS)
+		{
+			stream_p -> dps_sent_flag = true;
+		}
+
+	/*
+	 * Any problems with the copies just mean that they are
+	 * abandoned rather than stopping the response.
+	 */
+	WriteCacheFile (& (stream_p -> dps_cache_file), data_s, length);
+
+	if (stream_p -> dps_partial_p)
+		{
+			WriteCacheFile (stream_p -> dps_partial_p, data_s, length);
+		}
+
+	if (stream_p -> dps_rods_open_flag)
+		{
+			while ((length > 0) && (stream_p -> dps_rods_open_flag))
+				{
+					apr_size_t chunk_length = S_IRODS_BLOCK_SIZE - (stream_p -> dps_rods_buffer_length);
+
+					if (chunk_length > length)
+						{
+							chunk_length = length;
+						}
+
+					memcpy ((stream_p -> dps_rods_buffer_s) + (stream_p -> dps_rods_buffer_length), data_s, chunk_length);
+					stream_p -> dps_rods_buffer_length += chunk_length;
+					data_s += chunk_length;
+					length -= chunk_length;
+
+					if (stream_p -> dps_rods_buffer_length == S_IRODS_BLOCK_SIZE)
+						{
+							if (!WriteIRODSCopyBuffer (stream_p))
+								{
+									FinishIRODSCopy (stream_p, false, NULL);
+								}
+						}
+				}
+		}
+
+	return status;
+}
+
+
+/*
+ * Write a JSON value with each of its lines indented
+ * so that it lines up with the rest of the package.
+ */
+static apr_status_t WriteIndentedJSON (DataPackageStream *stream_p, const json_t *json_p, const char *indent_s)
+{
+	apr_status_t status = APR_ENOMEM;
+	char *json_s = json_dumps (json_p, JSON_INDENT (2));
+
+	if (json_s)
+		{
+			const size_t indent_length = strlen (indent_s);
+			const char *line_s = json_s;
+
+			status = APR_SUCCESS;
+
+			while (line_s && (status == APR_SUCCESS))
+				{
+					const char *end_s = strchr (line_s, '\n');
+
+					status = WriteToDataPackageStream (stream_p, indent_s, indent_length);
+
+					if (status == APR_SUCCESS)
+						{
+							if (end_s)
+								{
+									status = WriteToDataPackageStream (stream_p, line_s, end_s - line_s + 1);
+									line_s = end_s + 1;
+								}
+							else
+								{
+									status = WriteToDataPackageStream (stream_p, line_s, strlen (line_s));
+									line_s = NULL;
+								}
+						}
+				}
+
+			free (json_s);
+		}
+
+	return status;
+}
+
+
+/*
+ * Write the package fields, leaving the object open
+ * for the resources array to be added to the end.
+ */
+static apr_status_t WriteDataPackageHeader (DataPackageStream *stream_p, const json_t *dp_p)
+{
+	apr_status_t status = APR_ENOMEM;
+
+	if (json_object_size (dp_p) > 0)
+		{
+			char *dp_s = json_dumps (dp_p, JSON_INDENT (2));
+
+			if (dp_s)
+				{
+					char *end_s = strrchr (dp_s, '}');
+					size_t l;
+
+					/* Remove the closing brace along with the newline before it */
+					while ((end_s > dp_s) && (isspace (* (end_s - 1))))
+						{
+							-- end_s;
+						}
+
+					l = end_s ? (size_t) (end_s - dp_s) : strlen (dp_s);
+
+					status = WriteToDataPackageStream (stream_p, dp_s, l);
+
+					if (status == APR_SUCCESS)
+						{
+							status = WriteToDataPackageStream (stream_p, ",\n  \"resources\": [", 18);
+						}
+
+					free (dp_s);
+				}
+		}
+	else
+		{
+			status = WriteToDataPackageStream (stream_p, "{\n  \"resources\": [", 18);
+		}
+
+	return status;
+}
+
+
+/*
+ * Send the resources to the client in batches rather
+ * than letting them build up in the brigade.
+ */
+static apr_status_t FlushDataPackageStream (DataPackageStream *stream_p)
+{
+	return ap_fflush (stream_p -> dps_output_p, stream_p -> dps_bb_p);
+}
+
+
+/*
+ * The generated package depends upon who is asking, since the iCAT only
+ * returns what they can see, as well as upon where it is served from and
+ * the configured metadata keys, so all of these go into the filename.
+ * If collection_s is set, this is the path for the partial results for
+ * that collection within the package, since the resources' paths are
+ * relative to the package's root.
+ */
+static char *GetDiskCachePath (const struct dav_resource_private *davrods_resource_p, const char *collection_s, apr_pool_t *pool_p)
+{
+	char *path_s = NULL;
+	const struct HtmlTheme *theme_p = davrods_resource_p -> conf -> theme_p;
+	const char * const values_ss [] =
+		{
+			davrods_resource_p -> rods_conn -> clientUser.userName,
+			davrods_resource_p -> rods_path,
+			davrods_resource_p -> rods_root,
+			theme_p -> ht_fd_resource_name_key_s,
+			theme_p -> ht_fd_resource_license_name_key_s,
+			theme_p -> ht_fd_resource_license_url_key_s,
+			theme_p -> ht_fd_resource_title_key_s,
+			theme_p -> ht_fd_resource_id_key_s,
+			theme_p -> ht_fd_resource_authors_key_s,
+			theme_p -> ht_fd_resource_description_key_s,
+			collection_s
+		};
+	const size_t num_values = sizeof (values_ss) / sizeof (values_ss [0]);
+	unsigned char digest [APR_MD5_DIGESTSIZE];
+	apr_md5_ctx_t context;
+	size_t i;
+
+	apr_md5_init (&context);
+
+	for (i = 0; i < num_values; ++ i)
+		{
+			const char *value_s = values_ss [i] ? values_ss [i] : "";
+
+			/* Include the terminator so that the values can't run into each other */
+			apr_md5_update (&context, value_s, strlen (value_s) + 1);
+		}
+
+	if (apr_md5_final (digest, &context) == APR_SUCCESS)
+		{
+			char digest_s [(APR_MD5_DIGESTSIZE * 2) + 1];
+
+			for (i = 0; i < APR_MD5_DIGESTSIZE; ++ i)
+				{
+					apr_snprintf (digest_s + (i * 2), 3, "%02x", digest [i]);
+				}
+
+			path_s = apr_pstrcat (pool_p, theme_p -> ht_fd_cache_dir_s, "/", digest_s, collection_s ? ".partial" : ".json", NULL);
+		}
+
+	return path_s;
+}
+
+
+/*
+ * The cached files start with a line holding the fingerprint that they
+ * were made for, followed by the datapackage.json, or the partial results,
+ * itself. If the fingerprint matches, the file is returned positioned
+ * just after it.
+ */
+static apr_file_t *OpenCachedFile (const char *cache_path_s, const char *fingerprint_s, apr_pool_t *pool_p)
+{
+	apr_file_t *file_p = NULL;
+
+	if (apr_file_open (&file_p, cache_path_s, APR_FOPEN_READ, APR_OS_DEFAULT, pool_p) == APR_SUCCESS)
+		{
+			char line_s [256];
+			bool match_flag = false;
+
+			if ((strlen (fingerprint_s) + 2 <= sizeof (line_s)) && (apr_file_gets (line_s, sizeof (line_s), file_p) == APR_SUCCESS))
+				{
+					match_flag = DoesFingerprintLineMatch (line_s, fingerprint_s);
+				}
+
+			if (!match_flag)
+				{
+					apr_file_close (file_p);
+					file_p = NULL;
+				}
+		}
+	else
+		{
+			file_p = NULL;
+		}
+
+	return file_p;
+}
+
+
+static bool SendDataPackageFromDisk (const char *cache_path_s, const char *fingerprint_s, ap_filter_t *output_p, apr_pool_t *pool_p)
+{
+	bool success_flag = false;
+	apr_file_t *file_p = OpenCachedFile (cache_path_s, fingerprint_s, pool_p);
+
+	if (file_p)
+		{
+			apr_finfo_t finfo;
+			bool sent_flag = false;
+
+			if (apr_file_info_get (&finfo, APR_FINFO_SIZE, file_p) == APR_SUCCESS)
+				{
+					apr_bucket_brigade *bb_p = apr_brigade_create (pool_p, output_p -> c -> bucket_alloc);
+
+					if (bb_p)
+						{
+							const apr_off_t offset = (apr_off_t) (strlen (fingerprint_s) + 1);
+
+							/* The file bucket now owns the file */
+							apr_brigade_insert_file (bb_p, file_p, offset, finfo.size - offset, pool_p);
+							sent_flag = true;
+
+							if (ap_pass_brigade (output_p, bb_p) == APR_SUCCESS)
+								{
+									success_flag = true;
+								}
+							else
+								{
+									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to send cached datapackage \"%s\"", cache_path_s);
+								}
+
+							apr_brigade_destroy (bb_p);
 						}
+				}
 
-					json_decref (dp_p);
-				}		/* if (dp_p) */
-			else
+			if (!sent_flag)
 				{
-					ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "Failed to create output json for \"%s\"", davrods_resource_p -> rods_path);
+					apr_file_close (file_p);
 				}
+		}
+
+	return success_flag;
+}
+
+
+/*
+ * The fingerprint is known before we start so it
+ * can go on the first line straight away.
+ */
+static bool OpenCacheFile (CacheFile *cache_file_p, const char *cache_path_s, const char *fingerprint_s, apr_pool_t *pool_p)
+{
+	char *temp_path_s = apr_pstrcat (pool_p, cache_path_s, ".XXXXXX", NULL);
+	apr_file_t *file_p = NULL;
+
+	memset (cache_file_p, 0, sizeof (CacheFile));
 
-			apr_brigade_destroy (bb_p);
-		}		/* if (bb_p) */
+	if (temp_path_s && (apr_file_mktemp (&file_p, temp_path_s, APR_FOPEN_CREATE | APR_FOPEN_WRITE | APR_FOPEN_EXCL | APR_FOPEN_BUFFERED, pool_p) == APR_SUCCESS))
+		{
+			cache_file_p -> cf_file_p = file_p;
+			cache_file_p -> cf_temp_path_s = temp_path_s;
+			cache_file_p -> cf_path_s = cache_path_s;
+			cache_file_p -> cf_pool_p = pool_p;
+
+			if (apr_file_printf (file_p, "%s\n", fingerprint_s) <= 0)
+				{
+					CloseCacheFile (cache_file_p, false);
+				}
+		}
 	else
 		{
-			ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, req_p, "Failed to create output bucket brigade for \"%s\"", davrods_resource_p -> rods_path);
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to create temporary file to cache datapackage to \"%s\"", cache_path_s);
 		}
 
-	if (!success_flag)
+	return (cache_file_p -> cf_file_p != NULL);
+}
+
+
+/*
+ * Any problems just mean that the file is abandoned
+ * rather than stopping the response.
+ */
+static void WriteCacheFile (CacheFile *cache_file_p, const char *data_s, const apr_size_t length)
+{
+	if (cache_file_p -> cf_file_p)
 		{
-			res_p = dav_new_error (pool_p, HTTP_NOT_FOUND, 0, 0, "Failed to get file.");
+			if (apr_file_write_full (cache_file_p -> cf_file_p, data_s, length, NULL) != APR_SUCCESS)
+				{
+					CloseCacheFile (cache_file_p, false);
+				}
 		}
-
-	return res_p;
 }
 
 
-static bool CacheDataPackageToDisk (const char *collection_s, const char *package_data_s, const char *output_path_s, apr_pool_t *pool_p)
+static void CloseCacheFile (CacheFile *cache_file_p, const bool keep_flag)
 {
-	bool success_flag = false;
+	if (cache_file_p -> cf_file_p)
+		{
+			apr_pool_t *pool_p = cache_file_p -> cf_pool_p;
+			apr_status_t status = apr_file_close (cache_file_p -> cf_file_p);
 
-	return success_flag;
+			cache_file_p -> cf_file_p = NULL;
+
+			if (keep_flag)
+				{
+					if (status == APR_SUCCESS)
+						{
+							status = apr_file_rename (cache_file_p -> cf_temp_path_s, cache_file_p -> cf_path_s, pool_p);
+						}
+
+					if (status != APR_SUCCESS)
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to cache datapackage to \"%s\"", cache_file_p -> cf_path_s);
+						}
+				}
+			else
+				{
+					status = APR_EGENERAL;
+				}
+
+			if (status != APR_SUCCESS)
+				{
+					apr_file_remove (cache_file_p -> cf_temp_path_s, pool_p);
+				}
+		}
 }
 
 
-static bool CacheDataPackageToIRODS (const char *full_path_to_collection_s, char *package_data_s, rcComm_t *rods_conn_p, apr_pool_t *pool_p)
+static void StartIRODSCopy (DataPackageStream *stream_p, const char *full_path_to_collection_s, rcComm_t *rods_conn_p)
 {
-	bool success_flag = false;
-	dataObjInp_t input;
-	openedDataObjInp_t handle;
+	apr_pool_t *pool_p = stream_p -> dps_pool_p;
 	char *full_path_s = apr_pstrcat (pool_p, full_path_to_collection_s, "/", S_DATA_PACKAGE_S, NULL);
-	const int data_length = strlen (package_data_s);
+	char *buffer_s = (char *) apr_palloc (pool_p, S_IRODS_BLOCK_SIZE);
 
-	memset (&handle, 0, sizeof (openedDataObjInp_t));
-	memset (&input, 0, sizeof (dataObjInp_t));
+	if (full_path_s && buffer_s)
+		{
+			dataObjInp_t input;
+
+			memset (& (stream_p -> dps_rods_handle), 0, sizeof (openedDataObjInp_t));
+			memset (&input, 0, sizeof (dataObjInp_t));
+
+			rstrcpy (input.objPath, full_path_s, MAX_NAME_LEN);
+
+			input.createMode = 0750;
+
+			/* Replace any stale copy that we saved before */
+			addKeyVal (& (input.condInput), FORCE_FLAG_KW, "");
+
+			stream_p -> dps_rods_handle.l1descInx = rcDataObjCreate (rods_conn_p, &input);
+
+			if (stream_p -> dps_rods_handle.l1descInx >= 0)
+				{
+					stream_p -> dps_rods_conn_p = rods_conn_p;
+					stream_p -> dps_rods_path_s = full_path_s;
+					stream_p -> dps_rods_buffer_s = buffer_s;
+					stream_p -> dps_rods_buffer_length = 0;
+					stream_p -> dps_rods_open_flag = true;
+				}
+			else
+				{
+					const char *error_s = get_rods_error_msg (stream_p -> dps_rods_handle.l1descInx);
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, pool_p, "Failed to open cache datapackage at \"%s\", %s\"", full_path_s, error_s);
+				}
+
+			clearKeyVal (& (input.condInput));
+		}
+}
 
-	rstrcpy (input.objPath, full_path_s, MAX_NAME_LEN);
 
-	input.createMode = 0750;
-	input.dataSize = data_length;
-	handle.l1descInx = rcDataObjCreate (rods_conn_p, &input);
+static bool WriteIRODSCopyBuffer (DataPackageStream *stream_p)
+{
+	bool success_flag = true;
 
-	if (handle.l1descInx >= 0)
+	if (stream_p -> dps_rods_buffer_length > 0)
 		{
 			bytesBuf_t buffer;
 			int status;
 
-			bzero (&buffer, sizeof (bytesBuf_t));
+			memset (&buffer, 0, sizeof (bytesBuf_t));
 
-			buffer.len = data_length;
-			buffer.buf = package_data_s;
-			handle.len = data_length;
+			buffer.len = (int) (stream_p -> dps_rods_buffer_length);
+			buffer.buf = stream_p -> dps_rods_buffer_s;
+			stream_p -> dps_rods_handle.len = buffer.len;
 
-			status = rcDataObjWrite (rods_conn_p, &handle, &buffer);
+			status = rcDataObjWrite (stream_p -> dps_rods_conn_p, & (stream_p -> dps_rods_handle), &buffer);
 
-			if (status == data_length)
+			if (status == buffer.len)
 				{
-					success_flag = true;
+					stream_p -> dps_rods_buffer_length = 0;
 				}
 			else
 				{
 					const char *error_s = get_rods_error_msg (status);
-					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, pool_p, "Failed to write buffer for cached datapackage at \"%s\", %d bytes out of %d, error %s", full_path_s, status, data_length, error_s);
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, stream_p -> dps_pool_p, "Failed to write buffer for cached datapackage at \"%s\", %d bytes out of %d, error %s", stream_p -> dps_rods_path_s, status, buffer.len, error_s);
+					success_flag = false;
 				}
+		}
+
+	return success_flag;
+}
+
 
-			status = rcDataObjClose (rods_conn_p, &handle);
+/*
+ * Close the saved copy and either record what it was generated from, so
+ * that later requests can tell whether it is still current, or remove it
+ * if it is incomplete. Without the fingerprint, a partial copy would
+ * otherwise be served as if it was one that a user had put there.
+ */
+static void FinishIRODSCopy (DataPackageStream *stream_p, const bool keep_flag, const char *fingerprint_s)
+{
+	if (stream_p -> dps_rods_open_flag)
+		{
+			apr_pool_t *pool_p = stream_p -> dps_pool_p;
+			const char *full_path_s = stream_p -> dps_rods_path_s;
+			bool success_flag = keep_flag && WriteIRODSCopyBuffer (stream_p);
+			int status;
+
+			stream_p -> dps_rods_open_flag = false;
+
+			status = rcDataObjClose (stream_p -> dps_rods_conn_p, & (stream_p -> dps_rods_handle));
 
 			if (status < 0)
 				{
 					const char *error_s = get_rods_error_msg (status);
 					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, pool_p, "Failed to close cached datapackage at \"%s\", \"%s\"", full_path_s, error_s);
+					success_flag = false;
 				}
-		}
-	else
-		{
-			const char *error_s = get_rods_error_msg (handle.l1descInx);
-			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, pool_p, "Failed to open cache datapackage at \"%s\", %s\"", full_path_s, error_s);
-		}
 
-	return success_flag;
+			if (success_flag && fingerprint_s)
+				{
+					modAVUMetadataInp_t mod;
+
+					memset (&mod, 0, sizeof (modAVUMetadataInp_t));
+
+					mod.arg0 = "set";
+					mod.arg1 = "-d";
+					mod.arg2 = (char *) full_path_s;
+					mod.arg3 = (char *) S_FINGERPRINT_KEY_S;
+					mod.arg4 = (char *) fingerprint_s;
+					mod.arg5 = "";
+					mod.arg6 = "";
+					mod.arg7 = "";
+					mod.arg8 = "";
+					mod.arg9 = "";
+
+					status = rcModAVUMetadata (stream_p -> dps_rods_conn_p, &mod);
+
+					if (status < 0)
+						{
+							const char *error_s = get_rods_error_msg (status);
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, pool_p, "Failed to set fingerprint for cached datapackage at \"%s\", \"%s\"", full_path_s, error_s);
+						}
+				}
+			else if (!success_flag)
+				{
+					dataObjInp_t input;
+
+					memset (&input, 0, sizeof (dataObjInp_t));
+					rstrcpy (input.objPath, full_path_s, MAX_NAME_LEN);
+					addKeyVal (& (input.condInput), FORCE_FLAG_KW, "");
+
+					status = rcDataObjUnlink (stream_p -> dps_rods_conn_p, &input);
+
+					if (status < 0)
+						{
+							const char *error_s = get_rods_error_msg (status);
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to remove incomplete cached datapackage at \"%s\", \"%s\"", full_path_s, error_s);
+						}
+
+					clearKeyVal (& (input.condInput));
+				}
+		}
 }
 
 
@@ -701,156 +1452,265 @@ static bool SetJSONString (json_t *json_p, const char * const key_s, const char
 }
 
 
-static bool AddResources (json_t *fd_p, const dav_resource *resource_p)
+/*
+ * FD Data Packages don't appear to add the directory entries to the resources part,
+ * so just walk the data objects, writing each one out as it is found. Their
+ * checksums come from the same queries.
+ */
+static apr_status_t WriteResources (DataPackageStream *stream_p, const dav_resource *resource_p)
 {
-	json_t *resources_json_p = GetResources (resource_p);
+	apr_status_t status = APR_EGENERAL;
+	struct dav_resource_private *davrods_resource_p = (struct dav_resource_private *) resource_p -> info;
+	request_rec *req_p = davrods_resource_p -> r;
+	IRodsConfig irods_config;
 
-	if (resources_json_p)
+	if (InitIRodsConfig (&irods_config, resource_p) == APR_SUCCESS)
 		{
-			if (json_object_set_new (fd_p, "resources", resources_json_p) == 0)
+			ResourcesScan scan;
+
+			memset (&scan, 0, sizeof (ResourcesScan));
+			scan.rs_stream_p = stream_p;
+			scan.rs_davrods_resource_p = davrods_resource_p;
+
+			if (GetIRodsCredentialsForRequest (req_p, davrods_resource_p -> conf, &scan.rs_username_s, &scan.rs_password_s) != APR_SUCCESS)
 				{
-					return true;
+					scan.rs_username_s = NULL;
+					scan.rs_password_s = NULL;
 				}
 
-			json_decref (resources_json_p);
-		}
+			if (stream_p -> dps_partials_flag)
+				{
+					/*
+					 * Go through the collections, sending the resources for those that
+					 * haven't changed from disk and only generating them for the rest.
+					 * The tabular metadata is got for each of the changed ones instead.
+					 */
+					status = ForEachCollectionFingerprintInTree (davrods_resource_p -> rods_path, WriteCollectionResources, &scan, davrods_resource_p -> rods_conn, resource_p -> pool);
 
-	return false;
-}
+					if (status != APR_SUCCESS)
+						{
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to get the collections below \"%s\"", davrods_resource_p -> rods_path);
+						}
+				}
+			else
+				{
+					/*
+					 * Get the AVUs for all of the tabular schemas in the tree up front
+					 * rather than querying for each CSV and TSV file in turn.
+					 */
+					scan.rs_tabular_metadata_p = apr_hash_make (resource_p -> pool);
+
+					if (scan.rs_tabular_metadata_p)
+						{
+							status = GetDataObjectMetadataTablesForCollectionTree (davrods_resource_p -> rods_path, S_TABULAR_KEYS_CONDITION_S, scan.rs_tabular_metadata_p, davrods_resource_p -> rods_conn, resource_p -> pool);
+
+							if (status != APR_SUCCESS)
+								{
+									ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, status, req_p, "Failed to get the tabular metadata below \"%s\", getting it for each file instead", davrods_resource_p -> rods_path);
+									scan.rs_tabular_metadata_p = NULL;
+								}
+						}
+
+					status = ForEachDataObjectInCollectionTree (davrods_resource_p -> rods_path, AddResource, &scan, davrods_resource_p -> conf, scan.rs_username_s, scan.rs_password_s, davrods_resource_p -> rods_conn, resource_p -> pool);
+
+					if (status != APR_SUCCESS)
+						{
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to get the data objects below \"%s\"", davrods_resource_p -> rods_path);
+						}
+				}
 
+		}		/* if (InitIRodsConfig (&irods_config, resource_p) == APR_SUCCESS) */
+
+	return status;
+}
 
 
-static json_t *GetResources (const dav_resource *resource_p)
+/*
+ * Write the resources for the data objects directly within a collection,
+ * either from its partial results on disk if they were made for the same
+ * fingerprint or by generating them and storing them on disk for next time.
+ */
+static apr_status_t WriteCollectionResources (const char *collection_s, const char *fingerprint_s, void *data_p, apr_pool_t *pool_p)
 {
-	json_t *resources_json_p = NULL;
-	struct dav_resource_private *davrods_resource_p = (struct dav_resource_private *) resource_p -> info;
-	request_rec *req_p = davrods_resource_p -> r;
-	IRodsConfig irods_config;
+	ResourcesScan *scan_p = (ResourcesScan *) data_p;
+	DataPackageStream *stream_p = scan_p -> rs_stream_p;
+	struct dav_resource_private *davrods_resource_p = scan_p -> rs_davrods_resource_p;
+	apr_status_t status = APR_SUCCESS;
+	char *partial_path_s = GetDiskCachePath (davrods_resource_p, collection_s, pool_p);
 
-	if (InitIRodsConfig (&irods_config, resource_p) == APR_SUCCESS)
+	if (! (partial_path_s && SendPartialFromDisk (stream_p, partial_path_s, fingerprint_s, &status, pool_p)))
 		{
-			resources_json_p = json_array ();
+			CacheFile partial;
 
-			if (resources_json_p)
+			if (partial_path_s && OpenCacheFile (&partial, partial_path_s, fingerprint_s, pool_p))
 				{
-					collHandle_t collection_handle;
-					int status;
-
-					memset (&collection_handle, 0, sizeof (collHandle_t));
+					stream_p -> dps_partial_p = &partial;
+				}
 
-					// Open the collection
-					status = rclOpenCollection (davrods_resource_p -> rods_conn, davrods_resource_p -> rods_path, RECUR_QUERY_FG, &collection_handle);
+			scan_p -> rs_tabular_metadata_p = apr_hash_make (pool_p);
 
-					if (status >= 0)
+			if (scan_p -> rs_tabular_metadata_p)
+				{
+					if (GetDataObjectMetadataTablesForCollection (collection_s, S_TABULAR_KEYS_CONDITION_S, scan_p -> rs_tabular_metadata_p, davrods_resource_p -> rods_conn, pool_p) != APR_SUCCESS)
 						{
-							collEnt_t coll_entry;
+							scan_p -> rs_tabular_metadata_p = NULL;
+						}
+				}
 
-							memset (&coll_entry, 0, sizeof (collEnt_t));
+			status = ForEachDataObjectInCollection (collection_s, AddResource, scan_p, davrods_resource_p -> rods_conn, pool_p);
 
-							// Actually print the directory listing, one table row at a time.
-							do
-								{
-									status = rclReadCollection (davrods_resource_p -> rods_conn, &collection_handle, &coll_entry);
+			/* The hash was allocated from pool_p which is about to be cleared */
+			scan_p -> rs_tabular_metadata_p = NULL;
 
-									if (status >= 0)
-										{
-											/*
-											 * FD Data Packages don't appear to add the directory entries to the resources part.
-											 */
-											if (coll_entry.objType != COLL_OBJ_T) // || (strcmp (davrods_resource_p -> rods_path, coll_entry.collName) != 0))
-												{
-													/*
-													 * Add resource
-													 */
+			if (stream_p -> dps_partial_p)
+				{
+					CloseCacheFile (stream_p -> dps_partial_p, (status == APR_SUCCESS));
+					stream_p -> dps_partial_p = NULL;
+				}
+		}
 
-													if (!AddResource (&coll_entry, resources_json_p, davrods_resource_p, resource_p -> pool))
-														{
-															status = -1;
-														}
+	return status;
+}
 
-												}		/* if (strcmp (davrods_resource_p -> rods_path, coll_entry.collName) != 0) */
 
-										}		/* if (status >= 0) */
-									else if (status == CAT_NO_ROWS_FOUND)
-										{
-											// End of collection.
-										}
-									else
-										{
-											ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_EGENERAL,
-											               req_p,
-											               "rcReadCollection failed for collection <%s> with error <%s>",
-											               davrods_resource_p->rods_path, get_rods_error_msg (status));
-										}
-								}
-							while (status >= 0);
+/*
+ * The partial results hold the resources for a single collection with a
+ * separator before each of them, so that they can go anywhere within the
+ * resources array. This returns true if they were sent and false if they
+ * need generating, with status_p set if there was an error part way through.
+ */
+static bool SendPartialFromDisk (DataPackageStream *stream_p, const char *partial_path_s, const char *fingerprint_s, apr_status_t *status_p, apr_pool_t *pool_p)
+{
+	bool sent_flag = false;
+	apr_file_t *file_p = OpenCachedFile (partial_path_s, fingerprint_s, pool_p);
 
+	if (file_p)
+		{
+			char buffer [8192];
+			apr_size_t length = sizeof (buffer);
+			apr_status_t status = apr_file_read (file_p, buffer, &length);
 
-							rclCloseCollection (&collection_handle);
-						}		/* if (collection_handle >= 0) */
-					else
+			if (status == APR_SUCCESS)
+				{
+					/* The first resource in the package doesn't need the comma */
+					apr_size_t offset = ((! (stream_p -> dps_resources_flag)) && (length > 0) && (*buffer == ',')) ? 1 : 0;
+
+					stream_p -> dps_resources_flag = true;
+
+					while (status == APR_SUCCESS)
 						{
-							ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, req_p, "rcOpenCollection failed: %d = %s", status, get_rods_error_msg (status));
+							status = WriteToDataPackageStream (stream_p, buffer + offset, length - offset);
+
+							if (status == APR_SUCCESS)
+								{
+									offset = 0;
+									length = sizeof (buffer);
+									status = apr_file_read (file_p, buffer, &length);
+								}
 						}
 
-				}		/* if (resources_json_p) */
+					if (status == APR_EOF)
+						{
+							status = FlushDataPackageStream (stream_p);
+						}
+					else
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to send partial datapackage \"%s\"", partial_path_s);
+						}
 
-		}		/* if (SetIRodsConfig (&irods_config, exposed_root_s, davrods_root_path_s, metadata_link_s) == APR_SUCCESS) */
+					*status_p = status;
+					sent_flag = true;
+				}
 
+			/*
+			 * An empty file means that none of the collection's data
+			 * objects were added, e.g. just the datapackage.json.
+			 */
+			else if (status == APR_EOF)
+				{
+					sent_flag = true;
+				}
 
+			apr_file_close (file_p);
+		}
 
-	return resources_json_p;
+	return sent_flag;
 }
 
 
-static bool AddResource (collEnt_t * const entry_p, json_t *resources_p, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p)
+static apr_status_t AddResource (const IRodsObject *irods_obj_p, void *data_p, apr_pool_t *pool_p)
 {
-	json_t *resource_p = NULL;
+	ResourcesScan *scan_p = (ResourcesScan *) data_p;
+	DataPackageStream *stream_p = scan_p -> rs_stream_p;
+	apr_status_t status = APR_SUCCESS;
 
-	if (entry_p -> objType == DATA_OBJ_T)
-		{
-			resource_p = PopulateResourceFromDataObject (entry_p, davrods_resource_p, pool_p);
-		}
-	else if (entry_p -> objType == COLL_OBJ_T)
+	/*
+	 * Don't list the package in itself, which will be there if we are
+	 * saving it into iRODS as it is generated or replacing a stale copy.
+	 */
+	if (! ((strcmp (irods_obj_p -> io_data_s, S_DATA_PACKAGE_S) == 0) && (strcmp (irods_obj_p -> io_collection_s, scan_p -> rs_davrods_resource_p -> rods_path) == 0)))
 		{
-			resource_p = PopulateResourceFromCollection (entry_p, davrods_resource_p -> rods_conn, davrods_resource_p -> rods_root, pool_p);
-		}
+			json_t *resource_p = PopulateResourceFromDataObject (irods_obj_p, scan_p, pool_p);
 
-	if (resource_p)
-		{
-			if (json_array_append_new (resources_p, resource_p) == 0)
+			if (resource_p)
 				{
-					return true;
+					const char *separator_s = (stream_p -> dps_resources_flag) ? ",\n" : "\n";
+
+					/* The partial results always have the separator, see SendPartialFromDisk () */
+					if ((! (stream_p -> dps_resources_flag)) && (stream_p -> dps_partial_p))
+						{
+							WriteCacheFile (stream_p -> dps_partial_p, ",", 1);
+						}
+
+					status = WriteToDataPackageStream (stream_p, separator_s, strlen (separator_s));
+
+					if (status == APR_SUCCESS)
+						{
+							status = WriteIndentedJSON (stream_p, resource_p, "    ");
+						}
+
+					if (status == APR_SUCCESS)
+						{
+							stream_p -> dps_resources_flag = true;
+							++ (stream_p -> dps_num_resources);
+
+							if ((stream_p -> dps_num_resources % S_RESOURCES_PER_FLUSH) == 0)
+								{
+									status = FlushDataPackageStream (stream_p);
+								}
+						}
+
+					json_decref (resource_p);
 				}
 			else
 				{
-					json_decref (resource_p);
+					status = APR_ENOMEM;
 				}
 		}
 
-
-	return false;
+	return status;
 }
 
 
-static json_t *PopulateResourceFromDataObject (collEnt_t * const entry_p, struct dav_resource_private *davrods_resource_p, apr_pool_t *pool_p)
+static json_t *PopulateResourceFromDataObject (const IRodsObject *irods_obj_p, ResourcesScan *scan_p, apr_pool_t *pool_p)
 {
+	struct dav_resource_private *davrods_resource_p = scan_p -> rs_davrods_resource_p;
 	json_t *resource_p = json_object ();
 
 	if (resource_p)
 		{
-			if (json_object_set_new (resource_p, "bytes", json_integer (entry_p -> dataSize)) == 0)
+			if (json_object_set_new (resource_p, "bytes", json_integer (irods_obj_p -> io_size)) == 0)
 				{
-					const char *relative_collection_s = GetRelativePath (davrods_resource_p -> rods_root, entry_p -> collName, pool_p);
+					const char *relative_collection_s = GetRelativePath (davrods_resource_p -> rods_root, irods_obj_p -> io_collection_s, pool_p);
 					char *name_s = NULL;
 
-					if (strcmp (relative_collection_s, entry_p -> collName) == 0)
+					if (strcmp (relative_collection_s, irods_obj_p -> io_collection_s) == 0)
 						{
-							name_s = entry_p -> dataName;
+							name_s = apr_pstrdup (pool_p, irods_obj_p -> io_data_s);
 						}
 					else
 						{
-							name_s = apr_pstrcat (pool_p, relative_collection_s, "/",  entry_p -> dataName, NULL);
+							name_s = apr_pstrcat (pool_p, relative_collection_s, "/",  irods_obj_p -> io_data_s, NULL);
 						}
 
 
@@ -878,11 +1738,18 @@ static json_t *PopulateResourceFromDataObject (collEnt_t * const entry_p, struct
 
 							if (set_name_flag)
 								{
-									char *checksum_s = GetChecksum (entry_p, davrods_resource_p -> rods_conn, pool_p);
-
-									if (checksum_s)
+									/*
+									 * Only use a checksum that is already in the iCAT, any missing
+									 * ones are left out and calculated in the background for next
+									 * time rather than waiting for the server to read the whole file.
+									 */
+									if ((irods_obj_p -> io_checksum_s) && (* (irods_obj_p -> io_checksum_s) != '\0'))
 										{
-											SetJSONString (resource_p, "checksum", checksum_s, pool_p);
+											SetJSONString (resource_p, "checksum", irods_obj_p -> io_checksum_s, pool_p);
+										}
+									else if (scan_p -> rs_username_s)
+										{
+											QueueChecksum (apr_pstrcat (pool_p, irods_obj_p -> io_collection_s, "/", irods_obj_p -> io_data_s, NULL), davrods_resource_p -> conf, scan_p -> rs_username_s, scan_p -> rs_password_s);
 										}
 
 									/*
@@ -890,7 +1757,16 @@ static json_t *PopulateResourceFromDataObject (collEnt_t * const entry_p, struct
 									 */
 									if (IsTabularPackage (name_s))
 										{
-											apr_table_t *metadata_p = GetMetadataAsTable (davrods_resource_p -> rods_conn, DATA_OBJ_T, entry_p -> dataId, entry_p -> dataName, davrods_resource_p -> rods_env -> rodsZone, pool_p);
+											apr_table_t *metadata_p = NULL;
+
+											if (scan_p -> rs_tabular_metadata_p)
+												{
+													metadata_p = (apr_table_t *) apr_hash_get (scan_p -> rs_tabular_metadata_p, irods_obj_p -> io_id_s, APR_HASH_KEY_STRING);
+												}
+											else
+												{
+													metadata_p = GetMetadataAsTable (davrods_resource_p -> rods_conn, DATA_OBJ_T, irods_obj_p -> io_id_s, irods_obj_p -> io_data_s, davrods_resource_p -> rods_env -> rodsZone, pool_p);
+												}
 
 											if (metadata_p)
 												{
@@ -902,14 +1778,14 @@ static json_t *PopulateResourceFromDataObject (collEnt_t * const entry_p, struct
 																{
 																	if (!SetJSONString (resource_p, "profile", "tabular-data-resource", pool_p))
 																		{
-																			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to add \"profile\": \"tabular-data-resource\" to resource for \"%s\"", entry_p -> dataName);
+																			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to add \"profile\": \"tabular-data-resource\" to resource for \"%s\"", irods_obj_p -> io_data_s);
 																		}
 
 																}
 															else
 																{
 																	json_decref (schema_p);
-																	ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to add schema to resource for \"%s\"", entry_p -> dataName);
+																	ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to add schema to resource for \"%s\"", irods_obj_p -> io_data_s);
 																}
 														}
 												}
@@ -922,7 +1798,7 @@ static json_t *PopulateResourceFromDataObject (collEnt_t * const entry_p, struct
 
 						}		/* if (SetJSONString (resource_p, "path", name_s, pool_p)) */
 
-				}		/* if (json_object_set_new (resource_p, "bytes", json_integer (entry_p -> dataSize)) == 0) */
+				}		/* if (json_object_set_new (resource_p, "bytes", json_integer (irods_obj_p -> io_size)) == 0) */
 
 			json_decref (resource_p);
 		}		/* if (resource_p) */
@@ -973,46 +1849,6 @@ static const char *GetRelativePath (const char *data_package_root_path_s, const
 }
 
 
-static json_t *PopulateResourceFromCollection (collEnt_t * const entry_p, rcComm_t *connection_p, const char *data_package_root_path_s, apr_pool_t *pool_p)
-{
-	json_t *resource_p = json_object ();
-
-	if (resource_p)
-		{
-			//char *name_s = entry_p -> collName;
-			const char *name_s = GetRelativePath (data_package_root_path_s, entry_p -> collName, pool_p);
-
-			if (name_s)
-				{
-					if (*name_s == '/')
-						{
-							++ name_s;
-
-							if (*name_s == '\0')
-								{
-									name_s = NULL;
-								}
-						}
-				}
-
-			if (!name_s)
-				{
-					name_s = entry_p -> collName;
-				}
-
-			if (SetJSONString (resource_p, "name", name_s, pool_p))
-				{
-					return resource_p;
-				}
-
-			json_decref (resource_p);
-		}		/* if (resource_p) */
-
-	return NULL;
-}
-
-
-
 static bool AddLicense (json_t *resource_p, const char *name_s, const char *url_s, apr_pool_t *pool_p)
 {
 	json_t *licenses_array_p = json_array ();
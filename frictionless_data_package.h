@@ -45,6 +45,18 @@ char *GetFDDataPackageRequestCollectionPath (const char *request_uri_s, apr_pool
 
 bool DoesFDDataPackageExist (const dav_resource *resource_p);
 
+
+/**
+ * Check whether a datapackage.json that was saved by DavRodsFDSaveDataPackages
+ * is out of date, i.e. whether the data objects in its collection tree have
+ * changed since it was generated. This always returns <code>false</code> for
+ * any datapackage.json files that were put there by other means.
+ *
+ * @param resource_p The resource for the datapackage.json or for its collection.
+ * @return <code>true</code> if the saved copy needs to be generated again.
+ */
+bool IsSavedFDDataPackageStale (const dav_resource *resource_p);
+
 const char *GetDataPackageFilename (void);
 
 
@@ -21,6 +21,7 @@
  */
 
 
+
 #include "listing.h"
 
 #include "repo.h"
@@ -28,6 +29,9 @@
 #include "theme.h"
 #include "rest.h"
 #include "frictionless_data_package.h"
+#include "output_stream.h"
+#include "common.h"
+#include "query_utils.h"
 
 #include "apr_strings.h"
 #include "apr_time.h"
@@ -48,6 +52,21 @@ static bool SetStringValue (const char *src_s, char **dest_ss, apr_pool_t *pool_
 
 static int CompareIRodsObjectsDoublePointers (const void *a_p, const void *b_p);
 
+static int CompareListingEntriesByName (const void *a_p, const void *b_p);
+
+static int CompareListingEntriesBySize (const void *a_p, const void *b_p);
+
+static int CompareListingEntriesByDate (const void *a_p, const void *b_p);
+
+static int CompareListingEntriesByOwner (const void *a_p, const void *b_p);
+
+static void ReverseObjectPointers (apr_array_header_t *objects_p);
+
+static void SortListingObjects (apr_array_header_t *collections_p, apr_array_header_t *data_objects_p, const ListingPage *page_p);
+
+
+static const char * const S_LISTING_SORT_KEYS_SS [LSK_NUM_KEYS] = { "name", "size", "date", "owner" };
+
 
 
 void InitIRodsObject (IRodsObject *obj_p)
@@ -69,7 +88,7 @@ apr_status_t InitIRodsConfig (IRodsConfig *config_p, const dav_resource *resourc
 
 	if (SetIRodsConfig (config_p, exposed_root_s, davrods_root_path_s, metadata_link_s) == APR_SUCCESS)
 		{
-			status = APR_SUCCESS;
+			status = SetIRodsConfigEscapedRootPath (config_p, pool_p);
 		}
 	else
 		{
@@ -91,6 +110,25 @@ apr_status_t SetIRodsConfig (IRodsConfig *config_p, const char *exposed_root_s,
 	config_p -> ic_exposed_root_s = exposed_root_s;
 	config_p -> ic_root_path_s = root_path_s;
 	config_p -> ic_metadata_root_link_s = metadata_root_link_s;
+	config_p -> ic_escaped_root_path_s = NULL;
+
+	return status;
+}
+
+
+apr_status_t SetIRodsConfigEscapedRootPath (IRodsConfig *config_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	if (config_p -> ic_root_path_s)
+		{
+			config_p -> ic_escaped_root_path_s = ap_escape_html (pool_p, ap_escape_uri (pool_p, config_p -> ic_root_path_s));
+
+			if (! (config_p -> ic_escaped_root_path_s))
+				{
+					status = APR_ENOMEM;
+				}
+		}
 
 	return status;
 }
@@ -327,55 +365,45 @@ void FreeIRodsObjectNodeList (IRodsObjectNode *root_node_p)
 
 
 
-apr_status_t PrintIRodsObjectNodesToJSON (IRodsObjectNode *node_p, const IRodsConfig *config_p, request_rec *req_p)
+apr_status_t PrintIRodsObjectNodesToJSON (IRodsObjectNode *node_p, const IRodsConfig *config_p, const OutputFormat format, request_rec *req_p)
 {
-	apr_status_t status = APR_EGENERAL;
+	apr_status_t status = APR_ENOMEM;
 	apr_pool_t *pool_p = req_p -> pool;
+	OutputStream *stream_p = AllocateOutputStream (req_p, format);
 
-	json_t *values_p = json_array ();
-
-	if (values_p)
+	if (stream_p)
 		{
-			bool success_flag = true;
+			status = StartOutputStreamList (stream_p);
 
-			while (node_p && success_flag)
+			while (node_p && (status == APR_SUCCESS))
 				{
 					json_t *obj_json_p = GetIRodsObjectAsJSON (node_p -> ion_object_p, config_p, pool_p);
 
 					if (obj_json_p)
 						{
-							if (json_array_append_new (values_p, obj_json_p) == 0)
-								{
-									node_p = node_p -> ion_next_p;
-								}
-							else
-								{
-									success_flag = false;
-								}
+							status = WriteJSONToOutputStream (stream_p, obj_json_p);
+							json_decref (obj_json_p);
+
+							node_p = node_p -> ion_next_p;
 						}
 					else
 						{
-							success_flag = false;
+							status = APR_ENOMEM;
 						}
 				}
 
-			if (success_flag)
+			if (status == APR_SUCCESS)
 				{
-					char *data_s = json_dumps (values_p, JSON_INDENT (2));
-
-					if (data_s)
-						{
-							ap_rputs (data_s, req_p);
-							free (data_s);
-						}
+					status = EndOutputStreamList (stream_p);
 				}
 
-			json_decref (values_p);
-		}
-	else
-		{
+			if (status != APR_SUCCESS)
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_ERR, status, req_p, "Failed to print iRODS objects as JSON");
+				}
 
-		}
+			CloseOutputStream (stream_p);
+		}		/* if (stream_p) */
 
 	return status;
 }
@@ -441,6 +469,443 @@ static json_t *GetIRodsObjectAsJSON (const IRodsObject *irods_obj_p, const IRods
 }
 
 
+json_t *GetIRodsObjectListingAsJSON (const IRodsObject *irods_obj_p, const IRodsConfig *config_p, apr_pool_t *pool_p)
+{
+	json_t *irods_json_p = GetIRodsObjectAsJSON (irods_obj_p, config_p, pool_p);
+
+	if (irods_json_p)
+		{
+			const bool data_flag = (irods_obj_p -> io_obj_type == DATA_OBJ_T);
+			const char *name_s = GetIRodsObjectDisplayName (irods_obj_p);
+			int res = json_object_set_new (irods_json_p, "type", json_string (data_flag ? "data_object" : "collection"));
+
+			if ((res == 0) && name_s)
+				{
+					res = json_object_set_new (irods_json_p, "name", json_string (name_s));
+				}
+
+			if ((res == 0) && (irods_obj_p -> io_owner_name_s))
+				{
+					res = json_object_set_new (irods_json_p, "owner", json_string (irods_obj_p -> io_owner_name_s));
+				}
+
+			if ((res == 0) && (irods_obj_p -> io_last_modified_time_s))
+				{
+					/* Keep the raw time as the number of seconds since the epoch */
+					res = json_object_set_new (irods_json_p, "modified", json_integer (atoll (irods_obj_p -> io_last_modified_time_s)));
+				}
+
+			if (data_flag)
+				{
+					if (res == 0)
+						{
+							res = json_object_set_new (irods_json_p, "size", json_integer (irods_obj_p -> io_size));
+						}
+
+					if ((res == 0) && (irods_obj_p -> io_resource_s))
+						{
+							res = json_object_set_new (irods_json_p, "resource", json_string (irods_obj_p -> io_resource_s));
+						}
+
+					if ((res == 0) && (irods_obj_p -> io_checksum_s) && (* (irods_obj_p -> io_checksum_s) != '\0'))
+						{
+							res = json_object_set_new (irods_json_p, "checksum", json_string (irods_obj_p -> io_checksum_s));
+						}
+				}
+
+			if (res != 0)
+				{
+					ap_log_perror (APLOG_MARK, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to add listing details for \"%s\"", name_s ? name_s : "");
+					json_decref (irods_json_p);
+					irods_json_p = NULL;
+				}
+		}
+
+	return irods_json_p;
+}
+
+
+const char *GetListingSortKeyAsString (const ListingSortKey key)
+{
+	const char *key_s = NULL;
+
+	if ((key >= LSK_NAME) && (key < LSK_NUM_KEYS))
+		{
+			key_s = * (S_LISTING_SORT_KEYS_SS + key);
+		}
+
+	return key_s;
+}
+
+
+bool GetListingPageFromParameters (ListingPage *page_p, apr_table_t *params_p, const apr_size_t default_page_size, apr_pool_t *pool_p)
+{
+	const char *page_s = params_p ? GetParameterValue (params_p, "page", pool_p) : NULL;
+	const char *page_size_s = params_p ? GetParameterValue (params_p, "page_size", pool_p) : NULL;
+	const char *sort_s = params_p ? GetParameterValue (params_p, "sort", pool_p) : NULL;
+	const char *order_s = params_p ? GetParameterValue (params_p, "order", pool_p) : NULL;
+
+	memset (page_p, 0, sizeof (ListingPage));
+	page_p -> lp_sort_key = LSK_NAME;
+	page_p -> lp_page_size = default_page_size;
+
+	if (page_size_s)
+		{
+			apr_int64_t size = apr_atoi64 (page_size_s);
+
+			if (size > 0)
+				{
+					page_p -> lp_page_size = (size < LISTING_MAX_PAGE_SIZE) ? (apr_size_t) size : LISTING_MAX_PAGE_SIZE;
+				}
+		}
+
+	if (sort_s)
+		{
+			ListingSortKey key;
+
+			for (key = LSK_NAME; key < LSK_NUM_KEYS; ++ key)
+				{
+					if (strcmp (sort_s, * (S_LISTING_SORT_KEYS_SS + key)) == 0)
+						{
+							page_p -> lp_sort_key = key;
+							break;
+						}
+				}
+		}
+
+	if (order_s)
+		{
+			page_p -> lp_descending_flag = (strcmp (order_s, "desc") == 0);
+		}
+
+	/* If the client has asked for a page or a sort order, then page the listing */
+	if ((page_p -> lp_page_size == 0) && (page_s || page_size_s || sort_s || order_s))
+		{
+			page_p -> lp_page_size = LISTING_DEFAULT_PAGE_SIZE;
+		}
+
+	if (page_s && (page_p -> lp_page_size > 0))
+		{
+			page_p -> lp_page_index = GetListingPageIndex (apr_atoi64 (page_s), page_p -> lp_page_size);
+		}
+
+	return (page_p -> lp_page_size > 0);
+}
+
+
+apr_status_t GetCollectionListingPageInMemory (const char *collection_s, ListingPage *page_p, IRodsObjectNode **root_node_pp, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_EGENERAL;
+	collHandle_t collection_handle;
+	int rods_status;
+
+	/*
+	 * The replicas have to be kept if they are being filtered by resource
+	 * since the one that the iRODS client library would keep may not be on
+	 * any of the resources.
+	 */
+	int flags = DATA_QUERY_FIRST_FG | LONG_METADATA_FG;
+
+	if ((! (page_p -> lp_collapse_replicas_flag)) || (page_p -> lp_resources_ss))
+		{
+			flags |= NO_TRIM_REPL_FG;
+		}
+
+	*root_node_pp = NULL;
+	page_p -> lp_has_more_flag = false;
+
+	memset (&collection_handle, 0, sizeof (collHandle_t));
+
+	rods_status = rclOpenCollection (rods_connection_p, (char *) collection_s, flags, &collection_handle);
+
+	if (rods_status >= 0)
+		{
+			apr_pool_t *entries_pool_p = NULL;
+
+			/*
+			 * The entries are only needed until the page has been
+			 * copied out of them, so keep them in their own pool.
+			 */
+			status = apr_pool_create (&entries_pool_p, pool_p);
+
+			if (status == APR_SUCCESS)
+				{
+					apr_array_header_t *collections_p = apr_array_make (entries_pool_p, 64, sizeof (IRodsObject *));
+					apr_array_header_t *data_objects_p = apr_array_make (entries_pool_p, 256, sizeof (IRodsObject *));
+					apr_size_t num_entries = 0;
+					collEnt_t coll_entry;
+					const char *previous_data_id_s = NULL;
+
+					memset (&coll_entry, 0, sizeof (collEnt_t));
+
+					while ((status == APR_SUCCESS) && (num_entries < LISTING_MAX_IN_MEMORY_ENTRIES) && (rclReadCollection (rods_connection_p, &collection_handle, &coll_entry) >= 0))
+						{
+							bool add_flag = true;
+
+							if (coll_entry.objType == DATA_OBJ_T)
+								{
+									if ((page_p -> lp_resources_ss) && (!IsResourceInList (coll_entry.resource, page_p -> lp_resources_ss)))
+										{
+											add_flag = false;
+										}
+									else if ((page_p -> lp_collapse_replicas_flag) && IsReplicaOfPreviousDataObject (previous_data_id_s, coll_entry.dataId))
+										{
+											/* The replicas of a data object are read one after another */
+											add_flag = false;
+										}
+								}
+
+							if (add_flag)
+								{
+									IRodsObject *obj_p = (IRodsObject *) apr_palloc (entries_pool_p, sizeof (IRodsObject));
+
+									if (obj_p)
+										{
+											/*
+											 * Getting a collection's id needs a query of its own, so
+											 * leave it until we know which entries are on the page.
+											 */
+											const char *id_s = (coll_entry.objType == COLL_OBJ_T) ? "" : coll_entry.dataId;
+
+											status = SetIRodsObject (obj_p, coll_entry.objType, id_s, coll_entry.dataName, coll_entry.collName, coll_entry.ownerName, coll_entry.resource, coll_entry.modifyTime, coll_entry.dataSize, coll_entry.chksum, entries_pool_p);
+
+											if (status == APR_SUCCESS)
+												{
+													APR_ARRAY_PUSH ((coll_entry.objType == COLL_OBJ_T) ? collections_p : data_objects_p, IRodsObject *) = obj_p;
+													++ num_entries;
+
+													if (coll_entry.objType == DATA_OBJ_T)
+														{
+															previous_data_id_s = obj_p -> io_id_s;
+														}
+												}
+										}
+									else
+										{
+											status = APR_ENOMEM;
+										}
+								}		/* if (add_flag) */
+						}
+
+					if (num_entries == LISTING_MAX_IN_MEMORY_ENTRIES)
+						{
+							ap_log_perror (APLOG_MARK, APLOG_WARNING, APR_SUCCESS, pool_p, "Only the first %d entries of \"%s\" have been sorted", LISTING_MAX_IN_MEMORY_ENTRIES, collection_s);
+						}
+
+					if (status == APR_SUCCESS)
+						{
+							const apr_size_t num_collections = (apr_size_t) (collections_p -> nelts);
+							const apr_size_t num_objects = num_collections + (apr_size_t) (data_objects_p -> nelts);
+							apr_size_t start;
+							apr_size_t end;
+							IRodsObjectNode *current_node_p = NULL;
+							apr_size_t i;
+
+							page_p -> lp_has_more_flag = GetListingPageBounds (page_p -> lp_page_index, page_p -> lp_page_size, num_objects, &start, &end);
+
+							SortListingObjects (collections_p, data_objects_p, page_p);
+
+							for (i = start; (i < end) && (i < num_objects) && (status == APR_SUCCESS); ++ i)
+								{
+									const IRodsObject *obj_p = (i < num_collections) ? APR_ARRAY_IDX (collections_p, i, IRodsObject *) : APR_ARRAY_IDX (data_objects_p, i - num_collections, IRodsObject *);
+									const char *id_s = obj_p -> io_id_s;
+									IRodsObjectNode *node_p = NULL;
+
+									if (obj_p -> io_obj_type == COLL_OBJ_T)
+										{
+											id_s = GetCollectionId (obj_p -> io_collection_s, rods_connection_p, pool_p);
+										}
+
+									if (id_s)
+										{
+											node_p = AllocateIRodsObjectNode (obj_p -> io_obj_type, id_s, obj_p -> io_data_s, obj_p -> io_collection_s, obj_p -> io_owner_name_s, obj_p -> io_resource_s, obj_p -> io_last_modified_time_s, obj_p -> io_size, obj_p -> io_checksum_s, pool_p);
+										}
+
+									if (node_p)
+										{
+											if (current_node_p)
+												{
+													current_node_p -> ion_next_p = node_p;
+												}
+											else
+												{
+													*root_node_pp = node_p;
+												}
+
+											current_node_p = node_p;
+										}
+									else
+										{
+											status = APR_ENOMEM;
+										}
+								}
+						}		/* if (status == APR_SUCCESS) */
+
+					apr_pool_destroy (entries_pool_p);
+				}		/* if (status == APR_SUCCESS) */
+
+			rclCloseCollection (&collection_handle);
+		}		/* if (rods_status >= 0) */
+	else
+		{
+			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p, "rclOpenCollection failed for \"%s\": %d = %s", collection_s, rods_status, get_rods_error_msg (rods_status));
+		}
+
+	if ((status != APR_SUCCESS) && (*root_node_pp))
+		{
+			FreeIRodsObjectNodeList (*root_node_pp);
+			*root_node_pp = NULL;
+		}
+
+	return status;
+}
+
+
+apr_status_t GetListingPageFromNodes (IRodsObjectNode **root_node_pp, ListingPage *page_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	apr_array_header_t *collections_p = apr_array_make (pool_p, 64, sizeof (IRodsObject *));
+	apr_array_header_t *data_objects_p = apr_array_make (pool_p, 256, sizeof (IRodsObject *));
+	apr_array_header_t *nodes_p = apr_array_make (pool_p, 320, sizeof (IRodsObjectNode *));
+	apr_hash_t *data_ids_p = apr_hash_make (pool_p);
+
+	page_p -> lp_has_more_flag = false;
+
+	if (collections_p && data_objects_p && nodes_p && data_ids_p)
+		{
+			IRodsObjectNode *node_p = *root_node_pp;
+			IRodsObjectNode *current_node_p = NULL;
+			apr_size_t num_objects;
+			apr_size_t start;
+			apr_size_t end;
+			apr_size_t i;
+
+			/* Drop the entries that the paged listings from the iCAT would leave out */
+			while (node_p)
+				{
+					IRodsObjectNode *next_node_p = node_p -> ion_next_p;
+					IRodsObject *obj_p = node_p -> ion_object_p;
+					bool keep_flag = true;
+
+					if (obj_p -> io_obj_type == DATA_OBJ_T)
+						{
+							if ((page_p -> lp_resources_ss) && (!IsResourceInList (obj_p -> io_resource_s, page_p -> lp_resources_ss)))
+								{
+									keep_flag = false;
+								}
+							else if (page_p -> lp_collapse_replicas_flag)
+								{
+									if (apr_hash_get (data_ids_p, obj_p -> io_id_s, APR_HASH_KEY_STRING))
+										{
+											keep_flag = false;
+										}
+									else
+										{
+											apr_hash_set (data_ids_p, obj_p -> io_id_s, APR_HASH_KEY_STRING, obj_p);
+										}
+								}
+						}
+
+					if (keep_flag)
+						{
+							APR_ARRAY_PUSH ((obj_p -> io_obj_type == COLL_OBJ_T) ? collections_p : data_objects_p, IRodsObject *) = obj_p;
+							APR_ARRAY_PUSH (nodes_p, IRodsObjectNode *) = node_p;
+						}
+					else
+						{
+							FreeIRodsObjectNode (node_p);
+						}
+
+					node_p = next_node_p;
+				}		/* while (node_p) */
+
+			SortListingObjects (collections_p, data_objects_p, page_p);
+
+			num_objects = (apr_size_t) (nodes_p -> nelts);
+			page_p -> lp_has_more_flag = GetListingPageBounds (page_p -> lp_page_index, page_p -> lp_page_size, num_objects, &start, &end);
+			*root_node_pp = NULL;
+
+			/*
+			 * The nodes only hold the objects, so rather than sorting the nodes
+			 * themselves, give them the sorted objects in turn and then keep
+			 * the ones on the page.
+			 */
+			for (i = 0; i < num_objects; ++ i)
+				{
+					const apr_size_t num_collections = (apr_size_t) (collections_p -> nelts);
+
+					node_p = APR_ARRAY_IDX (nodes_p, i, IRodsObjectNode *);
+					node_p -> ion_object_p = (i < num_collections) ? APR_ARRAY_IDX (collections_p, i, IRodsObject *) : APR_ARRAY_IDX (data_objects_p, i - num_collections, IRodsObject *);
+					node_p -> ion_next_p = NULL;
+
+					if ((i >= start) && (i < end))
+						{
+							if (current_node_p)
+								{
+									current_node_p -> ion_next_p = node_p;
+								}
+							else
+								{
+									*root_node_pp = node_p;
+								}
+
+							current_node_p = node_p;
+						}
+					else
+						{
+							FreeIRodsObjectNode (node_p);
+						}
+				}
+
+			status = APR_SUCCESS;
+		}
+	else
+		{
+			FreeIRodsObjectNodeList (*root_node_pp);
+			*root_node_pp = NULL;
+		}
+
+	return status;
+}
+
+
+/*
+ * Sort the collections and data objects of a listing into the order given
+ * by the page. The collections are always listed before the data objects.
+ */
+static void SortListingObjects (apr_array_header_t *collections_p, apr_array_header_t *data_objects_p, const ListingPage *page_p)
+{
+	int (*compare_fn) (const void *a_p, const void *b_p) = CompareListingEntriesByName;
+
+	switch (page_p -> lp_sort_key)
+		{
+			case LSK_SIZE:
+				compare_fn = CompareListingEntriesBySize;
+				break;
+
+			case LSK_DATE:
+				compare_fn = CompareListingEntriesByDate;
+				break;
+
+			case LSK_OWNER:
+				compare_fn = CompareListingEntriesByOwner;
+				break;
+
+			default:
+				break;
+		}
+
+	qsort (collections_p -> elts, collections_p -> nelts, sizeof (IRodsObject *), compare_fn);
+	qsort (data_objects_p -> elts, data_objects_p -> nelts, sizeof (IRodsObject *), compare_fn);
+
+	if (page_p -> lp_descending_flag)
+		{
+			ReverseObjectPointers (collections_p);
+			ReverseObjectPointers (data_objects_p);
+		}
+}
+
+
 apr_status_t SetIRodsObject (IRodsObject *obj_p, const objType_t obj_type, const char *id_s, const char *data_s, const char *collection_s, const char *owner_name_s, const char *resource_s, const char *last_modified_time_s, const rodsLong_t size, const char *md5_s, apr_pool_t *pool_p)
 {
 	apr_status_t status = APR_ENOMEM;
@@ -453,6 +918,8 @@ apr_status_t SetIRodsObject (IRodsObject *obj_p, const objType_t obj_type, const
 	 */
 	char *prefix_s = apr_itoa (pool_p, obj_type);
 
+	obj_p -> io_checksum_pending_flag = false;
+
 	if (prefix_s)
 		{
 			char *major_id_s = apr_pstrcat (pool_p, prefix_s, ".", NULL);
@@ -488,6 +955,7 @@ apr_status_t SetIRodsObject (IRodsObject *obj_p, const objType_t obj_type, const
 																{
 																	obj_p -> io_obj_type = obj_type;
 																	obj_p -> io_size = size;
+																	obj_p -> io_metadata_p = NULL;
 
 																	status = APR_SUCCESS;
 																}		/* if (SetStringValue (md5_s, & (obj_p -> io_md5_s), pool_p)) */
@@ -745,6 +1213,29 @@ const char *GetIRodsObjectIcon (const IRodsObject *irods_obj_p, const struct Htm
 }
 
 
+bool IsResourceInList (const char *resource_s, char **resources_ss)
+{
+	bool found_flag = false;
+
+	if (resource_s)
+		{
+			while ((*resources_ss) && (!found_flag))
+				{
+					if (strcmp (resource_s, *resources_ss) == 0)
+						{
+							found_flag = true;
+						}
+					else
+						{
+							++ resources_ss;
+						}
+				}
+		}
+
+	return found_flag;
+}
+
+
 const char *GetIRodsObjectAltText (const IRodsObject *irods_obj_p)
 {
 	const char *alt_s = NULL;
@@ -777,7 +1268,7 @@ char *GetIRodsObjectRelativeLink (const IRodsObject *irods_obj_p, const IRodsCon
 
 			if (strncmp (config_p -> ic_exposed_root_s, irods_obj_p -> io_collection_s, l) == 0)
 				{
-					char *escaped_uri_root_s = ap_escape_html (pool_p, ap_escape_uri (pool_p, config_p -> ic_root_path_s));
+					const char *escaped_uri_root_s = (config_p -> ic_escaped_root_path_s) ? config_p -> ic_escaped_root_path_s : ap_escape_html (pool_p, ap_escape_uri (pool_p, config_p -> ic_root_path_s));
 					char *escaped_relative_collection_s = ap_escape_html (pool_p, ap_escape_uri (pool_p, (irods_obj_p -> io_collection_s) + l));
 					const char *separator_s = "";
 
@@ -898,7 +1389,12 @@ char *GetIRodsObjectLastModifiedTime (const  IRodsObject *irods_obj_p, apr_pool_
 apr_status_t GetAndPrintMetadataForIRodsObject (const IRodsObject *irods_obj_p, const char * const api_root_url_s, const char *zone_s, const struct HtmlTheme * const theme_p, apr_bucket_brigade *bb_p, rcComm_t *connection_p, request_rec *req_p, apr_pool_t *pool_p)
 {
 	apr_status_t status = APR_SUCCESS;
-	apr_array_header_t *metadata_array_p = GetMetadataAsArray (connection_p, irods_obj_p -> io_obj_type, irods_obj_p -> io_id_s, irods_obj_p -> io_collection_s, zone_s, pool_p);
+	apr_array_header_t *metadata_array_p = irods_obj_p -> io_metadata_p;
+
+	if (!metadata_array_p)
+		{
+			metadata_array_p = GetMetadataAsArray (connection_p, irods_obj_p -> io_obj_type, irods_obj_p -> io_id_s, irods_obj_p -> io_collection_s, zone_s, pool_p);
+		}
 
 	apr_brigade_puts (bb_p, NULL, NULL, "<td class=\"metatable\"><div class=\"metadata_toolbar\"\n");
 
@@ -1158,6 +1654,109 @@ static int CompareIRodsObjectsDoublePointers (const void *a_p, const void *b_p)
 }
 
 
+/*
+ * The listing comparators are only used on entries of the same type so
+ * for collections the full path orders them the same as their names.
+ */
+static int CompareListingEntriesByName (const void *a_p, const void *b_p)
+{
+	const IRodsObject *obj_a_p = * ((const IRodsObject **) a_p);
+	const IRodsObject *obj_b_p = * ((const IRodsObject **) b_p);
+	int res = strcmp (obj_a_p -> io_collection_s, obj_b_p -> io_collection_s);
+
+	if ((res == 0) && (obj_a_p -> io_data_s) && (obj_b_p -> io_data_s))
+		{
+			res = strcmp (obj_a_p -> io_data_s, obj_b_p -> io_data_s);
+		}
+
+	return res;
+}
+
+
+static int CompareListingEntriesBySize (const void *a_p, const void *b_p)
+{
+	const IRodsObject *obj_a_p = * ((const IRodsObject **) a_p);
+	const IRodsObject *obj_b_p = * ((const IRodsObject **) b_p);
+	int res = 0;
+
+	if (obj_a_p -> io_size < obj_b_p -> io_size)
+		{
+			res = -1;
+		}
+	else if (obj_a_p -> io_size > obj_b_p -> io_size)
+		{
+			res = 1;
+		}
+	else
+		{
+			res = CompareListingEntriesByName (a_p, b_p);
+		}
+
+	return res;
+}
+
+
+static int CompareListingEntriesByDate (const void *a_p, const void *b_p)
+{
+	const IRodsObject *obj_a_p = * ((const IRodsObject **) a_p);
+	const IRodsObject *obj_b_p = * ((const IRodsObject **) b_p);
+	const long long time_a = obj_a_p -> io_last_modified_time_s ? atoll (obj_a_p -> io_last_modified_time_s) : 0;
+	const long long time_b = obj_b_p -> io_last_modified_time_s ? atoll (obj_b_p -> io_last_modified_time_s) : 0;
+	int res = 0;
+
+	if (time_a < time_b)
+		{
+			res = -1;
+		}
+	else if (time_a > time_b)
+		{
+			res = 1;
+		}
+	else
+		{
+			res = CompareListingEntriesByName (a_p, b_p);
+		}
+
+	return res;
+}
+
+
+static int CompareListingEntriesByOwner (const void *a_p, const void *b_p)
+{
+	const IRodsObject *obj_a_p = * ((const IRodsObject **) a_p);
+	const IRodsObject *obj_b_p = * ((const IRodsObject **) b_p);
+	int res = strcmp (obj_a_p -> io_owner_name_s ? obj_a_p -> io_owner_name_s : "", obj_b_p -> io_owner_name_s ? obj_b_p -> io_owner_name_s : "");
+
+	if (res == 0)
+		{
+			res = CompareListingEntriesByName (a_p, b_p);
+		}
+
+	return res;
+}
+
+
+static void ReverseObjectPointers (apr_array_header_t *objects_p)
+{
+	if (objects_p -> nelts > 1)
+		{
+			IRodsObject **start_pp = (IRodsObject **) (objects_p -> elts);
+			IRodsObject **end_pp = start_pp + objects_p -> nelts - 1;
+
+			while (start_pp < end_pp)
+				{
+					IRodsObject *obj_p = *start_pp;
+
+					*start_pp = *end_pp;
+					*end_pp = obj_p;
+
+					++ start_pp;
+					-- end_pp;
+				}
+		}
+}
+
+
 static void PrintCollEntry (const collEnt_t *coll_entry_p, apr_pool_t *pool_p)
 {
 	ap_log_perror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, pool_p, "\n=====================\n");
@@ -24,14 +24,19 @@
 
 typedef unsigned int uint;
 #include <sys/types.h>
+#include <stdbool.h>
 
 #include "irods/rodsType.h"
 #include "irods/miscUtil.h"
 
 #include "apr_pools.h"
 #include "apr_buckets.h"
+#include "apr_tables.h"
+
+#include "jansson.h"
 
 #include "config.h"
+#include "output_format.h"
 
 /* Forward declaration */
 struct HtmlTheme;
@@ -48,6 +53,19 @@ typedef struct IRodsObject
 	char *io_last_modified_time_s;
 	char *io_checksum_s;
 	rodsLong_t io_size;
+
+	/*
+	 * Set if a data object without a checksum has had it queued to be
+	 * calculated in the background, so it is shown as pending rather
+	 * than missing.
+	 */
+	bool io_checksum_pending_flag;
+
+	/*
+	 * The sorted IrodsMetadata AVUs if they have already been fetched
+	 * along with the listing, otherwise NULL.
+	 */
+	apr_array_header_t *io_metadata_p;
 } IRodsObject;
 
 
@@ -71,6 +89,70 @@ typedef struct IRodsObjectList
 
 
 
+/**
+ * The page size used for a paged listing when the
+ * client asks for one without giving a size.
+ */
+#define LISTING_DEFAULT_PAGE_SIZE (100)
+
+
+/**
+ * The largest number of entries that a client can
+ * ask for in a single page of a listing.
+ */
+#define LISTING_MAX_PAGE_SIZE (10000)
+
+
+/**
+ * The most entries of a collection that will be read
+ * into memory when a sorted page can't be got from the iCAT.
+ */
+#define LISTING_MAX_IN_MEMORY_ENTRIES (50000)
+
+
+/**
+ * The values that a collection listing can be sorted on.
+ */
+typedef enum ListingSortKey
+{
+	LSK_NAME,
+	LSK_SIZE,
+	LSK_DATE,
+	LSK_OWNER,
+	LSK_NUM_KEYS
+} ListingSortKey;
+
+
+/**
+ * A single page of a sorted collection listing.
+ * Collections are always listed before data objects.
+ */
+typedef struct ListingPage
+{
+	ListingSortKey lp_sort_key;
+
+	bool lp_descending_flag;
+
+	/** The 0-based index of the page */
+	apr_size_t lp_page_index;
+
+	apr_size_t lp_page_size;
+
+	/** Set once the page has been got if there are further entries after it */
+	bool lp_has_more_flag;
+
+	/**
+	 * If this is not NULL, it is a NULL-terminated list of resources and
+	 * only the data objects with a replica on one of them are listed.
+	 */
+	char **lp_resources_ss;
+
+	/** List each data object once rather than once for each of its replicas */
+	bool lp_collapse_replicas_flag;
+} ListingPage;
+
+
+
 typedef struct IRodsConfig
 {
 	const char *ic_exposed_root_s;
@@ -78,6 +160,12 @@ typedef struct IRodsConfig
 	const char *ic_root_path_s;
 
 	const char *ic_metadata_root_link_s;
+
+	/**
+	 * ic_root_path_s escaped for use in links. If this is NULL, it is
+	 * escaped each time that a link is made.
+	 */
+	const char *ic_escaped_root_path_s;
 } IRodsConfig;
 
 
@@ -98,6 +186,17 @@ apr_status_t SetIRodsConfig (IRodsConfig *config_p, const char *exposed_root_s,
 apr_status_t InitIRodsConfig (IRodsConfig *config_p, const dav_resource *resource_p);
 
 
+/**
+ * Escape the root path of an IRodsConfig once so that it can be reused
+ * for the links of every object in a listing.
+ *
+ * @param config_p The IRodsConfig to update.
+ * @param pool_p The memory pool to allocate the escaped path from.
+ * @return APR_SUCCESS upon success or APR_ENOMEM upon failure.
+ */
+apr_status_t SetIRodsConfigEscapedRootPath (IRodsConfig *config_p, apr_pool_t *pool_p);
+
+
 apr_status_t SetIRodsObject (IRodsObject *obj_p, const objType_t obj_type, const char *id_s, const char *data_s, const char *collection_s, const char *owner_name_s, const char *resource_s, const char *last_modified_time_s, const rodsLong_t size, const char *md5_s, apr_pool_t *pool_p);
 
 
@@ -156,6 +255,16 @@ const char *GetIRodsObjectIconForExtension (const char *extension_s, const struc
 const char *GetIRodsObjectAltText (const IRodsObject *irods_obj_p);
 
 
+/**
+ * Check whether a resource is in a list of resources.
+ *
+ * @param resource_s The resource to look for. This can be <code>NULL</code>.
+ * @param resources_ss The NULL-terminated list of resources.
+ * @return <code>true</code> if the resource is in the list, <code>false</code> otherwise.
+ */
+bool IsResourceInList (const char *resource_s, char **resources_ss);
+
+
 /**
  * Get the relative link to access an IRodsObject.
  *
@@ -205,7 +314,89 @@ rodsObjStat_t *GetObjectStat (const char * const path_s, rcComm_t *connection_p,
 char *GetIRodsObjectFullPath (const IRodsObject *obj_p, apr_pool_t *pool_p);
 
 
-apr_status_t PrintIRodsObjectNodesToJSON (IRodsObjectNode *node_p, const IRodsConfig *config_p, request_rec *req_p);
+/**
+ * Stream a list of iRODS objects to the client as each one is converted
+ * to JSON, rather than building the whole response first.
+ *
+ * @param node_p The first node of the list of objects to print.
+ * @param config_p The configuration used to build the links for each object.
+ * @param format Either OF_JSON for a JSON array or OF_JSON_LINES for a JSON
+ * object on each line.
+ * @param req_p The request to send the objects to.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t PrintIRodsObjectNodesToJSON (IRodsObjectNode *node_p, const IRodsConfig *config_p, const OutputFormat format, request_rec *req_p);
+
+
+/**
+ * Get the JSON representation of an iRODS object for a collection listing.
+ * As well as the "path" and "id" used by PrintIRodsObjectNodesToJSON, this
+ * has the "name", "type", "owner", "modified" time and, for data objects,
+ * the "size", "resource" and "checksum".
+ *
+ * @param irods_obj_p The object to convert.
+ * @param config_p The configuration used to build the link for the object.
+ * @param pool_p The memory pool to use.
+ * @return The JSON object or <code>NULL</code> upon error. The caller is
+ * responsible for calling json_decref() on this.
+ */
+json_t *GetIRodsObjectListingAsJSON (const IRodsObject *irods_obj_p, const IRodsConfig *config_p, apr_pool_t *pool_p);
+
+
+/**
+ * Fill in a ListingPage from the "page", "page_size", "sort" and "order"
+ * parameters of a request. "page" starts at 1, "sort" is one of "name",
+ * "size", "date" or "owner" and "order" is either "asc" or "desc".
+ *
+ * @param page_p The ListingPage to fill in.
+ * @param params_p The request parameters. This can be <code>NULL</code>.
+ * @param default_page_size The page size to use if the request doesn't
+ * have one. If this is 0, then paging is only used if any of the parameters
+ * have been given.
+ * @param pool_p The memory pool to use.
+ * @return <code>true</code> if the listing should be paged, <code>false</code>
+ * if the whole listing should be used. The page is clamped so that all of
+ * its rows can be addressed by the iCAT's int row offsets, and any page
+ * past the end of the listing is empty.
+ */
+bool GetListingPageFromParameters (ListingPage *page_p, apr_table_t *params_p, const apr_size_t default_page_size, apr_pool_t *pool_p);
+
+
+const char *GetListingSortKeyAsString (const ListingSortKey key);
+
+
+/**
+ * Get a page of a collection listing by reading the collection and sorting
+ * it in memory. This is used when the page can't be got directly from the
+ * iCAT and only the first LISTING_MAX_IN_MEMORY_ENTRIES entries of the
+ * collection are sorted.
+ *
+ * @param collection_s The path of the collection to list.
+ * @param page_p The page to get. Its lp_has_more_flag will be set.
+ * @param root_node_pp Where the list of objects will be stored. This will
+ * be <code>NULL</code> if the page is empty.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to use.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t GetCollectionListingPageInMemory (const char *collection_s, ListingPage *page_p, IRodsObjectNode **root_node_pp, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+
+/**
+ * Cut a single sorted page out of a whole collection listing that has
+ * already been got, such as from a specific query. The data objects that
+ * the page's resources and replica settings leave out are dropped first,
+ * as GetCollectionListingPage() would.
+ *
+ * @param root_node_pp The list of the collection's entries. This will be
+ * replaced by the entries on the page and the other nodes are freed. It
+ * will be <code>NULL</code> if the page is empty.
+ * @param page_p The page to get. Its lp_has_more_flag will be set.
+ * @param pool_p The memory pool to use.
+ * @return APR_SUCCESS upon success or an APR error code upon failure, in
+ * which case the whole list will have been freed.
+ */
+apr_status_t GetListingPageFromNodes (IRodsObjectNode **root_node_pp, ListingPage *page_p, apr_pool_t *pool_p);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,772 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * listing_cache.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apr_file_info.h"
+#include "apr_file_io.h"
+#include "apr_md5.h"
+#include "apr_strings.h"
+#include "apr_time.h"
+
+#include "http_log.h"
+
+#include "listing_cache.h"
+#include "lru_cache.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+/*
+ * Each entry is allocated with malloc rather than from a pool since
+ * entries are added and removed independently of each other for the
+ * lifetime of the child process.
+ */
+typedef struct ListingCacheEntry
+{
+	char *lce_data_s;
+	apr_size_t lce_length;
+
+	/*
+	 * The modify time of the matching file in the cache directory, which
+	 * is set to when it expires. If the file has gone or been replaced
+	 * by another child, this entry is out of date.
+	 */
+	apr_time_t lce_file_mtime;
+} ListingCacheEntry;
+
+
+struct ListingCapture
+{
+	const char *lc_key_s;
+	char *lc_data_s;
+	apr_size_t lc_length;
+	apr_size_t lc_capacity;
+	bool lc_valid_flag;
+};
+
+
+/*
+ * STATIC VARIABLES
+ */
+
+/* The listings keyed by GetListingCacheKey (), limited by their number of bytes */
+static LRUCache *s_cache_p = NULL;
+
+/*
+ * The directory that the listings are shared between all of the child
+ * processes in, or NULL to keep them in each child's memory alone.
+ */
+static const char *s_cache_dir_s = NULL;
+
+/* The lifetime of a cache entry in seconds, 0 turns the cache off */
+static int s_cache_ttl = 0;
+
+static apr_size_t s_cache_max_bytes = 32 * 1024 * 1024;
+
+/* A single listing can use at most this fraction of the cache */
+static const apr_size_t S_MAX_ENTRY_FRACTION = 4;
+
+static const apr_size_t S_INITIAL_CAPTURE_SIZE = 16384;
+
+
+/*
+ * STATIC DECLARATIONS
+ */
+
+static void FreeListingCacheEntry (void *data_p);
+
+static bool ReserveCaptureSpace (ListingCapture *capture_p, const apr_size_t length);
+
+static void AddEntryToCache (const char *key_s, char *data_s, const apr_size_t length, const apr_time_t expiry_time, const apr_time_t file_mtime);
+
+static char *GetMD5Digest (const char *value_s, const apr_size_t length, apr_pool_t *pool_p);
+
+static char *GetCollectionCacheDir (const char *collection_s, const apr_size_t length, apr_pool_t *pool_p);
+
+static char *GetListingCacheFile (const char *key_s, const char **dir_ss, apr_pool_t *pool_p);
+
+static char *ReadListingFromDisk (const char *key_s, const char *path_s, apr_size_t *length_p, apr_time_t *mtime_p, apr_pool_t *pool_p);
+
+static apr_status_t WriteListingToDisk (const char *key_s, const char *data_s, const apr_size_t length, const apr_time_t expiry_time, apr_time_t *mtime_p, apr_pool_t *pool_p);
+
+static void RemoveListingsFromDisk (const char *dir_s, const bool expired_only_flag, apr_pool_t *pool_p);
+
+static apr_status_t ClearListingCache (void *data_p);
+
+
+/*
+ * API DEFINITIONS
+ */
+
+apr_status_t InitListingCache (apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	s_cache_p = AllocateLRUCache (s_cache_max_bytes, FreeListingCacheEntry, pool_p);
+
+	if (s_cache_p)
+		{
+			/* This runs before the cleanup of s_cache_p since it is registered after it */
+			apr_pool_cleanup_register (pool_p, NULL, ClearListingCache, apr_pool_cleanup_null);
+		}
+	else
+		{
+			status = APR_ENOMEM;
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to create listing cache");
+		}
+
+	return status;
+}
+
+
+bool IsListingCacheEnabled (void)
+{
+	return (s_cache_p && (s_cache_ttl > 0));
+}
+
+
+char *GetListingCacheKey (const char *collection_s, const char *location_s, const char *modify_time_s, const char *contents_modify_time_s, const char *username_s, const unsigned int theme_hash, const char *page_s, apr_pool_t *pool_p)
+{
+	char *key_s = NULL;
+
+	if (IsListingCacheEnabled () && collection_s && modify_time_s && contents_modify_time_s && username_s)
+		{
+			/*
+			 * Start with the collection so that all of its entries
+			 * can be found by InvalidateCachedListingsForObject.
+			 */
+			key_s = apr_psprintf (pool_p, "%s\n%s\n%s\n%s\n%s\n%x\n%s", collection_s, location_s ? location_s : "", modify_time_s, contents_modify_time_s, username_s, theme_hash, page_s ? page_s : "");
+		}
+
+	return key_s;
+}
+
+
+char *GetCachedListing (const char *key_s, apr_size_t *length_p, apr_pool_t *pool_p)
+{
+	char *data_s = NULL;
+
+	if (s_cache_p && key_s)
+		{
+			apr_time_t expiry_time = 0;
+			apr_time_t file_mtime = 0;
+			ListingCacheEntry *entry_p;
+
+			LockLRUCache (s_cache_p);
+
+			entry_p = (ListingCacheEntry *) FindLRUCacheValue (s_cache_p, key_s, &expiry_time);
+
+			if (entry_p)
+				{
+					if (expiry_time > apr_time_now ())
+						{
+							data_s = (char *) apr_pmemdup (pool_p, entry_p -> lce_data_s, entry_p -> lce_length);
+
+							if (data_s)
+								{
+									*length_p = entry_p -> lce_length;
+									file_mtime = entry_p -> lce_file_mtime;
+								}
+						}
+					else
+						{
+							RemoveLRUCacheValue (s_cache_p, key_s);
+						}
+				}
+
+			UnlockLRUCache (s_cache_p);
+
+			if (s_cache_dir_s)
+				{
+					const char *path_s = GetListingCacheFile (key_s, NULL, pool_p);
+
+					if (path_s)
+						{
+							if (data_s)
+								{
+									apr_finfo_t finfo;
+
+									/*
+									 * Another child may have invalidated or replaced
+									 * the listing since we kept our copy of it.
+									 */
+									if ((apr_stat (&finfo, path_s, APR_FINFO_MTIME, pool_p) != APR_SUCCESS) || (finfo.mtime != file_mtime))
+										{
+											data_s = NULL;
+
+											LockLRUCache (s_cache_p);
+											RemoveLRUCacheValue (s_cache_p, key_s);
+											UnlockLRUCache (s_cache_p);
+										}
+								}
+
+							if (!data_s)
+								{
+									data_s = ReadListingFromDisk (key_s, path_s, length_p, &file_mtime, pool_p);
+
+									if (data_s)
+										{
+											char *copy_s = (char *) malloc (*length_p);
+
+											if (copy_s)
+												{
+													memcpy (copy_s, data_s, *length_p);
+
+													/* The file's modify time is when it expires */
+													AddEntryToCache (key_s, copy_s, *length_p, file_mtime, file_mtime);
+												}
+										}
+								}
+						}
+					else
+						{
+							data_s = NULL;
+						}
+				}		/* if (s_cache_dir_s) */
+
+		}		/* if (s_cache_p && key_s) */
+
+	return data_s;
+}
+
+
+ListingCapture *StartListingCapture (const char *key_s, apr_pool_t *pool_p)
+{
+	ListingCapture *capture_p = NULL;
+
+	if (IsListingCacheEnabled () && key_s)
+		{
+			capture_p = (ListingCapture *) apr_pcalloc (pool_p, sizeof (ListingCapture));
+
+			if (capture_p)
+				{
+					capture_p -> lc_key_s = key_s;
+					capture_p -> lc_valid_flag = true;
+				}
+		}
+
+	return capture_p;
+}
+
+
+void CaptureListingRows (ListingCapture *capture_p, apr_bucket_brigade *bb_p)
+{
+	if (capture_p && (capture_p -> lc_valid_flag))
+		{
+			apr_off_t length = 0;
+
+			if (apr_brigade_length (bb_p, 1, &length) == APR_SUCCESS)
+				{
+					if (length > 0)
+						{
+							if (ReserveCaptureSpace (capture_p, (apr_size_t) length))
+								{
+									apr_size_t num_bytes = (apr_size_t) length;
+
+									if (apr_brigade_flatten (bb_p, capture_p -> lc_data_s + capture_p -> lc_length, &num_bytes) == APR_SUCCESS)
+										{
+											capture_p -> lc_length += num_bytes;
+										}
+									else
+										{
+											capture_p -> lc_valid_flag = false;
+										}
+								}
+						}
+				}
+			else
+				{
+					capture_p -> lc_valid_flag = false;
+				}
+
+			if (! (capture_p -> lc_valid_flag))
+				{
+					free (capture_p -> lc_data_s);
+					capture_p -> lc_data_s = NULL;
+					capture_p -> lc_length = 0;
+					capture_p -> lc_capacity = 0;
+				}
+		}
+}
+
+
+void CaptureListingData (ListingCapture *capture_p, const char *data_s, const apr_size_t length)
+{
+	if (capture_p && (capture_p -> lc_valid_flag) && (length > 0))
+		{
+			if (ReserveCaptureSpace (capture_p, length))
+				{
+					memcpy (capture_p -> lc_data_s + capture_p -> lc_length, data_s, length);
+					capture_p -> lc_length += length;
+				}
+			else
+				{
+					free (capture_p -> lc_data_s);
+					capture_p -> lc_data_s = NULL;
+					capture_p -> lc_length = 0;
+					capture_p -> lc_capacity = 0;
+				}
+		}
+}
+
+
+void FinishListingCapture (ListingCapture *capture_p, const bool store_flag, apr_pool_t *pool_p)
+{
+	if (capture_p)
+		{
+			if (store_flag && (capture_p -> lc_valid_flag) && s_cache_p)
+				{
+					apr_time_t expiry_time = apr_time_now () + apr_time_from_sec (s_cache_ttl);
+					apr_time_t file_mtime = 0;
+					bool store_in_memory_flag = true;
+
+					if (s_cache_dir_s)
+						{
+							store_in_memory_flag = (WriteListingToDisk (capture_p -> lc_key_s, capture_p -> lc_data_s, capture_p -> lc_length, expiry_time, &file_mtime, pool_p) == APR_SUCCESS);
+							expiry_time = file_mtime;
+						}
+
+					if (store_in_memory_flag)
+						{
+							/* The entry takes over the captured rows */
+							AddEntryToCache (capture_p -> lc_key_s, capture_p -> lc_data_s, capture_p -> lc_length, expiry_time, file_mtime);
+							capture_p -> lc_data_s = NULL;
+						}
+				}
+
+			free (capture_p -> lc_data_s);
+			capture_p -> lc_data_s = NULL;
+			capture_p -> lc_valid_flag = false;
+		}
+}
+
+
+void InvalidateCachedListingsForObject (const char *path_s, apr_pool_t *pool_p)
+{
+	if (s_cache_p && path_s)
+		{
+			const char *last_slash_s = strrchr (path_s, '/');
+
+			if (last_slash_s)
+				{
+					const size_t parent_length = (last_slash_s == path_s) ? 1 : (size_t) (last_slash_s - path_s);
+
+					/* The keys start with the collection followed by a newline */
+					char *prefix_s = apr_pstrcat (pool_p, apr_pstrmemdup (pool_p, path_s, parent_length), "\n", NULL);
+
+					if (prefix_s)
+						{
+							LockLRUCache (s_cache_p);
+							RemoveLRUCacheValuesWithPrefix (s_cache_p, prefix_s);
+							UnlockLRUCache (s_cache_p);
+						}
+
+					if (s_cache_dir_s)
+						{
+							/* This is what makes the other children drop their copies too */
+							const char *dir_s = GetCollectionCacheDir (path_s, parent_length, pool_p);
+
+							if (dir_s)
+								{
+									RemoveListingsFromDisk (dir_s, false, pool_p);
+								}
+						}
+				}
+		}
+}
+
+
+const char *SetListingCacheTTL (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *error_s = NULL;
+	apr_int64_t ttl = apr_atoi64 (arg_p);
+
+	if ((ttl >= 0) && (ttl <= INT_MAX))
+		{
+			s_cache_ttl = (int) ttl;
+		}
+	else
+		{
+			error_s = "The listing cache TTL must be a number of seconds, or 0 to turn the cache off";
+		}
+
+	return error_s;
+}
+
+
+const char *SetListingCacheSize (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *error_s = NULL;
+	apr_int64_t size = apr_atoi64 (arg_p);
+
+	if (size > 0)
+		{
+			s_cache_max_bytes = (apr_size_t) size;
+		}
+	else
+		{
+			error_s = "The listing cache size must be a number of bytes greater than zero";
+		}
+
+	return error_s;
+}
+
+
+const char *SetListingCacheDir (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	s_cache_dir_s = arg_p;
+
+	return NULL;
+}
+
+
+/*
+ * STATIC DEFINITIONS
+ */
+
+static void FreeListingCacheEntry (void *data_p)
+{
+	ListingCacheEntry *entry_p = (ListingCacheEntry *) data_p;
+
+	free (entry_p -> lce_data_s);
+	free (entry_p);
+}
+
+
+/*
+ * Add a listing to this child's memory, taking over data_s, which
+ * must have been allocated with malloc.
+ */
+/*
+ * Make room for length more bytes in a capture. If the listing would grow
+ * larger than an entry can be, or the memory can't be allocated, the
+ * capture is marked as invalid.
+ */
+static bool ReserveCaptureSpace (ListingCapture *capture_p, const apr_size_t length)
+{
+	const apr_size_t max_length = s_cache_max_bytes / S_MAX_ENTRY_FRACTION;
+	const apr_size_t new_length = capture_p -> lc_length + length;
+
+	if (new_length <= max_length)
+		{
+			if (new_length > capture_p -> lc_capacity)
+				{
+					apr_size_t capacity = (capture_p -> lc_capacity > 0) ? capture_p -> lc_capacity : S_INITIAL_CAPTURE_SIZE;
+					char *data_s;
+
+					while (capacity < new_length)
+						{
+							capacity <<= 1;
+						}
+
+					if (capacity > max_length)
+						{
+							capacity = max_length;
+						}
+
+					data_s = (char *) realloc (capture_p -> lc_data_s, capacity);
+
+					if (data_s)
+						{
+							capture_p -> lc_data_s = data_s;
+							capture_p -> lc_capacity = capacity;
+						}
+					else
+						{
+							capture_p -> lc_valid_flag = false;
+						}
+				}
+		}
+	else
+		{
+			/* The listing is too large to cache */
+			capture_p -> lc_valid_flag = false;
+		}
+
+	return capture_p -> lc_valid_flag;
+}
+
+
+static void AddEntryToCache (const char *key_s, char *data_s, const apr_size_t length, const apr_time_t expiry_time, const apr_time_t file_mtime)
+{
+	ListingCacheEntry *entry_p = (ListingCacheEntry *) calloc (1, sizeof (ListingCacheEntry));
+	bool added_flag = false;
+
+	if (entry_p)
+		{
+			entry_p -> lce_data_s = data_s;
+			entry_p -> lce_length = length;
+			entry_p -> lce_file_mtime = file_mtime;
+
+			LockLRUCache (s_cache_p);
+			added_flag = AddLRUCacheValue (s_cache_p, key_s, entry_p, length, expiry_time);
+			UnlockLRUCache (s_cache_p);
+
+			if (!added_flag)
+				{
+					free (entry_p);
+				}
+		}
+
+	if (!added_flag)
+		{
+			free (data_s);
+		}
+}
+
+
+static char *GetMD5Digest (const char *value_s, const apr_size_t length, apr_pool_t *pool_p)
+{
+	char *digest_s = NULL;
+	unsigned char digest [APR_MD5_DIGESTSIZE];
+
+	if (apr_md5 (digest, value_s, length) == APR_SUCCESS)
+		{
+			digest_s = (char *) apr_palloc (pool_p, (APR_MD5_DIGESTSIZE * 2) + 1);
+
+			if (digest_s)
+				{
+					size_t i;
+
+					for (i = 0; i < APR_MD5_DIGESTSIZE; ++ i)
+						{
+							apr_snprintf (digest_s + (i * 2), 3, "%02x", digest [i]);
+						}
+				}
+		}
+
+	return digest_s;
+}
+
+
+/*
+ * Each collection has its own subdirectory so that all of its listings
+ * can be removed without going through those of every other collection.
+ */
+static char *GetCollectionCacheDir (const char *collection_s, const apr_size_t length, apr_pool_t *pool_p)
+{
+	char *dir_s = NULL;
+	char *digest_s = GetMD5Digest (collection_s, length, pool_p);
+
+	if (digest_s)
+		{
+			dir_s = apr_pstrcat (pool_p, s_cache_dir_s, "/", digest_s, NULL);
+		}
+
+	return dir_s;
+}
+
+
+static char *GetListingCacheFile (const char *key_s, const char **dir_ss, apr_pool_t *pool_p)
+{
+	char *path_s = NULL;
+	const char *newline_s = strchr (key_s, '\n');
+
+	if (newline_s)
+		{
+			const char *dir_s = GetCollectionCacheDir (key_s, newline_s - key_s, pool_p);
+
+			if (dir_s)
+				{
+					char *digest_s = GetMD5Digest (key_s, strlen (key_s), pool_p);
+
+					if (digest_s)
+						{
+							path_s = apr_pstrcat (pool_p, dir_s, "/", digest_s, NULL);
+
+							if (dir_ss)
+								{
+									*dir_ss = dir_s;
+								}
+						}
+				}
+		}
+
+	return path_s;
+}
+
+
+/*
+ * The files start with the whole key and its terminator, in case two keys
+ * have the same digest, followed by the listing itself. The modify time
+ * of each file is set to when it expires.
+ */
+static char *ReadListingFromDisk (const char *key_s, const char *path_s, apr_size_t *length_p, apr_time_t *mtime_p, apr_pool_t *pool_p)
+{
+	char *data_s = NULL;
+	apr_finfo_t finfo;
+
+	if (apr_stat (&finfo, path_s, APR_FINFO_MTIME | APR_FINFO_SIZE, pool_p) == APR_SUCCESS)
+		{
+			const apr_size_t key_length = strlen (key_s) + 1;
+
+			if ((finfo.mtime > apr_time_now ()) && (finfo.size > (apr_off_t) key_length) && ((apr_size_t) finfo.size <= key_length + (s_cache_max_bytes / S_MAX_ENTRY_FRACTION)))
+				{
+					apr_file_t *file_p = NULL;
+
+					if (apr_file_open (&file_p, path_s, APR_FOPEN_READ | APR_FOPEN_BINARY, APR_FPROT_OS_DEFAULT, pool_p) == APR_SUCCESS)
+						{
+							const apr_size_t file_length = (apr_size_t) finfo.size;
+							char *buffer_s = (char *) apr_palloc (pool_p, file_length);
+
+							if (buffer_s)
+								{
+									apr_size_t num_read = 0;
+
+									if ((apr_file_read_full (file_p, buffer_s, file_length, &num_read) == APR_SUCCESS) && (memcmp (buffer_s, key_s, key_length) == 0))
+										{
+											data_s = buffer_s + key_length;
+											*length_p = file_length - key_length;
+											*mtime_p = finfo.mtime;
+										}
+								}
+
+							apr_file_close (file_p);
+						}
+				}
+		}
+
+	return data_s;
+}
+
+
+/*
+ * The listing is written to a temporary file that is renamed once it is
+ * complete, so that other children never read a partial listing.
+ */
+static apr_status_t WriteListingToDisk (const char *key_s, const char *data_s, const apr_size_t length, const apr_time_t expiry_time, apr_time_t *mtime_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	const char *dir_s = NULL;
+	const char *path_s = GetListingCacheFile (key_s, &dir_s, pool_p);
+
+	if (path_s)
+		{
+			status = apr_dir_make_recursive (dir_s, APR_FPROT_OS_DEFAULT, pool_p);
+
+			if (status == APR_SUCCESS)
+				{
+					/* The temporary files start with a dot so that RemoveListingsFromDisk () leaves them alone */
+					char *temp_path_s = apr_pstrcat (pool_p, dir_s, "/.XXXXXX", NULL);
+					apr_file_t *file_p = NULL;
+
+					/* Tidy up the expired listings for the collection whilst we are here */
+					RemoveListingsFromDisk (dir_s, true, pool_p);
+
+					status = temp_path_s ? apr_file_mktemp (&file_p, temp_path_s, APR_FOPEN_CREATE | APR_FOPEN_WRITE | APR_FOPEN_EXCL | APR_FOPEN_BINARY, pool_p) : APR_ENOMEM;
+
+					if (status == APR_SUCCESS)
+						{
+							apr_size_t num_written = 0;
+
+							status = apr_file_write_full (file_p, key_s, strlen (key_s) + 1, &num_written);
+
+							if ((status == APR_SUCCESS) && (length > 0))
+								{
+									status = apr_file_write_full (file_p, data_s, length, &num_written);
+								}
+
+							apr_file_close (file_p);
+
+							if (status == APR_SUCCESS)
+								{
+									status = apr_file_mtime_set (temp_path_s, expiry_time, pool_p);
+								}
+
+							if (status == APR_SUCCESS)
+								{
+									status = apr_file_rename (temp_path_s, path_s, pool_p);
+								}
+
+							if (status == APR_SUCCESS)
+								{
+									apr_finfo_t finfo;
+
+									/* The file system may not keep the time to the microsecond */
+									status = apr_stat (&finfo, path_s, APR_FINFO_MTIME, pool_p);
+
+									if (status == APR_SUCCESS)
+										{
+											*mtime_p = finfo.mtime;
+										}
+								}
+							else
+								{
+									apr_file_remove (temp_path_s, pool_p);
+								}
+						}
+				}
+
+			if (status != APR_SUCCESS)
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, status, pool_p, "Failed to write cached listing to \"%s\"", path_s);
+				}
+		}
+
+	return status;
+}
+
+
+static void RemoveListingsFromDisk (const char *dir_s, const bool expired_only_flag, apr_pool_t *pool_p)
+{
+	apr_dir_t *dir_p = NULL;
+
+	if (apr_dir_open (&dir_p, dir_s, pool_p) == APR_SUCCESS)
+		{
+			const apr_time_t now = apr_time_now ();
+			const apr_int32_t wanted = APR_FINFO_NAME | APR_FINFO_TYPE | APR_FINFO_MTIME;
+			apr_finfo_t finfo;
+			apr_status_t status = apr_dir_read (&finfo, wanted, dir_p);
+
+			/* Some platforms can't fill in everything that we asked for from a directory entry */
+			while ((status == APR_SUCCESS) || (APR_STATUS_IS_INCOMPLETE (status)))
+				{
+					if (((finfo.valid & wanted) == wanted) && (finfo.filetype == APR_REG) && (* (finfo.name) != '.') && ((!expired_only_flag) || (finfo.mtime <= now)))
+						{
+							const char *path_s = apr_pstrcat (pool_p, dir_s, "/", finfo.name, NULL);
+
+							if (path_s)
+								{
+									/* Another child may have already removed it */
+									apr_file_remove (path_s, pool_p);
+								}
+						}
+
+					status = apr_dir_read (&finfo, wanted, dir_p);
+				}
+
+			apr_dir_close (dir_p);
+		}
+}
+
+
+static apr_status_t ClearListingCache (void *data_p)
+{
+	/* The listings themselves are freed by the cleanup of s_cache_p */
+	s_cache_p = NULL;
+
+	return APR_SUCCESS;
+}
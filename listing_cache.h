@@ -0,0 +1,171 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * listing_cache.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef LISTING_CACHE_H_
+#define LISTING_CACHE_H_
+
+#include <stdbool.h>
+
+#include "apr_pools.h"
+#include "apr_buckets.h"
+
+#include "httpd.h"
+#include "http_config.h"
+
+
+/**
+ * The rendered rows of a themed listing that are being
+ * collected as they are sent so that they can be cached.
+ */
+typedef struct ListingCapture ListingCapture;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create the per-child cache of rendered listings. This should be called
+ * once from the child_init hook. If DavRodsListingCacheDir is set, the
+ * listings are also kept on disk where every child can use them and the
+ * per-child copies are checked against these before they are used.
+ *
+ * @param pool_p The child's memory pool. The cache will be cleaned up
+ * when this pool is destroyed.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t InitListingCache (apr_pool_t *pool_p);
+
+
+/**
+ * Check whether the listing cache is turned on, so that the values for
+ * its keys only need getting when they will be used.
+ *
+ * @return <code>true</code> if the cache is turned on, <code>false</code> otherwise.
+ */
+bool IsListingCacheEnabled (void);
+
+
+/**
+ * Get the key for a rendered listing.
+ *
+ * @param collection_s The path of the collection.
+ * @param location_s The path that the listing is being served from, since this
+ * is used in the links for each row.
+ * @param modify_time_s The collection's modify time. Adding, removing or
+ * renaming anything in the collection updates this so older entries are
+ * never matched.
+ * @param contents_modify_time_s The newest modify time of the data objects
+ * in the collection, from GetCollectionContentsModifyTime(). This catches
+ * the data objects that are overwritten in place, which doesn't change the
+ * collection's own modify time.
+ * @param username_s The iRODS user that the listing is for.
+ * @param theme_hash A hash of the theme settings used for the rows.
+ * @param page_s The page of the listing, including its size and sort order,
+ * or <code>NULL</code> for a whole listing.
+ * @param pool_p The memory pool to allocate the key from.
+ * @return The key or <code>NULL</code> if the cache is turned off or upon error.
+ */
+char *GetListingCacheKey (const char *collection_s, const char *location_s, const char *modify_time_s, const char *contents_modify_time_s, const char *username_s, const unsigned int theme_hash, const char *page_s, apr_pool_t *pool_p);
+
+
+/**
+ * Get a copy of the cached rows for a listing.
+ *
+ * @param key_s The key from GetListingCacheKey().
+ * @param length_p Where the length of the rows will be stored.
+ * @param pool_p The memory pool to copy the rows into.
+ * @return The rows or <code>NULL</code> if there is no valid cached entry.
+ */
+char *GetCachedListing (const char *key_s, apr_size_t *length_p, apr_pool_t *pool_p);
+
+
+/**
+ * Start collecting the rows of a listing as they are sent.
+ *
+ * @param key_s The key from GetListingCacheKey().
+ * @param pool_p The memory pool to allocate the capture from.
+ * @return The capture or <code>NULL</code> if the cache is turned off.
+ */
+ListingCapture *StartListingCapture (const char *key_s, apr_pool_t *pool_p);
+
+
+/**
+ * Add the contents of a bucket brigade to a capture. This must be called
+ * before each time that the brigade is sent.
+ *
+ * If the listing grows larger than an entry can be, the capture is
+ * abandoned and the listing won't be cached.
+ *
+ * @param capture_p The capture. This can be <code>NULL</code>.
+ * @param bb_p The brigade of rows that is about to be sent.
+ */
+void CaptureListingRows (ListingCapture *capture_p, apr_bucket_brigade *bb_p);
+
+
+/**
+ * Add some data that isn't sent to the client to the end of a capture,
+ * e.g. the details needed to print a paged listing's links on a later request.
+ *
+ * @param capture_p The capture. This can be <code>NULL</code>.
+ * @param data_s The data to add.
+ * @param length The number of bytes to add.
+ */
+void CaptureListingData (ListingCapture *capture_p, const char *data_s, const apr_size_t length);
+
+
+/**
+ * Finish a capture and free its memory.
+ *
+ * @param capture_p The capture. This can be <code>NULL</code>.
+ * @param store_flag <code>true</code> to add the collected rows to the cache,
+ * <code>false</code> to throw them away, e.g. if the listing failed part way through.
+ * @param pool_p A memory pool for any temporary allocations.
+ */
+void FinishListingCapture (ListingCapture *capture_p, const bool store_flag, apr_pool_t *pool_p);
+
+
+/**
+ * Remove the cached listings for the collection that holds an iRODS object.
+ * This is used when the object's metadata has been changed, since that
+ * doesn't change the modify time of the collection.
+ *
+ * @param path_s The full path of the data object or collection that has changed.
+ * @param pool_p A memory pool for any temporary allocations.
+ */
+void InvalidateCachedListingsForObject (const char *path_s, apr_pool_t *pool_p);
+
+
+const char *SetListingCacheTTL (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetListingCacheSize (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetListingCacheDir (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LISTING_CACHE_H_ */
@@ -0,0 +1,350 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * lru_cache.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "apr_hash.h"
+
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
+
+#include "http_log.h"
+
+#include "lru_cache.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+/*
+ * Each entry is allocated with malloc rather than from a pool since
+ * entries are added and removed independently of each other for the
+ * lifetime of the child process.
+ */
+typedef struct LRUCacheEntry
+{
+	char *lce_key_s;
+	void *lce_value_p;
+	apr_size_t lce_size;
+	apr_time_t lce_expiry_time;
+
+	/* The more and less recently used entries */
+	struct LRUCacheEntry *lce_prev_p;
+	struct LRUCacheEntry *lce_next_p;
+} LRUCacheEntry;
+
+
+struct LRUCache
+{
+	apr_hash_t *lc_entries_p;
+
+	/* The most and least recently used entries */
+	LRUCacheEntry *lc_newest_entry_p;
+	LRUCacheEntry *lc_oldest_entry_p;
+
+	apr_size_t lc_size;
+	apr_size_t lc_max_size;
+
+	void (*lc_free_value_fn) (void *value_p);
+
+	#if APR_HAS_THREADS
+	apr_thread_mutex_t *lc_mutex_p;
+	#endif
+};
+
+
+/*
+ * STATIC DECLARATIONS
+ */
+
+static void UnlinkEntry (LRUCache *cache_p, LRUCacheEntry *entry_p);
+
+static void LinkEntryAsNewest (LRUCache *cache_p, LRUCacheEntry *entry_p);
+
+static void RemoveEntry (LRUCache *cache_p, LRUCacheEntry *entry_p);
+
+static apr_status_t ClearLRUCache (void *data_p);
+
+
+/*
+ * API DEFINITIONS
+ */
+
+LRUCache *AllocateLRUCache (const apr_size_t max_size, void (*free_value_fn) (void *value_p), apr_pool_t *pool_p)
+{
+	LRUCache *cache_p = (LRUCache *) apr_pcalloc (pool_p, sizeof (LRUCache));
+
+	if (cache_p)
+		{
+			cache_p -> lc_entries_p = apr_hash_make (pool_p);
+
+			if (cache_p -> lc_entries_p)
+				{
+					apr_status_t status = APR_SUCCESS;
+
+					cache_p -> lc_max_size = max_size;
+					cache_p -> lc_free_value_fn = free_value_fn;
+
+					#if APR_HAS_THREADS
+					status = apr_thread_mutex_create (& (cache_p -> lc_mutex_p), APR_THREAD_MUTEX_DEFAULT, pool_p);
+
+					if (status != APR_SUCCESS)
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to create cache mutex");
+						}
+					#endif
+
+					if (status == APR_SUCCESS)
+						{
+							apr_pool_cleanup_register (pool_p, cache_p, ClearLRUCache, apr_pool_cleanup_null);
+						}
+					else
+						{
+							cache_p = NULL;
+						}
+				}
+			else
+				{
+					cache_p = NULL;
+				}
+		}
+
+	return cache_p;
+}
+
+
+void LockLRUCache (LRUCache *cache_p)
+{
+	#if APR_HAS_THREADS
+	if (cache_p -> lc_mutex_p)
+		{
+			apr_thread_mutex_lock (cache_p -> lc_mutex_p);
+		}
+	#endif
+}
+
+
+void UnlockLRUCache (LRUCache *cache_p)
+{
+	#if APR_HAS_THREADS
+	if (cache_p -> lc_mutex_p)
+		{
+			apr_thread_mutex_unlock (cache_p -> lc_mutex_p);
+		}
+	#endif
+}
+
+
+void *FindLRUCacheValue (LRUCache *cache_p, const char *key_s, apr_time_t *expiry_time_p)
+{
+	void *value_p = NULL;
+	LRUCacheEntry *entry_p = (LRUCacheEntry *) apr_hash_get (cache_p -> lc_entries_p, key_s, APR_HASH_KEY_STRING);
+
+	if (entry_p)
+		{
+			value_p = entry_p -> lce_value_p;
+
+			if (expiry_time_p)
+				{
+					*expiry_time_p = entry_p -> lce_expiry_time;
+				}
+
+			UnlinkEntry (cache_p, entry_p);
+			LinkEntryAsNewest (cache_p, entry_p);
+		}
+
+	return value_p;
+}
+
+
+bool AddLRUCacheValue (LRUCache *cache_p, const char *key_s, void *value_p, const apr_size_t size, const apr_time_t expiry_time)
+{
+	bool added_flag = false;
+
+	if (size <= cache_p -> lc_max_size)
+		{
+			LRUCacheEntry *entry_p = (LRUCacheEntry *) calloc (1, sizeof (LRUCacheEntry));
+
+			if (entry_p)
+				{
+					entry_p -> lce_key_s = strdup (key_s);
+
+					if (entry_p -> lce_key_s)
+						{
+							LRUCacheEntry *old_entry_p = (LRUCacheEntry *) apr_hash_get (cache_p -> lc_entries_p, key_s, APR_HASH_KEY_STRING);
+
+							if (old_entry_p)
+								{
+									RemoveEntry (cache_p, old_entry_p);
+								}
+
+							while (cache_p -> lc_oldest_entry_p && (cache_p -> lc_size + size > cache_p -> lc_max_size))
+								{
+									RemoveEntry (cache_p, cache_p -> lc_oldest_entry_p);
+								}
+
+							entry_p -> lce_value_p = value_p;
+							entry_p -> lce_size = size;
+							entry_p -> lce_expiry_time = expiry_time;
+
+							apr_hash_set (cache_p -> lc_entries_p, entry_p -> lce_key_s, APR_HASH_KEY_STRING, entry_p);
+							LinkEntryAsNewest (cache_p, entry_p);
+
+							cache_p -> lc_size += size;
+							added_flag = true;
+						}
+					else
+						{
+							free (entry_p);
+						}
+				}
+		}
+
+	return added_flag;
+}
+
+
+bool SetLRUCacheValueExpiryTime (LRUCache *cache_p, const char *key_s, const apr_time_t expiry_time)
+{
+	LRUCacheEntry *entry_p = (LRUCacheEntry *) apr_hash_get (cache_p -> lc_entries_p, key_s, APR_HASH_KEY_STRING);
+
+	if (entry_p)
+		{
+			entry_p -> lce_expiry_time = expiry_time;
+		}
+
+	return (entry_p != NULL);
+}
+
+
+void RemoveLRUCacheValue (LRUCache *cache_p, const char *key_s)
+{
+	LRUCacheEntry *entry_p = (LRUCacheEntry *) apr_hash_get (cache_p -> lc_entries_p, key_s, APR_HASH_KEY_STRING);
+
+	if (entry_p)
+		{
+			RemoveEntry (cache_p, entry_p);
+		}
+}
+
+
+void RemoveLRUCacheValuesWithPrefix (LRUCache *cache_p, const char *prefix_s)
+{
+	const size_t prefix_length = strlen (prefix_s);
+	apr_hash_index_t *index_p;
+
+	/*
+	 * Deleting the entry for the current iterator is safe with apr_hash.
+	 */
+	for (index_p = apr_hash_first (NULL, cache_p -> lc_entries_p); index_p; index_p = apr_hash_next (index_p))
+		{
+			LRUCacheEntry *entry_p = (LRUCacheEntry *) apr_hash_this_val (index_p);
+
+			if (strncmp (entry_p -> lce_key_s, prefix_s, prefix_length) == 0)
+				{
+					RemoveEntry (cache_p, entry_p);
+				}
+		}
+}
+
+
+/*
+ * STATIC DEFINITIONS
+ */
+
+static void UnlinkEntry (LRUCache *cache_p, LRUCacheEntry *entry_p)
+{
+	if (entry_p -> lce_prev_p)
+		{
+			entry_p -> lce_prev_p -> lce_next_p = entry_p -> lce_next_p;
+		}
+	else
+		{
+			cache_p -> lc_newest_entry_p = entry_p -> lce_next_p;
+		}
+
+	if (entry_p -> lce_next_p)
+		{
+			entry_p -> lce_next_p -> lce_prev_p = entry_p -> lce_prev_p;
+		}
+	else
+		{
+			cache_p -> lc_oldest_entry_p = entry_p -> lce_prev_p;
+		}
+
+	entry_p -> lce_prev_p = NULL;
+	entry_p -> lce_next_p = NULL;
+}
+
+
+static void LinkEntryAsNewest (LRUCache *cache_p, LRUCacheEntry *entry_p)
+{
+	entry_p -> lce_prev_p = NULL;
+	entry_p -> lce_next_p = cache_p -> lc_newest_entry_p;
+
+	if (cache_p -> lc_newest_entry_p)
+		{
+			cache_p -> lc_newest_entry_p -> lce_prev_p = entry_p;
+		}
+	else
+		{
+			cache_p -> lc_oldest_entry_p = entry_p;
+		}
+
+	cache_p -> lc_newest_entry_p = entry_p;
+}
+
+
+static void RemoveEntry (LRUCache *cache_p, LRUCacheEntry *entry_p)
+{
+	apr_hash_set (cache_p -> lc_entries_p, entry_p -> lce_key_s, APR_HASH_KEY_STRING, NULL);
+	UnlinkEntry (cache_p, entry_p);
+
+	cache_p -> lc_size -= entry_p -> lce_size;
+
+	if (cache_p -> lc_free_value_fn)
+		{
+			cache_p -> lc_free_value_fn (entry_p -> lce_value_p);
+		}
+
+	free (entry_p -> lce_key_s);
+	free (entry_p);
+}
+
+
+static apr_status_t ClearLRUCache (void *data_p)
+{
+	LRUCache *cache_p = (LRUCache *) data_p;
+
+	while (cache_p -> lc_oldest_entry_p)
+		{
+			RemoveEntry (cache_p, cache_p -> lc_oldest_entry_p);
+		}
+
+	#if APR_HAS_THREADS
+	cache_p -> lc_mutex_p = NULL;
+	#endif
+
+	return APR_SUCCESS;
+}
@@ -0,0 +1,148 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * lru_cache.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef LRU_CACHE_H_
+#define LRU_CACHE_H_
+
+#include <stdbool.h>
+
+#include "apr_pools.h"
+#include "apr_time.h"
+
+
+/**
+ * A cache of values keyed by strings that removes the least recently
+ * used values once the total size of its values goes over its limit.
+ * The values are allocated by the caller, with malloc or similar, and
+ * the cache takes them over and frees them with its free function.
+ *
+ * The size of each value is whatever the caller wants to limit, e.g.
+ * its number of bytes or 1 to limit the number of values.
+ *
+ * None of the functions lock the cache themselves, apart from
+ * AllocateLRUCache() and the cleanup of its pool, so the caller must
+ * hold the lock, using LockLRUCache() and UnlockLRUCache(), around
+ * each use of the cache.
+ */
+typedef struct LRUCache LRUCache;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create a cache.
+ *
+ * @param max_size The largest total size of the values in the cache.
+ * @param free_value_fn The function used to free each value when it is
+ * removed from the cache.
+ * @param pool_p The memory pool to allocate the cache from. All of the
+ * values are freed when this pool is cleaned up.
+ * @return The cache or <code>NULL</code> upon error.
+ */
+LRUCache *AllocateLRUCache (const apr_size_t max_size, void (*free_value_fn) (void *value_p), apr_pool_t *pool_p);
+
+
+/**
+ * Lock a cache so that the calling thread can use it.
+ *
+ * @param cache_p The cache.
+ */
+void LockLRUCache (LRUCache *cache_p);
+
+
+/**
+ * Unlock a cache that was locked with LockLRUCache().
+ *
+ * @param cache_p The cache.
+ */
+void UnlockLRUCache (LRUCache *cache_p);
+
+
+/**
+ * Find a value in the cache and mark it as the most recently used.
+ *
+ * @param cache_p The cache.
+ * @param key_s The key of the value.
+ * @param expiry_time_p If this is not <code>NULL</code> and the value is
+ * found, its expiry time will be stored here. The cache doesn't remove
+ * values that have expired when they are found, so that the caller can
+ * still use them if it wants to, e.g. to revalidate them.
+ * @return The value or <code>NULL</code> if it is not in the cache.
+ */
+void *FindLRUCacheValue (LRUCache *cache_p, const char *key_s, apr_time_t *expiry_time_p);
+
+
+/**
+ * Add a value to the cache as the most recently used one, replacing any
+ * existing value for the same key. The least recently used values are
+ * removed until there is room for it.
+ *
+ * @param cache_p The cache.
+ * @param key_s The key of the value. The cache makes its own copy of this.
+ * @param value_p The value. The cache takes this over if it is added.
+ * @param size The size of the value.
+ * @param expiry_time The time when the value expires.
+ * @return <code>true</code> if the value was added, <code>false</code> if
+ * it is larger than the whole cache or upon error, in which case the
+ * caller still owns the value.
+ */
+bool AddLRUCacheValue (LRUCache *cache_p, const char *key_s, void *value_p, const apr_size_t size, const apr_time_t expiry_time);
+
+
+/**
+ * Change the expiry time of a value in the cache.
+ *
+ * @param cache_p The cache.
+ * @param key_s The key of the value.
+ * @param expiry_time The new expiry time.
+ * @return <code>true</code> if the value was found, <code>false</code> otherwise.
+ */
+bool SetLRUCacheValueExpiryTime (LRUCache *cache_p, const char *key_s, const apr_time_t expiry_time);
+
+
+/**
+ * Remove and free a value in the cache, if it is there.
+ *
+ * @param cache_p The cache.
+ * @param key_s The key of the value.
+ */
+void RemoveLRUCacheValue (LRUCache *cache_p, const char *key_s);
+
+
+/**
+ * Remove and free all of the values whose keys start with a given prefix.
+ *
+ * @param cache_p The cache.
+ * @param prefix_s The prefix. If this is empty, all of the values are removed.
+ */
+void RemoveLRUCacheValuesWithPrefix (LRUCache *cache_p, const char *prefix_s);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LRU_CACHE_H_ */
@@ -20,12 +20,15 @@
  *      Author: billy
  */
 
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "apr_hash.h"
 #include "apr_strings.h"
 
 #include "http_protocol.h"
+#include "util_filter.h"
 
 #include "irods/objStat.h"
 #include "irods/rodsGenQueryNames.h"
@@ -37,15 +40,169 @@
 #include "rest.h"
 #include "auth.h"
 #include "theme.h"
+#include "metadata_cache.h"
+#include "output_stream.h"
+#include "parallel_query.h"
+#include "query_utils.h"
+
+#include "jansson.h"
+
+/*************************************/
+
+/*
+ * The state of a metadata export while it is being
+ * streamed to the client.
+ */
+typedef struct MetadataExport
+{
+	request_rec *me_req_p;
+	apr_bucket_brigade *me_bb_p;
+	OutputFormat me_format;
+
+	/* The root collection without any trailing slash, so "/" becomes "" */
+	const char *me_prefix_s;
+	size_t me_prefix_length;
+
+	/*
+	 * For JSON Lines, the object whose AVUs are currently being
+	 * gathered, along with its array of AVUs.
+	 */
+	json_t *me_object_p;
+	json_t *me_metadata_p;
+} MetadataExport;
+
+
+/* The part of a collection tree that a query covers */
+typedef enum QueryScope
+{
+	/* Just the collection itself */
+	QS_COLLECTION,
+
+	/* All of the collections below it but not the collection itself */
+	QS_BELOW,
+
+	/* The collection along with all of the collections below it */
+	QS_TREE
+} QueryScope;
+
+
+/*
+ * Where the pages of results for a paged query come from, either by
+ * running it on the request's own connection or from a set of queries
+ * that are being run at the same time.
+ */
+typedef struct QueryPageSource
+{
+	genQueryInp_t *qps_query_p;
+	rcComm_t *qps_connection_p;
+
+	/* If this is set, the page comes from the query at qps_index within it */
+	ParallelQueries *qps_parallel_p;
+	size_t qps_index;
+} QueryPageSource;
+
+
+/*
+ * The queries for each of the collections directly within the
+ * root of a tree, which are run over separate connections when
+ * more than one can be used.
+ */
+typedef struct SubtreeQueries
+{
+	/* The full paths of the subcollections, in order */
+	apr_array_header_t *sq_subtrees_p;
+
+	/*
+	 * The queries are grouped by kind and then by subcollection, which
+	 * is the order that they are used in, since they are started in the
+	 * same order.
+	 */
+	genQueryInp_t *sq_queries_p;
+	size_t sq_num_queries;
+
+	ParallelQueries *sq_parallel_p;
+
+	const davrods_dir_conf_t *sq_conf_p;
+	const char *sq_username_s;
+	const char *sq_password_s;
+	rcComm_t *sq_connection_p;
+} SubtreeQueries;
+
+
+/*
+ * The entries of a collection listing that have been got so far.
+ */
+typedef struct ListingEntries
+{
+	IRodsObjectNode *le_root_node_p;
+	IRodsObjectNode *le_current_node_p;
+
+	/*
+	 * The number of catalog rows still wanted, which is counted in rows
+	 * rather than entries so that the pages line up with the iCAT's
+	 * offsets. This isn't used when le_batch_fn is set.
+	 */
+	apr_size_t le_num_rows_wanted;
+
+	/* Whether the last row that was got added a node rather than being skipped */
+	bool le_last_row_added_flag;
+
+	/*
+	 * The id of the data object on the last row so that the rows for its
+	 * other replicas can be skipped, even when they are in a later batch.
+	 */
+	char le_last_data_id_s [NAME_LEN];
+
+	/*
+	 * If this is set, it is called with each batch of entries as the
+	 * iCAT returns them, which are then freed, and all of the rows are got.
+	 */
+	apr_status_t (*le_batch_fn) (IRodsObjectNode *root_node_p, void *data_p);
+	void *le_batch_data_p;
+} ListingEntries;
+
+
+/*
+ * Where the rows from a query for a set of minor ids are stored. The
+ * values in mir_results_p are either IRodsObjects or arrays of AVUs
+ * depending upon what was queried.
+ */
+typedef struct MinorIdResults
+{
+	objType_t mir_obj_type;
+	apr_hash_t *mir_results_p;
+	apr_pool_t *mir_pool_p;
+} MinorIdResults;
 
 /*************************************/
 
 static const int S_INITIAL_ARRAY_SIZE = 16;
 
+/* The maximum number of ids to put into each "in" clause when resolving ids in bulk */
+static const int S_MAX_IDS_PER_QUERY = 128;
+
+/*
+ * The number of rows to get for each page of a metadata export
+ * before the output is flushed to the client.
+ */
+static const int S_EXPORT_ROWS_PER_PAGE = 256;
+
 static const char * const S_SEARCH_OPERATOR_EQUALS_S = "=";
 
 static const char * const S_SEARCH_OPERATOR_LIKE_S = "like";
 
+/*
+ * The "n" prefix makes the iCAT compare the values numerically
+ * rather than as strings.
+ */
+static const char * const S_SEARCH_OPERATOR_LESS_THAN_S = "n<";
+
+static const char * const S_SEARCH_OPERATOR_LESS_THAN_OR_EQUALS_S = "n<=";
+
+static const char * const S_SEARCH_OPERATOR_GREATER_THAN_S = "n>";
+
+static const char * const S_SEARCH_OPERATOR_GREATER_THAN_OR_EQUALS_S = "n>=";
+
 static int s_debug_flag = 0;
 
 /**************************************/
@@ -58,7 +215,9 @@ static int SetMetadataQuery (genQueryInp_t *query_p, const char * const zone_s);
 
 static genQueryOut_t *ExecuteGenQuery (rcComm_t *connection_p, genQueryInp_t * const in_query_p, apr_pool_t *pool_p);
 
-static genQueryOut_t *ExecuteSpecificQuery (rcComm_t *connection_p, specificQueryInp_t * const in_query_p);
+static genQueryOut_t *ExecuteGenQueryWithStatus (rcComm_t *connection_p, genQueryInp_t * const in_query_p, int *status_p, apr_pool_t *pool_p);
+
+static genQueryOut_t *ExecuteSpecificQuery (rcComm_t *connection_p, specificQueryInp_t * const in_query_p, int *status_p, apr_pool_t *pool_p);
 
 static char *GetQuotedValue (const char * const input_s, const SearchOperator op, apr_pool_t *pool_p);
 
@@ -92,6 +251,8 @@ static apr_status_t GetMetadataArrayAsColumnData (apr_array_header_t *metadata_a
 
 static apr_status_t GetMetadataArrayAsJSON (apr_array_header_t *metadata_array_p, apr_bucket_brigade *bucket_brigade_p);
 
+static apr_status_t GetMetadataArrayAsJSONLines (apr_array_header_t *metadata_array_p, apr_bucket_brigade *bucket_brigade_p);
+
 static apr_status_t PrintDownloadMetadataObjectLink (const IRodsObject *irods_obj_p, const char *icon_s, const char *label_s, const char *type_s, const char *api_root_url_s, apr_bucket_brigade *bb_p);
 
 static objType_t GetObjTypeForIdString (const char * const id_s);
@@ -102,6 +263,98 @@ static bool AddToTable (IrodsMetadata *metadata_p, void *data_p, apr_pool_t *poo
 
 static bool AddToArray (IrodsMetadata *metadata_p, void *data_p, apr_pool_t *pool_p);
 
+static apr_array_header_t *GetMetadataList (rcComm_t *irods_connection_p, const objType_t object_type, const char *id_s, const char *coll_name_s, const char *zone_s, apr_pool_t *pool_p);
+
+static apr_status_t AddMatchingObjectsToList (const apr_array_header_t *conditions_p, const objType_t obj_type, IRodsObjectNode **root_node_pp, IRodsObjectNode **current_node_pp, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static char *GetSearchConditionsAsString (const apr_array_header_t *conditions_p, const char *prefix_s, const char *suffix_s, apr_pool_t *pool_p);
+
+static int AddSearchConditionsToQuery (genQueryInp_t *query_p, const apr_array_header_t *conditions_p, const int key_column, const int value_column, apr_pool_t *pool_p);
+
+static apr_status_t AddFacetCounts (const char *key_s, const apr_array_header_t *conditions_p, const objType_t obj_type, apr_hash_t *facets_p, apr_array_header_t *facets_array_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static apr_status_t AddFacetCountsUsingSpecificQuery (const char *query_s, const char *key_s, apr_hash_t *facets_p, apr_array_header_t *facets_array_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static MetadataFacetCount *GetFacetCount (const char *value_s, apr_hash_t *facets_p, apr_array_header_t *facets_array_p, apr_pool_t *pool_p);
+
+static int CompareMetadataFacetCounts (const void *v0_p, const void *v1_p);
+
+static apr_status_t RunListingSpecificQuery (const char *query_s, const char **args_ss, const int num_args, const bool metadata_flag, IRodsObjectNode **root_node_pp, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static char *GetSpecificQuerySearchPattern (const char *value_s, const SearchOperator op, apr_pool_t *pool_p);
+
+static apr_status_t AddIRodsObjectsForMinorIds (const objType_t obj_type, const apr_array_header_t *minor_ids_p, apr_hash_t *objects_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static apr_status_t AddIRodsObjectForRow (const genQueryOut_t *results_p, const int row, void *data_p);
+
+static apr_status_t ForEachRowForMinorIds (const objType_t obj_type, const apr_array_header_t *minor_ids_p, const int *select_columns_p, apr_status_t (*row_fn) (const genQueryOut_t *results_p, const int row, void *data_p), void *data_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static apr_status_t RemoveInaccessibleNodes (IRodsObjectNode **root_node_pp, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static bool IsNumericId (const char *id_s);
+
+static apr_status_t AddMetadataForMinorIds (const objType_t obj_type, const apr_array_header_t *minor_ids_p, apr_hash_t *metadata_arrays_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static apr_status_t AddMetadataForRow (const genQueryOut_t *results_p, const int row, void *data_p);
+
+static apr_status_t ExportMetadataForQuery (MetadataExport *export_p, const objType_t obj_type, const QueryScope scope, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static apr_status_t ExportMetadataForSubtrees (MetadataExport *export_p, const objType_t obj_type, SubtreeQueries *subtrees_p, const size_t first_query, apr_pool_t *pool_p);
+
+static int BuildMetadataExportQuery (genQueryInp_t *query_p, const objType_t obj_type, const char *prefix_s, const size_t prefix_length, const QueryScope scope, apr_pool_t *pool_p);
+
+static apr_status_t ExportMetadataPages (MetadataExport *export_p, const objType_t obj_type, const char *prefix_s, const size_t prefix_length, const QueryScope scope, QueryPageSource *source_p, apr_pool_t *pool_p);
+
+static apr_status_t ExportAVU (MetadataExport *export_p, const char *type_s, const char *path_s, const char *key_s, const char *value_s, const char *units_s);
+
+static apr_status_t ForEachDataObjectForQuery (const char *prefix_s, const size_t prefix_length, const QueryScope scope, apr_status_t (*object_fn) (const IRodsObject *irods_obj_p, void *data_p, apr_pool_t *pool_p), void *data_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static int BuildDataObjectsQuery (genQueryInp_t *query_p, const char *prefix_s, const size_t prefix_length, const QueryScope scope, apr_pool_t *pool_p);
+
+static apr_status_t ForEachDataObjectInPages (QueryPageSource *source_p, const char *prefix_s, const size_t prefix_length, const QueryScope scope, apr_status_t (*object_fn) (const IRodsObject *irods_obj_p, void *data_p, apr_pool_t *pool_p), void *data_p, apr_pool_t *pool_p);
+
+static char *GetCollectionScopeCondition (const char *prefix_s, const size_t prefix_length, const QueryScope scope, apr_pool_t *pool_p);
+
+static bool IsCollectionInScope (const char *coll_s, const char *prefix_s, const size_t prefix_length, const QueryScope scope);
+
+static bool IsPathSafeForQuery (const char *path_s);
+
+static genQueryOut_t *GetNextQueryPage (QueryPageSource *source_p, int *status_p, apr_pool_t *pool_p);
+
+static bool MoveToNextQueryPage (QueryPageSource *source_p, const genQueryOut_t *results_p, const bool wanted_flag);
+
+static bool OpenSubtreeQueries (SubtreeQueries *subtrees_p, const char *prefix_s, const size_t prefix_length, const size_t queries_per_subtree, const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static void StartSubtreeQueries (SubtreeQueries *subtrees_p, apr_pool_t *pool_p);
+
+static void SetSubtreeQueryPageSource (QueryPageSource *source_p, SubtreeQueries *subtrees_p, const size_t index);
+
+static void CloseSubtreeQueries (SubtreeQueries *subtrees_p);
+
+static apr_status_t AddDataObjectMetadataTablesForQuery (const char *prefix_s, const size_t prefix_length, const bool subtree_flag, const char *key_condition_s, apr_hash_t *tables_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static char *GetAggregateValues (const int *columns_p, const int *aggregates_p, const size_t num_columns, const int *where_columns_p, const char **conditions_ss, const size_t num_conditions, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static char *AppendAggregateValues (char *values_s, const int *columns_p, const int *aggregates_p, const size_t num_columns, const int *where_columns_p, const char **conditions_ss, const size_t num_conditions, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static apr_status_t ExportJSONLine (MetadataExport *export_p);
+
+static apr_status_t ExportCSVValue (MetadataExport *export_p, const char *value_s, const char *suffix_s);
+
+static void CloseGenQuery (genQueryInp_t *query_p, const int continue_index, rcComm_t *rods_connection_p);
+
+static apr_status_t CountChildCollections (const char *collection_s, apr_size_t *num_collections_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static apr_status_t AddListingPageEntries (const char *collection_s, const objType_t obj_type, const ListingPage *page_p, const apr_size_t offset, ListingEntries *entries_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+static void InitListingEntries (ListingEntries *entries_p, apr_status_t (*batch_fn) (IRodsObjectNode *root_node_p, void *data_p), void *data_p);
+
+static int GetListingSortColumn (const objType_t obj_type, const ListingSortKey key);
+
+static const char *GetQueryResultValue (const genQueryOut_t *results_p, const int column, const int row);
+
+static char *GetResourcesCondition (char **resources_ss, apr_pool_t *pool_p);
+
 /*************************************/
 
 
@@ -187,9 +440,7 @@ char *GetParentCollectionId (const char *child_id_s, const objType_t object_type
 
 apr_array_header_t *GetMetadataAsArray (rcComm_t *irods_connection_p, const objType_t object_type, const char *id_s, const char *coll_name_s, const char *zone_s, apr_pool_t *pool_p)
 {
-	apr_array_header_t *metadata_array_p = apr_array_make (pool_p, S_INITIAL_ARRAY_SIZE, sizeof (IrodsMetadata *));
-
-	GetMetadata (irods_connection_p, object_type, id_s, coll_name_s, zone_s, AddToArray, metadata_array_p, pool_p);
+	apr_array_header_t *metadata_array_p = GetMetadataList (irods_connection_p, object_type, id_s, coll_name_s, zone_s, pool_p);
 
 	SortIRodsMetadataArray (metadata_array_p, CompareIrodsMetadata);
 
@@ -199,14 +450,46 @@ apr_array_header_t *GetMetadataAsArray (rcComm_t *irods_connection_p, const objT
 
 apr_table_t *GetMetadataAsTable (rcComm_t *irods_connection_p, const objType_t object_type, const char *id_s, const char *coll_name_s, const char *zone_s, apr_pool_t *pool_p)
 {
-	apr_table_t *table_p = apr_table_make (pool_p, S_INITIAL_ARRAY_SIZE);
+	apr_array_header_t *metadata_array_p = GetMetadataList (irods_connection_p, object_type, id_s, coll_name_s, zone_s, pool_p);
+	apr_table_t *table_p = apr_table_make (pool_p, metadata_array_p -> nelts > 0 ? metadata_array_p -> nelts : S_INITIAL_ARRAY_SIZE);
 
-	GetMetadata (irods_connection_p, object_type, id_s, coll_name_s, zone_s, AddToTable, table_p, pool_p);
+	if (table_p)
+		{
+			int i;
+
+			for (i = 0; i < metadata_array_p -> nelts; ++ i)
+				{
+					AddToTable (APR_ARRAY_IDX (metadata_array_p, i, IrodsMetadata *), table_p, pool_p);
+				}
+		}
 
 	return table_p;
 }
 
 
+/*
+ * Get the unsorted AVUs for an object, using the per-child cache
+ * if it is turned on.
+ */
+static apr_array_header_t *GetMetadataList (rcComm_t *irods_connection_p, const objType_t object_type, const char *id_s, const char *coll_name_s, const char *zone_s, apr_pool_t *pool_p)
+{
+	const char *username_s = irods_connection_p -> clientUser.userName;
+	apr_array_header_t *metadata_array_p = GetCachedMetadata (object_type, id_s, coll_name_s, username_s, pool_p);
+
+	if (!metadata_array_p)
+		{
+			metadata_array_p = apr_array_make (pool_p, S_INITIAL_ARRAY_SIZE, sizeof (IrodsMetadata *));
+
+			if (GetMetadata (irods_connection_p, object_type, id_s, coll_name_s, zone_s, AddToArray, metadata_array_p, pool_p))
+				{
+					CacheMetadata (object_type, id_s, coll_name_s, username_s, metadata_array_p, pool_p);
+				}
+		}
+
+	return metadata_array_p;
+}
+
+
 static bool AddToTable (IrodsMetadata *metadata_p, void *data_p, apr_pool_t *pool_p)
 {
 	apr_table_t *table_p =  (apr_table_t *) data_p;
@@ -229,6 +512,7 @@ static bool AddToArray (IrodsMetadata *metadata_p, void *data_p, apr_pool_t *poo
 
 static bool GetMetadata (rcComm_t *irods_connection_p, const objType_t object_type, const char *id_s, const char *coll_name_s, const char *zone_s, bool (*insert_fn) (IrodsMetadata *metadata_p, void *data_p, apr_pool_t *pool_p), void *data_p, apr_pool_t *pool_p)
 {
+	bool success_flag = false;
 	apr_array_header_t *metadata_array_p = apr_array_make (pool_p, S_INITIAL_ARRAY_SIZE, sizeof (IrodsMetadata *));
 
 	if (metadata_array_p)
@@ -350,6 +634,7 @@ static bool GetMetadata (rcComm_t *irods_connection_p, const objType_t object_ty
 							if (success_code == 0)
 								{
 									genQueryOut_t *meta_id_results_p = NULL;
+									int query_status = 0;
 
 									if (s_debug_flag)
 										{
@@ -357,7 +642,7 @@ static bool GetMetadata (rcComm_t *irods_connection_p, const objType_t object_ty
 											printGenQI (&in_query);
 										}
 
-									meta_id_results_p = ExecuteGenQuery (irods_connection_p, &in_query, pool_p);
+									meta_id_results_p = ExecuteGenQueryWithStatus (irods_connection_p, &in_query, &query_status, pool_p);
 
 									if (meta_id_results_p)
 										{
@@ -422,6 +707,8 @@ static bool GetMetadata (rcComm_t *irods_connection_p, const objType_t object_ty
 																									units_s += metadata_query_results_p -> sqlResult [2].len;
 																								}
 
+																							success_flag = true;
+
 																						}
 																					else
 																						{
@@ -459,6 +746,12 @@ static bool GetMetadata (rcComm_t *irods_connection_p, const objType_t object_ty
 										}		/* if (meta_id_results_p) */
 									else
 										{
+											/* An object without any AVUs is a valid result */
+											if (query_status == CAT_NO_ROWS_FOUND)
+												{
+													success_flag = true;
+												}
+
 											ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_EGENERAL, pool_p, "%d \"%s\" produced no results", where_col, where_value_s);
 										}
 
@@ -487,7 +780,7 @@ static bool GetMetadata (rcComm_t *irods_connection_p, const objType_t object_ty
 			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to create metadata array");
 		}
 
-	return metadata_array_p;
+	return success_flag;
 }
 
 
@@ -605,66 +898,107 @@ static int AddWhereClausesToQuery (genQueryInp_t *query_p, const int *where_colu
 }
 
 
-char *DoMetadataSearch (const char * const key_s, const char *value_s, const SearchOperator op, rcComm_t *connection_p, davrods_dir_conf_t *conf_p, request_rec *req_p, const char *davrods_path_s)
+apr_status_t DoMetadataSearch (const apr_array_header_t *conditions_p, rcComm_t *connection_p, davrods_dir_conf_t *conf_p, request_rec *req_p, const char *davrods_path_s)
 {
+	apr_status_t apr_status = APR_ENOMEM;
 	apr_pool_t *pool_p = req_p -> pool;
-	IRodsObjectNode *hits_p = GetMatchingMetadataHits (key_s, value_s, op, connection_p, pool_p);
-	char *result_s = NULL;
-	apr_size_t result_length = 0;
-	apr_bucket_brigade *bucket_brigade_p = apr_brigade_create (pool_p, req_p -> connection -> bucket_alloc);
-
-	char *relative_uri_s = apr_pstrcat (pool_p, "the search results for ", key_s, " = ", value_s, NULL);
-	char *marked_up_relative_uri_s = apr_pstrcat (pool_p, "the search results for <strong>", key_s, "</strong> = <strong>", value_s, "</strong>", NULL);
+	OutputStream *stream_p = AllocateOutputStream (req_p, OF_HTML);
 
-	const char *escaped_zone_s = conf_p -> theme_p -> ht_zone_label_s ? conf_p -> theme_p -> ht_zone_label_s : ap_escape_html (pool_p, conf_p -> rods_zone);
+	if (stream_p)
+		{
+			apr_bucket_brigade *bucket_brigade_p = stream_p -> os_bb_p;
+			IRodsObjectNode *hits_p = NULL;
 
-	apr_status_t apr_status = PrintAllHTMLBeforeListing (NULL, escaped_zone_s, relative_uri_s, davrods_path_s, marked_up_relative_uri_s, NULL, connection_p -> clientUser.userName, conf_p, req_p, bucket_brigade_p, pool_p);
+			char *relative_uri_s = apr_pstrcat (pool_p, "the search results for ", GetSearchConditionsAsString (conditions_p, "", "", pool_p), NULL);
+			char *marked_up_relative_uri_s = apr_pstrcat (pool_p, "the search results for ", GetSearchConditionsAsString (conditions_p, "<strong>", "</strong>", pool_p), NULL);
 
+			const char *escaped_zone_s = conf_p -> theme_p -> ht_zone_label_s ? conf_p -> theme_p -> ht_zone_label_s : ap_escape_html (pool_p, conf_p -> rods_zone);
 
-	char *metadata_root_link_s = apr_pstrcat (pool_p, davrods_path_s, conf_p -> davrods_api_path_s, REST_METADATA_SEARCH_S, NULL);
+			char *metadata_root_link_s = apr_pstrcat (pool_p, davrods_path_s, conf_p -> davrods_api_path_s, REST_METADATA_SEARCH_S, NULL);
 
-	const char *exposed_root_s = GetRodsExposedPath (req_p);
+			const char *exposed_root_s = GetRodsExposedPath (req_p);
 
-	IRodsConfig irods_config;
+			IRodsConfig irods_config;
 
-	apr_status = SetIRodsConfig (&irods_config, exposed_root_s, davrods_path_s, metadata_root_link_s);
+			ap_set_content_type (req_p, "text/html");
 
+			apr_status = PrintAllHTMLBeforeListing (NULL, escaped_zone_s, relative_uri_s, davrods_path_s, marked_up_relative_uri_s, NULL, connection_p -> clientUser.userName, conf_p, req_p, bucket_brigade_p, pool_p);
 
-	if (hits_p)
-		{
-			IRodsObjectNode *node_p = hits_p;
-			unsigned int i;
+			/* Let the client start rendering the page while the search runs */
+			if (apr_status == APR_SUCCESS)
+				{
+					apr_status = FlushOutputStream (stream_p);
+				}
 
-			while (node_p && (apr_status == APR_SUCCESS))
+			/* There's no point searching if the client can't be sent the results */
+			if (apr_status == APR_SUCCESS)
 				{
-					apr_status = PrintItem (conf_p -> theme_p, node_p -> ion_object_p, &irods_config, i, bucket_brigade_p, pool_p, connection_p, req_p);
+					apr_status_t search_status = APR_SUCCESS;
 
-					node_p = node_p -> ion_next_p;
-					++ i;
-				}
+					hits_p = GetMatchingMetadataHitsForConditions (conditions_p, conf_p -> eirods_dav_search_specific_query_s, connection_p, &search_status, pool_p);
 
-			FreeIRodsObjectNodeList (hits_p);
-		}		/* if (hits_p) */
+					if (search_status != APR_SUCCESS)
+						{
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, search_status, req_p, "Failed to get %s", relative_uri_s);
+						}
 
-	apr_status = PrintAllHTMLAfterListing (connection_p -> clientUser.userName, escaped_zone_s, davrods_path_s, conf_p, NULL, connection_p, req_p, bucket_brigade_p, pool_p);
+					apr_status = SetIRodsConfig (&irods_config, exposed_root_s, davrods_path_s, metadata_root_link_s);
 
+					if (apr_status == APR_SUCCESS)
+						{
+							apr_status = SetIRodsConfigEscapedRootPath (&irods_config, pool_p);
+						}
 
-	CloseBucketsStream (bucket_brigade_p);
+					if (hits_p)
+						{
+							IRodsObjectNode *node_p = hits_p;
+							unsigned int i = 0;
 
-	apr_status = apr_brigade_pflatten (bucket_brigade_p, &result_s, &result_length, pool_p);
+							while (node_p && (apr_status == APR_SUCCESS))
+								{
+									apr_status = PrintItem (conf_p -> theme_p, node_p -> ion_object_p, &irods_config, i, bucket_brigade_p, pool_p, connection_p, req_p);
 
-	/*
-	 * Sometimes there is garbage at the end of this, and I don't know which apr_brigade_...
-	 * method I need to get the terminating '\0' so have to do it explicitly.
-	 */
-	if (* (result_s + result_length) != '\0')
-		{
-			* (result_s + result_length) = '\0';
-		}
+									if (apr_status == APR_SUCCESS)
+										{
+											apr_status = FlushOutputStreamIfFull (stream_p);
+										}
+
+									node_p = node_p -> ion_next_p;
+									++ i;
+								}
 
-	apr_brigade_destroy (bucket_brigade_p);
+							FreeIRodsObjectNodeList (hits_p);
+						}		/* if (hits_p) */
 
-	return result_s;
+					/*
+					 * Finish the page even if the search failed, so that it is complete,
+					 * but not once printing the rows has failed.
+					 */
+					if (apr_status == APR_SUCCESS)
+						{
+							apr_status = PrintAllHTMLAfterListing (connection_p -> clientUser.userName, escaped_zone_s, davrods_path_s, conf_p, NULL, NULL, connection_p, req_p, bucket_brigade_p, pool_p);
+						}
+
+					/* Keep the first error */
+					if (apr_status == APR_SUCCESS)
+						{
+							apr_status = search_status;
+						}
+
+				}		/* if (apr_status == APR_SUCCESS) */
+			else
+				{
+					ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, apr_status, req_p, "Failed to send the start of %s", relative_uri_s);
+				}
+
+			if ((CloseOutputStream (stream_p) != APR_SUCCESS) && (apr_status == APR_SUCCESS))
+				{
+					apr_status = APR_EGENERAL;
+				}
+
+		}		/* if (stream_p) */
+
+	return apr_status;
 }
 
 
@@ -695,643 +1029,3938 @@ static objType_t GetObjTypeForIdString (const char * const id_s)
 
 
 
-IRodsObjectNode *GetIRodsObjectNodeForId (const char *id_s, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+apr_status_t GetIRodsObjectsForIds (const apr_array_header_t *ids_p, apr_hash_t *objects_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
 {
-	IRodsObjectNode *node_p = NULL;
-	int select_columns_p [] = { COL_COLL_NAME, -1, -1 };
-	int where_columns_p [] =  { COL_COLL_ID };
-	genQueryOut_t *results_p = NULL;
-	int num_select_columns = 1;
-	bool found_flag = false;
-	const char *minor_id_s = GetMinorId (id_s);
-	const char **where_values_ss = &minor_id_s;
-
-	/*
-	 * Check object type to try to narrow down the queries
-	 * we need to execute
-	 */
-
-	objType_t obj_type = GetObjTypeForIdString (id_s);
+	apr_status_t status = APR_ENOMEM;
+	apr_array_header_t *data_ids_p = apr_array_make (pool_p, ids_p -> nelts, sizeof (const char *));
+	apr_array_header_t *coll_ids_p = apr_array_make (pool_p, ids_p -> nelts, sizeof (const char *));
+	apr_hash_t *data_objects_p = apr_hash_make (pool_p);
+	apr_hash_t *collections_p = apr_hash_make (pool_p);
 
-	if ((obj_type == COLL_OBJ_T) || (obj_type == UNKNOWN_OBJ_T))
+	if (data_ids_p && coll_ids_p && data_objects_p && collections_p)
 		{
-			results_p = RunQuery (rods_connection_p, select_columns_p, where_columns_p, where_values_ss, NULL, 1, 0, pool_p);
+			int i;
 
-			if (results_p)
+			/*
+			 * Ids without a type prefix are tried as data objects first
+			 * and then as collections, as SetIRodsObjectFromIdString does.
+			 */
+			for (i = 0; i < ids_p -> nelts; ++ i)
 				{
-					if (results_p -> rowCnt > 0)
+					const char *id_s = APR_ARRAY_IDX (ids_p, i, const char *);
+					const char *minor_id_s = GetMinorId (id_s);
+					const objType_t obj_type = minor_id_s ? (objType_t) atoi (id_s) : UNKNOWN_OBJ_T;
+
+					if (!minor_id_s)
 						{
-							found_flag = true;
+							minor_id_s = id_s;
+						}
 
-							if (results_p -> attriCnt == num_select_columns)
+					if (IsNumericId (minor_id_s))
+						{
+							if (obj_type == COLL_OBJ_T)
 								{
-									const char *collection_s = results_p -> sqlResult [0].value;
-									rodsObjStat_t *stat_p;
+									APR_ARRAY_PUSH (coll_ids_p, const char *) = minor_id_s;
+								}
+							else
+								{
+									APR_ARRAY_PUSH (data_ids_p, const char *) = minor_id_s;
+								}
+						}
+					else
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, APR_BADARG, pool_p, "Ignoring invalid id \"%s\"", id_s);
+						}
+				}
 
-									stat_p = GetObjectStat (collection_s, rods_connection_p, pool_p);
+			status = AddIRodsObjectsForMinorIds (DATA_OBJ_T, data_ids_p, data_objects_p, rods_connection_p, pool_p);
 
-									if (stat_p)
-										{
-											node_p = AllocateIRodsObjectNode (COLL_OBJ_T, id_s, NULL, collection_s, stat_p -> ownerName, NULL, stat_p -> modifyTime, stat_p -> objSize, stat_p -> chksum, pool_p);
+			if (status == APR_SUCCESS)
+				{
+					for (i = 0; i < ids_p -> nelts; ++ i)
+						{
+							const char *id_s = APR_ARRAY_IDX (ids_p, i, const char *);
 
-											if (node_p)
-												{
+							if ((!GetMinorId (id_s)) && IsNumericId (id_s) && (!apr_hash_get (data_objects_p, id_s, APR_HASH_KEY_STRING)))
+								{
+									APR_ARRAY_PUSH (coll_ids_p, const char *) = id_s;
+								}
+						}
 
-												}
+					status = AddIRodsObjectsForMinorIds (COLL_OBJ_T, coll_ids_p, collections_p, rods_connection_p, pool_p);
+				}
 
-											freeRodsObjStat (stat_p);
-										}		/* if (stat_p) */
+			if (status == APR_SUCCESS)
+				{
+					for (i = 0; i < ids_p -> nelts; ++ i)
+						{
+							const char *id_s = APR_ARRAY_IDX (ids_p, i, const char *);
+							const char *minor_id_s = GetMinorId (id_s);
+							IRodsObject *obj_p = NULL;
 
-								}		/* if (results_p -> attriCnt == num_select_columns) */
+							if (minor_id_s)
+								{
+									apr_hash_t *hash_p = (atoi (id_s) == COLL_OBJ_T) ? collections_p : data_objects_p;
 
-						}		/* if (results_p -> rowCnt > 0) */
+									obj_p = (IRodsObject *) apr_hash_get (hash_p, minor_id_s, APR_HASH_KEY_STRING);
+								}
+							else
+								{
+									obj_p = (IRodsObject *) apr_hash_get (data_objects_p, id_s, APR_HASH_KEY_STRING);
 
-					freeGenQueryOut (&results_p);
-				}		/* if (results_p) */
+									if (!obj_p)
+										{
+											obj_p = (IRodsObject *) apr_hash_get (collections_p, id_s, APR_HASH_KEY_STRING);
+										}
+								}
+
+							if (obj_p)
+								{
+									apr_hash_set (objects_p, id_s, APR_HASH_KEY_STRING, obj_p);
+								}
+						}
+				}
+
+		}		/* if (data_ids_p && coll_ids_p && data_objects_p && collections_p) */
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to allocate memory to resolve %d ids", ids_p -> nelts);
 		}
 
+	return status;
+}
 
 
-	if (!found_flag)
+apr_status_t GetMetadataArraysForIds (const apr_array_header_t *ids_p, apr_hash_t *metadata_arrays_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	apr_hash_t *objects_p = apr_hash_make (pool_p);
+	apr_hash_t *data_arrays_p = apr_hash_make (pool_p);
+	apr_hash_t *coll_arrays_p = apr_hash_make (pool_p);
+	apr_array_header_t *data_ids_p = apr_array_make (pool_p, ids_p -> nelts, sizeof (const char *));
+	apr_array_header_t *coll_ids_p = apr_array_make (pool_p, ids_p -> nelts, sizeof (const char *));
+
+	if (objects_p && data_arrays_p && coll_arrays_p && data_ids_p && coll_ids_p)
 		{
-			if ((obj_type == DATA_OBJ_T) || (obj_type == UNKNOWN_OBJ_T))
-				{
-					*select_columns_p = COL_DATA_NAME;
-					* (select_columns_p + 1) = COL_D_COLL_ID;
-					* where_columns_p = COL_D_DATA_ID;
-
-					num_select_columns = 2;
+			/* Find out what each id refers to, which also checks that the user can see it */
+			status = GetIRodsObjectsForIds (ids_p, objects_p, rods_connection_p, pool_p);
 
-					/*
-					 * Testing as data object id.
-					 *
-					 * 		SELECT data_name, coll_id FROM r_data_main where data_id = 10001;
-					 *
-					 */
-					results_p = RunQuery (rods_connection_p, select_columns_p, where_columns_p, where_values_ss, NULL, 1, 0, pool_p);
+			if (status == APR_SUCCESS)
+				{
+					const char *username_s = rods_connection_p -> clientUser.userName;
+					int i;
 
-					if (results_p)
+					/* Use any cached AVUs and get the rest together */
+					for (i = 0; i < ids_p -> nelts; ++ i)
 						{
-							if (results_p -> rowCnt == 1)
+							const char *id_s = APR_ARRAY_IDX (ids_p, i, const char *);
+							const IRodsObject *obj_p = (const IRodsObject *) apr_hash_get (objects_p, id_s, APR_HASH_KEY_STRING);
+
+							if (obj_p)
 								{
-									/* we have a data id match */
-									if (results_p -> attriCnt == num_select_columns)
-										{
-											sqlResult_t *sql_p = results_p -> sqlResult;
-											const char *data_name_s = sql_p -> value;
-											const char *coll_id_s = (++ sql_p) -> value;
-											genQueryOut_t *coll_id_results_p = NULL;
-											int coll_id_select_columns_p [] = { COL_COLL_NAME, -1 };
-											int num_coll_id_select_columns = 1;
-											int coll_id_where_columns_p [] = { COL_COLL_ID };
-											const char *coll_id_where_values_ss [] = { coll_id_s };
-											int num_coll_id_where_columns = 1;
+									const bool data_flag = (obj_p -> io_obj_type == DATA_OBJ_T);
+									apr_hash_t *arrays_p = data_flag ? data_arrays_p : coll_arrays_p;
 
-											/*
-											 * We have the local data object name, we now need to get the collection name
-											 * and join the two together
-											 */
-											coll_id_results_p = RunQuery (rods_connection_p, coll_id_select_columns_p, coll_id_where_columns_p, coll_id_where_values_ss, NULL, num_coll_id_where_columns, 0, pool_p);
+									if (!apr_hash_get (arrays_p, obj_p -> io_id_s, APR_HASH_KEY_STRING))
+										{
+											apr_array_header_t *metadata_array_p = GetCachedMetadata (obj_p -> io_obj_type, obj_p -> io_id_s, NULL, username_s, pool_p);
 
-											if (coll_id_results_p)
+											if (!metadata_array_p)
 												{
-													if (coll_id_results_p -> rowCnt == 1)
-														{
-															/* we have a coll id match */
-															if (coll_id_results_p -> attriCnt == num_coll_id_select_columns)
-																{
-																	const char *collection_res_s = coll_id_results_p -> sqlResult [0].value;
-																	char *collection_s = NULL;
-																	const size_t res_length = strlen (collection_res_s);
+													metadata_array_p = apr_array_make (pool_p, S_INITIAL_ARRAY_SIZE, sizeof (IrodsMetadata *));
 
-																	if (* (collection_res_s + res_length - 1) == '/')
-																		{
-																			collection_s = apr_pstrdup (pool_p, collection_res_s);
-																		}
-																	else
-																		{
-																			collection_s = apr_pstrcat (pool_p, collection_res_s, "/", NULL);
-																		}
-
-																	if (collection_s)
-																		{
-																			char *irods_data_path_s = apr_pstrcat (pool_p, collection_s, data_name_s, NULL);
-
-																			if (irods_data_path_s)
-																				{
-																					rodsObjStat_t *stat_p;
+													if (metadata_array_p)
+														{
+															APR_ARRAY_PUSH (data_flag ? data_ids_p : coll_ids_p, const char *) = obj_p -> io_id_s;
+														}
+												}
 
-																					stat_p = GetObjectStat (irods_data_path_s, rods_connection_p, pool_p);
+											if (metadata_array_p)
+												{
+													apr_hash_set (arrays_p, obj_p -> io_id_s, APR_HASH_KEY_STRING, metadata_array_p);
+												}
+										}
+								}
+						}
 
-																					if (stat_p)
-																						{
-																							node_p = AllocateIRodsObjectNode (DATA_OBJ_T, id_s, data_name_s, collection_s, stat_p -> ownerName, stat_p -> rescHier, stat_p -> modifyTime, stat_p -> objSize, stat_p -> chksum, pool_p);
+					status = AddMetadataForMinorIds (DATA_OBJ_T, data_ids_p, data_arrays_p, rods_connection_p, pool_p);
 
-																							if (node_p)
-																								{
+					if (status == APR_SUCCESS)
+						{
+							status = AddMetadataForMinorIds (COLL_OBJ_T, coll_ids_p, coll_arrays_p, rods_connection_p, pool_p);
+						}
 
-																								}
+					if (status == APR_SUCCESS)
+						{
+							for (i = 0; i < data_ids_p -> nelts; ++ i)
+								{
+									const char *minor_id_s = APR_ARRAY_IDX (data_ids_p, i, const char *);
 
+									CacheMetadata (DATA_OBJ_T, minor_id_s, NULL, username_s, (apr_array_header_t *) apr_hash_get (data_arrays_p, minor_id_s, APR_HASH_KEY_STRING), pool_p);
+								}
 
-																							freeRodsObjStat (stat_p);
-																						}
+							for (i = 0; i < coll_ids_p -> nelts; ++ i)
+								{
+									const char *minor_id_s = APR_ARRAY_IDX (coll_ids_p, i, const char *);
 
-																				}		/* if (irods_data_path_s) */
+									CacheMetadata (COLL_OBJ_T, minor_id_s, NULL, username_s, (apr_array_header_t *) apr_hash_get (coll_arrays_p, minor_id_s, APR_HASH_KEY_STRING), pool_p);
+								}
 
-																		}		/* if (collection_s) */
+							for (i = 0; i < ids_p -> nelts; ++ i)
+								{
+									const char *id_s = APR_ARRAY_IDX (ids_p, i, const char *);
+									const IRodsObject *obj_p = (const IRodsObject *) apr_hash_get (objects_p, id_s, APR_HASH_KEY_STRING);
 
-																}		/* if (coll_id_results_p -> attriCnt == num_select_columns) */
+									if (obj_p)
+										{
+											apr_hash_t *arrays_p = (obj_p -> io_obj_type == DATA_OBJ_T) ? data_arrays_p : coll_arrays_p;
+											apr_array_header_t *metadata_array_p = (apr_array_header_t *) apr_hash_get (arrays_p, obj_p -> io_id_s, APR_HASH_KEY_STRING);
 
-														}		/* if (coll_id_results_p -> rowCnt == 1) */
+											if (metadata_array_p)
+												{
+													if (!apr_hash_get (metadata_arrays_p, id_s, APR_HASH_KEY_STRING))
+														{
+															SortIRodsMetadataArray (metadata_array_p, CompareIrodsMetadata);
+															apr_hash_set (metadata_arrays_p, id_s, APR_HASH_KEY_STRING, metadata_array_p);
+														}
+												}
+										}
+								}
+						}
 
-													freeGenQueryOut (&coll_id_results_p);
-												}		/* if (coll_id_results_p) */
+				}		/* if (status == APR_SUCCESS) */
 
-										}		/* if (results_p -> attriCnt == num_select_columns) */
+		}		/* if (objects_p && data_arrays_p && coll_arrays_p && data_ids_p && coll_ids_p) */
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to allocate memory to get the metadata for %d ids", ids_p -> nelts);
+		}
 
-								}		/* if (results_p -> rowCnt == 1) */
+	return status;
+}
 
-							freeGenQueryOut (&results_p);
-						}		/* if (results_p) */
 
-				}		/* if ((obj_type == DATA_OBJ_T) || (obj_type == UNKNOWN_OBJ_T)) */
+/*
+ * Look up the given ids with an "in" clause, in batches of S_MAX_IDS_PER_QUERY,
+ * and store an IRodsObject for each one that is found in objects_p using its
+ * minor id as the key. For data objects with more than one replica, the first
+ * replica returned is used.
+ */
+static apr_status_t AddIRodsObjectsForMinorIds (const objType_t obj_type, const apr_array_header_t *minor_ids_p, apr_hash_t *objects_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	const int data_select_columns_p [] = { COL_D_DATA_ID, COL_DATA_NAME, COL_COLL_NAME, COL_D_OWNER_NAME, COL_D_RESC_NAME, COL_D_MODIFY_TIME, COL_DATA_SIZE, COL_D_DATA_CHECKSUM, -1 };
+	const int coll_select_columns_p [] = { COL_COLL_ID, COL_COLL_NAME, COL_COLL_OWNER_NAME, COL_COLL_MODIFY_TIME, -1 };
+	const int *select_columns_p = (obj_type == DATA_OBJ_T) ? data_select_columns_p : coll_select_columns_p;
+	MinorIdResults results;
 
-		}		/* if (!found_flag) */
+	results.mir_obj_type = obj_type;
+	results.mir_results_p = objects_p;
+	results.mir_pool_p = pool_p;
 
-	return node_p;
+	return ForEachRowForMinorIds (obj_type, minor_ids_p, select_columns_p, AddIRodsObjectForRow, &results, rods_connection_p, pool_p);
 }
 
 
-IRodsObjectNode *GetMatchingMetadataHits (const char * const key_s, const char * const value_s, SearchOperator op, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+static apr_status_t AddIRodsObjectForRow (const genQueryOut_t *results_p, const int row, void *data_p)
 {
-	/*
-	 * SELECT meta_id FROM r_meta_main WHERE meta_attr_name = ' ' AND meta_attr_value = ' ';
-	 *
-	 * SELECT object_id FROM r_objt_metamap WHERE meta_id = ' ';
-	 *
-	 * object_id is for data object and collection
-	 *
-	 * Get the full path to the object and then use
-	 *
-	 * rcObjStat     (rcComm_t *conn, dataObjInp_t *dataObjInp, rodsObjStat_t **rodsObjStatOut)
-	 *
-	 * to get the info we need for a listing
-	 */
-	int num_where_columns = 2;
-	int where_columns_p [] =  { COL_META_DATA_ATTR_NAME, COL_META_DATA_ATTR_VALUE };
-	const char *where_values_ss [] = { key_s, value_s };
-	SearchOperator ops_p [] = { SO_EQUALS, op };
-	int select_columns_p [] =  { COL_META_DATA_ATTR_ID, -1, -1};
-	genQueryOut_t *meta_id_results_p = NULL;
-	IRodsObjectNode *root_node_p = NULL;
-	IRodsObjectNode *current_node_p = NULL;
-
-	/*
-	 * SELECT meta_id FROM r_meta_main WHERE meta_attr_name = ' ' AND meta_attr_value = ' ';
-	 */
-	meta_id_results_p = RunQuery (rods_connection_p, select_columns_p, where_columns_p, where_values_ss, ops_p, num_where_columns, 0, pool_p);
+	MinorIdResults *minor_id_results_p = (MinorIdResults *) data_p;
+	apr_pool_t *pool_p = minor_id_results_p -> mir_pool_p;
+	const char *id_s = results_p -> sqlResult [0].value + (row * results_p -> sqlResult [0].len);
 
-	if (meta_id_results_p)
+	if (!apr_hash_get (minor_id_results_p -> mir_results_p, id_s, APR_HASH_KEY_STRING))
 		{
+			IRodsObject *obj_p = (IRodsObject *) apr_palloc (pool_p, sizeof (IRodsObject));
+			apr_status_t obj_status = APR_ENOMEM;
 
-			if (meta_id_results_p -> attriCnt == 1)
+			if (obj_p)
 				{
-					int i;
-					const int meta_results_inc = meta_id_results_p -> sqlResult [0].len;
-					const char *meta_id_s = meta_id_results_p -> sqlResult [0].value;
-
-					/*
-					 * SELECT object_id FROM r_objt_metamap WHERE meta_id = ' ';
-					 */
+					InitIRodsObject (obj_p);
 
-					for (i = 0; i < meta_id_results_p -> rowCnt; ++ i, meta_id_s += meta_results_inc)
+					if (minor_id_results_p -> mir_obj_type == DATA_OBJ_T)
+						{
+							const char *data_name_s = results_p -> sqlResult [1].value + (row * results_p -> sqlResult [1].len);
+							const char *collection_s = results_p -> sqlResult [2].value + (row * results_p -> sqlResult [2].len);
+							const char *owner_s = results_p -> sqlResult [3].value + (row * results_p -> sqlResult [3].len);
+							const char *resource_s = results_p -> sqlResult [4].value + (row * results_p -> sqlResult [4].len);
+							const char *modified_s = results_p -> sqlResult [5].value + (row * results_p -> sqlResult [5].len);
+							const char *size_s = results_p -> sqlResult [6].value + (row * results_p -> sqlResult [6].len);
+							const char *checksum_s = results_p -> sqlResult [7].value + (row * results_p -> sqlResult [7].len);
+
+							obj_status = SetIRodsObject (obj_p, DATA_OBJ_T, id_s, data_name_s, collection_s, owner_s, resource_s, modified_s, (rodsLong_t) atoll (size_s), checksum_s, pool_p);
+						}
+					else
 						{
-							/*
-							 * Get all of the matching collections first
-							 */
-							int object_id_select_columns_p [] = { COL_COLL_ID, -1 };
-							genQueryOut_t *id_results_p;
+							const char *collection_s = results_p -> sqlResult [1].value + (row * results_p -> sqlResult [1].len);
+							const char *owner_s = results_p -> sqlResult [2].value + (row * results_p -> sqlResult [2].len);
+							const char *modified_s = results_p -> sqlResult [3].value + (row * results_p -> sqlResult [3].len);
 
-							where_columns_p [0] = COL_META_COLL_ATTR_ID;
-							where_values_ss [0] = meta_id_s;
+							obj_status = SetIRodsObject (obj_p, COLL_OBJ_T, id_s, NULL, collection_s, owner_s, NULL, modified_s, 0, NULL, pool_p);
+						}
+				}
 
-							/*
-							 * Get all of the matching collections
-							 *
-							 * SELECT object_id FROM r_objt_metamap WHERE meta_id = ' ';
-							 */
+			if (obj_status == APR_SUCCESS)
+				{
+					apr_hash_set (minor_id_results_p -> mir_results_p, obj_p -> io_id_s, APR_HASH_KEY_STRING, obj_p);
+				}
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, obj_status, pool_p, "Failed to set iRODS object for id \"%s\"", id_s);
+				}
+		}
 
-							id_results_p = RunQuery (rods_connection_p, object_id_select_columns_p, where_columns_p, where_values_ss, NULL, 1, 0, pool_p);
+	/* A row that can't be stored is logged and skipped rather than failing the whole lookup */
+	return APR_SUCCESS;
+}
 
-							if (id_results_p)
-								{
-									if (id_results_p -> rowCnt > 0)
-										{
-											int j;
-											int num_select_columns = 1;
 
-											/* we only searched for 1 attribute so we want the 1st result */
-											const char *id_s = id_results_p -> sqlResult[0].value;
-											const int inc = id_results_p -> sqlResult[0].len;
-											select_columns_p [0] = COL_COLL_NAME;
-											select_columns_p [1] = -1;
+/*
+ * Run a query for the given minor ids with an "in" clause, in batches of
+ * S_MAX_IDS_PER_QUERY, and call row_fn for each row of the results. The
+ * first column in select_columns_p must be the id column for obj_type.
+ */
+static apr_status_t ForEachRowForMinorIds (const objType_t obj_type, const apr_array_header_t *minor_ids_p, const int *select_columns_p, apr_status_t (*row_fn) (const genQueryOut_t *results_p, const int row, void *data_p), void *data_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+	const int id_column = (obj_type == DATA_OBJ_T) ? COL_D_DATA_ID : COL_COLL_ID;
+	int start = 0;
 
-											where_columns_p [0] = COL_COLL_ID;
-											num_where_columns = 1;
+	while ((start < minor_ids_p -> nelts) && (status == APR_SUCCESS))
+		{
+			const int end = (start + S_MAX_IDS_PER_QUERY < minor_ids_p -> nelts) ? start + S_MAX_IDS_PER_QUERY : minor_ids_p -> nelts;
+			char *in_clause_s = apr_pstrcat (pool_p, "in ('", APR_ARRAY_IDX (minor_ids_p, start, const char *), "'", NULL);
+			genQueryInp_t in_query;
+			int success_code;
+			int i;
 
-											for (j = 0; j < id_results_p -> rowCnt; ++ j, id_s += inc)
-												{
-													/*
-													 *
-													 * The id can be the data id, coll id, etc. so we have to work
-													 * out what it is
-													 *
-													 * Start by testing if the id refers to a collection
-													 *
-													 * 		SELECT coll_name FROM r_coll_main WHERE coll_id = '10001';
-													 *
-													 */
+			for (i = start + 1; i < end; ++ i)
+				{
+					in_clause_s = apr_pstrcat (pool_p, in_clause_s, ", '", APR_ARRAY_IDX (minor_ids_p, i, const char *), "'", NULL);
+				}
 
-													genQueryOut_t *collection_name_results_p = NULL;
+			in_clause_s = apr_pstrcat (pool_p, in_clause_s, ")", NULL);
 
-													where_values_ss [0] = id_s;
+			success_code = InitGenQuery (&in_query, 0, NULL);
 
-													collection_name_results_p = RunQuery (rods_connection_p, select_columns_p, where_columns_p, where_values_ss, NULL, num_where_columns, 0, pool_p);
+			if (success_code == 0)
+				{
+					success_code = AddSelectClausesToQuery (&in_query, select_columns_p);
+				}
 
-													if (collection_name_results_p)
-														{
-															if (collection_name_results_p -> rowCnt > 0)
-																{
-																	if (collection_name_results_p -> attriCnt == num_select_columns)
-																		{
-																			const char *collection_s = collection_name_results_p -> sqlResult [0].value;
-																			rodsObjStat_t *stat_p;
+			if (success_code == 0)
+				{
+					success_code = addInxVal (& (in_query.sqlCondInp), id_column, in_clause_s);
+				}
 
-																			stat_p = GetObjectStat (collection_s, rods_connection_p, pool_p);
+			if (success_code == 0)
+				{
+					bool loop_flag = true;
 
-																			if (stat_p)
-																				{
-																					IRodsObjectNode *node_p = AllocateIRodsObjectNode (COLL_OBJ_T, id_s, NULL, collection_s, stat_p -> ownerName, NULL, stat_p -> modifyTime, stat_p -> objSize, stat_p -> chksum, pool_p);
+					while (loop_flag)
+						{
+							int query_status = 0;
+							genQueryOut_t *results_p = ExecuteGenQueryWithStatus (rods_connection_p, &in_query, &query_status, pool_p);
 
-																					if (node_p)
-																						{
-																							if (current_node_p)
-																								{
-																									current_node_p -> ion_next_p = node_p;
-																								}
-																							else
-																								{
-																									root_node_p = node_p;
-																								}
+							loop_flag = false;
 
-																							current_node_p = node_p;
-																						}
+							if (results_p)
+								{
+									int j;
 
+									for (j = 0; (j < results_p -> rowCnt) && (status == APR_SUCCESS); ++ j)
+										{
+											status = row_fn (results_p, j, data_p);
+										}
 
-																					freeRodsObjStat (stat_p);
-																				}		/* if (stat_p) */
+									/* Are there more results to get? */
+									if ((results_p -> continueInx > 0) && (status == APR_SUCCESS))
+										{
+											in_query.continueInx = results_p -> continueInx;
+											loop_flag = true;
+										}
 
-																		}		/* if (collection_name_results_p -> attriCnt == num_select_columns) */
+									freeGenQueryOut (&results_p);
+								}		/* if (results_p) */
+							else if (query_status != CAT_NO_ROWS_FOUND)
+								{
+									status = APR_EGENERAL;
+								}
 
-																}		/* if (collection_name_results_p -> rowCnt > 0) */
+						}		/* while (loop_flag) */
 
-															freeGenQueryOut (&collection_name_results_p);
-														}		/* if (collection_name_results_p) */
+				}		/* if (success_code == 0) */
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to build id query for \"%s\"", in_clause_s);
+					status = APR_EGENERAL;
+				}
 
+			ClearPooledMemoryFromGenQuery (&in_query);
+			clearGenQueryInp (&in_query);
 
+			start = end;
+		}		/* while ((start < minor_ids_p -> nelts) && (status == APR_SUCCESS)) */
 
-												}		/* for (j = 0; j < id_results_p -> rowCnt; ++ j) */
+	return status;
+}
 
-										}		/* if (id_results_p -> rowCnt > 0) */
 
-									freeGenQueryOut (&id_results_p);
-								}		/* if (id_results_p) */
+/*
+ * Specific queries run directly against the iCAT without checking the
+ * user's permissions, so look the hits up again with GenQuery, which does,
+ * and remove any nodes for objects that the user can't see.
+ */
+static apr_status_t RemoveInaccessibleNodes (IRodsObjectNode **root_node_pp, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	apr_array_header_t *data_ids_p = apr_array_make (pool_p, S_INITIAL_ARRAY_SIZE, sizeof (const char *));
+	apr_array_header_t *coll_ids_p = apr_array_make (pool_p, S_INITIAL_ARRAY_SIZE, sizeof (const char *));
+	apr_hash_t *data_objects_p = apr_hash_make (pool_p);
+	apr_hash_t *collections_p = apr_hash_make (pool_p);
 
+	if (data_ids_p && coll_ids_p && data_objects_p && collections_p)
+		{
+			IRodsObjectNode *node_p;
 
-							/*
-							 * Get all of the data objects
-							 */
-							object_id_select_columns_p [0] = COL_D_DATA_ID;
+			for (node_p = *root_node_pp; node_p; node_p = node_p -> ion_next_p)
+				{
+					const IRodsObject *obj_p = node_p -> ion_object_p;
 
-							where_columns_p [0] = COL_META_DATA_ATTR_ID;
-							where_values_ss [0] = meta_id_s;
+					APR_ARRAY_PUSH ((obj_p -> io_obj_type == DATA_OBJ_T) ? data_ids_p : coll_ids_p, const char *) = obj_p -> io_id_s;
+				}
 
-							id_results_p = RunQuery (rods_connection_p, object_id_select_columns_p, where_columns_p, where_values_ss, NULL, 1, 0, pool_p);
+			status = AddIRodsObjectsForMinorIds (DATA_OBJ_T, data_ids_p, data_objects_p, rods_connection_p, pool_p);
 
-							if (id_results_p)
-								{
-									if (id_results_p -> rowCnt > 0)
-										{
-											int j;
+			if (status == APR_SUCCESS)
+				{
+					status = AddIRodsObjectsForMinorIds (COLL_OBJ_T, coll_ids_p, collections_p, rods_connection_p, pool_p);
+				}
 
-											/* we only searched for 1 attribute so we want the 1st result */
-											const char *id_s = id_results_p -> sqlResult [0].value;
-											const int inc = id_results_p -> sqlResult [0].len;
-											int num_select_columns = 2;
+			if (status == APR_SUCCESS)
+				{
+					IRodsObjectNode *previous_node_p = NULL;
 
-											select_columns_p [0] = COL_DATA_NAME;
-											select_columns_p [1] = COL_D_COLL_ID;
-											select_columns_p [2] = -1;
+					node_p = *root_node_pp;
 
-											where_columns_p [0] = COL_D_DATA_ID;
+					while (node_p)
+						{
+							IRodsObjectNode *next_node_p = node_p -> ion_next_p;
+							const IRodsObject *obj_p = node_p -> ion_object_p;
+							apr_hash_t *found_objects_p = (obj_p -> io_obj_type == DATA_OBJ_T) ? data_objects_p : collections_p;
 
-											for (j = 0; j < id_results_p -> rowCnt; ++ j, id_s += inc)
-												{
-													genQueryOut_t *data_id_results_p = NULL;
+							if (apr_hash_get (found_objects_p, obj_p -> io_id_s, APR_HASH_KEY_STRING))
+								{
+									previous_node_p = node_p;
+								}
+							else
+								{
+									if (previous_node_p)
+										{
+											previous_node_p -> ion_next_p = next_node_p;
+										}
+									else
+										{
+											*root_node_pp = next_node_p;
+										}
 
-													where_values_ss [0] = id_s;
+									FreeIRodsObjectNode (node_p);
+								}
 
-													num_select_columns = 2;
+							node_p = next_node_p;
+						}
+				}
 
-													/*
-													 * Testing as data object id.
-													 *
-													 * 		SELECT data_name, coll_id FROM r_data_main where data_id = 10001;
-													 *
-													 */
-													data_id_results_p = RunQuery (rods_connection_p, select_columns_p, where_columns_p, where_values_ss, NULL, 1, 0, pool_p);
+		}		/* if (data_ids_p && coll_ids_p && data_objects_p && collections_p) */
 
-													if (data_id_results_p)
-														{
-															if (data_id_results_p -> rowCnt == 1)
-																{
-																	/* we have a data id match */
-																	if (data_id_results_p -> attriCnt == num_select_columns)
-																		{
-																			sqlResult_t *sql_p = data_id_results_p -> sqlResult;
-																			const char *data_name_s = sql_p -> value;
-																			const char *coll_id_s = (++ sql_p) -> value;
-																			genQueryOut_t *coll_id_results_p = NULL;
-																			int coll_id_select_columns_p [] = { COL_COLL_NAME, -1 };
-																			int num_coll_id_select_columns = 1;
-																			int coll_id_where_columns_p [] = { COL_COLL_ID };
-																			const char *coll_id_where_values_ss [] = { coll_id_s };
-																			int num_coll_id_where_columns = 1;
-
-																			/*
-																			 * We have the local data object name, we now need to get the collection name
-																			 * and join the two together
-																			 */
-																			coll_id_results_p = RunQuery (rods_connection_p, coll_id_select_columns_p, coll_id_where_columns_p, coll_id_where_values_ss, NULL, num_coll_id_where_columns, 0, pool_p);
-
-																			if (coll_id_results_p)
-																				{
-																					if (coll_id_results_p -> rowCnt == 1)
-																						{
-																							/* we have a coll id match */
-																							if (coll_id_results_p -> attriCnt == num_coll_id_select_columns)
-																								{
-																									const char *collection_s = coll_id_results_p -> sqlResult [0].value;
-																									char *irods_data_path_s = apr_pstrcat (pool_p, collection_s, "/", data_name_s, NULL);
+	return status;
+}
 
-																									if (irods_data_path_s)
-																										{
-																											rodsObjStat_t *stat_p;
 
-																											stat_p = GetObjectStat (irods_data_path_s, rods_connection_p, pool_p);
+/*
+ * Get the AVUs for the given minor ids with an "in" clause, in batches of
+ * S_MAX_IDS_PER_QUERY, and add them to the arrays in metadata_arrays_p which
+ * must already have an array for each minor id.
+ */
+static apr_status_t AddMetadataForMinorIds (const objType_t obj_type, const apr_array_header_t *minor_ids_p, apr_hash_t *metadata_arrays_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	const int data_select_columns_p [] = { COL_D_DATA_ID, COL_META_DATA_ATTR_NAME, COL_META_DATA_ATTR_VALUE, COL_META_DATA_ATTR_UNITS, -1 };
+	const int coll_select_columns_p [] = { COL_COLL_ID, COL_META_COLL_ATTR_NAME, COL_META_COLL_ATTR_VALUE, COL_META_COLL_ATTR_UNITS, -1 };
+	const int *select_columns_p = (obj_type == DATA_OBJ_T) ? data_select_columns_p : coll_select_columns_p;
+	MinorIdResults results;
 
-																											if (stat_p)
-																												{
-																													IRodsObjectNode *node_p = AllocateIRodsObjectNode (DATA_OBJ_T, id_s, data_name_s, collection_s, stat_p -> ownerName, stat_p -> rescHier, stat_p -> modifyTime, stat_p -> objSize, stat_p -> chksum, pool_p);
+	results.mir_obj_type = obj_type;
+	results.mir_results_p = metadata_arrays_p;
+	results.mir_pool_p = pool_p;
 
-																													if (node_p)
-																														{
-																															if (current_node_p)
-																																{
-																																	current_node_p -> ion_next_p = node_p;
-																																}
-																															else
-																																{
-																																	root_node_p = node_p;
-																																}
+	return ForEachRowForMinorIds (obj_type, minor_ids_p, select_columns_p, AddMetadataForRow, &results, rods_connection_p, pool_p);
+}
 
-																															current_node_p = node_p;
-																														}
 
+static apr_status_t AddMetadataForRow (const genQueryOut_t *results_p, const int row, void *data_p)
+{
+	apr_status_t status = APR_SUCCESS;
+	MinorIdResults *minor_id_results_p = (MinorIdResults *) data_p;
+	const char *id_s = results_p -> sqlResult [0].value + (row * results_p -> sqlResult [0].len);
+	apr_array_header_t *metadata_array_p = (apr_array_header_t *) apr_hash_get (minor_id_results_p -> mir_results_p, id_s, APR_HASH_KEY_STRING);
 
-																													freeRodsObjStat (stat_p);
-																												}
+	if (metadata_array_p)
+		{
+			const char *key_s = results_p -> sqlResult [1].value + (row * results_p -> sqlResult [1].len);
+			const char *value_s = results_p -> sqlResult [2].value + (row * results_p -> sqlResult [2].len);
+			const char *units_s = results_p -> sqlResult [3].value + (row * results_p -> sqlResult [3].len);
+			IrodsMetadata *metadata_p = AllocateIrodsMetadata (key_s, value_s, units_s, minor_id_results_p -> mir_pool_p);
 
-																										}		/* if (irods_data_path_s) */
+			if (metadata_p)
+				{
+					APR_ARRAY_PUSH (metadata_array_p, IrodsMetadata *) = metadata_p;
+				}
+			else
+				{
+					status = APR_ENOMEM;
+				}
+		}
 
-																								}		/* if (coll_id_results_p -> attriCnt == num_select_columns) */
+	return status;
+}
 
-																						}		/* if (coll_id_results_p -> rowCnt == 1) */
 
-																					freeGenQueryOut (&coll_id_results_p);
-																				}		/* if (coll_id_results_p) */
+/*
+ * Only plain numbers are allowed since the ids are put directly into queries.
+ */
+static bool IsNumericId (const char *id_s)
+{
+	bool numeric_flag = (*id_s != '\0');
 
-																		}
+	while (numeric_flag && (*id_s != '\0'))
+		{
+			if (isdigit ((unsigned char) *id_s))
+				{
+					++ id_s;
+				}
+			else
+				{
+					numeric_flag = false;
+				}
+		}
+
+	return numeric_flag;
+}
+
+
+IRodsObjectNode *GetIRodsObjectNodeForId (const char *id_s, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	IRodsObjectNode *node_p = NULL;
+	int select_columns_p [] = { COL_COLL_NAME, -1, -1 };
+	int where_columns_p [] =  { COL_COLL_ID };
+	genQueryOut_t *results_p = NULL;
+	int num_select_columns = 1;
+	bool found_flag = false;
+	const char *minor_id_s = GetMinorId (id_s);
+	const char **where_values_ss = &minor_id_s;
+
+	/*
+	 * Check object type to try to narrow down the queries
+	 * we need to execute
+	 */
+
+	objType_t obj_type = GetObjTypeForIdString (id_s);
+
+	if ((obj_type == COLL_OBJ_T) || (obj_type == UNKNOWN_OBJ_T))
+		{
+			results_p = RunQuery (rods_connection_p, select_columns_p, where_columns_p, where_values_ss, NULL, 1, 0, pool_p);
+
+			if (results_p)
+				{
+					if (results_p -> rowCnt > 0)
+						{
+							found_flag = true;
+
+							if (results_p -> attriCnt == num_select_columns)
+								{
+									const char *collection_s = results_p -> sqlResult [0].value;
+									rodsObjStat_t *stat_p;
+
+									stat_p = GetObjectStat (collection_s, rods_connection_p, pool_p);
+
+									if (stat_p)
+										{
+											node_p = AllocateIRodsObjectNode (COLL_OBJ_T, id_s, NULL, collection_s, stat_p -> ownerName, NULL, stat_p -> modifyTime, stat_p -> objSize, stat_p -> chksum, pool_p);
+
+											if (node_p)
+												{
+
+												}
+
+											freeRodsObjStat (stat_p);
+										}		/* if (stat_p) */
+
+								}		/* if (results_p -> attriCnt == num_select_columns) */
+
+						}		/* if (results_p -> rowCnt > 0) */
+
+					freeGenQueryOut (&results_p);
+				}		/* if (results_p) */
+		}
+
+
+
+	if (!found_flag)
+		{
+			if ((obj_type == DATA_OBJ_T) || (obj_type == UNKNOWN_OBJ_T))
+				{
+					*select_columns_p = COL_DATA_NAME;
+					* (select_columns_p + 1) = COL_D_COLL_ID;
+					* where_columns_p = COL_D_DATA_ID;
+
+					num_select_columns = 2;
+
+					/*
+					 * Testing as data object id.
+					 *
+					 * 		SELECT data_name, coll_id FROM r_data_main where data_id = 10001;
+					 *
+					 */
+					results_p = RunQuery (rods_connection_p, select_columns_p, where_columns_p, where_values_ss, NULL, 1, 0, pool_p);
+
+					if (results_p)
+						{
+							if (results_p -> rowCnt == 1)
+								{
+									/* we have a data id match */
+									if (results_p -> attriCnt == num_select_columns)
+										{
+											sqlResult_t *sql_p = results_p -> sqlResult;
+											const char *data_name_s = sql_p -> value;
+											const char *coll_id_s = (++ sql_p) -> value;
+											genQueryOut_t *coll_id_results_p = NULL;
+											int coll_id_select_columns_p [] = { COL_COLL_NAME, -1 };
+											int num_coll_id_select_columns = 1;
+											int coll_id_where_columns_p [] = { COL_COLL_ID };
+											const char *coll_id_where_values_ss [] = { coll_id_s };
+											int num_coll_id_where_columns = 1;
+
+											/*
+											 * We have the local data object name, we now need to get the collection name
+											 * and join the two together
+											 */
+											coll_id_results_p = RunQuery (rods_connection_p, coll_id_select_columns_p, coll_id_where_columns_p, coll_id_where_values_ss, NULL, num_coll_id_where_columns, 0, pool_p);
+
+											if (coll_id_results_p)
+												{
+													if (coll_id_results_p -> rowCnt == 1)
+														{
+															/* we have a coll id match */
+															if (coll_id_results_p -> attriCnt == num_coll_id_select_columns)
+																{
+																	const char *collection_res_s = coll_id_results_p -> sqlResult [0].value;
+																	char *collection_s = NULL;
+																	const size_t res_length = strlen (collection_res_s);
+
+																	if (* (collection_res_s + res_length - 1) == '/')
+																		{
+																			collection_s = apr_pstrdup (pool_p, collection_res_s);
+																		}
+																	else
+																		{
+																			collection_s = apr_pstrcat (pool_p, collection_res_s, "/", NULL);
+																		}
+
+																	if (collection_s)
+																		{
+																			char *irods_data_path_s = apr_pstrcat (pool_p, collection_s, data_name_s, NULL);
+
+																			if (irods_data_path_s)
+																				{
+																					rodsObjStat_t *stat_p;
+
+																					stat_p = GetObjectStat (irods_data_path_s, rods_connection_p, pool_p);
+
+																					if (stat_p)
+																						{
+																							node_p = AllocateIRodsObjectNode (DATA_OBJ_T, id_s, data_name_s, collection_s, stat_p -> ownerName, stat_p -> rescHier, stat_p -> modifyTime, stat_p -> objSize, stat_p -> chksum, pool_p);
+
+																							if (node_p)
+																								{
+
+																								}
+
+
+																							freeRodsObjStat (stat_p);
+																						}
+
+																				}		/* if (irods_data_path_s) */
+
+																		}		/* if (collection_s) */
+
+																}		/* if (coll_id_results_p -> attriCnt == num_select_columns) */
+
+														}		/* if (coll_id_results_p -> rowCnt == 1) */
+
+													freeGenQueryOut (&coll_id_results_p);
+												}		/* if (coll_id_results_p) */
+
+										}		/* if (results_p -> attriCnt == num_select_columns) */
+
+								}		/* if (results_p -> rowCnt == 1) */
+
+							freeGenQueryOut (&results_p);
+						}		/* if (results_p) */
+
+				}		/* if ((obj_type == DATA_OBJ_T) || (obj_type == UNKNOWN_OBJ_T)) */
+
+		}		/* if (!found_flag) */
+
+	return node_p;
+}
+
+
+IRodsObjectNode *GetMatchingMetadataHits (const char * const key_s, const char * const value_s, SearchOperator op, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	IRodsObjectNode *root_node_p = NULL;
+	apr_array_header_t *conditions_p = apr_array_make (pool_p, 1, sizeof (MetadataSearchCondition));
+
+	if (conditions_p)
+		{
+			MetadataSearchCondition *condition_p = (MetadataSearchCondition *) apr_array_push (conditions_p);
+
+			condition_p -> msc_key_s = key_s;
+			condition_p -> msc_value_s = value_s;
+			condition_p -> msc_op = op;
+
+			root_node_p = GetMatchingMetadataHitsForConditions (conditions_p, NULL, rods_connection_p, NULL, pool_p);
+		}
+
+	return root_node_p;
+}
+
+
+IRodsObjectNode *GetMatchingMetadataHitsForConditions (const apr_array_header_t *conditions_p, const char *specific_query_s, rcComm_t *rods_connection_p, apr_status_t *status_p, apr_pool_t *pool_p)
+{
+	/*
+	 * Rather than getting the matching meta ids, then the object ids for each
+	 * of those and then stat'ing every object, we get the iCAT to do the join
+	 * and intersection for us. Each condition adds its own name/value pair of
+	 * where clauses which the iCAT maps onto a separate AVU, e.g.
+	 *
+	 * 		iquest "SELECT DATA_ID, DATA_NAME, COLL_NAME, ... WHERE META_DATA_ATTR_NAME = 'species'
+	 * 			AND META_DATA_ATTR_VALUE = 'wheat' AND META_DATA_ATTR_NAME = 'year' AND META_DATA_ATTR_VALUE n>= '2018'"
+	 *
+	 * Data objects and collections have separate AVU tables, so this needs one
+	 * query for each.
+	 */
+	IRodsObjectNode *root_node_p = NULL;
+	apr_status_t status = APR_SUCCESS;
+	bool done_flag = false;
+
+	/*
+	 * A registered specific query can only take fixed arguments, so it is
+	 * only used for the single condition equality and "like" searches.
+	 */
+	if (specific_query_s && conditions_p && (conditions_p -> nelts == 1))
+		{
+			const MetadataSearchCondition *condition_p = & (APR_ARRAY_IDX (conditions_p, 0, MetadataSearchCondition));
+
+			if ((condition_p -> msc_op == SO_EQUALS) || (condition_p -> msc_op == SO_LIKE))
+				{
+					const char *args_ss [2];
+
+					args_ss [0] = condition_p -> msc_key_s;
+					args_ss [1] = GetSpecificQuerySearchPattern (condition_p -> msc_value_s, condition_p -> msc_op, pool_p);
+
+					if (args_ss [1])
+						{
+							if (RunListingSpecificQuery (specific_query_s, args_ss, 2, false, &root_node_p, rods_connection_p, pool_p) == APR_SUCCESS)
+								{
+									if ((!root_node_p) || (RemoveInaccessibleNodes (&root_node_p, rods_connection_p, pool_p) == APR_SUCCESS))
+										{
+											done_flag = true;
+										}
+									else
+										{
+											ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, APR_EGENERAL, pool_p, "Failed to check access to the results of specific query \"%s\", using GenQuery instead", specific_query_s);
+
+											FreeIRodsObjectNodeList (root_node_p);
+											root_node_p = NULL;
+										}
+								}
+						}
+				}
+		}
+
+	if (done_flag)
+		{
+			if (root_node_p)
+				{
+					SortIRodsObjectNodeListIntoDirectoryOrder (root_node_p);
+				}
+		}
+	else if (conditions_p && (conditions_p -> nelts > 0))
+		{
+			IRodsObjectNode *current_node_p = NULL;
+
+			status = AddMatchingObjectsToList (conditions_p, COLL_OBJ_T, &root_node_p, &current_node_p, rods_connection_p, pool_p);
+
+			if (status == APR_SUCCESS)
+				{
+					status = AddMatchingObjectsToList (conditions_p, DATA_OBJ_T, &root_node_p, &current_node_p, rods_connection_p, pool_p);
+
+					if (status != APR_SUCCESS)
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to search for data objects");
+						}
+				}
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to search for collections");
+				}
+
+			if (status != APR_SUCCESS)
+				{
+					/* Don't pass off some of the hits as all of them */
+					if (root_node_p)
+						{
+							FreeIRodsObjectNodeList (root_node_p);
+							root_node_p = NULL;
+						}
+				}
+			else if (root_node_p)
+				{
+					SortIRodsObjectNodeListIntoDirectoryOrder (root_node_p);
+				}
+		}
+
+	if (status_p)
+		{
+			*status_p = status;
+		}
+
+	return root_node_p;
+}
+
+
+static apr_status_t AddMatchingObjectsToList (const apr_array_header_t *conditions_p, const objType_t obj_type, IRodsObjectNode **root_node_pp, IRodsObjectNode **current_node_pp, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_EGENERAL;
+	const int data_select_columns_p [] = { COL_D_DATA_ID, COL_DATA_NAME, COL_COLL_NAME, COL_D_OWNER_NAME, COL_D_RESC_NAME, COL_D_MODIFY_TIME, COL_DATA_SIZE, COL_D_DATA_CHECKSUM, -1 };
+	const int coll_select_columns_p [] = { COL_COLL_ID, COL_COLL_NAME, COL_COLL_OWNER_NAME, COL_COLL_MODIFY_TIME, -1 };
+	const int *select_columns_p = (obj_type == DATA_OBJ_T) ? data_select_columns_p : coll_select_columns_p;
+	const int key_column = (obj_type == DATA_OBJ_T) ? COL_META_DATA_ATTR_NAME : COL_META_COLL_ATTR_NAME;
+	const int value_column = (obj_type == DATA_OBJ_T) ? COL_META_DATA_ATTR_VALUE : COL_META_COLL_ATTR_VALUE;
+	genQueryInp_t in_query;
+	int success_code = InitGenQuery (&in_query, 0, NULL);
+
+	if (success_code == 0)
+		{
+			success_code = AddSelectClausesToQuery (&in_query, select_columns_p);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = AddSearchConditionsToQuery (&in_query, conditions_p, key_column, value_column, pool_p);
+		}
+
+	if (success_code == 0)
+		{
+			/* Data objects have a row per replica, so keep track of the ones we've already added */
+			apr_hash_t *seen_ids_p = apr_hash_make (pool_p);
+			bool loop_flag = true;
+
+			status = APR_SUCCESS;
+
+			while (loop_flag)
+				{
+					int query_status = 0;
+					genQueryOut_t *results_p = ExecuteGenQueryWithStatus (rods_connection_p, &in_query, &query_status, pool_p);
+
+					loop_flag = false;
+
+					if (results_p)
+						{
+							int j;
+
+							for (j = 0; j < results_p -> rowCnt; ++ j)
+								{
+									const char *id_s = results_p -> sqlResult [0].value + (j * results_p -> sqlResult [0].len);
+
+									if (!apr_hash_get (seen_ids_p, id_s, APR_HASH_KEY_STRING))
+										{
+											IRodsObjectNode *node_p = NULL;
+
+											if (obj_type == DATA_OBJ_T)
+												{
+													const char *data_name_s = results_p -> sqlResult [1].value + (j * results_p -> sqlResult [1].len);
+													const char *collection_s = results_p -> sqlResult [2].value + (j * results_p -> sqlResult [2].len);
+													const char *owner_s = results_p -> sqlResult [3].value + (j * results_p -> sqlResult [3].len);
+													const char *resource_s = results_p -> sqlResult [4].value + (j * results_p -> sqlResult [4].len);
+													const char *modified_s = results_p -> sqlResult [5].value + (j * results_p -> sqlResult [5].len);
+													const char *size_s = results_p -> sqlResult [6].value + (j * results_p -> sqlResult [6].len);
+													const char *checksum_s = results_p -> sqlResult [7].value + (j * results_p -> sqlResult [7].len);
+
+													node_p = AllocateIRodsObjectNode (DATA_OBJ_T, id_s, data_name_s, collection_s, owner_s, resource_s, modified_s, (rodsLong_t) atoll (size_s), checksum_s, pool_p);
+												}
+											else
+												{
+													const char *collection_s = results_p -> sqlResult [1].value + (j * results_p -> sqlResult [1].len);
+													const char *owner_s = results_p -> sqlResult [2].value + (j * results_p -> sqlResult [2].len);
+													const char *modified_s = results_p -> sqlResult [3].value + (j * results_p -> sqlResult [3].len);
+
+													node_p = AllocateIRodsObjectNode (COLL_OBJ_T, id_s, NULL, collection_s, owner_s, NULL, modified_s, 0, NULL, pool_p);
+												}
+
+											if (node_p)
+												{
+													if (*current_node_pp)
+														{
+															(*current_node_pp) -> ion_next_p = node_p;
+														}
+													else
+														{
+															*root_node_pp = node_p;
+														}
+
+													*current_node_pp = node_p;
+
+													apr_hash_set (seen_ids_p, node_p -> ion_object_p -> io_id_s, APR_HASH_KEY_STRING, node_p);
+												}
+											else
+												{
+													ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to allocate node for id \"%s\"", id_s);
+												}
+
+										}		/* if (!apr_hash_get (seen_ids_p, id_s, APR_HASH_KEY_STRING)) */
+
+								}		/* for (j = 0; j < results_p -> rowCnt; ++ j) */
+
+							/* Are there more results to get? */
+							if (results_p -> continueInx > 0)
+								{
+									in_query.continueInx = results_p -> continueInx;
+									loop_flag = true;
+								}
+
+							freeGenQueryOut (&results_p);
+						}		/* if (results_p) */
+					else if (query_status != CAT_NO_ROWS_FOUND)
+						{
+							status = APR_EGENERAL;
+						}
+
+				}		/* while (loop_flag) */
+
+		}		/* if (success_code == 0) */
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to build metadata search query");
+		}
+
+	ClearPooledMemoryFromGenQuery (&in_query);
+	clearGenQueryInp (&in_query);
+
+	return status;
+}
+
+
+apr_status_t GetCollectionListingUsingSpecificQuery (const char *query_s, const char *collection_s, IRodsObjectNode **root_node_pp, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	const char *args_ss [1];
+
+	args_ss [0] = collection_s;
+
+	return RunListingSpecificQuery (query_s, args_ss, 1, true, root_node_pp, rods_connection_p, pool_p);
+}
+
+
+/*
+ * Run a specific query whose rows have the columns
+ *
+ * 		object type, id, data name, collection name, owner, resource, modify time, size, checksum
+ *
+ * optionally followed by the attribute name, value and units of one of
+ * the object's AVUs. The objects are added to the list in the order that
+ * they first appear. Data objects with replicas on different resources
+ * get a node for each resource when metadata_flag is true, as with the
+ * standard listings, and are collapsed into a single node otherwise,
+ * as with the standard search results.
+ */
+static apr_status_t RunListingSpecificQuery (const char *query_s, const char **args_ss, const int num_args, const bool metadata_flag, IRodsObjectNode **root_node_pp, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_EGENERAL;
+	const int num_columns = metadata_flag ? 12 : 9;
+	apr_hash_t *nodes_p = apr_hash_make (pool_p);
+	IRodsObjectNode *root_node_p = NULL;
+	IRodsObjectNode *current_node_p = NULL;
+	specificQueryInp_t in_query;
+	int success_code = InitSpecificQuery (&in_query, 0, NULL);
+
+	if ((success_code == 0) && nodes_p)
+		{
+			bool loop_flag = true;
+			int i;
+
+			in_query.sql = apr_pstrdup (pool_p, query_s);
+
+			for (i = 0; i < num_args; ++ i)
+				{
+					in_query.args [i] = apr_pstrdup (pool_p, args_ss [i]);
+				}
+
+			status = APR_SUCCESS;
+
+			while (loop_flag)
+				{
+					int query_status = 0;
+					genQueryOut_t *results_p = ExecuteSpecificQuery (rods_connection_p, &in_query, &query_status, pool_p);
+
+					loop_flag = false;
+
+					if (results_p)
+						{
+							if (results_p -> attriCnt >= num_columns)
+								{
+									int j;
+
+									for (j = 0; j < results_p -> rowCnt; ++ j)
+										{
+											const char *values_ss [12];
+											const char *node_key_s;
+											IRodsObjectNode *node_p;
+											int k;
+
+											for (k = 0; k < num_columns; ++ k)
+												{
+													values_ss [k] = results_p -> sqlResult [k].value + (j * results_p -> sqlResult [k].len);
+												}
+
+											node_key_s = metadata_flag ? apr_pstrcat (pool_p, values_ss [0], ".", values_ss [1], ":", values_ss [5], NULL) : apr_pstrcat (pool_p, values_ss [0], ".", values_ss [1], NULL);
+											node_p = (IRodsObjectNode *) apr_hash_get (nodes_p, node_key_s, APR_HASH_KEY_STRING);
+
+											if (!node_p)
+												{
+													const objType_t obj_type = (objType_t) atoi (values_ss [0]);
+
+													if (obj_type == DATA_OBJ_T)
+														{
+															node_p = AllocateIRodsObjectNode (DATA_OBJ_T, values_ss [1], values_ss [2], values_ss [3], values_ss [4], values_ss [5], values_ss [6], (rodsLong_t) atoll (values_ss [7]), values_ss [8], pool_p);
+														}
+													else
+														{
+															node_p = AllocateIRodsObjectNode (COLL_OBJ_T, values_ss [1], NULL, values_ss [3], values_ss [4], NULL, values_ss [6], 0, NULL, pool_p);
+														}
+
+													if (node_p)
+														{
+															if (metadata_flag)
+																{
+																	/* An empty array stops the listing from querying for the AVUs again */
+																	node_p -> ion_object_p -> io_metadata_p = apr_array_make (pool_p, S_INITIAL_ARRAY_SIZE, sizeof (IrodsMetadata *));
+																}
+
+															if (current_node_p)
+																{
+																	current_node_p -> ion_next_p = node_p;
+																}
+															else
+																{
+																	root_node_p = node_p;
+																}
+
+															current_node_p = node_p;
+															apr_hash_set (nodes_p, node_key_s, APR_HASH_KEY_STRING, node_p);
+														}
+													else
+														{
+															ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to allocate node for id \"%s\"", values_ss [1]);
+															status = APR_ENOMEM;
+														}
+												}		/* if (!node_p) */
+
+											if (node_p && metadata_flag && (* (values_ss [9]) != '\0') && (node_p -> ion_object_p -> io_metadata_p))
+												{
+													IrodsMetadata *metadata_p = AllocateIrodsMetadata (values_ss [9], values_ss [10], values_ss [11], pool_p);
+
+													if (metadata_p)
+														{
+															APR_ARRAY_PUSH (node_p -> ion_object_p -> io_metadata_p, IrodsMetadata *) = metadata_p;
+														}
+													else
+														{
+															status = APR_ENOMEM;
+														}
+												}
+
+										}		/* for (j = 0; j < results_p -> rowCnt; ++ j) */
+
+									/* Are there more results to get? */
+									if ((results_p -> continueInx > 0) && (status == APR_SUCCESS))
+										{
+											in_query.continueInx = results_p -> continueInx;
+											loop_flag = true;
+										}
+
+								}		/* if (results_p -> attriCnt >= num_columns) */
+							else
+								{
+									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Specific query \"%s\" returns %d columns instead of %d", query_s, results_p -> attriCnt, num_columns);
+									status = APR_EGENERAL;
+								}
+
+							/* If we are stopping early, let the server close the query */
+							if ((!loop_flag) && (results_p -> continueInx > 0))
+								{
+									genQueryOut_t *close_results_p = NULL;
+
+									in_query.continueInx = results_p -> continueInx;
+									in_query.maxRows = 0;
+									rcSpecificQuery (rods_connection_p, &in_query, &close_results_p);
+
+									if (close_results_p)
+										{
+											freeGenQueryOut (&close_results_p);
+										}
+								}
+
+							freeGenQueryOut (&results_p);
+						}		/* if (results_p) */
+					else if (query_status != CAT_NO_ROWS_FOUND)
+						{
+							status = APR_EGENERAL;
+						}
+
+				}		/* while (loop_flag) */
+
+		}		/* if ((success_code == 0) && nodes_p) */
+
+	clearKeyVal (& (in_query.condInput));
+
+	if (status == APR_SUCCESS)
+		{
+			if (metadata_flag)
+				{
+					IRodsObjectNode *node_p;
+
+					for (node_p = root_node_p; node_p; node_p = node_p -> ion_next_p)
+						{
+							SortIRodsMetadataArray (node_p -> ion_object_p -> io_metadata_p, CompareIrodsMetadata);
+						}
+				}
+
+			*root_node_pp = root_node_p;
+		}
+	else if (root_node_p)
+		{
+			FreeIRodsObjectNodeList (root_node_p);
+		}
+
+	return status;
+}
+
+
+apr_status_t GetCollectionListingPage (const char *collection_s, ListingPage *page_p, IRodsObjectNode **root_node_pp, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	const apr_size_t offset = page_p -> lp_page_index * page_p -> lp_page_size;
+	apr_size_t num_collections = 0;
+	ListingEntries entries;
+	apr_status_t status;
+
+	InitListingEntries (&entries, NULL, NULL);
+
+	/* Ask for one more row than is needed to see if there is a next page */
+	entries.le_num_rows_wanted = page_p -> lp_page_size + 1;
+
+	*root_node_pp = NULL;
+	page_p -> lp_has_more_flag = false;
+
+	/*
+	 * Collections are listed before data objects so we need to know how
+	 * many there are to work out where the page starts in each of them.
+	 */
+	status = CountChildCollections (collection_s, &num_collections, rods_connection_p, pool_p);
+
+	if (status == APR_SUCCESS)
+		{
+			apr_size_t data_offset = 0;
+
+			if (offset < num_collections)
+				{
+					status = AddListingPageEntries (collection_s, COLL_OBJ_T, page_p, offset, &entries, rods_connection_p, pool_p);
+				}
+			else
+				{
+					data_offset = offset - num_collections;
+				}
+
+			if ((status == APR_SUCCESS) && (entries.le_num_rows_wanted > 0))
+				{
+					status = AddListingPageEntries (collection_s, DATA_OBJ_T, page_p, data_offset, &entries, rods_connection_p, pool_p);
+				}
+		}
+
+	if (status == APR_SUCCESS)
+		{
+			if (entries.le_num_rows_wanted == 0)
+				{
+					/* Remove the entry for the extra row, unless it was a replica that was skipped */
+					if (entries.le_last_row_added_flag)
+						{
+							IRodsObjectNode *node_p = entries.le_root_node_p;
+							IRodsObjectNode *prev_node_p = NULL;
+
+							while (node_p -> ion_next_p)
+								{
+									prev_node_p = node_p;
+									node_p = node_p -> ion_next_p;
+								}
+
+							if (prev_node_p)
+								{
+									prev_node_p -> ion_next_p = NULL;
+								}
+							else
+								{
+									entries.le_root_node_p = NULL;
+								}
+
+							FreeIRodsObjectNode (node_p);
+						}
+
+					page_p -> lp_has_more_flag = true;
+				}
+
+			*root_node_pp = entries.le_root_node_p;
+		}
+	else
+		{
+			if (entries.le_root_node_p)
+				{
+					FreeIRodsObjectNodeList (entries.le_root_node_p);
+				}
+
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, status, pool_p, "Failed to get page %" APR_SIZE_T_FMT " of \"%s\" from the iCAT, sorting it in memory instead", page_p -> lp_page_index + 1, collection_s);
+
+			status = GetCollectionListingPageInMemory (collection_s, page_p, root_node_pp, rods_connection_p, pool_p);
+		}
+
+	return status;
+}
+
+
+apr_status_t GetCollectionListingPageUsingSpecificQuery (const char *query_s, const char *collection_s, ListingPage *page_p, IRodsObjectNode **root_node_pp, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = GetCollectionListingUsingSpecificQuery (query_s, collection_s, root_node_pp, rods_connection_p, pool_p);
+
+	if (status == APR_SUCCESS)
+		{
+			status = GetListingPageFromNodes (root_node_pp, page_p, pool_p);
+		}
+
+	return status;
+}
+
+
+apr_status_t ForEachCollectionListingBatch (const char *collection_s, const ListingPage *page_p, apr_status_t (*batch_fn) (IRodsObjectNode *root_node_p, void *data_p), void *data_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	ListingEntries entries;
+	apr_status_t status;
+
+	InitListingEntries (&entries, batch_fn, data_p);
+
+	/*
+	 * Each query is only run once and read until the end, so unlike
+	 * getting each page in turn there is no need to count the collections
+	 * or have the iCAT skip over the earlier rows again.
+	 */
+	status = AddListingPageEntries (collection_s, COLL_OBJ_T, page_p, 0, &entries, rods_connection_p, pool_p);
+
+	if (status == APR_SUCCESS)
+		{
+			status = AddListingPageEntries (collection_s, DATA_OBJ_T, page_p, 0, &entries, rods_connection_p, pool_p);
+		}
+
+	return status;
+}
+
+
+static void InitListingEntries (ListingEntries *entries_p, apr_status_t (*batch_fn) (IRodsObjectNode *root_node_p, void *data_p), void *data_p)
+{
+	entries_p -> le_root_node_p = NULL;
+	entries_p -> le_current_node_p = NULL;
+	entries_p -> le_num_rows_wanted = 0;
+	entries_p -> le_last_row_added_flag = false;
+	* (entries_p -> le_last_data_id_s) = '\0';
+	entries_p -> le_batch_fn = batch_fn;
+	entries_p -> le_batch_data_p = data_p;
+}
+
+
+static apr_status_t CountChildCollections (const char *collection_s, apr_size_t *num_collections_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_EGENERAL;
+	const char *condition_s = GetQuotedValue (collection_s, SO_EQUALS, pool_p);
+	genQueryInp_t in_query;
+	int success_code = InitGenQuery (&in_query, 0, NULL);
+
+	*num_collections_p = 0;
+
+	if (success_code == 0)
+		{
+			success_code = addInxIval (& (in_query.selectInp), COL_COLL_ID, SELECT_COUNT);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = condition_s ? addInxVal (& (in_query.sqlCondInp), COL_COLL_PARENT_NAME, condition_s) : -1;
+		}
+
+	/* The root collection is its own parent */
+	if ((success_code == 0) && (strcmp (collection_s, "/") == 0))
+		{
+			success_code = addInxVal (& (in_query.sqlCondInp), COL_COLL_NAME, "<> '/'");
+		}
+
+	if (success_code == 0)
+		{
+			int query_status = 0;
+			genQueryOut_t *results_p = ExecuteGenQueryWithStatus (rods_connection_p, &in_query, &query_status, pool_p);
+
+			if (results_p)
+				{
+					if ((results_p -> rowCnt == 1) && (results_p -> attriCnt == 1))
+						{
+							*num_collections_p = (apr_size_t) atoll (results_p -> sqlResult [0].value);
+							status = APR_SUCCESS;
+						}
+
+					freeGenQueryOut (&results_p);
+				}
+			else if (query_status == CAT_NO_ROWS_FOUND)
+				{
+					status = APR_SUCCESS;
+				}
+		}
+
+	ClearPooledMemoryFromGenQuery (&in_query);
+	clearGenQueryInp (&in_query);
+
+	return status;
+}
+
+
+/*
+ * Get the entries of one type in a collection, starting at the given row
+ * offset, with the iCAT doing the sorting, until the wanted number of rows
+ * have been got or there are no more. When the replicas are collapsed, the
+ * rows for the other replicas of the previous data object still count
+ * towards the rows that are got, so that each page covers a fixed range of
+ * rows and the pages never overlap.
+ */
+static apr_status_t AddListingPageEntries (const char *collection_s, const objType_t obj_type, const ListingPage *page_p, const apr_size_t offset, ListingEntries *entries_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_EGENERAL;
+	const bool data_flag = (obj_type == DATA_OBJ_T);
+	const bool all_rows_flag = (entries_p -> le_batch_fn != NULL);
+	const int data_columns_p [] = { COL_D_DATA_ID, COL_DATA_NAME, COL_COLL_NAME, COL_D_OWNER_NAME, COL_D_RESC_NAME, COL_D_MODIFY_TIME, COL_DATA_SIZE, COL_D_DATA_CHECKSUM, -1 };
+	const int collection_columns_p [] = { COL_COLL_ID, COL_COLL_NAME, COL_COLL_OWNER_NAME, COL_COLL_MODIFY_TIME, -1 };
+	const int *columns_p = data_flag ? data_columns_p : collection_columns_p;
+	const int name_column = data_flag ? COL_DATA_NAME : COL_COLL_NAME;
+
+	/*
+	 * Without the resource, the replicas of a data object are normally
+	 * identical so the iCAT's distinct rows collapse them into one.
+	 */
+	const bool collapse_flag = data_flag && (page_p -> lp_collapse_replicas_flag);
+
+	/*
+	 * To spot a replica of the last data object on the previous page,
+	 * start a row early and only use that row for its id.
+	 */
+	bool look_back_flag = collapse_flag && (offset > 0);
+	const int sort_column = GetListingSortColumn (obj_type, page_p -> lp_sort_key);
+	const int order_flag = page_p -> lp_descending_flag ? ORDER_BY_DESC : ORDER_BY;
+	const char *condition_s = GetQuotedValue (collection_s, SO_EQUALS, pool_p);
+	genQueryInp_t in_query;
+	int success_code = InitGenQuery (&in_query, 0, NULL);
+
+	if (success_code == 0)
+		{
+			apr_size_t num_rows = all_rows_flag ? MAX_SQL_ROWS : entries_p -> le_num_rows_wanted + (look_back_flag ? 1 : 0);
+
+			in_query.maxRows = (num_rows < MAX_SQL_ROWS) ? (int) num_rows : MAX_SQL_ROWS;
+			in_query.rowOffset = (int) (look_back_flag ? offset - 1 : offset);
+
+			success_code = addInxIval (& (in_query.selectInp), sort_column, order_flag);
+		}
+
+	/* Break any ties by name so that the pages are stable */
+	if ((success_code == 0) && (sort_column != name_column))
+		{
+			success_code = addInxIval (& (in_query.selectInp), name_column, order_flag);
+		}
+
+	if (success_code == 0)
+		{
+			const int *column_p;
+
+			for (column_p = columns_p; (*column_p != -1) && (success_code == 0); ++ column_p)
+				{
+					if ((*column_p != sort_column) && (*column_p != name_column) && (! (collapse_flag && (*column_p == COL_D_RESC_NAME))))
+						{
+							success_code = addInxIval (& (in_query.selectInp), *column_p, 1);
+						}
+				}
+		}
+
+	if (success_code == 0)
+		{
+			success_code = condition_s ? addInxVal (& (in_query.sqlCondInp), data_flag ? COL_COLL_NAME : COL_COLL_PARENT_NAME, condition_s) : -1;
+		}
+
+	/* The root collection is its own parent */
+	if ((success_code == 0) && (!data_flag) && (strcmp (collection_s, "/") == 0))
+		{
+			success_code = addInxVal (& (in_query.sqlCondInp), COL_COLL_NAME, "<> '/'");
+		}
+
+	/* Let the iCAT filter out the replicas on other resources */
+	if ((success_code == 0) && data_flag && (page_p -> lp_resources_ss))
+		{
+			const char *resources_condition_s = GetResourcesCondition (page_p -> lp_resources_ss, pool_p);
+
+			success_code = resources_condition_s ? addInxVal (& (in_query.sqlCondInp), COL_D_RESC_NAME, resources_condition_s) : -1;
+		}
+
+	if (success_code == 0)
+		{
+			bool loop_flag = true;
+
+			status = APR_SUCCESS;
+
+			while (loop_flag)
+				{
+					int query_status = 0;
+					genQueryOut_t *results_p = ExecuteGenQueryWithStatus (rods_connection_p, &in_query, &query_status, pool_p);
+
+					loop_flag = false;
+
+					if (results_p)
+						{
+							int j;
+
+							for (j = 0; (j < results_p -> rowCnt) && (all_rows_flag || (entries_p -> le_num_rows_wanted > 0)) && (status == APR_SUCCESS); ++ j)
+								{
+									const char *id_s = GetQueryResultValue (results_p, data_flag ? COL_D_DATA_ID : COL_COLL_ID, j);
+									const char *coll_s = GetQueryResultValue (results_p, COL_COLL_NAME, j);
+									IRodsObjectNode *node_p = NULL;
+
+									/*
+									 * Replicas that differ, e.g. a stale one with an older modify time,
+									 * still get rows of their own so skip any that are next to each other.
+									 */
+									const bool duplicate_flag = collapse_flag && IsReplicaOfPreviousDataObject (entries_p -> le_last_data_id_s, id_s);
+
+									if (look_back_flag)
+										{
+											/* This row is only used for its id */
+											look_back_flag = false;
+										}
+									else
+										{
+											if (duplicate_flag)
+												{
+													/* nothing to add */
+												}
+											else if (data_flag)
+												{
+													const char *size_s = GetQueryResultValue (results_p, COL_DATA_SIZE, j);
+
+													node_p = AllocateIRodsObjectNode (obj_type, id_s, GetQueryResultValue (results_p, COL_DATA_NAME, j), coll_s,
+														GetQueryResultValue (results_p, COL_D_OWNER_NAME, j), GetQueryResultValue (results_p, COL_D_RESC_NAME, j),
+														GetQueryResultValue (results_p, COL_D_MODIFY_TIME, j), size_s ? atoll (size_s) : 0, GetQueryResultValue (results_p, COL_D_DATA_CHECKSUM, j), pool_p);
+												}
+											else
+												{
+													node_p = AllocateIRodsObjectNode (obj_type, id_s, NULL, coll_s, GetQueryResultValue (results_p, COL_COLL_OWNER_NAME, j),
+														NULL, GetQueryResultValue (results_p, COL_COLL_MODIFY_TIME, j), 0, NULL, pool_p);
+												}
+
+											if (node_p)
+												{
+													if (entries_p -> le_current_node_p)
+														{
+															entries_p -> le_current_node_p -> ion_next_p = node_p;
+														}
+													else
+														{
+															entries_p -> le_root_node_p = node_p;
+														}
+
+													entries_p -> le_current_node_p = node_p;
+												}
+											else if (!duplicate_flag)
+												{
+													status = APR_ENOMEM;
+												}
+
+											entries_p -> le_last_row_added_flag = (node_p != NULL);
+
+											if (!all_rows_flag)
+												{
+													-- (entries_p -> le_num_rows_wanted);
+												}
+										}
+
+									if (collapse_flag)
+										{
+											apr_cpystrn (entries_p -> le_last_data_id_s, id_s ? id_s : "", NAME_LEN);
+										}
+								}		/* for (j = 0; (j < results_p -> rowCnt) && (all_rows_flag || (entries_p -> le_num_rows_wanted > 0)) && (status == APR_SUCCESS); ++ j) */
+
+							/* Hand over this batch of entries */
+							if (all_rows_flag && (entries_p -> le_root_node_p))
+								{
+									if (status == APR_SUCCESS)
+										{
+											status = entries_p -> le_batch_fn (entries_p -> le_root_node_p, entries_p -> le_batch_data_p);
+										}
+
+									FreeIRodsObjectNodeList (entries_p -> le_root_node_p);
+									entries_p -> le_root_node_p = NULL;
+									entries_p -> le_current_node_p = NULL;
+								}
+
+							/* Are there more results to get? */
+							if (results_p -> continueInx > 0)
+								{
+									if ((status == APR_SUCCESS) && (all_rows_flag || (entries_p -> le_num_rows_wanted > 0)))
+										{
+											in_query.continueInx = results_p -> continueInx;
+											loop_flag = true;
+										}
+									else
+										{
+											CloseGenQuery (&in_query, results_p -> continueInx, rods_connection_p);
+										}
+								}
+
+							freeGenQueryOut (&results_p);
+						}		/* if (results_p) */
+					else if (query_status != CAT_NO_ROWS_FOUND)
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get the %s in \"%s\" from row %" APR_SIZE_T_FMT ", error %d", data_flag ? "data objects" : "collections", collection_s, offset, query_status);
+							status = APR_EGENERAL;
+						}
+
+				}		/* while (loop_flag) */
+
+		}		/* if (success_code == 0) */
+
+	ClearPooledMemoryFromGenQuery (&in_query);
+	clearGenQueryInp (&in_query);
+
+	return status;
+}
+
+
+static int GetListingSortColumn (const objType_t obj_type, const ListingSortKey key)
+{
+	int column;
+
+	if (obj_type == DATA_OBJ_T)
+		{
+			switch (key)
+				{
+					case LSK_SIZE:
+						column = COL_DATA_SIZE;
+						break;
+
+					case LSK_DATE:
+						column = COL_D_MODIFY_TIME;
+						break;
+
+					case LSK_OWNER:
+						column = COL_D_OWNER_NAME;
+						break;
+
+					default:
+						column = COL_DATA_NAME;
+						break;
+				}
+		}
+	else
+		{
+			/* Collections don't have a size so they are sorted by name instead */
+			switch (key)
+				{
+					case LSK_DATE:
+						column = COL_COLL_MODIFY_TIME;
+						break;
+
+					case LSK_OWNER:
+						column = COL_COLL_OWNER_NAME;
+						break;
+
+					default:
+						column = COL_COLL_NAME;
+						break;
+				}
+		}
+
+	return column;
+}
+
+
+/*
+ * Since the order of the select columns depends upon the sort
+ * key, find the values by their column rather than by position.
+ */
+static const char *GetQueryResultValue (const genQueryOut_t *results_p, const int column, const int row)
+{
+	const char *value_s = NULL;
+	int i;
+
+	for (i = 0; i < results_p -> attriCnt; ++ i)
+		{
+			if (results_p -> sqlResult [i].attriInx == column)
+				{
+					value_s = results_p -> sqlResult [i].value + (row * results_p -> sqlResult [i].len);
+					break;
+				}
+		}
+
+	return value_s;
+}
+
+
+/*
+ * Get the GenQuery condition that matches any of the given resources.
+ */
+static char *GetResourcesCondition (char **resources_ss, apr_pool_t *pool_p)
+{
+	char *condition_s = NULL;
+
+	if (*resources_ss)
+		{
+			if (* (resources_ss + 1))
+				{
+					char **resource_ss;
+
+					condition_s = apr_pstrcat (pool_p, "in ('", *resources_ss, "'", NULL);
+
+					for (resource_ss = resources_ss + 1; (*resource_ss) && condition_s; ++ resource_ss)
+						{
+							condition_s = apr_pstrcat (pool_p, condition_s, ", '", *resource_ss, "'", NULL);
+						}
+
+					if (condition_s)
+						{
+							condition_s = apr_pstrcat (pool_p, condition_s, ")", NULL);
+						}
+				}
+			else
+				{
+					condition_s = GetQuotedValue (*resources_ss, SO_EQUALS, pool_p);
+				}
+		}
+
+	return condition_s;
+}
+
+
+/*
+ * Let the server know that we have finished with a query
+ * before all of its results have been got.
+ */
+static void CloseGenQuery (genQueryInp_t *query_p, const int continue_index, rcComm_t *rods_connection_p)
+{
+	genQueryOut_t *close_results_p = NULL;
+
+	query_p -> continueInx = continue_index;
+	query_p -> maxRows = 0;
+	rcGenQuery (rods_connection_p, query_p, &close_results_p);
+
+	if (close_results_p)
+		{
+			freeGenQueryOut (&close_results_p);
+		}
+}
+
+
+/*
+ * The search specific query matches the value with "like", so escape
+ * the wildcards for equality searches and add them for "like" searches,
+ * as GetQuotedValue does.
+ */
+static char *GetSpecificQuerySearchPattern (const char *value_s, const SearchOperator op, apr_pool_t *pool_p)
+{
+	char *pattern_s = NULL;
+
+	if (op == SO_LIKE)
+		{
+			pattern_s = apr_pstrcat (pool_p, "%", value_s, "%", NULL);
+		}
+	else
+		{
+			pattern_s = (char *) apr_palloc (pool_p, (2 * strlen (value_s) + 1) * sizeof (char));
+
+			if (pattern_s)
+				{
+					const char *src_p = value_s;
+					char *dest_p = pattern_s;
+
+					while (*src_p != '\0')
+						{
+							if ((*src_p == '%') || (*src_p == '_') || (*src_p == '\\'))
+								{
+									*dest_p = '\\';
+									++ dest_p;
+								}
+
+							*dest_p = *src_p;
+							++ dest_p;
+							++ src_p;
+						}
+
+					*dest_p = '\0';
+				}
+		}
+
+	return pattern_s;
+}
+
+
+/*
+ * Add a name/value pair of where clauses for each of the search conditions.
+ */
+static int AddSearchConditionsToQuery (genQueryInp_t *query_p, const apr_array_header_t *conditions_p, const int key_column, const int value_column, apr_pool_t *pool_p)
+{
+	int success_code = 0;
+
+	if (conditions_p)
+		{
+			int i;
+
+			for (i = 0; (i < conditions_p -> nelts) && (success_code == 0); ++ i)
+				{
+					const MetadataSearchCondition *condition_p = & (APR_ARRAY_IDX (conditions_p, i, MetadataSearchCondition));
+					char *key_s = GetQuotedValue (condition_p -> msc_key_s, SO_EQUALS, pool_p);
+					char *value_s = GetQuotedValue (condition_p -> msc_value_s, condition_p -> msc_op, pool_p);
+
+					if (key_s && value_s)
+						{
+							success_code = addInxVal (& (query_p -> sqlCondInp), key_column, key_s);
+
+							if (success_code == 0)
+								{
+									success_code = addInxVal (& (query_p -> sqlCondInp), value_column, value_s);
+								}
+						}
+					else
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to create search clause for \"%s\" \"%s\"", condition_p -> msc_key_s, condition_p -> msc_value_s);
+							success_code = -1;
+						}
+				}
+		}
+
+	return success_code;
+}
+
+
+apr_array_header_t *GetMetadataFacetCounts (const char *key_s, const apr_array_header_t *conditions_p, const char *specific_query_s, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	/*
+	 * Rather than searching for each value in turn and counting the hits, we
+	 * get the iCAT to do the grouping and counting for us, e.g.
+	 *
+	 * 		iquest "SELECT META_DATA_ATTR_VALUE, COUNT(DATA_ID) WHERE META_DATA_ATTR_NAME = 'species'
+	 * 			AND META_DATA_ATTR_NAME = 'year' AND META_DATA_ATTR_VALUE n>= '2018'"
+	 *
+	 * The facet key is added as the first where clause so that the selected
+	 * value comes from the facet's AVU rather than from one of the filters.
+	 */
+	apr_array_header_t *facets_array_p = apr_array_make (pool_p, S_INITIAL_ARRAY_SIZE, sizeof (MetadataFacetCount *));
+	apr_hash_t *facets_p = apr_hash_make (pool_p);
+
+	if (facets_array_p && facets_p)
+		{
+			bool done_flag = false;
+
+			/*
+			 * GenQuery can only COUNT rows, so each replica of a data object, and each
+			 * AVU that matches more than once, adds to the counts. A registered specific
+			 * query can use COUNT (DISTINCT ...) instead but, since it can only take fixed
+			 * arguments, it is only used when there are no filters.
+			 */
+			if (specific_query_s && ((!conditions_p) || (conditions_p -> nelts == 0)))
+				{
+					if (AddFacetCountsUsingSpecificQuery (specific_query_s, key_s, facets_p, facets_array_p, rods_connection_p, pool_p) == APR_SUCCESS)
+						{
+							done_flag = true;
+						}
+					else
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, APR_EGENERAL, pool_p, "Failed to get counts for facet \"%s\" with specific query \"%s\", using GenQuery instead", key_s, specific_query_s);
+
+							apr_hash_clear (facets_p);
+							apr_array_clear (facets_array_p);
+						}
+				}
+
+			if (!done_flag)
+				{
+					if (AddFacetCounts (key_s, conditions_p, DATA_OBJ_T, facets_p, facets_array_p, rods_connection_p, pool_p) == APR_SUCCESS)
+						{
+							if (AddFacetCounts (key_s, conditions_p, COLL_OBJ_T, facets_p, facets_array_p, rods_connection_p, pool_p) == APR_SUCCESS)
+								{
+									done_flag = true;
+								}
+							else
+								{
+									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get collection counts for facet \"%s\"", key_s);
+								}
+						}
+					else
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get data object counts for facet \"%s\"", key_s);
+						}
+				}
+
+			if (done_flag)
+				{
+					if (facets_array_p -> nelts > 1)
+						{
+							qsort (facets_array_p -> elts, facets_array_p -> nelts, sizeof (MetadataFacetCount *), CompareMetadataFacetCounts);
+						}
+				}
+			else
+				{
+					facets_array_p = NULL;
+				}
+		}
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to allocate facet counts for \"%s\"", key_s);
+			facets_array_p = NULL;
+		}
+
+	return facets_array_p;
+}
+
+
+static apr_status_t AddFacetCounts (const char *key_s, const apr_array_header_t *conditions_p, const objType_t obj_type, apr_hash_t *facets_p, apr_array_header_t *facets_array_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_EGENERAL;
+	const int key_column = (obj_type == DATA_OBJ_T) ? COL_META_DATA_ATTR_NAME : COL_META_COLL_ATTR_NAME;
+	const int value_column = (obj_type == DATA_OBJ_T) ? COL_META_DATA_ATTR_VALUE : COL_META_COLL_ATTR_VALUE;
+	const int id_column = (obj_type == DATA_OBJ_T) ? COL_D_DATA_ID : COL_COLL_ID;
+	char *quoted_key_s = GetQuotedValue (key_s, SO_EQUALS, pool_p);
+	genQueryInp_t in_query;
+	int success_code = InitGenQuery (&in_query, 0, NULL);
+
+	if (success_code == 0)
+		{
+			success_code = addInxIval (& (in_query.selectInp), value_column, 1);
+		}
+
+	/* The iCAT groups the rows by the value and sends back one count for each */
+	if (success_code == 0)
+		{
+			success_code = addInxIval (& (in_query.selectInp), id_column, SELECT_COUNT);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = quoted_key_s ? addInxVal (& (in_query.sqlCondInp), key_column, quoted_key_s) : -1;
+		}
+
+	if (success_code == 0)
+		{
+			success_code = AddSearchConditionsToQuery (&in_query, conditions_p, key_column, value_column, pool_p);
+		}
+
+	if (success_code == 0)
+		{
+			bool loop_flag = true;
+
+			status = APR_SUCCESS;
+
+			while (loop_flag)
+				{
+					int query_status = 0;
+					genQueryOut_t *results_p = ExecuteGenQueryWithStatus (rods_connection_p, &in_query, &query_status, pool_p);
+
+					loop_flag = false;
+
+					if (results_p)
+						{
+							int j;
+
+							for (j = 0; (j < results_p -> rowCnt) && (status == APR_SUCCESS); ++ j)
+								{
+									const char *value_s = results_p -> sqlResult [0].value + (j * results_p -> sqlResult [0].len);
+									const char *count_s = results_p -> sqlResult [1].value + (j * results_p -> sqlResult [1].len);
+									MetadataFacetCount *facet_p = GetFacetCount (value_s, facets_p, facets_array_p, pool_p);
+
+									if (facet_p)
+										{
+											const rodsLong_t count = (rodsLong_t) atoll (count_s);
+
+											if (obj_type == DATA_OBJ_T)
+												{
+													facet_p -> mfc_num_data_objects += count;
+												}
+											else
+												{
+													facet_p -> mfc_num_collections += count;
+												}
+										}
+									else
+										{
+											status = APR_ENOMEM;
+										}
+
+								}		/* for (j = 0; (j < results_p -> rowCnt) && (status == APR_SUCCESS); ++ j) */
+
+							/* Are there more results to get? */
+							if ((results_p -> continueInx > 0) && (status == APR_SUCCESS))
+								{
+									in_query.continueInx = results_p -> continueInx;
+									loop_flag = true;
+								}
+
+							freeGenQueryOut (&results_p);
+						}		/* if (results_p) */
+					else if (query_status != CAT_NO_ROWS_FOUND)
+						{
+							status = APR_EGENERAL;
+						}
+
+				}		/* while (loop_flag) */
+
+		}		/* if (success_code == 0) */
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to build facet query for \"%s\"", key_s);
+		}
+
+	ClearPooledMemoryFromGenQuery (&in_query);
+	clearGenQueryInp (&in_query);
+
+	return status;
+}
+
+
+/*
+ * The specific query takes the facet key as its only argument and returns
+ * a row for each value of the key for data objects and for collections,
+ * with the object type (1 for data objects, 2 for collections), the value
+ * and the number of distinct objects of that type that have it.
+ */
+static apr_status_t AddFacetCountsUsingSpecificQuery (const char *query_s, const char *key_s, apr_hash_t *facets_p, apr_array_header_t *facets_array_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_EGENERAL;
+	const int num_columns = 3;
+	specificQueryInp_t in_query;
+	int success_code = InitSpecificQuery (&in_query, 0, NULL);
+
+	if (success_code == 0)
+		{
+			bool loop_flag = true;
+
+			in_query.sql = apr_pstrdup (pool_p, query_s);
+			in_query.args [0] = apr_pstrdup (pool_p, key_s);
+
+			status = APR_SUCCESS;
+
+			while (loop_flag)
+				{
+					int query_status = 0;
+					genQueryOut_t *results_p = ExecuteSpecificQuery (rods_connection_p, &in_query, &query_status, pool_p);
+
+					loop_flag = false;
+
+					if (results_p)
+						{
+							if (results_p -> attriCnt >= num_columns)
+								{
+									int j;
+
+									for (j = 0; (j < results_p -> rowCnt) && (status == APR_SUCCESS); ++ j)
+										{
+											const char *type_s = results_p -> sqlResult [0].value + (j * results_p -> sqlResult [0].len);
+											const char *value_s = results_p -> sqlResult [1].value + (j * results_p -> sqlResult [1].len);
+											const char *count_s = results_p -> sqlResult [2].value + (j * results_p -> sqlResult [2].len);
+											MetadataFacetCount *facet_p = GetFacetCount (value_s, facets_p, facets_array_p, pool_p);
+
+											if (facet_p)
+												{
+													const rodsLong_t count = (rodsLong_t) atoll (count_s);
+
+													if ((objType_t) atoi (type_s) == DATA_OBJ_T)
+														{
+															facet_p -> mfc_num_data_objects += count;
+														}
+													else
+														{
+															facet_p -> mfc_num_collections += count;
+														}
+												}
+											else
+												{
+													status = APR_ENOMEM;
+												}
+										}
+
+									/* Are there more results to get? */
+									if ((results_p -> continueInx > 0) && (status == APR_SUCCESS))
+										{
+											in_query.continueInx = results_p -> continueInx;
+											loop_flag = true;
+										}
+
+								}		/* if (results_p -> attriCnt >= num_columns) */
+							else
+								{
+									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Specific query \"%s\" returns %d columns instead of %d", query_s, results_p -> attriCnt, num_columns);
+									status = APR_EGENERAL;
+								}
+
+							/* If we are stopping early, let the server close the query */
+							if ((!loop_flag) && (results_p -> continueInx > 0))
+								{
+									genQueryOut_t *close_results_p = NULL;
+
+									in_query.continueInx = results_p -> continueInx;
+									in_query.maxRows = 0;
+									rcSpecificQuery (rods_connection_p, &in_query, &close_results_p);
+
+									if (close_results_p)
+										{
+											freeGenQueryOut (&close_results_p);
+										}
+								}
+
+							freeGenQueryOut (&results_p);
+						}		/* if (results_p) */
+					else if (query_status != CAT_NO_ROWS_FOUND)
+						{
+							status = APR_EGENERAL;
+						}
+
+				}		/* while (loop_flag) */
+
+		}		/* if (success_code == 0) */
+
+	clearKeyVal (& (in_query.condInput));
+
+	return status;
+}
+
+
+static MetadataFacetCount *GetFacetCount (const char *value_s, apr_hash_t *facets_p, apr_array_header_t *facets_array_p, apr_pool_t *pool_p)
+{
+	MetadataFacetCount *facet_p = (MetadataFacetCount *) apr_hash_get (facets_p, value_s, APR_HASH_KEY_STRING);
+
+	if (!facet_p)
+		{
+			facet_p = (MetadataFacetCount *) apr_pcalloc (pool_p, sizeof (MetadataFacetCount));
+
+			if (facet_p)
+				{
+					facet_p -> mfc_value_s = apr_pstrdup (pool_p, value_s);
+
+					apr_hash_set (facets_p, facet_p -> mfc_value_s, APR_HASH_KEY_STRING, facet_p);
+					APR_ARRAY_PUSH (facets_array_p, MetadataFacetCount *) = facet_p;
+				}
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to allocate facet count for \"%s\"", value_s);
+				}
+		}
+
+	return facet_p;
+}
+
+
+static int CompareMetadataFacetCounts (const void *v0_p, const void *v1_p)
+{
+	const MetadataFacetCount *facet_0_p = * ((const MetadataFacetCount **) v0_p);
+	const MetadataFacetCount *facet_1_p = * ((const MetadataFacetCount **) v1_p);
+
+	return strcmp (facet_0_p -> mfc_value_s, facet_1_p -> mfc_value_s);
+}
+
+
+/*
+ * Get a human-readable version of the search conditions, with each key and value
+ * escaped and wrapped in prefix_s and suffix_s.
+ */
+static char *GetSearchConditionsAsString (const apr_array_header_t *conditions_p, const char *prefix_s, const char *suffix_s, apr_pool_t *pool_p)
+{
+	char *result_s = "";
+	int i;
+
+	for (i = 0; (i < conditions_p -> nelts) && result_s; ++ i)
+		{
+			const MetadataSearchCondition *condition_p = & (APR_ARRAY_IDX (conditions_p, i, MetadataSearchCondition));
+			const char *op_s = NULL;
+
+			switch (condition_p -> msc_op)
+				{
+					case SO_LESS_THAN:
+						op_s = "&lt;";
+						break;
+
+					case SO_LESS_THAN_OR_EQUALS:
+						op_s = "&lt;=";
+						break;
+
+					case SO_GREATER_THAN:
+						op_s = "&gt;";
+						break;
+
+					case SO_GREATER_THAN_OR_EQUALS:
+						op_s = "&gt;=";
+						break;
+
+					case SO_LIKE:
+						op_s = "like";
+						break;
+
+					default:
+						op_s = "=";
+						break;
+				}
+
+			result_s = apr_pstrcat (pool_p, result_s, (i > 0) ? " and " : "",
+				prefix_s, ap_escape_html (pool_p, condition_p -> msc_key_s), suffix_s, " ", op_s, " ",
+				prefix_s, ap_escape_html (pool_p, condition_p -> msc_value_s), suffix_s, NULL);
+		}
+
+	return result_s;
+}
+
+
+
+apr_status_t GetMetadataTableForId (char *id_s, davrods_dir_conf_t *config_p, rcComm_t *connection_p, request_rec *req_p, apr_pool_t *pool_p, apr_bucket_brigade *bucket_brigade_p, OutputFormat format, const int editable_flag)
+{
+	apr_status_t status = APR_EGENERAL;
+	apr_array_header_t *metadata_array_p = GetMetadataArrayForId (id_s, connection_p, req_p, pool_p);
+
+	if (metadata_array_p)
+		{
+			const char *content_type_s = "text/html";
+
+			switch (format)
+			{
+				case OF_JSON:
+					status = GetMetadataArrayAsJSON (metadata_array_p, bucket_brigade_p);
+					content_type_s = CONTENT_TYPE_JSON_S;
+					break;
+
+				case OF_TSV:
+					status = GetMetadataArrayAsColumnData (metadata_array_p, bucket_brigade_p, "\t");
+					break;
+
+				case OF_CSV:
+					status = GetMetadataArrayAsColumnData (metadata_array_p, bucket_brigade_p, ", ");
+					break;
+
+				case OF_JSON_LINES:
+					status = GetMetadataArrayAsJSONLines (metadata_array_p, bucket_brigade_p);
+					content_type_s = "application/x-ndjson";
+					break;
+
+				case OF_HTML:
+				default:
+					{
+						char *metadata_link_s = GetDavrodsAPIPath (NULL, config_p, req_p);
+
+						status = PrintMetadata (id_s, metadata_array_p, config_p -> theme_p, editable_flag, bucket_brigade_p, metadata_link_s, pool_p);
+					}
+					break;
+			}
+
+			ap_set_content_type (req_p, content_type_s);
+		}
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to get metadata array for id \"%s\"", id_s);
+		}
+
+	return status;
+}
+
+
+
+apr_array_header_t *GetMetadataArrayForId (char *id_s, rcComm_t *connection_p, request_rec *req_p, apr_pool_t *pool_p)
+{
+	apr_array_header_t *metadata_array_p = NULL;
+	objType_t obj_type = UNKNOWN_OBJ_T;
+
+	char *child_id_s = GetId (id_s, &obj_type, pool_p);
+
+	if (child_id_s)
+		{
+			char *zone_s = NULL;
+			char *minor_id_s = (char *) GetMinorId (child_id_s);
+
+			if (minor_id_s)
+				{
+					metadata_array_p = GetMetadataAsArray (connection_p, obj_type, minor_id_s, NULL, zone_s, pool_p);
+
+					if (!metadata_array_p)
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to get metadata array for minor id \"%s\"", child_id_s);
+						}
+
+				}
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to get minor id value from \"%s\"", child_id_s);
+				}
+
+		}
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to create id value for \"%s\"", req_p -> unparsed_uri);
+		}
+
+	return metadata_array_p;
+}
+
+
+
+
+json_t *GetIrodsMetadataAsJSON (const IrodsMetadata *metadata_p)
+{
+	json_t *avu_p = json_pack ("{s:s,s:s}", "attribute", metadata_p -> im_key_s, "value", metadata_p -> im_value_s);
+
+	if (avu_p)
+		{
+			if ((metadata_p -> im_units_s) && (strlen (metadata_p -> im_units_s) > 0))
+				{
+					if (json_object_set_new (avu_p, "units", json_string (metadata_p -> im_units_s)) != 0)
+						{
+							json_decref (avu_p);
+							avu_p = NULL;
+						}
+				}
+		}
+
+	return avu_p;
+}
+
+
+json_t *GetMetadataArrayAsJSONArray (const apr_array_header_t *metadata_array_p)
+{
+	json_t *avus_p = json_array ();
+
+	if (avus_p)
+		{
+			int i;
+
+			for (i = 0; i < metadata_array_p -> nelts; ++ i)
+				{
+					const IrodsMetadata *metadata_p = APR_ARRAY_IDX (metadata_array_p, i, IrodsMetadata *);
+					json_t *avu_p = GetIrodsMetadataAsJSON (metadata_p);
+
+					if ((!avu_p) || (json_array_append_new (avus_p, avu_p) != 0))
+						{
+							json_decref (avus_p);
+							avus_p = NULL;
+							i = metadata_array_p -> nelts;
+						}
+				}
+		}
+
+	return avus_p;
+}
+
+
+static apr_status_t GetMetadataArrayAsJSON (apr_array_header_t *metadata_array_p, apr_bucket_brigade *bucket_brigade_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	if (metadata_array_p -> nelts > 0)
+		{
+			json_t *avus_p = GetMetadataArrayAsJSONArray (metadata_array_p);
+
+			status = APR_ENOMEM;
+
+			if (avus_p)
+				{
+					char *avus_s = json_dumps (avus_p, JSON_INDENT (2) | JSON_PRESERVE_ORDER);
+
+					if (avus_s)
+						{
+							status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "%s\n", avus_s);
+							free (avus_s);
+						}
+
+					json_decref (avus_p);
+				}
+
+		}		/* if (metadata_array_p -> nelts > 0) */
+
+	return status;
+}
+
+
+static apr_status_t GetMetadataArrayAsJSONLines (apr_array_header_t *metadata_array_p, apr_bucket_brigade *bucket_brigade_p)
+{
+	apr_status_t status = APR_SUCCESS;
+	int i;
+
+	for (i = 0; (i < metadata_array_p -> nelts) && (status == APR_SUCCESS); ++ i)
+		{
+			const IrodsMetadata *metadata_p = APR_ARRAY_IDX (metadata_array_p, i, IrodsMetadata *);
+			json_t *avu_p = GetIrodsMetadataAsJSON (metadata_p);
+
+			status = APR_ENOMEM;
+
+			if (avu_p)
+				{
+					char *line_s = json_dumps (avu_p, JSON_COMPACT | JSON_PRESERVE_ORDER);
+
+					if (line_s)
+						{
+							status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "%s\n", line_s);
+							free (line_s);
+						}
+
+					json_decref (avu_p);
+				}
+
+		}		/* for (i = 0; (i < metadata_array_p -> nelts) && (status == APR_SUCCESS); ++ i) */
+
+	return status;
+}
+
+
+static apr_status_t GetMetadataArrayAsColumnData (apr_array_header_t *metadata_array_p, apr_bucket_brigade *bucket_brigade_p, const char * const sep_s)
+{
+	apr_status_t status = APR_SUCCESS;
+	const int last_index = metadata_array_p -> nelts;
+
+	if (last_index >= 0)
+		{
+			int i;
+
+			for (i = 0; i < last_index; ++ i)
+				{
+					const IrodsMetadata *metadata_p = APR_ARRAY_IDX (metadata_array_p, i, IrodsMetadata *);
+
+					status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "\"%s\"%s\"%s\"", metadata_p -> im_key_s, sep_s, metadata_p -> im_value_s);
+
+					if (status == APR_SUCCESS)
+						{
+							if ((metadata_p -> im_units_s) && (strlen (metadata_p -> im_units_s) > 0))
+								{
+									status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "%s\"%s\"", sep_s, metadata_p -> im_units_s);
+								}
+
+							if (status == APR_SUCCESS)
+								{
+									status = apr_brigade_puts (bucket_brigade_p, NULL, NULL, "\n");
+								}
+						}
+
+					if (status != APR_SUCCESS)
+						{
+							i = last_index;
+						}
+
+				}		/* for (i = 0; i < last_index; ++ i */
+
+		}		/* if (size > 0) */
+
+	return status;
+}
+
+
+apr_status_t ExportMetadataForCollectionTree (const char *collection_s, const OutputFormat format, const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s, rcComm_t *rods_connection_p, request_rec *req_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	apr_pool_t *pool_p = req_p -> pool;
+	apr_bucket_brigade *bb_p = NULL;
+
+	if (IsPathSafeForQuery (collection_s))
+		{
+			bb_p = apr_brigade_create (pool_p, req_p -> connection -> bucket_alloc);
+		}
+	else
+		{
+			ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "Cannot export metadata for \"%s\" since it contains a quote", collection_s);
+			status = APR_BADARG;
+		}
+
+	if (bb_p)
+		{
+			char *prefix_s = apr_pstrdup (pool_p, collection_s);
+
+			if (prefix_s)
+				{
+					MetadataExport export;
+					SubtreeQueries subtrees;
+					size_t l = strlen (prefix_s);
+					bool subtrees_flag = false;
+
+					while ((l > 0) && (* (prefix_s + l - 1) == '/'))
+						{
+							-- l;
+							* (prefix_s + l) = '\0';
+						}
+
+					memset (&export, 0, sizeof (MetadataExport));
+					export.me_req_p = req_p;
+					export.me_bb_p = bb_p;
+					export.me_format = format;
+					export.me_prefix_s = prefix_s;
+					export.me_prefix_length = l;
+
+					/*
+					 * If the subcollections can be exported at the same time, each one
+					 * has a query for its collections followed later by one for its
+					 * data objects. These are started now so that they are running
+					 * while the collection itself is being exported.
+					 */
+					if (OpenSubtreeQueries (&subtrees, prefix_s, l, 2, conf_p, username_s, password_s, rods_connection_p, pool_p))
+						{
+							const size_t num_subtrees = (size_t) (subtrees.sq_subtrees_p -> nelts);
+							int success_code = 0;
+							size_t i;
+
+							for (i = 0; (i < num_subtrees) && (success_code == 0); ++ i)
+								{
+									const char *subtree_s = APR_ARRAY_IDX (subtrees.sq_subtrees_p, i, const char *);
+									const size_t subtree_length = strlen (subtree_s);
+
+									success_code = BuildMetadataExportQuery ((subtrees.sq_queries_p) + i, COLL_OBJ_T, subtree_s, subtree_length, QS_TREE, pool_p);
+
+									if (success_code == 0)
+										{
+											success_code = BuildMetadataExportQuery ((subtrees.sq_queries_p) + num_subtrees + i, DATA_OBJ_T, subtree_s, subtree_length, QS_TREE, pool_p);
+										}
+								}
+
+							if (success_code == 0)
+								{
+									StartSubtreeQueries (&subtrees, pool_p);
+									subtrees_flag = true;
+								}
+							else
+								{
+									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to build the subcollection export queries for \"%s\", using a single query instead", prefix_s);
+									CloseSubtreeQueries (&subtrees);
+								}
+						}
+
+					status = APR_SUCCESS;
+
+					if (format == OF_CSV)
+						{
+							status = apr_brigade_puts (bb_p, ap_filter_flush, req_p -> output_filters, "type,path,key,value,units\n");
+						}
+
+					/*
+					 * Export the collection itself, then all of the collections below it,
+					 * then the data objects directly within it and finally all of the
+					 * data objects further down the tree.
+					 */
+					if (status == APR_SUCCESS)
+						{
+							status = ExportMetadataForQuery (&export, COLL_OBJ_T, QS_COLLECTION, rods_connection_p, pool_p);
+						}
+
+					if (status == APR_SUCCESS)
+						{
+							status = subtrees_flag ? ExportMetadataForSubtrees (&export, COLL_OBJ_T, &subtrees, 0, pool_p) : ExportMetadataForQuery (&export, COLL_OBJ_T, QS_BELOW, rods_connection_p, pool_p);
+						}
+
+					if (status == APR_SUCCESS)
+						{
+							status = ExportMetadataForQuery (&export, DATA_OBJ_T, QS_COLLECTION, rods_connection_p, pool_p);
+						}
+
+					if (status == APR_SUCCESS)
+						{
+							status = subtrees_flag ? ExportMetadataForSubtrees (&export, DATA_OBJ_T, &subtrees, (size_t) (subtrees.sq_subtrees_p -> nelts), pool_p) : ExportMetadataForQuery (&export, DATA_OBJ_T, QS_BELOW, rods_connection_p, pool_p);
+						}
+
+					if (subtrees_flag)
+						{
+							CloseSubtreeQueries (&subtrees);
+						}
+
+					if (export.me_object_p)
+						{
+							if (status == APR_SUCCESS)
+								{
+									status = ExportJSONLine (&export);
+								}
+							else
+								{
+									json_decref (export.me_object_p);
+								}
+						}
+
+					if (status != APR_SUCCESS)
+						{
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Metadata export for \"%s\" did not complete", collection_s);
+						}
+
+					/* Close the stream even upon failure so the client gets a terminated response */
+					CloseBucketsStream (bb_p);
+
+					if (ap_pass_brigade (req_p -> output_filters, bb_p) != APR_SUCCESS)
+						{
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, req_p, "Failed to close metadata export stream for \"%s\"", collection_s);
+						}
+
+				}		/* if (prefix_s) */
+
+			apr_brigade_destroy (bb_p);
+		}		/* if (bb_p) */
+
+	return status;
+}
+
+
+static apr_status_t ExportMetadataForQuery (MetadataExport *export_p, const objType_t obj_type, const QueryScope scope, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_EGENERAL;
+	genQueryInp_t in_query;
+	int success_code = BuildMetadataExportQuery (&in_query, obj_type, export_p -> me_prefix_s, export_p -> me_prefix_length, scope, pool_p);
+
+	if (success_code == 0)
+		{
+			QueryPageSource source;
+
+			memset (&source, 0, sizeof (QueryPageSource));
+			source.qps_query_p = &in_query;
+			source.qps_connection_p = rods_connection_p;
+
+			status = ExportMetadataPages (export_p, obj_type, export_p -> me_prefix_s, export_p -> me_prefix_length, scope, &source, pool_p);
+		}
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to build metadata export query for \"%s\"", export_p -> me_prefix_s);
+		}
+
+	ClearPooledMemoryFromGenQuery (&in_query);
+	clearGenQueryInp (&in_query);
+
+	return status;
+}
+
+
+static apr_status_t ExportMetadataForSubtrees (MetadataExport *export_p, const objType_t obj_type, SubtreeQueries *subtrees_p, const size_t first_query, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+	int i;
+
+	for (i = 0; (i < subtrees_p -> sq_subtrees_p -> nelts) && (status == APR_SUCCESS); ++ i)
+		{
+			const char *subtree_s = APR_ARRAY_IDX (subtrees_p -> sq_subtrees_p, i, const char *);
+			QueryPageSource source;
+
+			SetSubtreeQueryPageSource (&source, subtrees_p, first_query + i);
+			status = ExportMetadataPages (export_p, obj_type, subtree_s, strlen (subtree_s), QS_TREE, &source, pool_p);
+		}
+
+	return status;
+}
+
+
+/*
+ * Keep the pages small and order the rows so that all
+ * of an object's AVUs are next to each other.
+ */
+static int BuildMetadataExportQuery (genQueryInp_t *query_p, const objType_t obj_type, const char *prefix_s, const size_t prefix_length, const QueryScope scope, apr_pool_t *pool_p)
+{
+	const bool data_flag = (obj_type == DATA_OBJ_T);
+	const char *condition_s = GetCollectionScopeCondition (prefix_s, prefix_length, scope, pool_p);
+	int success_code = InitGenQuery (query_p, 0, NULL);
+
+	if (success_code == 0)
+		{
+			query_p -> maxRows = S_EXPORT_ROWS_PER_PAGE;
+			success_code = addInxIval (& (query_p -> selectInp), COL_COLL_NAME, ORDER_BY);
+		}
+
+	if ((success_code == 0) && data_flag)
+		{
+			success_code = addInxIval (& (query_p -> selectInp), COL_DATA_NAME, ORDER_BY);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = addInxIval (& (query_p -> selectInp), data_flag ? COL_META_DATA_ATTR_NAME : COL_META_COLL_ATTR_NAME, 1);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = addInxIval (& (query_p -> selectInp), data_flag ? COL_META_DATA_ATTR_VALUE : COL_META_COLL_ATTR_VALUE, 1);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = addInxIval (& (query_p -> selectInp), data_flag ? COL_META_DATA_ATTR_UNITS : COL_META_COLL_ATTR_UNITS, 1);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = condition_s ? addInxVal (& (query_p -> sqlCondInp), COL_COLL_NAME, condition_s) : -1;
+		}
+
+	return success_code;
+}
+
+
+static apr_status_t ExportMetadataPages (MetadataExport *export_p, const objType_t obj_type, const char *prefix_s, const size_t prefix_length, const QueryScope scope, QueryPageSource *source_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	const bool data_flag = (obj_type == DATA_OBJ_T);
+	const char *type_s = data_flag ? "data_object" : "collection";
+	const int key_index = data_flag ? 2 : 1;
+	apr_pool_t *page_pool_p = NULL;
+
+	if (apr_pool_create (&page_pool_p, pool_p) == APR_SUCCESS)
+		{
+			bool loop_flag = true;
+
+			status = APR_SUCCESS;
+
+			while (loop_flag)
+				{
+					int query_status = 0;
+					genQueryOut_t *results_p = GetNextQueryPage (source_p, &query_status, page_pool_p);
+
+					loop_flag = false;
+
+					if (results_p)
+						{
+							int j;
+
+							for (j = 0; (j < results_p -> rowCnt) && (status == APR_SUCCESS); ++ j)
+								{
+									const char *coll_s = results_p -> sqlResult [0].value + (j * results_p -> sqlResult [0].len);
+
+									/*
+									 * The like clause also matches the root collection itself when
+									 * exporting from "/", and an '_' in the path would match any
+									 * character, so check that this really is within the scope.
+									 */
+									if (IsCollectionInScope (coll_s, prefix_s, prefix_length, scope))
+										{
+											const char *key_s = results_p -> sqlResult [key_index].value + (j * results_p -> sqlResult [key_index].len);
+											const char *value_s = results_p -> sqlResult [key_index + 1].value + (j * results_p -> sqlResult [key_index + 1].len);
+											const char *units_s = results_p -> sqlResult [key_index + 2].value + (j * results_p -> sqlResult [key_index + 2].len);
+											const char *path_s = coll_s;
+
+											if (data_flag)
+												{
+													const char *data_s = results_p -> sqlResult [1].value + (j * results_p -> sqlResult [1].len);
+
+													path_s = (strcmp (coll_s, "/") == 0) ? apr_pstrcat (page_pool_p, coll_s, data_s, NULL) : apr_pstrcat (page_pool_p, coll_s, "/", data_s, NULL);
+												}
+
+											status = ExportAVU (export_p, type_s, path_s, key_s, value_s, units_s);
+										}
+
+								}		/* for (j = 0; (j < results_p -> rowCnt) && (status == APR_SUCCESS); ++ j) */
+
+							/* Send this page to the client before getting the next one */
+							if (status == APR_SUCCESS)
+								{
+									status = ap_fflush (export_p -> me_req_p -> output_filters, export_p -> me_bb_p);
+								}
+
+							loop_flag = MoveToNextQueryPage (source_p, results_p, (status == APR_SUCCESS));
+
+							freeGenQueryOut (&results_p);
+						}		/* if (results_p) */
+					else if (query_status != CAT_NO_ROWS_FOUND)
+						{
+							status = APR_EGENERAL;
+						}
+
+					/* Only keep the memory for a single page at a time */
+					apr_pool_clear (page_pool_p);
+				}		/* while (loop_flag) */
+
+			apr_pool_destroy (page_pool_p);
+		}		/* if (apr_pool_create (&page_pool_p, pool_p) == APR_SUCCESS) */
+
+	return status;
+}
+
+
+apr_status_t ForEachDataObjectInCollectionTree (const char *collection_s, apr_status_t (*object_fn) (const IRodsObject *irods_obj_p, void *data_p, apr_pool_t *pool_p), void *data_p, const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	char *prefix_s = apr_pstrdup (pool_p, collection_s);
+
+	if (prefix_s)
+		{
+			SubtreeQueries subtrees;
+			size_t l = strlen (prefix_s);
+			bool subtrees_flag = false;
+
+			while ((l > 0) && (* (prefix_s + l - 1) == '/'))
+				{
+					-- l;
+					* (prefix_s + l) = '\0';
+				}
+
+			/*
+			 * If the subcollections can be walked at the same time, start their
+			 * queries now so that they are running while the data objects directly
+			 * within the collection are being done.
+			 */
+			if (OpenSubtreeQueries (&subtrees, prefix_s, l, 1, conf_p, username_s, password_s, rods_connection_p, pool_p))
+				{
+					int success_code = 0;
+					int i;
+
+					for (i = 0; (i < subtrees.sq_subtrees_p -> nelts) && (success_code == 0); ++ i)
+						{
+							const char *subtree_s = APR_ARRAY_IDX (subtrees.sq_subtrees_p, i, const char *);
+
+							success_code = BuildDataObjectsQuery ((subtrees.sq_queries_p) + i, subtree_s, strlen (subtree_s), QS_TREE, pool_p);
+						}
+
+					if (success_code == 0)
+						{
+							StartSubtreeQueries (&subtrees, pool_p);
+							subtrees_flag = true;
+						}
+					else
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to build the subcollection data object queries for \"%s\", using a single query instead", prefix_s);
+							CloseSubtreeQueries (&subtrees);
+						}
+				}
+
+			/*
+			 * Do the data objects directly within the collection
+			 * and then all of those further down the tree.
+			 */
+			status = ForEachDataObjectForQuery (prefix_s, l, QS_COLLECTION, object_fn, data_p, rods_connection_p, pool_p);
+
+			if (status == APR_SUCCESS)
+				{
+					if (subtrees_flag)
+						{
+							int i;
+
+							for (i = 0; (i < subtrees.sq_subtrees_p -> nelts) && (status == APR_SUCCESS); ++ i)
+								{
+									const char *subtree_s = APR_ARRAY_IDX (subtrees.sq_subtrees_p, i, const char *);
+									QueryPageSource source;
+
+									SetSubtreeQueryPageSource (&source, &subtrees, i);
+									status = ForEachDataObjectInPages (&source, subtree_s, strlen (subtree_s), QS_TREE, object_fn, data_p, pool_p);
+								}
+						}
+					else
+						{
+							status = ForEachDataObjectForQuery (prefix_s, l, QS_BELOW, object_fn, data_p, rods_connection_p, pool_p);
+						}
+				}
+
+			if (subtrees_flag)
+				{
+					CloseSubtreeQueries (&subtrees);
+				}
+		}
+
+	return status;
+}
+
+
+apr_status_t ForEachDataObjectInCollection (const char *collection_s, apr_status_t (*object_fn) (const IRodsObject *irods_obj_p, void *data_p, apr_pool_t *pool_p), void *data_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	char *prefix_s = apr_pstrdup (pool_p, collection_s);
+
+	if (prefix_s)
+		{
+			size_t l = strlen (prefix_s);
+
+			while ((l > 0) && (* (prefix_s + l - 1) == '/'))
+				{
+					-- l;
+					* (prefix_s + l) = '\0';
+				}
+
+			status = ForEachDataObjectForQuery (prefix_s, l, QS_COLLECTION, object_fn, data_p, rods_connection_p, pool_p);
+		}
+
+	return status;
+}
+
+
+static apr_status_t ForEachDataObjectForQuery (const char *prefix_s, const size_t prefix_length, const QueryScope scope, apr_status_t (*object_fn) (const IRodsObject *irods_obj_p, void *data_p, apr_pool_t *pool_p), void *data_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = IsPathSafeForQuery (prefix_s) ? APR_EGENERAL : APR_BADARG;
+	genQueryInp_t in_query;
+	int success_code = BuildDataObjectsQuery (&in_query, prefix_s, prefix_length, scope, pool_p);
+
+	if (success_code == 0)
+		{
+			QueryPageSource source;
+
+			memset (&source, 0, sizeof (QueryPageSource));
+			source.qps_query_p = &in_query;
+			source.qps_connection_p = rods_connection_p;
+
+			status = ForEachDataObjectInPages (&source, prefix_s, prefix_length, scope, object_fn, data_p, pool_p);
+		}
+	else if (status == APR_BADARG)
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Cannot query the data objects in \"%s\" since it contains a quote", prefix_s);
+		}
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to build data object query for \"%s\"", prefix_s);
+		}
+
+	ClearPooledMemoryFromGenQuery (&in_query);
+	clearGenQueryInp (&in_query);
+
+	return status;
+}
+
+
+/*
+ * Order the rows so that the output is stable and so
+ * that any replicas of a data object are next to each other.
+ */
+static int BuildDataObjectsQuery (genQueryInp_t *query_p, const char *prefix_s, const size_t prefix_length, const QueryScope scope, apr_pool_t *pool_p)
+{
+	const char *condition_s = GetCollectionScopeCondition (prefix_s, prefix_length, scope, pool_p);
+	int success_code = InitGenQuery (query_p, 0, NULL);
+
+	if (success_code == 0)
+		{
+			query_p -> maxRows = S_EXPORT_ROWS_PER_PAGE;
+			success_code = addInxIval (& (query_p -> selectInp), COL_COLL_NAME, ORDER_BY);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = addInxIval (& (query_p -> selectInp), COL_DATA_NAME, ORDER_BY);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = addInxIval (& (query_p -> selectInp), COL_D_DATA_ID, 1);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = addInxIval (& (query_p -> selectInp), COL_DATA_SIZE, 1);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = addInxIval (& (query_p -> selectInp), COL_D_DATA_CHECKSUM, 1);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = condition_s ? addInxVal (& (query_p -> sqlCondInp), COL_COLL_NAME, condition_s) : -1;
+		}
+
+	return success_code;
+}
+
+
+static apr_status_t ForEachDataObjectInPages (QueryPageSource *source_p, const char *prefix_s, const size_t prefix_length, const QueryScope scope, apr_status_t (*object_fn) (const IRodsObject *irods_obj_p, void *data_p, apr_pool_t *pool_p), void *data_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	apr_pool_t *page_pool_p = NULL;
+	apr_pool_t *object_pool_p = NULL;
+
+	if (apr_pool_create (&page_pool_p, pool_p) == APR_SUCCESS)
+		{
+			if (apr_pool_create (&object_pool_p, pool_p) == APR_SUCCESS)
+				{
+					/*
+					 * The object is held back until the next row so that it can be
+					 * merged with any further replicas, since these only get rows of
+					 * their own when their size or checksum differs.
+					 */
+					IRodsObject irods_obj;
+					bool held_flag = false;
+					bool loop_flag = true;
+
+					memset (&irods_obj, 0, sizeof (IRodsObject));
+					status = APR_SUCCESS;
+
+					while (loop_flag)
+						{
+							int query_status = 0;
+							genQueryOut_t *results_p = GetNextQueryPage (source_p, &query_status, page_pool_p);
+
+							loop_flag = false;
+
+							if (results_p)
+								{
+									int j;
+
+									for (j = 0; (j < results_p -> rowCnt) && (status == APR_SUCCESS); ++ j)
+										{
+											const char *coll_s = GetQueryResultValue (results_p, COL_COLL_NAME, j);
+
+											/* As with the metadata export, an '_' in the like clause matches any character */
+											if (coll_s && IsCollectionInScope (coll_s, prefix_s, prefix_length, scope))
+												{
+													const char *id_s = GetQueryResultValue (results_p, COL_D_DATA_ID, j);
+													const char *checksum_s = GetQueryResultValue (results_p, COL_D_DATA_CHECKSUM, j);
+
+													if (held_flag && IsReplicaOfPreviousDataObject (irods_obj.io_id_s, id_s))
+														{
+															if (ShouldUseReplicaChecksum (irods_obj.io_checksum_s, checksum_s))
+																{
+																	irods_obj.io_checksum_s = apr_pstrdup (object_pool_p, checksum_s);
+																}
+														}
+													else
+														{
+															const char *size_s = GetQueryResultValue (results_p, COL_DATA_SIZE, j);
+
+															if (held_flag)
+																{
+																	status = object_fn (&irods_obj, data_p, object_pool_p);
+																	apr_pool_clear (object_pool_p);
+																	held_flag = false;
+																}
+
+															if (status == APR_SUCCESS)
+																{
+																	status = SetIRodsObject (&irods_obj, DATA_OBJ_T, id_s, GetQueryResultValue (results_p, COL_DATA_NAME, j), coll_s,
+																		NULL, NULL, NULL, size_s ? atoll (size_s) : 0, checksum_s, object_pool_p);
+
+																	held_flag = (status == APR_SUCCESS);
+																}
+														}
+
+												}		/* if (coll_s && IsCollectionInScope (coll_s, prefix_s, prefix_length, scope)) */
+
+										}		/* for (j = 0; (j < results_p -> rowCnt) && (status == APR_SUCCESS); ++ j) */
+
+									loop_flag = MoveToNextQueryPage (source_p, results_p, (status == APR_SUCCESS));
+
+									freeGenQueryOut (&results_p);
+								}		/* if (results_p) */
+							else if (query_status != CAT_NO_ROWS_FOUND)
+								{
+									status = APR_EGENERAL;
+								}
+
+							/* Only keep the memory for a single page at a time */
+							apr_pool_clear (page_pool_p);
+						}		/* while (loop_flag) */
+
+					if (held_flag && (status == APR_SUCCESS))
+						{
+							status = object_fn (&irods_obj, data_p, object_pool_p);
+						}
+
+					apr_pool_destroy (object_pool_p);
+				}		/* if (apr_pool_create (&object_pool_p, pool_p) == APR_SUCCESS) */
+
+			apr_pool_destroy (page_pool_p);
+		}		/* if (apr_pool_create (&page_pool_p, pool_p) == APR_SUCCESS) */
+
+	return status;
+}
+
+
+static char *GetCollectionScopeCondition (const char *prefix_s, const size_t prefix_length, const QueryScope scope, apr_pool_t *pool_p)
+{
+	char *condition_s = NULL;
+	const char *root_s = (prefix_length > 0) ? prefix_s : "/";
+
+	/* The path goes straight into the condition */
+	if (IsPathSafeForQuery (prefix_s))
+		{
+			switch (scope)
+			{
+				case QS_COLLECTION:
+					condition_s = apr_psprintf (pool_p, "= '%s'", root_s);
+					break;
+
+				case QS_BELOW:
+					condition_s = apr_psprintf (pool_p, "like '%s/%%'", prefix_s);
+					break;
+
+				case QS_TREE:
+					condition_s = apr_psprintf (pool_p, "= '%s' || like '%s/%%'", root_s, prefix_s);
+					break;
+
+				default:
+					break;
+			}
+		}
+
+	return condition_s;
+}
+
+
+/*
+ * Paths go straight into the conditions of GenQueries, which have no
+ * way of escaping a quote, so a path with one in can't be queried.
+ */
+static bool IsPathSafeForQuery (const char *path_s)
+{
+	return (strchr (path_s, '\'') == NULL);
+}
+
+
+/*
+ * Check that a collection returned by a query really is within its
+ * scope since an '_' in a like clause matches any character.
+ */
+static bool IsCollectionInScope (const char *coll_s, const char *prefix_s, const size_t prefix_length, const QueryScope scope)
+{
+	bool in_scope_flag = true;
+
+	if (scope != QS_COLLECTION)
+		{
+			in_scope_flag = (strncmp (coll_s, prefix_s, prefix_length) == 0) && (* (coll_s + prefix_length) == '/') && (* (coll_s + prefix_length + 1) != '\0');
+
+			/* The tree also includes the collection at its root */
+			if ((!in_scope_flag) && (scope == QS_TREE))
+				{
+					in_scope_flag = (strcmp (coll_s, (prefix_length > 0) ? prefix_s : "/") == 0);
+				}
+		}
+
+	return in_scope_flag;
+}
+
+
+static genQueryOut_t *GetNextQueryPage (QueryPageSource *source_p, int *status_p, apr_pool_t *pool_p)
+{
+	genQueryOut_t *results_p = NULL;
+
+	if (source_p -> qps_parallel_p)
+		{
+			results_p = GetNextParallelQueryPage (source_p -> qps_parallel_p, source_p -> qps_index, status_p);
+
+			if ((!results_p) && (*status_p != CAT_NO_ROWS_FOUND))
+				{
+					const char *error_s = rodsErrorName (*status_p, NULL);
+
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Parallel query %" APR_SIZE_T_FMT " failed, error: %s", source_p -> qps_index, error_s ? error_s : "unknown");
+				}
+		}
+	else
+		{
+			results_p = ExecuteGenQueryWithStatus (source_p -> qps_connection_p, source_p -> qps_query_p, status_p, pool_p);
+		}
+
+	return results_p;
+}
+
+
+/*
+ * Get ready for the next page of results if there is one and it
+ * is wanted, or else close the query. This returns true if there
+ * is another page to get.
+ */
+static bool MoveToNextQueryPage (QueryPageSource *source_p, const genQueryOut_t *results_p, const bool wanted_flag)
+{
+	bool more_flag = false;
+
+	if (source_p -> qps_parallel_p)
+		{
+			/*
+			 * The query's own connection reads the pages ahead and
+			 * it is closed by FreeParallelQueries () if it isn't
+			 * finished.
+			 */
+			more_flag = wanted_flag;
+		}
+	else if (results_p -> continueInx > 0)
+		{
+			source_p -> qps_query_p -> continueInx = results_p -> continueInx;
+
+			if (wanted_flag)
+				{
+					more_flag = true;
+				}
+			else
+				{
+					CloseGenQuery (source_p -> qps_query_p, results_p -> continueInx, source_p -> qps_connection_p);
+				}
+		}
+
+	return more_flag;
+}
+
+
+/*
+ * Get the collections directly within the root of a tree, so that the
+ * queries for each of them can be run at the same time, and make space
+ * for those queries. This returns false if there aren't enough
+ * subcollections or connections to make this worthwhile, in which case
+ * the whole tree should be queried on the request's own connection.
+ */
+static bool OpenSubtreeQueries (SubtreeQueries *subtrees_p, const char *prefix_s, const size_t prefix_length, const size_t queries_per_subtree, const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	bool success_flag = false;
+
+	memset (subtrees_p, 0, sizeof (SubtreeQueries));
+
+	if ((GetTreeWalkConnections () > 1) && conf_p && username_s && password_s && (strchr (prefix_s, '\'') == NULL))
+		{
+			apr_array_header_t *collections_p = apr_array_make (pool_p, S_INITIAL_ARRAY_SIZE, sizeof (char *));
+
+			if (collections_p)
+				{
+					const char *condition_s = apr_psprintf (pool_p, "= '%s'", (prefix_length > 0) ? prefix_s : "/");
+					genQueryInp_t in_query;
+					int success_code = InitGenQuery (&in_query, 0, NULL);
+
+					if (success_code == 0)
+						{
+							in_query.maxRows = S_EXPORT_ROWS_PER_PAGE;
+							success_code = addInxIval (& (in_query.selectInp), COL_COLL_NAME, ORDER_BY);
+						}
+
+					if (success_code == 0)
+						{
+							success_code = condition_s ? addInxVal (& (in_query.sqlCondInp), COL_COLL_PARENT_NAME, condition_s) : -1;
+						}
+
+					if (success_code == 0)
+						{
+							bool valid_flag = true;
+							bool loop_flag = true;
+
+							while (loop_flag)
+								{
+									int query_status = 0;
+									genQueryOut_t *results_p = ExecuteGenQueryWithStatus (rods_connection_p, &in_query, &query_status, pool_p);
+
+									loop_flag = false;
+
+									if (results_p)
+										{
+											int j;
+
+											for (j = 0; (j < results_p -> rowCnt) && valid_flag; ++ j)
+												{
+													const char *coll_s = GetQueryResultValue (results_p, COL_COLL_NAME, j);
+
+													/* The root collection is its own parent so make sure that this is below it */
+													if (coll_s && IsCollectionInScope (coll_s, prefix_s, prefix_length, QS_BELOW))
+														{
+															/* A quote would break the conditions in the subcollection's queries */
+															char *copied_coll_s = (strchr (coll_s, '\'') == NULL) ? apr_pstrdup (pool_p, coll_s) : NULL;
+
+															if (copied_coll_s)
+																{
+																	APR_ARRAY_PUSH (collections_p, char *) = copied_coll_s;
+																}
+															else
+																{
+																	valid_flag = false;
+																}
+														}
+												}
+
+											/* Are there more results to get? */
+											if (results_p -> continueInx > 0)
+												{
+													in_query.continueInx = results_p -> continueInx;
+
+													if (valid_flag)
+														{
+															loop_flag = true;
+														}
+													else
+														{
+															CloseGenQuery (&in_query, results_p -> continueInx, rods_connection_p);
+														}
+												}
+
+											freeGenQueryOut (&results_p);
+										}		/* if (results_p) */
+									else if (query_status != CAT_NO_ROWS_FOUND)
+										{
+											valid_flag = false;
+										}
+
+								}		/* while (loop_flag) */
+
+							if (valid_flag && (collections_p -> nelts > 1))
+								{
+									const size_t num_queries = queries_per_subtree * (size_t) (collections_p -> nelts);
+									genQueryInp_t *queries_p = (genQueryInp_t *) apr_pcalloc (pool_p, num_queries * sizeof (genQueryInp_t));
+
+									if (queries_p)
+										{
+											subtrees_p -> sq_subtrees_p = collections_p;
+											subtrees_p -> sq_queries_p = queries_p;
+											subtrees_p -> sq_num_queries = num_queries;
+											subtrees_p -> sq_conf_p = conf_p;
+											subtrees_p -> sq_username_s = username_s;
+											subtrees_p -> sq_password_s = password_s;
+											subtrees_p -> sq_connection_p = rods_connection_p;
+
+											success_flag = true;
+										}
+								}
+
+						}		/* if (success_code == 0) */
+
+					ClearPooledMemoryFromGenQuery (&in_query);
+					clearGenQueryInp (&in_query);
+				}		/* if (collections_p) */
+
+		}		/* if ((GetTreeWalkConnections () > 1) && conf_p && username_s && password_s && (strchr (prefix_s, '\'') == NULL)) */
+
+	return success_flag;
+}
+
+
+/*
+ * If the extra connections can't be made, the queries
+ * are run in turn on the request's own connection.
+ */
+static void StartSubtreeQueries (SubtreeQueries *subtrees_p, apr_pool_t *pool_p)
+{
+	subtrees_p -> sq_parallel_p = StartParallelQueries (subtrees_p -> sq_queries_p, subtrees_p -> sq_num_queries, subtrees_p -> sq_conf_p, subtrees_p -> sq_username_s, subtrees_p -> sq_password_s, pool_p);
+
+	if (! (subtrees_p -> sq_parallel_p))
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_SUCCESS, pool_p, "Running the queries for %d subcollections in turn", subtrees_p -> sq_subtrees_p -> nelts);
+		}
+}
+
+
+static void SetSubtreeQueryPageSource (QueryPageSource *source_p, SubtreeQueries *subtrees_p, const size_t index)
+{
+	memset (source_p, 0, sizeof (QueryPageSource));
+
+	source_p -> qps_query_p = (subtrees_p -> sq_queries_p) + index;
+	source_p -> qps_connection_p = subtrees_p -> sq_connection_p;
+	source_p -> qps_parallel_p = subtrees_p -> sq_parallel_p;
+	source_p -> qps_index = index;
+}
+
+
+static void CloseSubtreeQueries (SubtreeQueries *subtrees_p)
+{
+	size_t i;
+
+	/* Stop any queries that are still running before their inputs are freed */
+	if (subtrees_p -> sq_parallel_p)
+		{
+			FreeParallelQueries (subtrees_p -> sq_parallel_p);
+			subtrees_p -> sq_parallel_p = NULL;
+		}
+
+	for (i = 0; i < subtrees_p -> sq_num_queries; ++ i)
+		{
+			genQueryInp_t *query_p = (subtrees_p -> sq_queries_p) + i;
+
+			if (query_p -> sqlCondInp.value)
+				{
+					ClearPooledMemoryFromGenQuery (query_p);
+				}
+
+			clearGenQueryInp (query_p);
+		}
+}
+
+
+apr_status_t GetDataObjectMetadataTablesForCollectionTree (const char *collection_s, const char *key_condition_s, apr_hash_t *tables_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	char *prefix_s = apr_pstrdup (pool_p, collection_s);
+
+	if (prefix_s)
+		{
+			size_t l = strlen (prefix_s);
+
+			while ((l > 0) && (* (prefix_s + l - 1) == '/'))
+				{
+					-- l;
+					* (prefix_s + l) = '\0';
+				}
+
+			status = AddDataObjectMetadataTablesForQuery (prefix_s, l, false, key_condition_s, tables_p, rods_connection_p, pool_p);
+
+			if (status == APR_SUCCESS)
+				{
+					status = AddDataObjectMetadataTablesForQuery (prefix_s, l, true, key_condition_s, tables_p, rods_connection_p, pool_p);
+				}
+		}
+
+	return status;
+}
+
+
+apr_status_t GetDataObjectMetadataTablesForCollection (const char *collection_s, const char *key_condition_s, apr_hash_t *tables_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	char *prefix_s = apr_pstrdup (pool_p, collection_s);
+
+	if (prefix_s)
+		{
+			size_t l = strlen (prefix_s);
+
+			while ((l > 0) && (* (prefix_s + l - 1) == '/'))
+				{
+					-- l;
+					* (prefix_s + l) = '\0';
+				}
+
+			status = AddDataObjectMetadataTablesForQuery (prefix_s, l, false, key_condition_s, tables_p, rods_connection_p, pool_p);
+		}
+
+	return status;
+}
+
+
+static apr_status_t AddDataObjectMetadataTablesForQuery (const char *prefix_s, const size_t prefix_length, const bool subtree_flag, const char *key_condition_s, apr_hash_t *tables_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_EGENERAL;
+	const char *condition_s = NULL;
+	apr_pool_t *page_pool_p = NULL;
+	genQueryInp_t in_query;
+	int success_code = InitGenQuery (&in_query, 0, NULL);
+
+	if (!IsPathSafeForQuery (prefix_s))
+		{
+			status = APR_BADARG;
+		}
+	else if (subtree_flag)
+		{
+			condition_s = apr_psprintf (pool_p, "like '%s/%%'", prefix_s);
+		}
+	else
+		{
+			condition_s = apr_psprintf (pool_p, "= '%s'", (prefix_length > 0) ? prefix_s : "/");
+		}
+
+	if (success_code == 0)
+		{
+			in_query.maxRows = S_EXPORT_ROWS_PER_PAGE;
+			success_code = addInxIval (& (in_query.selectInp), COL_COLL_NAME, 1);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = addInxIval (& (in_query.selectInp), COL_D_DATA_ID, 1);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = addInxIval (& (in_query.selectInp), COL_META_DATA_ATTR_NAME, 1);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = addInxIval (& (in_query.selectInp), COL_META_DATA_ATTR_VALUE, 1);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = addInxIval (& (in_query.selectInp), COL_META_DATA_ATTR_UNITS, 1);
+		}
+
+	if (success_code == 0)
+		{
+			success_code = condition_s ? addInxVal (& (in_query.sqlCondInp), COL_COLL_NAME, condition_s) : -1;
+		}
+
+	if ((success_code == 0) && key_condition_s)
+		{
+			success_code = addInxVal (& (in_query.sqlCondInp), COL_META_DATA_ATTR_NAME, key_condition_s);
+		}
+
+	if ((success_code == 0) && (apr_pool_create (&page_pool_p, pool_p) == APR_SUCCESS))
+		{
+			bool loop_flag = true;
+
+			status = APR_SUCCESS;
+
+			while (loop_flag)
+				{
+					int query_status = 0;
+					genQueryOut_t *results_p = ExecuteGenQueryWithStatus (rods_connection_p, &in_query, &query_status, page_pool_p);
+
+					loop_flag = false;
+
+					if (results_p)
+						{
+							int j;
+
+							for (j = 0; (j < results_p -> rowCnt) && (status == APR_SUCCESS); ++ j)
+								{
+									const char *coll_s = GetQueryResultValue (results_p, COL_COLL_NAME, j);
+									const char *id_s = GetQueryResultValue (results_p, COL_D_DATA_ID, j);
+									bool wanted_flag = (coll_s != NULL) && (id_s != NULL);
+
+									/* As with the metadata export, an '_' in the like clause matches any character */
+									if (wanted_flag && subtree_flag)
+										{
+											wanted_flag = (strncmp (coll_s, prefix_s, prefix_length) == 0) &&
+												(* (coll_s + prefix_length) == '/') && (* (coll_s + prefix_length + 1) != '\0');
+										}
+
+									if (wanted_flag)
+										{
+											apr_table_t *table_p = (apr_table_t *) apr_hash_get (tables_p, id_s, APR_HASH_KEY_STRING);
+											IrodsMetadata *metadata_p = NULL;
+
+											if (!table_p)
+												{
+													char *copied_id_s = apr_pstrdup (pool_p, id_s);
+
+													table_p = apr_table_make (pool_p, S_INITIAL_ARRAY_SIZE);
+
+													if (copied_id_s && table_p)
+														{
+															apr_hash_set (tables_p, copied_id_s, APR_HASH_KEY_STRING, table_p);
+														}
+													else
+														{
+															table_p = NULL;
+														}
+												}
+
+											if (table_p)
+												{
+													metadata_p = AllocateIrodsMetadata (GetQueryResultValue (results_p, COL_META_DATA_ATTR_NAME, j), GetQueryResultValue (results_p, COL_META_DATA_ATTR_VALUE, j),
+														GetQueryResultValue (results_p, COL_META_DATA_ATTR_UNITS, j), pool_p);
+												}
+
+											if (metadata_p)
+												{
+													AddToTable (metadata_p, table_p, pool_p);
+												}
+											else
+												{
+													status = APR_ENOMEM;
+												}
+
+										}		/* if (wanted_flag) */
+
+								}		/* for (j = 0; (j < results_p -> rowCnt) && (status == APR_SUCCESS); ++ j) */
+
+							/* Are there more results to get? */
+							if (results_p -> continueInx > 0)
+								{
+									in_query.continueInx = results_p -> continueInx;
+
+									if (status == APR_SUCCESS)
+										{
+											loop_flag = true;
+										}
+									else
+										{
+											CloseGenQuery (&in_query, results_p -> continueInx, rods_connection_p);
+										}
+								}
+
+							freeGenQueryOut (&results_p);
+						}		/* if (results_p) */
+					else if (query_status != CAT_NO_ROWS_FOUND)
+						{
+							status = APR_EGENERAL;
+						}
+
+					apr_pool_clear (page_pool_p);
+				}		/* while (loop_flag) */
+
+			apr_pool_destroy (page_pool_p);
+		}		/* if ((success_code == 0) && (apr_pool_create (&page_pool_p, pool_p) == APR_SUCCESS)) */
+	else if (status == APR_BADARG)
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Cannot query the data object metadata in \"%s\" since it contains a quote", prefix_s);
+		}
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to build data object metadata query for \"%s\"", prefix_s);
+		}
+
+	ClearPooledMemoryFromGenQuery (&in_query);
+	clearGenQueryInp (&in_query);
+
+	return status;
+}
+
+
+char *GetCollectionTreeFingerprint (const char *collection_s, const char *ignored_data_name_s, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	char *fingerprint_s = NULL;
+	char *prefix_s = apr_pstrdup (pool_p, collection_s);
+
+	if (prefix_s)
+		{
+			const char *root_s = NULL;
+			size_t l = strlen (prefix_s);
+
+			while ((l > 0) && (* (prefix_s + l - 1) == '/'))
+				{
+					-- l;
+					* (prefix_s + l) = '\0';
+				}
+
+			root_s = (l > 0) ? prefix_s : "/";
+
+			if ((strchr (prefix_s, '\'') == NULL) && ((!ignored_data_name_s) || (strchr (ignored_data_name_s, '\'') == NULL)))
+				{
+					const int data_columns_p [] = { COL_D_MODIFY_TIME, COL_D_DATA_ID };
+					const int data_aggregates_p [] = { SELECT_MAX, SELECT_COUNT };
+					const int data_avu_columns_p [] = { COL_META_DATA_MODIFY_TIME };
+					const int coll_avu_columns_p [] = { COL_META_COLL_MODIFY_TIME };
+					const int max_aggregates_p [] = { SELECT_MAX };
+					const int root_data_where_columns_p [] = { COL_COLL_NAME, COL_DATA_NAME };
+					const int coll_where_columns_p [] = { COL_COLL_NAME };
+					const char *root_conditions_ss [] = { apr_psprintf (pool_p, "= '%s'", root_s), ignored_data_name_s ? apr_psprintf (pool_p, "<> '%s'", ignored_data_name_s) : NULL };
+					const char *below_conditions_ss [] = { apr_psprintf (pool_p, "like '%s/%%'", prefix_s) };
+					const size_t num_root_conditions = ignored_data_name_s ? 2 : 1;
+
+					/*
+					 * A single COL_COLL_NAME condition can't leave out one data object
+					 * in the root collection whilst keeping any with the same name in
+					 * the subcollections, so the root collection and those below it
+					 * are aggregated separately. The AVUs on the data objects need
+					 * their own queries too as joining them to the data objects would
+					 * skip any without AVUs and count the others once per AVU.
+					 */
+					fingerprint_s = GetAggregateValues (data_columns_p, data_aggregates_p, 2, root_data_where_columns_p, root_conditions_ss, num_root_conditions, rods_connection_p, pool_p);
+					fingerprint_s = AppendAggregateValues (fingerprint_s, data_avu_columns_p, max_aggregates_p, 1, root_data_where_columns_p, root_conditions_ss, num_root_conditions, rods_connection_p, pool_p);
+					fingerprint_s = AppendAggregateValues (fingerprint_s, data_columns_p, data_aggregates_p, 2, coll_where_columns_p, below_conditions_ss, 1, rods_connection_p, pool_p);
+					fingerprint_s = AppendAggregateValues (fingerprint_s, data_avu_columns_p, max_aggregates_p, 1, coll_where_columns_p, below_conditions_ss, 1, rods_connection_p, pool_p);
+
+					/* The newest AVU on the collection itself */
+					fingerprint_s = AppendAggregateValues (fingerprint_s, coll_avu_columns_p, max_aggregates_p, 1, coll_where_columns_p, root_conditions_ss, 1, rods_connection_p, pool_p);
+				}
+		}
+
+	return fingerprint_s;
+}
+
+
+char *GetCollectionContentsModifyTime (const char *collection_s, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	char *modify_time_s = NULL;
+
+	if (strchr (collection_s, '\'') == NULL)
+		{
+			const int columns_p [] = { COL_D_MODIFY_TIME, COL_D_DATA_ID };
+			const int aggregates_p [] = { SELECT_MAX, SELECT_COUNT };
+			const int where_columns_p [] = { COL_COLL_NAME };
+			const char *conditions_ss [] = { apr_psprintf (pool_p, "= '%s'", collection_s) };
+
+			/* The count catches a data object being removed when it isn't the newest one */
+			modify_time_s = GetAggregateValues (columns_p, aggregates_p, 2, where_columns_p, conditions_ss, 1, rods_connection_p, pool_p);
+		}
+
+	return modify_time_s;
+}
+
+
+apr_status_t ForEachCollectionFingerprintInTree (const char *collection_s, apr_status_t (*collection_fn) (const char *collection_s, const char *fingerprint_s, void *data_p, apr_pool_t *pool_p), void *data_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_EGENERAL;
+	char *prefix_s = apr_pstrdup (pool_p, collection_s);
+
+	if (prefix_s && (strchr (prefix_s, '\'') == NULL))
+		{
+			const char *condition_s = NULL;
+			size_t l = strlen (prefix_s);
+			genQueryInp_t in_query;
+			int success_code;
+
+			while ((l > 0) && (* (prefix_s + l - 1) == '/'))
+				{
+					-- l;
+					* (prefix_s + l) = '\0';
+				}
+
+			condition_s = apr_psprintf (pool_p, "= '%s' || like '%s/%%'", (l > 0) ? prefix_s : "/", prefix_s);
+			success_code = InitGenQuery (&in_query, 0, NULL);
+
+			/*
+			 * The aggregates make the iCAT group the rows by collection and, as
+			 * the collection names are ordered, they come back in the same order
+			 * as ForEachDataObjectInCollectionTree () goes through them when it
+			 * uses a single connection.
+			 */
+			if (success_code == 0)
+				{
+					in_query.maxRows = S_EXPORT_ROWS_PER_PAGE;
+					success_code = addInxIval (& (in_query.selectInp), COL_COLL_NAME, ORDER_BY);
+				}
+
+			if (success_code == 0)
+				{
+					success_code = addInxIval (& (in_query.selectInp), COL_COLL_MODIFY_TIME, 1);
+				}
+
+			if (success_code == 0)
+				{
+					success_code = addInxIval (& (in_query.selectInp), COL_D_MODIFY_TIME, SELECT_MAX);
+				}
+
+			if (success_code == 0)
+				{
+					success_code = addInxIval (& (in_query.selectInp), COL_D_DATA_ID, SELECT_COUNT);
+				}
+
+			if (success_code == 0)
+				{
+					success_code = condition_s ? addInxVal (& (in_query.sqlCondInp), COL_COLL_NAME, condition_s) : -1;
+				}
+
+			if (success_code == 0)
+				{
+					apr_pool_t *page_pool_p = NULL;
+
+					if (apr_pool_create (&page_pool_p, pool_p) == APR_SUCCESS)
+						{
+							apr_pool_t *collection_pool_p = NULL;
+
+							if (apr_pool_create (&collection_pool_p, pool_p) == APR_SUCCESS)
+								{
+									bool loop_flag = true;
+
+									status = APR_SUCCESS;
+
+									while (loop_flag)
+										{
+											int query_status = 0;
+											genQueryOut_t *results_p = ExecuteGenQueryWithStatus (rods_connection_p, &in_query, &query_status, page_pool_p);
+
+											loop_flag = false;
 
-																}		/* if (data_id_results_p -> rowCnt == 1) */
+											if (results_p)
+												{
+													int j;
+
+													for (j = 0; (j < results_p -> rowCnt) && (status == APR_SUCCESS); ++ j)
+														{
+															const char *coll_s = GetQueryResultValue (results_p, COL_COLL_NAME, j);
+															bool wanted_flag = (coll_s != NULL);
+
+															/* As with the other subtree queries, an '_' in the like clause matches any character */
+															if (wanted_flag && (l > 0) && (strcmp (coll_s, prefix_s) != 0))
+																{
+																	wanted_flag = (strncmp (coll_s, prefix_s, l) == 0) && (* (coll_s + l) == '/') && (* (coll_s + l + 1) != '\0');
+																}
+
+															if (wanted_flag)
+																{
+																	const char *coll_modify_s = GetQueryResultValue (results_p, COL_COLL_MODIFY_TIME, j);
+																	const char *data_modify_s = GetQueryResultValue (results_p, COL_D_MODIFY_TIME, j);
+																	const char *count_s = GetQueryResultValue (results_p, COL_D_DATA_ID, j);
+																	char *fingerprint_s = apr_pstrcat (collection_pool_p, coll_modify_s ? coll_modify_s : "", ":", data_modify_s ? data_modify_s : "", ":", count_s ? count_s : "", NULL);
+
+																	status = fingerprint_s ? collection_fn (coll_s, fingerprint_s, data_p, collection_pool_p) : APR_ENOMEM;
+																	apr_pool_clear (collection_pool_p);
+																}
+														}
+
+													/* Are there more results to get? */
+													if (results_p -> continueInx > 0)
+														{
+															in_query.continueInx = results_p -> continueInx;
+
+															if (status == APR_SUCCESS)
+																{
+																	loop_flag = true;
+																}
+															else
+																{
+																	CloseGenQuery (&in_query, results_p -> continueInx, rods_connection_p);
+																}
+														}
+
+													freeGenQueryOut (&results_p);
+												}		/* if (results_p) */
+											else if (query_status != CAT_NO_ROWS_FOUND)
+												{
+													status = APR_EGENERAL;
+												}
+
+											apr_pool_clear (page_pool_p);
+										}		/* while (loop_flag) */
+
+									apr_pool_destroy (collection_pool_p);
+								}
+							else
+								{
+									status = APR_ENOMEM;
+								}
+
+							apr_pool_destroy (page_pool_p);
+						}
+					else
+						{
+							status = APR_ENOMEM;
+						}
+				}
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to build collection fingerprint query for \"%s\"", prefix_s);
+				}
 
-															freeGenQueryOut (&data_id_results_p);
-														}		/* if (data_id_results_p) */
+			ClearPooledMemoryFromGenQuery (&in_query);
+			clearGenQueryInp (&in_query);
+		}
 
+	return status;
+}
 
 
-												}		/* for (j = 0; j < id_results_p -> rowCnt; ++ j) */
+/*
+ * Run a query with a single row of aggregated columns and get the
+ * values joined with colons. If there are no matching rows, each
+ * value is an empty string.
+ */
+static char *GetAggregateValues (const int *columns_p, const int *aggregates_p, const size_t num_columns, const int *where_columns_p, const char **conditions_ss, const size_t num_conditions, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
+{
+	char *values_s = NULL;
+	genQueryInp_t in_query;
+	int success_code = InitGenQuery (&in_query, 0, NULL);
+	size_t i;
 
-										}		/* if (id_results_p -> rowCnt > 0) */
+	for (i = 0; (i < num_columns) && (success_code == 0); ++ i)
+		{
+			success_code = addInxIval (& (in_query.selectInp), columns_p [i], aggregates_p [i]);
+		}
 
+	for (i = 0; (i < num_conditions) && (success_code == 0); ++ i)
+		{
+			success_code = conditions_ss [i] ? addInxVal (& (in_query.sqlCondInp), where_columns_p [i], conditions_ss [i]) : -1;
+		}
 
-									freeGenQueryOut (&id_results_p);
-								}		/* if (id_results_p) */
+	if (success_code == 0)
+		{
+			int query_status = 0;
+			genQueryOut_t *results_p = ExecuteGenQueryWithStatus (rods_connection_p, &in_query, &query_status, pool_p);
 
-						}		/* for (i = 0; i < meta_id_results_p -> rowCnt; ++ i, meta_id_s += meta_results_inc) */
+			if (results_p)
+				{
+					if ((results_p -> rowCnt == 1) && (results_p -> attriCnt == (int) num_columns))
+						{
+							values_s = apr_pstrdup (pool_p, results_p -> sqlResult [0].value);
 
+							for (i = 1; (i < num_columns) && values_s; ++ i)
+								{
+									values_s = apr_pstrcat (pool_p, values_s, ":", results_p -> sqlResult [i].value, NULL);
+								}
+						}
 
+					freeGenQueryOut (&results_p);
+				}
+			else if (query_status == CAT_NO_ROWS_FOUND)
+				{
+					values_s = apr_pstrdup (pool_p, "");
 
-				}		/* if (meta_id_results_p -> attriCnt == 1) */
+					for (i = 1; (i < num_columns) && values_s; ++ i)
+						{
+							values_s = apr_pstrcat (pool_p, values_s, ":", NULL);
+						}
+				}
+		}
 
-			freeGenQueryOut (&meta_id_results_p);
-		}		/* if (meta_id_results_p) */
+	ClearPooledMemoryFromGenQuery (&in_query);
+	clearGenQueryInp (&in_query);
 
-	return root_node_p;
+	return values_s;
 }
 
 
-
-apr_status_t GetMetadataTableForId (char *id_s, davrods_dir_conf_t *config_p, rcComm_t *connection_p, request_rec *req_p, apr_pool_t *pool_p, apr_bucket_brigade *bucket_brigade_p, OutputFormat format, const int editable_flag)
+/*
+ * Add the values from GetAggregateValues () to the end of values_s,
+ * separated by a colon. If values_s is NULL, as an earlier query failed,
+ * then no query is run and NULL is returned.
+ */
+static char *AppendAggregateValues (char *values_s, const int *columns_p, const int *aggregates_p, const size_t num_columns, const int *where_columns_p, const char **conditions_ss, const size_t num_conditions, rcComm_t *rods_connection_p, apr_pool_t *pool_p)
 {
-	apr_status_t status = APR_EGENERAL;
-	apr_array_header_t *metadata_array_p = GetMetadataArrayForId (id_s, connection_p, req_p, pool_p);
-
-	if (metadata_array_p)
+	if (values_s)
 		{
-			const char *content_type_s = "text/html";
-
-			switch (format)
-			{
-				case OF_JSON:
-					status = GetMetadataArrayAsJSON (metadata_array_p, bucket_brigade_p);
-					content_type_s = CONTENT_TYPE_JSON_S;
-					break;
-
-				case OF_TSV:
-					status = GetMetadataArrayAsColumnData (metadata_array_p, bucket_brigade_p, "\t");
-					break;
-
-				case OF_CSV:
-					status = GetMetadataArrayAsColumnData (metadata_array_p, bucket_brigade_p, ", ");
-					break;
-
-				case OF_HTML:
-				default:
-					{
-						char *metadata_link_s = GetDavrodsAPIPath (NULL, config_p, req_p);
+			char *more_values_s = GetAggregateValues (columns_p, aggregates_p, num_columns, where_columns_p, conditions_ss, num_conditions, rods_connection_p, pool_p);
 
-						status = PrintMetadata (id_s, metadata_array_p, config_p -> theme_p, editable_flag, bucket_brigade_p, metadata_link_s, pool_p);
-					}
-					break;
-			}
-
-			ap_set_content_type (req_p, content_type_s);
-		}
-	else
-		{
-			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to get metadata array for id \"%s\"", id_s);
+			values_s = more_values_s ? apr_pstrcat (pool_p, values_s, ":", more_values_s, NULL) : NULL;
 		}
 
-	return status;
+	return values_s;
 }
 
 
-
-apr_array_header_t *GetMetadataArrayForId (char *id_s, rcComm_t *connection_p, request_rec *req_p, apr_pool_t *pool_p)
+static apr_status_t ExportAVU (MetadataExport *export_p, const char *type_s, const char *path_s, const char *key_s, const char *value_s, const char *units_s)
 {
-	apr_array_header_t *metadata_array_p = NULL;
-	objType_t obj_type = UNKNOWN_OBJ_T;
-
-	char *child_id_s = GetId (id_s, &obj_type, pool_p);
+	apr_status_t status = APR_SUCCESS;
 
-	if (child_id_s)
+	if (export_p -> me_format == OF_JSON_LINES)
 		{
-			char *zone_s = NULL;
-			char *minor_id_s = (char *) GetMinorId (child_id_s);
-
-			if (minor_id_s)
+			/* Have we moved on to a different object? */
+			if (export_p -> me_object_p)
 				{
-					metadata_array_p = GetMetadataAsArray (connection_p, obj_type, minor_id_s, NULL, zone_s, pool_p);
+					const char *current_path_s = json_string_value (json_object_get (export_p -> me_object_p, "path"));
 
-					if (!metadata_array_p)
+					if ((!current_path_s) || (strcmp (current_path_s, path_s) != 0))
 						{
-							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to get metadata array for minor id \"%s\"", child_id_s);
+							status = ExportJSONLine (export_p);
 						}
-
-				}
-			else
-				{
-					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to get minor id value from \"%s\"", child_id_s);
 				}
 
-		}
-	else
-		{
-			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to create id value for \"%s\"", req_p -> unparsed_uri);
-		}
-
-	return metadata_array_p;
-}
+			if ((status == APR_SUCCESS) && (!export_p -> me_object_p))
+				{
+					json_t *metadata_p = json_array ();
 
+					/* json_pack () steals the reference to metadata_p */
+					export_p -> me_object_p = json_pack ("{s:s,s:s,s:o}", "type", type_s, "path", path_s, "metadata", metadata_p);
 
+					if (export_p -> me_object_p)
+						{
+							export_p -> me_metadata_p = metadata_p;
+						}
+					else
+						{
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, export_p -> me_req_p, "Failed to create JSON object for \"%s\"", path_s);
+							status = APR_ENOMEM;
+						}
+				}
 
+			if (status == APR_SUCCESS)
+				{
+					json_t *avu_p = json_pack ("{s:s,s:s}", "key", key_s, "value", value_s);
 
-static apr_status_t GetMetadataArrayAsJSON (apr_array_header_t *metadata_array_p, apr_bucket_brigade *bucket_brigade_p)
-{
-	apr_status_t status = APR_SUCCESS;
-	const int last_index = metadata_array_p -> nelts - 1;
+					if ((avu_p) && (*units_s != '\0'))
+						{
+							if (json_object_set_new (avu_p, "units", json_string (units_s)) != 0)
+								{
+									json_decref (avu_p);
+									avu_p = NULL;
+								}
+						}
 
-	if (last_index >= 0)
+					if (avu_p)
+						{
+							if (json_array_append_new (export_p -> me_metadata_p, avu_p) != 0)
+								{
+									status = APR_ENOMEM;
+								}
+						}
+					else
+						{
+							/* Most likely this isn't valid UTF-8, so skip it rather than abandoning the export */
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, APR_EGENERAL, export_p -> me_req_p, "Skipping AVU \"%s\" for \"%s\" as it can't be stored as JSON", key_s, path_s);
+						}
+				}
+		}
+	else
 		{
-			status = apr_brigade_puts (bucket_brigade_p, NULL, NULL, "[\n");
+			status = ExportCSVValue (export_p, type_s, ",");
 
 			if (status == APR_SUCCESS)
 				{
-					int i;
+					status = ExportCSVValue (export_p, path_s, ",");
+				}
 
-					for (i = 0; i <= last_index; ++ i)
-						{
-							const IrodsMetadata *metadata_p = APR_ARRAY_IDX (metadata_array_p, i, IrodsMetadata *);
+			if (status == APR_SUCCESS)
+				{
+					status = ExportCSVValue (export_p, key_s, ",");
+				}
 
-							status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "\t{\n\t\t\"attribute\": \"%s\",\n\t\t\"value\": \"%s\"", metadata_p -> im_key_s, metadata_p -> im_value_s);
+			if (status == APR_SUCCESS)
+				{
+					status = ExportCSVValue (export_p, value_s, ",");
+				}
 
-							if (status == APR_SUCCESS)
-								{
-									if ((metadata_p -> im_units_s) && (strlen (metadata_p -> im_units_s) > 0))
-										{
-											status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, ",\n\t\t\"units\": \"%s\"", metadata_p -> im_units_s);
-										}
+			if (status == APR_SUCCESS)
+				{
+					status = ExportCSVValue (export_p, units_s, "\n");
+				}
+		}
 
+	return status;
+}
 
-									if (status == APR_SUCCESS)
-										{
-											if (i == last_index)
-												{
-													status = apr_brigade_puts (bucket_brigade_p, NULL, NULL, "\n\t}\n");
-												}
-											else
-												{
-													status = apr_brigade_puts (bucket_brigade_p, NULL, NULL, "\n\t},\n");
-												}
-										}
-								}
 
-							if (status != APR_SUCCESS)
-								{
-									i = last_index;
-								}
+static apr_status_t ExportJSONLine (MetadataExport *export_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	char *line_s = json_dumps (export_p -> me_object_p, JSON_COMPACT);
 
-						}		/* for (i = 0; i < last_index; ++ i */
+	if (line_s)
+		{
+			status = apr_brigade_puts (export_p -> me_bb_p, ap_filter_flush, export_p -> me_req_p -> output_filters, line_s);
 
-					if (status == APR_SUCCESS)
-						{
-							apr_brigade_puts (bucket_brigade_p, NULL, NULL, "]\n");
-						}
+			if (status == APR_SUCCESS)
+				{
+					status = apr_brigade_putc (export_p -> me_bb_p, ap_filter_flush, export_p -> me_req_p -> output_filters, '\n');
 				}
 
-		}		/* if (size > 0) */
+			free (line_s);
+		}
+
+	json_decref (export_p -> me_object_p);
+	export_p -> me_object_p = NULL;
+	export_p -> me_metadata_p = NULL;
 
 	return status;
 }
 
 
-static apr_status_t GetMetadataArrayAsColumnData (apr_array_header_t *metadata_array_p, apr_bucket_brigade *bucket_brigade_p, const char * const sep_s)
+static apr_status_t ExportCSVValue (MetadataExport *export_p, const char *value_s, const char *suffix_s)
 {
 	apr_status_t status = APR_SUCCESS;
-	const int last_index = metadata_array_p -> nelts;
+	apr_bucket_brigade *bb_p = export_p -> me_bb_p;
+	ap_filter_t *filter_p = export_p -> me_req_p -> output_filters;
 
-	if (last_index >= 0)
+	if (strpbrk (value_s, ",\"\r\n"))
 		{
-			int i;
+			const char *start_s = value_s;
+			const char *quote_s;
 
-			for (i = 0; i < last_index; ++ i)
-				{
-					const IrodsMetadata *metadata_p = APR_ARRAY_IDX (metadata_array_p, i, IrodsMetadata *);
+			status = apr_brigade_putc (bb_p, ap_filter_flush, filter_p, '"');
 
-					status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "\"%s\"%s\"%s\"", metadata_p -> im_key_s, sep_s, metadata_p -> im_value_s);
+			/* Double up any embedded quotes */
+			while ((status == APR_SUCCESS) && ((quote_s = strchr (start_s, '"')) != NULL))
+				{
+					status = apr_brigade_write (bb_p, ap_filter_flush, filter_p, start_s, quote_s - start_s + 1);
 
 					if (status == APR_SUCCESS)
 						{
-							if ((metadata_p -> im_units_s) && (strlen (metadata_p -> im_units_s) > 0))
-								{
-									status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "%s\"%s\"", sep_s, metadata_p -> im_units_s);
-								}
-
-							if (status == APR_SUCCESS)
-								{
-									status = apr_brigade_puts (bucket_brigade_p, NULL, NULL, "\n");
-								}
+							status = apr_brigade_putc (bb_p, ap_filter_flush, filter_p, '"');
 						}
 
-					if (status != APR_SUCCESS)
-						{
-							i = last_index;
-						}
+					start_s = quote_s + 1;
+				}
 
-				}		/* for (i = 0; i < last_index; ++ i */
+			if (status == APR_SUCCESS)
+				{
+					status = apr_brigade_puts (bb_p, ap_filter_flush, filter_p, start_s);
+				}
 
-		}		/* if (size > 0) */
+			if (status == APR_SUCCESS)
+				{
+					status = apr_brigade_putc (bb_p, ap_filter_flush, filter_p, '"');
+				}
+		}
+	else
+		{
+			status = apr_brigade_puts (bb_p, ap_filter_flush, filter_p, value_s);
+		}
+
+	if (status == APR_SUCCESS)
+		{
+			status = apr_brigade_puts (bb_p, ap_filter_flush, filter_p, suffix_s);
+		}
 
 	return status;
 }
@@ -1388,6 +5017,22 @@ const char *GetSearchOperatorAsString (const SearchOperator op)
 			op_s = S_SEARCH_OPERATOR_LIKE_S;
 			break;
 
+		case SO_LESS_THAN:
+			op_s = S_SEARCH_OPERATOR_LESS_THAN_S;
+			break;
+
+		case SO_LESS_THAN_OR_EQUALS:
+			op_s = S_SEARCH_OPERATOR_LESS_THAN_OR_EQUALS_S;
+			break;
+
+		case SO_GREATER_THAN:
+			op_s = S_SEARCH_OPERATOR_GREATER_THAN_S;
+			break;
+
+		case SO_GREATER_THAN_OR_EQUALS:
+			op_s = S_SEARCH_OPERATOR_GREATER_THAN_OR_EQUALS_S;
+			break;
+
 		default:
 			//	ap_log_rerror  ();
 			break;
@@ -1414,6 +5059,26 @@ apr_status_t GetSearchOperatorFromString (const char *op_s, SearchOperator *op_p
 					*op_p = SO_LIKE;
 					res = APR_SUCCESS;
 				}
+			else if ((strcmp ("<", op_s) == 0) || (strcmp ("lt", op_s) == 0))
+				{
+					*op_p = SO_LESS_THAN;
+					res = APR_SUCCESS;
+				}
+			else if ((strcmp ("<=", op_s) == 0) || (strcmp ("le", op_s) == 0))
+				{
+					*op_p = SO_LESS_THAN_OR_EQUALS;
+					res = APR_SUCCESS;
+				}
+			else if ((strcmp (">", op_s) == 0) || (strcmp ("gt", op_s) == 0))
+				{
+					*op_p = SO_GREATER_THAN;
+					res = APR_SUCCESS;
+				}
+			else if ((strcmp (">=", op_s) == 0) || (strcmp ("ge", op_s) == 0))
+				{
+					*op_p = SO_GREATER_THAN_OR_EQUALS;
+					res = APR_SUCCESS;
+				}
 		}
 
 
@@ -1537,29 +5202,41 @@ static int SetMetadataQuery (genQueryInp_t *query_p, const char * const zone_s)
 }
 
 
-static genQueryOut_t *ExecuteSpecificQuery (rcComm_t *connection_p, specificQueryInp_t * const in_query_p)
+static genQueryOut_t *ExecuteSpecificQuery (rcComm_t *connection_p, specificQueryInp_t * const in_query_p, int *status_p, apr_pool_t *pool_p)
 {
 	genQueryOut_t *out_query_p = NULL;
 	int status = rcSpecificQuery (connection_p, in_query_p, &out_query_p);
 
+	*status_p = status;
+
 	/* Did we run it successfully? */
 	if (status == 0)
 		{
-#if QUERY_DEBUG >= STM_LEVEL_FINER
-#endif
+			if (s_debug_flag)
+				{
+					PrintBasicGenQueryOut (out_query_p);
+				}
 		}
 	else if (status == CAT_NO_ROWS_FOUND)
 		{
-
-			WHISPER ("No rows found\n");
+			ap_log_perror (APLOG_MARK, APLOG_TRACE1, APR_SUCCESS, pool_p, "Specific query \"%s\" no rows found", in_query_p -> sql);
 		}
 	else if (status < 0 )
 		{
-			WHISPER ("error status: %d\n", status);
-		}
-	else
-		{
-			//printBasicGenQueryOut (out_query_p, "result: \"%s\" \"%s\"\n");
+			const char *error_s = rodsErrorName (status, NULL);
+
+			/*
+			 * This isn't an error as such since we fall back to using GenQuery
+			 * when the specific query hasn't been registered.
+			 */
+			if (error_s)
+				{
+					ap_log_perror (APLOG_MARK, APLOG_WARNING, APR_EGENERAL, pool_p, "Specific query \"%s\" failed, error: %s", in_query_p -> sql, error_s);
+				}
+			else
+				{
+					ap_log_perror (APLOG_MARK, APLOG_WARNING, APR_EGENERAL, pool_p, "Specific query \"%s\" failed, error: %d", in_query_p -> sql, status);
+				}
 		}
 
 	return out_query_p;
@@ -1567,10 +5244,24 @@ static genQueryOut_t *ExecuteSpecificQuery (rcComm_t *connection_p, specificQuer
 
 
 static genQueryOut_t *ExecuteGenQuery (rcComm_t *connection_p, genQueryInp_t * const in_query_p, apr_pool_t *pool_p)
+{
+	int status;
+
+	return ExecuteGenQueryWithStatus (connection_p, in_query_p, &status, pool_p);
+}
+
+
+/*
+ * As ExecuteGenQuery but also stores the iRODS status code so that callers
+ * can tell an empty result set apart from a failed query.
+ */
+static genQueryOut_t *ExecuteGenQueryWithStatus (rcComm_t *connection_p, genQueryInp_t * const in_query_p, int *status_p, apr_pool_t *pool_p)
 {
 	genQueryOut_t *out_query_p = NULL;
 	int status = rcGenQuery (connection_p, in_query_p, &out_query_p);
 
+	*status_p = status;
+
 	/* Did we run it successfully? */
 	if (status == 0)
 		{
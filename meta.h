@@ -27,6 +27,7 @@
 #include "mod_dav.h"
 #include "apr_pools.h"
 #include "apr_tables.h"
+#include "apr_hash.h"
 #include "apr_buckets.h"
 
 #include "irods/rodsConnect.h"
@@ -50,10 +51,38 @@ typedef enum SearchOperator
 {
 	SO_EQUALS,
 	SO_LIKE,
+	SO_LESS_THAN,
+	SO_LESS_THAN_OR_EQUALS,
+	SO_GREATER_THAN,
+	SO_GREATER_THAN_OR_EQUALS,
 	SO_NUM_OPERATORS
 } SearchOperator;
 
 
+/**
+ * A single key, operator and value to match
+ * against the AVUs of a data object or collection.
+ */
+typedef struct MetadataSearchCondition
+{
+	const char *msc_key_s;
+	const char *msc_value_s;
+	SearchOperator msc_op;
+} MetadataSearchCondition;
+
+
+/**
+ * The number of data objects and collections that
+ * have a given value for a metadata key.
+ */
+typedef struct MetadataFacetCount
+{
+	const char *mfc_value_s;
+	rodsLong_t mfc_num_data_objects;
+	rodsLong_t mfc_num_collections;
+} MetadataFacetCount;
+
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -74,10 +103,46 @@ IrodsMetadata *AllocateIrodsMetadata (const char * const key_s, const char * con
 void SortIRodsMetadataArray (apr_array_header_t *metadata_array_p, int (*compare_fn) (const void *v0_p, const void *v1_p));
 
 
+/**
+ * Get an AVU as a JSON object with "attribute" and "value" keys and a
+ * "units" key if it has any units. This is the representation used by
+ * all of the JSON outputs of the metadata API.
+ *
+ * @param metadata_p The AVU to convert.
+ * @return The JSON object which the caller must free with json_decref()
+ * or NULL upon error.
+ */
+json_t *GetIrodsMetadataAsJSON (const IrodsMetadata *metadata_p);
+
+
+/**
+ * Get an array of AVUs as a JSON array of the objects made by
+ * GetIrodsMetadataAsJSON().
+ *
+ * @param metadata_array_p The array of IrodsMetadata pointers.
+ * @return The JSON array which the caller must free with json_decref()
+ * or NULL upon error.
+ */
+json_t *GetMetadataArrayAsJSONArray (const apr_array_header_t *metadata_array_p);
+
+
 apr_status_t PrintMetadata (const char *id_s, const apr_array_header_t *metadata_list_p, const struct HtmlTheme * const theme_p, const int editable_flag, apr_bucket_brigade *bb_p, const char *api_root_url_s, apr_pool_t *pool_p);
 
 
-char *DoMetadataSearch (const char * const key_s, const char *value_s, const SearchOperator op, rcComm_t *connection_p, davrods_dir_conf_t *conf_p, request_rec *req_p, const char *davrods_path_s);
+/**
+ * Run a metadata search and stream the results to the client as an HTML
+ * page. The top of the page is sent before the search is run and the
+ * results are sent on in batches as they are printed.
+ *
+ * @param conditions_p An array of MetadataSearchCondition entries which
+ * are combined with AND.
+ * @param connection_p The connection to the iRODS server.
+ * @param conf_p The module configuration.
+ * @param req_p The request to send the page to.
+ * @param davrods_path_s The path of the davrods location.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t DoMetadataSearch (const apr_array_header_t *conditions_p, rcComm_t *connection_p, davrods_dir_conf_t *conf_p, request_rec *req_p, const char *davrods_path_s);
 
 genQueryOut_t *RunQuery (rcComm_t *connection_p, const int *select_columns_p, const int *where_columns_p, const char **where_values_ss, const SearchOperator *where_ops_p, size_t num_where_columns, const int options, apr_pool_t *pool_p);
 
@@ -87,9 +152,172 @@ apr_status_t GetSearchOperatorFromString (const char *op_s, SearchOperator *op_p
 
 IRodsObjectNode *GetMatchingMetadataHits (const char * const key_s, const char * const value_s, SearchOperator op, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
 
+
+/**
+ * Get all of the data objects and collections that match every one
+ * of a set of conditions.
+ *
+ * @param conditions_p An array of MetadataSearchCondition entries which
+ * are combined with AND.
+ * @param specific_query_s The alias of a registered specific query to use
+ * for single condition searches, or <code>NULL</code> to always use GenQuery.
+ * If the specific query fails, GenQuery is used instead. Since specific
+ * queries don't check the user's permissions, their hits are checked again
+ * with GenQuery and any that the user can't see are removed.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param status_p If this is not <code>NULL</code>, then APR_SUCCESS will be
+ * stored here if the search ran, even if there were no hits, or the error
+ * if it failed.
+ * @param pool_p The memory pool to use.
+ * @return The matching objects, with all of their listing details, or
+ * <code>NULL</code> if there were none or the search failed.
+ */
+IRodsObjectNode *GetMatchingMetadataHitsForConditions (const apr_array_header_t *conditions_p, const char *specific_query_s, rcComm_t *rods_connection_p, apr_status_t *status_p, apr_pool_t *pool_p);
+
+
+/**
+ * Get the contents of a collection, along with all of their AVUs, using
+ * a single registered specific query.
+ *
+ * @param query_s The alias of the specific query. See the
+ * DavRodsListingSpecificQuery directive for the columns that it needs to return.
+ * @param collection_s The path of the collection to list.
+ * @param root_node_pp Where the list of objects will be stored. Each object's
+ * io_metadata_p will be set to its sorted AVUs. This will be <code>NULL</code>
+ * if the collection is empty.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to use.
+ * @return APR_SUCCESS if the specific query ran successfully, or an error code
+ * if it failed, e.g. if it has not been registered, in which case the caller
+ * should fall back to using GenQuery.
+ */
+apr_status_t GetCollectionListingUsingSpecificQuery (const char *query_s, const char *collection_s, IRodsObjectNode **root_node_pp, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+const char *GetSearchOperatorAsString (const SearchOperator op);
+
+
+/**
+ * Get a single sorted page of the contents of a collection.
+ *
+ * The iCAT does the sorting and paging, with the collections listed before
+ * the data objects, so only the entries on the page are got from the server.
+ * Each page covers a fixed range of the iCAT's rows, so when the replicas
+ * of a data object are collapsed into a single entry a page can have fewer
+ * entries than its size, but the pages never overlap or miss any entries.
+ * If the paged queries fail, the collection is sorted in memory instead
+ * using GetCollectionListingPageInMemory().
+ *
+ * @param collection_s The path of the collection to list.
+ * @param page_p The page to get. Its lp_has_more_flag will be set if there
+ * are further entries after this page.
+ * @param root_node_pp Where the list of objects will be stored. This will
+ * be <code>NULL</code> if the page is empty.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to use.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t GetCollectionListingPage (const char *collection_s, ListingPage *page_p, IRodsObjectNode **root_node_pp, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+
+/**
+ * Get a single sorted page of the contents of a collection using the
+ * listing specific query set by DavRodsListingSpecificQuery, so that the
+ * entries on the page come with their AVUs. The whole listing is got and
+ * the page is sorted in memory with GetListingPageFromNodes().
+ *
+ * @param query_s The specific query as for GetCollectionListingUsingSpecificQuery().
+ * @param collection_s The path of the collection to list.
+ * @param page_p The page to get. Its lp_has_more_flag will be set.
+ * @param root_node_pp Where the list of objects will be stored. This will
+ * be <code>NULL</code> if the page is empty.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to use.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t GetCollectionListingPageUsingSpecificQuery (const char *query_s, const char *collection_s, ListingPage *page_p, IRodsObjectNode **root_node_pp, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+
+/**
+ * Go through the whole sorted contents of a collection, in the same order
+ * as GetCollectionListingPage() lists them, a batch at a time.
+ *
+ * Each query is only run once and read through until the end, so this
+ * avoids the repeated counting and skipping over earlier rows that getting
+ * each page in turn would need.
+ *
+ * @param collection_s The path of the collection to list.
+ * @param page_p The sorting and filtering to use. Its page index and size
+ * are ignored.
+ * @param batch_fn The function to call with each batch of entries. These
+ * are freed once it returns. If it returns anything other than APR_SUCCESS,
+ * the listing stops and that value is returned.
+ * @param data_p The custom data to pass to batch_fn.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to use.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t ForEachCollectionListingBatch (const char *collection_s, const ListingPage *page_p, apr_status_t (*batch_fn) (IRodsObjectNode *root_node_p, void *data_p), void *data_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+
+
+/**
+ * Get the number of data objects and collections for each distinct value
+ * of a metadata key, using the iCAT to do the counting.
+ *
+ * @param key_s The metadata key to get the values for.
+ * @param conditions_p An optional array of MetadataSearchCondition entries
+ * that the objects must also match. This can be <code>NULL</code>.
+ * @param specific_query_s The alias of a registered specific query that
+ * counts the distinct objects for each value, as set by the
+ * DavRodsFacetSpecificQuery directive. This is only used when there are no
+ * conditions and can be <code>NULL</code>. Without it, GenQuery is used
+ * which counts each replica and each matching AVU of an object separately.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to use.
+ * @return An array of MetadataFacetCount pointers sorted by value or
+ * <code>NULL</code> upon error.
+ */
+apr_array_header_t *GetMetadataFacetCounts (const char *key_s, const apr_array_header_t *conditions_p, const char *specific_query_s, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
 IRodsObjectNode *GetIRodsObjectNodeForId (const char *id_s, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
 
 
+/**
+ * Get the details for many iRODS ids using a few bulk queries rather
+ * than querying for each one in turn.
+ *
+ * @param ids_p An array of id strings. These can be prefixed with their
+ * object type, e.g. "1.1234" and "2.5678", or be unprefixed in which case
+ * data objects are tried before collections.
+ * @param objects_p The hash table to store the IRodsObject pointers in, using
+ * the given id strings as the keys. Any ids that could not be found won't be
+ * added. Collections have their full path in io_collection_s and no io_data_s.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to allocate the IRodsObjects from.
+ * @return APR_SUCCESS if all of the queries ran successfully, an APR error
+ * code otherwise.
+ */
+apr_status_t GetIRodsObjectsForIds (const apr_array_header_t *ids_p, apr_hash_t *objects_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+
+/**
+ * Get the AVUs for many iRODS ids using a few bulk queries rather than
+ * querying for each one in turn.
+ *
+ * @param ids_p An array of id strings, in any of the forms accepted by
+ * GetIRodsObjectsForIds().
+ * @param metadata_arrays_p The hash table to store the sorted arrays of
+ * IrodsMetadata pointers in, using the given id strings as the keys. Any ids
+ * that could not be found won't be added. Objects without any AVUs get an
+ * empty array.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to allocate the arrays from.
+ * @return APR_SUCCESS if all of the queries ran successfully, an APR error
+ * code otherwise.
+ */
+apr_status_t GetMetadataArraysForIds (const apr_array_header_t *ids_p, apr_hash_t *metadata_arrays_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+
 apr_table_t *GetAllDataObjectMetadataValuesForKey (apr_pool_t *pool_p, rcComm_t *connection_p, const char *key_s);
 
 char *GetParentCollectionId (const char *child_id_s, const objType_t object_type, const char *zone_s, rcComm_t *irods_connection_p, apr_pool_t *pool_p);
@@ -98,6 +326,168 @@ apr_status_t GetMetadataTableForId (char *id_s, davrods_dir_conf_t *config_p, rc
 
 apr_array_header_t *GetMetadataArrayForId (char *id_s, rcComm_t *connection_p, request_rec *req_p, apr_pool_t *pool_p);
 
+
+/**
+ * Stream the AVUs for a collection and for every collection and data object
+ * below it to the client as the export runs.
+ *
+ * The AVUs are got using a few paged queries over the whole tree rather than
+ * separate queries for each object, and each page is sent on before the next
+ * one is requested so the memory used stays bounded regardless of the size
+ * of the tree.
+ *
+ * @param collection_s The full path of the collection at the root of the tree.
+ * @param format Either OF_CSV for a row per AVU with "type", "path", "key",
+ * "value" and "units" columns, or OF_JSON_LINES for a JSON object per line
+ * for each data object or collection with its "type", "path" and "metadata" array.
+ * @param conf_p The module configuration. If DavRodsTreeWalkConnections is
+ * greater than 1, the collections directly within the root are exported over
+ * that many extra connections at the same time and their output is sent in
+ * the order of their names, with each one's collections and then its data
+ * objects ordered by path.
+ * @param username_s The iRODS user to make any extra connections as. If this or
+ * password_s is <code>NULL</code>, only rods_connection_p is used.
+ * @param password_s The password for the iRODS user.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param req_p The request to send the export to.
+ * @return APR_SUCCESS if the whole tree was exported, an APR error code otherwise.
+ */
+apr_status_t ExportMetadataForCollectionTree (const char *collection_s, const OutputFormat format, const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s, rcComm_t *rods_connection_p, request_rec *req_p);
+
+
+/**
+ * Call a function for every data object in a collection and in all of the
+ * collections below it.
+ *
+ * The data objects are got with a few paged queries over the whole tree which
+ * also select their sizes and any checksums that are already in the iCAT, so
+ * no checksums are calculated. The data objects directly in the collection
+ * come first and the rest are ordered by collection and then by name. Each
+ * data object is only given once even if it has more than one replica, using
+ * the checksum of any replica that has one.
+ *
+ * @param collection_s The full path of the collection at the root of the tree.
+ * @param object_fn The function to call for each data object. Its IRodsObject
+ * has the id, name, collection, size and checksum set. If it returns anything
+ * other than APR_SUCCESS, the walk is stopped and that value is returned.
+ * @param data_p The data to pass to object_fn.
+ * @param conf_p The module configuration. If DavRodsTreeWalkConnections is
+ * greater than 1, the collections directly within the root are queried over
+ * that many extra connections at the same time. object_fn is still only called
+ * from this thread, for each of these subcollections in turn in the order of
+ * their names, with the data objects in each one ordered by collection and
+ * then by name.
+ * @param username_s The iRODS user to make any extra connections as. If this or
+ * password_s is <code>NULL</code>, only rods_connection_p is used.
+ * @param password_s The password for the iRODS user.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to use. object_fn is given a subpool of this
+ * that is cleared after each call.
+ * @return APR_SUCCESS if the whole tree was done, an APR error code otherwise.
+ */
+apr_status_t ForEachDataObjectInCollectionTree (const char *collection_s, apr_status_t (*object_fn) (const IRodsObject *irods_obj_p, void *data_p, apr_pool_t *pool_p), void *data_p, const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+
+/**
+ * Call a function for each of the data objects directly within a collection,
+ * in the same way as ForEachDataObjectInCollectionTree() but without going
+ * into any of its subcollections.
+ *
+ * @param collection_s The full path of the collection.
+ * @param object_fn The function to call for each data object.
+ * @param data_p The data to pass to object_fn.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to use.
+ * @return APR_SUCCESS if all of the data objects were done, an APR error code otherwise.
+ * @see ForEachDataObjectInCollectionTree
+ */
+apr_status_t ForEachDataObjectInCollection (const char *collection_s, apr_status_t (*object_fn) (const IRodsObject *irods_obj_p, void *data_p, apr_pool_t *pool_p), void *data_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+
+/**
+ * Get a fingerprint for each collection in a tree that has any data objects
+ * directly within it. These are all got with a single paged query.
+ *
+ * Each fingerprint is made from the collection's modify time along with the
+ * newest modify time and the number of the data objects directly within it,
+ * so it changes whenever any of those data objects do.
+ *
+ * @param collection_s The full path of the collection at the root of the tree.
+ * @param collection_fn The function to call for each collection, in the same
+ * order that ForEachDataObjectInCollectionTree() goes through them when it
+ * uses a single connection. If it returns anything other than APR_SUCCESS,
+ * the query is stopped and that value is returned.
+ * @param data_p The data to pass to collection_fn.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to use. collection_fn is given a subpool of this
+ * that is cleared after each call.
+ * @return APR_SUCCESS if all of the collections were done, an APR error code otherwise.
+ */
+apr_status_t ForEachCollectionFingerprintInTree (const char *collection_s, apr_status_t (*collection_fn) (const char *collection_s, const char *fingerprint_s, void *data_p, apr_pool_t *pool_p), void *data_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+
+/**
+ * Get the AVUs for all of the data objects in a collection and in all of the
+ * collections below it using a few paged queries over the whole tree.
+ *
+ * @param collection_s The full path of the collection at the root of the tree.
+ * @param key_condition_s An optional GenQuery condition on the attribute names
+ * to limit the AVUs that are got, e.g. "= 'column_headings' || like '%_type'".
+ * This can be <code>NULL</code> to get all of them.
+ * @param tables_p The hash table to store the AVUs in. The keys are the data
+ * object ids and the values are apr_table_t with the IrodsMetadata pointers
+ * keyed by attribute name, in the same form as GetMetadataAsTable(). Data
+ * objects without any matching AVUs won't be added.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to allocate the tables from.
+ * @return APR_SUCCESS if all of the queries ran successfully, an APR error
+ * code otherwise.
+ */
+apr_status_t GetDataObjectMetadataTablesForCollectionTree (const char *collection_s, const char *key_condition_s, apr_hash_t *tables_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+
+/**
+ * Get the AVUs for the data objects directly within a collection, in the
+ * same way as GetDataObjectMetadataTablesForCollectionTree().
+ *
+ * @see GetDataObjectMetadataTablesForCollectionTree
+ */
+apr_status_t GetDataObjectMetadataTablesForCollection (const char *collection_s, const char *key_condition_s, apr_hash_t *tables_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+
+/**
+ * Get a fingerprint of a collection tree that changes whenever the data
+ * objects within it do.
+ *
+ * This is made from the newest modify times and the number of the data
+ * objects across the whole tree and the newest modify time of the AVUs on
+ * them, along with the newest modify time of the AVUs on the collection
+ * itself.
+ *
+ * @param collection_s The full path of the collection at the root of the tree.
+ * @param ignored_data_name_s The name of a data object directly within the
+ * collection to leave out of the fingerprint, such as a file generated from
+ * the tree and saved alongside it, or <code>NULL</code> to include them all.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to allocate the fingerprint from.
+ * @return The fingerprint or <code>NULL</code> upon error.
+ */
+char *GetCollectionTreeFingerprint (const char *collection_s, const char *ignored_data_name_s, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
+
+/**
+ * Get the newest modify time and the number of the data objects directly
+ * within a collection. Unlike the collection's own modify time, this
+ * changes when a data object in it is overwritten.
+ *
+ * @param collection_s The full path of the collection.
+ * @param rods_connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to allocate the value from.
+ * @return The modify time and count joined with a colon, or
+ * <code>NULL</code> upon error.
+ */
+char *GetCollectionContentsModifyTime (const char *collection_s, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
+
 apr_status_t PrintDownloadMetadataObjectAsLinks (const struct HtmlTheme *theme_p, apr_bucket_brigade *bb_p, const char *api_root_url_s, const IRodsObject *irods_obj_p);
 
 
@@ -0,0 +1,624 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * metadata_batch.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apr_hash.h"
+#include "apr_strings.h"
+#include "apr_tables.h"
+
+#include "http_log.h"
+
+#include "irods/modAVUMetadata.h"
+#include "irods/rodsErrorTable.h"
+
+#if defined (IRODS_4_3) || defined (IRODS_HAS_ATOMIC_METADATA)
+#include "irods/atomic_apply_metadata_operations.h"
+#define USE_ATOMIC_METADATA_OPERATIONS (1)
+#endif
+
+#include "metadata_batch.h"
+#include "metadata_cache.h"
+#include "listing_cache.h"
+#include "listing.h"
+#include "meta.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+typedef struct MetadataOperation
+{
+	size_t mo_index;
+	const char *mo_op_s;
+	const char *mo_id_s;
+	const char *mo_path_s;
+	const char *mo_key_s;
+	const char *mo_value_s;
+	const char *mo_units_s;
+
+	/* The iRODS object that the id refers to, once it has been resolved */
+	IRodsObject *mo_obj_p;
+
+	bool mo_success_flag;
+	const char *mo_error_s;
+} MetadataOperation;
+
+
+/*
+ * STATIC VARIABLES
+ */
+
+#ifdef USE_ATOMIC_METADATA_OPERATIONS
+/*
+ * This gets cleared if the server does not know about the atomic metadata
+ * API, so that the rest of this child's requests don't keep trying it.
+ */
+static bool s_use_atomic_operations_flag = true;
+#endif
+
+
+/*
+ * STATIC DECLARATIONS
+ */
+
+static bool ParseMetadataOperation (const json_t *op_json_p, MetadataOperation *op_p, apr_pool_t *pool_p);
+
+static void RunMetadataOperationsForObject (apr_array_header_t *ops_p, rcComm_t *connection_p, apr_pool_t *pool_p);
+
+static bool RunMetadataOperation (MetadataOperation *op_p, const char *full_path_s, rcComm_t *connection_p, apr_pool_t *pool_p);
+
+static json_t *GetMetadataOperationResultAsJSON (const MetadataOperation *op_p);
+
+static IRodsObject *GetIRodsObjectForPath (const char *path_s, rcComm_t *connection_p, apr_pool_t *pool_p);
+
+#ifdef USE_ATOMIC_METADATA_OPERATIONS
+static bool RunAtomicMetadataOperations (apr_array_header_t *ops_p, const char *full_path_s, rcComm_t *connection_p, apr_pool_t *pool_p);
+#endif
+
+
+/*
+ * API DEFINITIONS
+ */
+
+json_t *RunMetadataOperations (const json_t *operations_p, rcComm_t *connection_p, apr_pool_t *pool_p)
+{
+	json_t *results_p = NULL;
+
+	if (json_is_array (operations_p))
+		{
+			const size_t num_ops = json_array_size (operations_p);
+			MetadataOperation *ops_p = (MetadataOperation *) apr_pcalloc (pool_p, (num_ops > 0 ? num_ops : 1) * sizeof (MetadataOperation));
+			apr_array_header_t *ids_p = apr_array_make (pool_p, num_ops > 0 ? num_ops : 1, sizeof (const char *));
+			apr_hash_t *objects_p = apr_hash_make (pool_p);
+			apr_hash_t *path_objects_p = apr_hash_make (pool_p);
+			apr_hash_t *seen_ids_p = apr_hash_make (pool_p);
+			apr_hash_t *groups_p = apr_hash_make (pool_p);
+			apr_array_header_t *group_order_p = apr_array_make (pool_p, num_ops > 0 ? num_ops : 1, sizeof (apr_array_header_t *));
+
+			if (ops_p && ids_p && objects_p && path_objects_p && seen_ids_p && groups_p && group_order_p)
+				{
+					size_t i;
+
+					/*
+					 * Parse all of the operations first so that we can
+					 * resolve all of their ids in one go.
+					 */
+					for (i = 0; i < num_ops; ++ i)
+						{
+							MetadataOperation *op_p = ops_p + i;
+
+							op_p -> mo_index = i;
+
+							if (ParseMetadataOperation (json_array_get (operations_p, i), op_p, pool_p) && op_p -> mo_id_s)
+								{
+									if (!apr_hash_get (seen_ids_p, op_p -> mo_id_s, APR_HASH_KEY_STRING))
+										{
+											APR_ARRAY_PUSH (ids_p, const char *) = op_p -> mo_id_s;
+											apr_hash_set (seen_ids_p, op_p -> mo_id_s, APR_HASH_KEY_STRING, op_p);
+										}
+								}
+						}
+
+					if (GetIRodsObjectsForIds (ids_p, objects_p, connection_p, pool_p) == APR_SUCCESS)
+						{
+							int j;
+
+							/*
+							 * Group the operations by the object that they refer to, keeping
+							 * the order in which each object first appeared.
+							 */
+							for (i = 0; i < num_ops; ++ i)
+								{
+									MetadataOperation *op_p = ops_p + i;
+
+									if ((op_p -> mo_id_s || op_p -> mo_path_s) && !op_p -> mo_error_s)
+										{
+											IRodsObject *obj_p = NULL;
+
+											if (op_p -> mo_id_s)
+												{
+													obj_p = (IRodsObject *) apr_hash_get (objects_p, op_p -> mo_id_s, APR_HASH_KEY_STRING);
+												}
+											else
+												{
+													/* Paths can't be looked up in bulk so stat each distinct one */
+													obj_p = (IRodsObject *) apr_hash_get (path_objects_p, op_p -> mo_path_s, APR_HASH_KEY_STRING);
+
+													if (!obj_p)
+														{
+															obj_p = GetIRodsObjectForPath (op_p -> mo_path_s, connection_p, pool_p);
+
+															if (obj_p)
+																{
+																	apr_hash_set (path_objects_p, op_p -> mo_path_s, APR_HASH_KEY_STRING, obj_p);
+																}
+														}
+												}
+
+											if (obj_p)
+												{
+													const char *full_path_s = GetIRodsObjectFullPath (obj_p, pool_p);
+
+													if (full_path_s)
+														{
+															apr_array_header_t *group_p = (apr_array_header_t *) apr_hash_get (groups_p, full_path_s, APR_HASH_KEY_STRING);
+
+															if (!group_p)
+																{
+																	group_p = apr_array_make (pool_p, 4, sizeof (MetadataOperation *));
+																	apr_hash_set (groups_p, full_path_s, APR_HASH_KEY_STRING, group_p);
+																	APR_ARRAY_PUSH (group_order_p, apr_array_header_t *) = group_p;
+																}
+
+															op_p -> mo_obj_p = obj_p;
+															APR_ARRAY_PUSH (group_p, MetadataOperation *) = op_p;
+														}
+													else
+														{
+															op_p -> mo_error_s = "Failed to get path";
+														}
+												}
+											else
+												{
+													op_p -> mo_error_s = op_p -> mo_id_s ? "Unknown id" : "Unknown path";
+												}
+										}
+
+								}		/* for (i = 0; i < num_ops; ++ i) */
+
+							for (j = 0; j < group_order_p -> nelts; ++ j)
+								{
+									RunMetadataOperationsForObject (APR_ARRAY_IDX (group_order_p, j, apr_array_header_t *), connection_p, pool_p);
+								}
+
+							results_p = json_array ();
+
+							if (results_p)
+								{
+									for (i = 0; i < num_ops; ++ i)
+										{
+											json_t *result_p = GetMetadataOperationResultAsJSON (ops_p + i);
+
+											if (!result_p || (json_array_append_new (results_p, result_p) != 0))
+												{
+													ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to add result for operation %" APR_SIZE_T_FMT, i);
+												}
+										}
+								}
+
+						}		/* if (GetIRodsObjectsForIds (ids_p, objects_p, connection_p, pool_p) == APR_SUCCESS) */
+					else
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to resolve the ids for %d metadata operations", ids_p -> nelts);
+						}
+
+				}		/* if (ops_p && ids_p && objects_p && path_objects_p && seen_ids_p && groups_p && group_order_p) */
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to allocate memory for %" APR_SIZE_T_FMT " metadata operations", num_ops);
+				}
+
+		}		/* if (json_is_array (operations_p)) */
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Metadata operations must be a JSON array");
+		}
+
+	return results_p;
+}
+
+
+/*
+ * STATIC DEFINITIONS
+ */
+
+static bool ParseMetadataOperation (const json_t *op_json_p, MetadataOperation *op_p, apr_pool_t *pool_p)
+{
+	bool success_flag = false;
+
+	if (json_is_object (op_json_p))
+		{
+			const char *op_s = json_string_value (json_object_get (op_json_p, "op"));
+			const char *id_s = json_string_value (json_object_get (op_json_p, "id"));
+			const char *path_s = json_string_value (json_object_get (op_json_p, "path"));
+			const char *key_s = json_string_value (json_object_get (op_json_p, "key"));
+			const char *value_s = json_string_value (json_object_get (op_json_p, "value"));
+			const char *units_s = json_string_value (json_object_get (op_json_p, "units"));
+
+			op_p -> mo_op_s = op_s;
+			op_p -> mo_id_s = (id_s && (*id_s != '\0')) ? id_s : NULL;
+			op_p -> mo_path_s = (path_s && (*path_s == '/')) ? path_s : NULL;
+
+			if (op_s && ((strcmp (op_s, "add") == 0) || (strcmp (op_s, "set") == 0) || (strcmp (op_s, "rm") == 0)))
+				{
+					if (op_p -> mo_id_s || op_p -> mo_path_s)
+						{
+							if (key_s && (*key_s != '\0') && value_s && (*value_s != '\0'))
+								{
+									op_p -> mo_key_s = key_s;
+									op_p -> mo_value_s = value_s;
+									op_p -> mo_units_s = (units_s && (*units_s != '\0')) ? units_s : NULL;
+
+									success_flag = true;
+								}
+							else
+								{
+									op_p -> mo_error_s = "A non-empty key and value are required";
+								}
+						}
+					else
+						{
+							op_p -> mo_error_s = "Missing id or path";
+						}
+				}
+			else
+				{
+					op_p -> mo_error_s = "op must be one of \"add\", \"set\" or \"rm\"";
+				}
+		}
+	else
+		{
+			op_p -> mo_error_s = "Operation is not a JSON object";
+		}
+
+	return success_flag;
+}
+
+
+static void RunMetadataOperationsForObject (apr_array_header_t *ops_p, rcComm_t *connection_p, apr_pool_t *pool_p)
+{
+	const IRodsObject *obj_p = APR_ARRAY_IDX (ops_p, 0, MetadataOperation *) -> mo_obj_p;
+	const char *full_path_s = GetIRodsObjectFullPath (obj_p, pool_p);
+	bool modified_flag = false;
+	bool done_flag = false;
+
+	#ifdef USE_ATOMIC_METADATA_OPERATIONS
+	if (s_use_atomic_operations_flag)
+		{
+			bool atomic_flag = true;
+			int i;
+
+			/* The atomic API only knows about adding and removing AVUs */
+			for (i = 0; i < ops_p -> nelts; ++ i)
+				{
+					if (strcmp (APR_ARRAY_IDX (ops_p, i, MetadataOperation *) -> mo_op_s, "set") == 0)
+						{
+							atomic_flag = false;
+							i = ops_p -> nelts;
+						}
+				}
+
+			if (atomic_flag)
+				{
+					done_flag = RunAtomicMetadataOperations (ops_p, full_path_s, connection_p, pool_p);
+					modified_flag = done_flag && APR_ARRAY_IDX (ops_p, 0, MetadataOperation *) -> mo_success_flag;
+				}
+		}
+	#endif
+
+	if (!done_flag)
+		{
+			int i;
+
+			for (i = 0; i < ops_p -> nelts; ++ i)
+				{
+					if (RunMetadataOperation (APR_ARRAY_IDX (ops_p, i, MetadataOperation *), full_path_s, connection_p, pool_p))
+						{
+							modified_flag = true;
+						}
+				}
+		}
+
+	if (modified_flag)
+		{
+			/* Make sure that nothing serves the old AVUs */
+			InvalidateCachedMetadata (obj_p -> io_obj_type, obj_p -> io_id_s, full_path_s, pool_p);
+			InvalidateCachedListingsForObject (full_path_s, pool_p);
+		}
+}
+
+
+static bool RunMetadataOperation (MetadataOperation *op_p, const char *full_path_s, rcComm_t *connection_p, apr_pool_t *pool_p)
+{
+	modAVUMetadataInp_t mod;
+	int status;
+
+	memset (&mod, 0, sizeof (modAVUMetadataInp_t));
+
+	mod.arg0 = (char *) op_p -> mo_op_s;
+	mod.arg1 = (op_p -> mo_obj_p -> io_obj_type == COLL_OBJ_T) ? "-C" : "-d";
+	mod.arg2 = (char *) full_path_s;
+	mod.arg3 = (char *) op_p -> mo_key_s;
+	mod.arg4 = (char *) op_p -> mo_value_s;
+	mod.arg5 = op_p -> mo_units_s ? (char *) op_p -> mo_units_s : "";
+	mod.arg6 = "";
+	mod.arg7 = "";
+	mod.arg8 = "";
+	mod.arg9 = "";
+
+	status = rcModAVUMetadata (connection_p, &mod);
+
+	if (status == 0)
+		{
+			op_p -> mo_success_flag = true;
+		}
+	else
+		{
+			const char *error_s = rodsErrorName (status, NULL);
+
+			op_p -> mo_error_s = error_s ? error_s : apr_itoa (pool_p, status);
+
+			ap_log_perror (APLOG_MARK, APLOG_ERR, APR_EGENERAL, pool_p,
+										 "rcModAVUMetadata failed, error: %s for args \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\"",
+										 op_p -> mo_error_s, mod.arg0, mod.arg1, mod.arg2, mod.arg3, mod.arg4, mod.arg5);
+		}
+
+	return op_p -> mo_success_flag;
+}
+
+
+#ifdef USE_ATOMIC_METADATA_OPERATIONS
+/*
+ * Apply all of the operations for a single object as one transaction. If any
+ * of them fails, none of them are applied. This returns false if the
+ * request could not be made at all and the caller should fall back to
+ * applying the operations one at a time.
+ */
+static bool RunAtomicMetadataOperations (apr_array_header_t *ops_p, const char *full_path_s, rcComm_t *connection_p, apr_pool_t *pool_p)
+{
+	bool done_flag = false;
+	const IRodsObject *obj_p = APR_ARRAY_IDX (ops_p, 0, MetadataOperation *) -> mo_obj_p;
+	json_t *operations_p = json_array ();
+
+	if (operations_p)
+		{
+			json_t *input_p = json_pack ("{s:s,s:s,s:o}",
+																	 "entity_name", full_path_s,
+																	 "entity_type", (obj_p -> io_obj_type == COLL_OBJ_T) ? "collection" : "data_object",
+																	 "operations", operations_p);
+
+			if (input_p)
+				{
+					bool success_flag = true;
+					int i;
+
+					for (i = 0; i < ops_p -> nelts; ++ i)
+						{
+							const MetadataOperation *op_p = APR_ARRAY_IDX (ops_p, i, MetadataOperation *);
+							json_t *operation_p = json_pack ("{s:s,s:s,s:s}",
+																							 "operation", (strcmp (op_p -> mo_op_s, "rm") == 0) ? "remove" : "add",
+																							 "attribute", op_p -> mo_key_s,
+																							 "value", op_p -> mo_value_s);
+
+							if (operation_p)
+								{
+									if (op_p -> mo_units_s)
+										{
+											if (json_object_set_new (operation_p, "units", json_string (op_p -> mo_units_s)) != 0)
+												{
+													success_flag = false;
+												}
+										}
+
+									if (json_array_append_new (operations_p, operation_p) != 0)
+										{
+											success_flag = false;
+										}
+								}
+							else
+								{
+									success_flag = false;
+								}
+						}
+
+					if (success_flag)
+						{
+							char *input_s = json_dumps (input_p, JSON_COMPACT);
+
+							if (input_s)
+								{
+									char *output_s = NULL;
+									int status = rc_atomic_apply_metadata_operations (connection_p, input_s, &output_s);
+
+									if (status == 0)
+										{
+											for (i = 0; i < ops_p -> nelts; ++ i)
+												{
+													APR_ARRAY_IDX (ops_p, i, MetadataOperation *) -> mo_success_flag = true;
+												}
+
+											done_flag = true;
+										}
+									else if (status == SYS_UNMATCHED_API_NUM)
+										{
+											ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_NOTICE, APR_SUCCESS, pool_p, "The iRODS server does not support atomic metadata operations, falling back to individual modifications");
+											s_use_atomic_operations_flag = false;
+										}
+									else
+										{
+											/*
+											 * Nothing was applied. Work out which operation caused the
+											 * failure so that it can be reported against that one.
+											 */
+											const char *error_s = rodsErrorName (status, NULL);
+											json_t *output_p = output_s ? json_loads (output_s, 0, NULL) : NULL;
+											json_int_t failed_index = -1;
+
+											if (output_p)
+												{
+													const char *message_s = json_string_value (json_object_get (output_p, "error_message"));
+													json_t *index_p = json_object_get (output_p, "operation_index");
+
+													if (message_s)
+														{
+															error_s = apr_pstrdup (pool_p, message_s);
+														}
+
+													if (json_is_integer (index_p))
+														{
+															failed_index = json_integer_value (index_p);
+														}
+
+													json_decref (output_p);
+												}
+
+											if (!error_s)
+												{
+													error_s = apr_itoa (pool_p, status);
+												}
+
+											for (i = 0; i < ops_p -> nelts; ++ i)
+												{
+													MetadataOperation *op_p = APR_ARRAY_IDX (ops_p, i, MetadataOperation *);
+
+													if ((failed_index < 0) || (failed_index == i))
+														{
+															op_p -> mo_error_s = error_s;
+														}
+													else
+														{
+															op_p -> mo_error_s = "Not applied since another operation on the same object failed";
+														}
+												}
+
+											ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Atomic metadata operations on \"%s\" failed: %s", full_path_s, error_s);
+											done_flag = true;
+										}
+
+									if (output_s)
+										{
+											free (output_s);
+										}
+
+									free (input_s);
+								}		/* if (input_s) */
+
+						}		/* if (success_flag) */
+
+					json_decref (input_p);
+				}		/* if (input_p) */
+			else
+				{
+					/* The array is only owned by input_p once that has been made */
+					json_decref (operations_p);
+				}
+
+		}		/* if (operations_p) */
+
+	return done_flag;
+}
+#endif
+
+
+static json_t *GetMetadataOperationResultAsJSON (const MetadataOperation *op_p)
+{
+	json_t *result_p = json_pack ("{s:I,s:b}", "index", (json_int_t) (op_p -> mo_index), "success", op_p -> mo_success_flag ? 1 : 0);
+
+	if (result_p)
+		{
+			bool success_flag = true;
+
+			if (op_p -> mo_id_s)
+				{
+					success_flag = (json_object_set_new (result_p, "id", json_string (op_p -> mo_id_s)) == 0);
+				}
+
+			if (success_flag && op_p -> mo_path_s)
+				{
+					success_flag = (json_object_set_new (result_p, "path", json_string (op_p -> mo_path_s)) == 0);
+				}
+
+			if (success_flag && op_p -> mo_op_s)
+				{
+					success_flag = (json_object_set_new (result_p, "op", json_string (op_p -> mo_op_s)) == 0);
+				}
+
+			if (success_flag && op_p -> mo_error_s)
+				{
+					success_flag = (json_object_set_new (result_p, "error", json_string (op_p -> mo_error_s)) == 0);
+				}
+
+			if (!success_flag)
+				{
+					json_decref (result_p);
+					result_p = NULL;
+				}
+		}
+
+	return result_p;
+}
+
+
+static IRodsObject *GetIRodsObjectForPath (const char *path_s, rcComm_t *connection_p, apr_pool_t *pool_p)
+{
+	IRodsObject *obj_p = NULL;
+
+	if (strlen (path_s) < MAX_NAME_LEN)
+		{
+			rodsObjStat_t *stat_p = GetObjectStat (path_s, connection_p, pool_p);
+
+			if (stat_p)
+				{
+					if ((stat_p -> objType == DATA_OBJ_T) || (stat_p -> objType == COLL_OBJ_T))
+						{
+							obj_p = (IRodsObject *) apr_palloc (pool_p, sizeof (IRodsObject));
+
+							if (obj_p)
+								{
+									InitIRodsObject (obj_p);
+
+									if (SetIRodsObject (obj_p, stat_p -> objType, stat_p -> dataId, NULL, path_s, stat_p -> ownerName, NULL, stat_p -> modifyTime, stat_p -> objSize, stat_p -> chksum, pool_p) != APR_SUCCESS)
+										{
+											obj_p = NULL;
+										}
+								}
+						}
+
+					freeRodsObjStat (stat_p);
+				}
+		}
+
+	return obj_p;
+}
@@ -0,0 +1,66 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * metadata_batch.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef METADATA_BATCH_H_
+#define METADATA_BATCH_H_
+
+#include "apr_pools.h"
+
+#include "irods/rodsClient.h"
+
+#include "jansson.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Run a list of metadata modifications across any number of
+ * data objects and collections.
+ *
+ * Each operation is an object of the form
+ *
+ * <code>{ "op": "add" | "set" | "rm", "id": "1.1234", "key": "k", "value": "v", "units": "u" }</code>
+ *
+ * where "units" is optional. All of the ids are resolved in bulk and the
+ * operations for each iRODS object are applied together. Where the server
+ * supports atomic metadata operations, the "add" and "rm" operations for an
+ * object are applied as a single transaction.
+ *
+ * @param operations_p The JSON array of operations.
+ * @param connection_p The connection to the iRODS server.
+ * @param pool_p The memory pool to use.
+ * @return A JSON array with a result object for each of the operations
+ * in the same order, or <code>NULL</code> upon error. The caller is
+ * responsible for calling json_decref() on this.
+ */
+json_t *RunMetadataOperations (const json_t *operations_p, rcComm_t *connection_p, apr_pool_t *pool_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* METADATA_BATCH_H_ */
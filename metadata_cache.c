@@ -0,0 +1,577 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * metadata_cache.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apr_atomic.h"
+#include "apr_shm.h"
+#include "apr_strings.h"
+#include "apr_time.h"
+
+#include "http_log.h"
+
+#include "metadata_cache.h"
+#include "lru_cache.h"
+#include "meta.h"
+#include "rest.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+/*
+ * Each entry is allocated with malloc rather than from a pool since
+ * entries are added and removed independently of each other for the
+ * lifetime of the child process.
+ */
+typedef struct MetadataCacheEntry
+{
+	int mce_num_avus;
+	IrodsMetadata *mce_avus_p;
+
+	/* The serialised facet counts, used instead of the AVUs in the facet cache */
+	char *mce_data_s;
+} MetadataCacheEntry;
+
+
+/*
+ * STATIC VARIABLES
+ */
+
+static LRUCache *s_cache_p = NULL;
+
+static LRUCache *s_facet_cache_p = NULL;
+
+/* The lifetime of a cache entry in seconds, 0 turns the cache off */
+static int s_cache_ttl = 0;
+
+/* The lifetime of a facet counts entry in seconds, 0 turns the cache off */
+static int s_facet_cache_ttl = 0;
+
+static int s_cache_max_entries = 1024;
+
+/*
+ * A counter shared by all of the child processes that is increased whenever
+ * any of them changes some metadata, or NULL if it couldn't be created.
+ */
+static volatile apr_uint32_t *s_shared_generation_p = NULL;
+
+/* The value of the shared counter that this child's caches are up to date with */
+static volatile apr_uint32_t s_generation = 0;
+
+
+/*
+ * STATIC DECLARATIONS
+ */
+
+static char *GetMetadataCacheKey (const objType_t object_type, const char *id_s, const char *coll_name_s, const char *username_s, apr_pool_t *pool_p);
+
+static MetadataCacheEntry *AllocateMetadataCacheEntry (const apr_array_header_t *metadata_array_p);
+
+static void FreeMetadataCacheEntry (void *data_p);
+
+static void AddEntryToCache (LRUCache *cache_p, const char *key_s, MetadataCacheEntry *entry_p, const int ttl);
+
+static const char *ParseCacheTTL (const char *arg_p, int *ttl_p, const char *error_s);
+
+static apr_status_t ClearMetadataCache (void *data_p);
+
+static void CheckMetadataCacheGeneration (void);
+
+
+/*
+ * API DEFINITIONS
+ */
+
+apr_status_t InitSharedMetadataCache (apr_pool_t *pool_p)
+{
+	apr_shm_t *shm_p = NULL;
+
+	/* An anonymous segment is inherited by the children when they are forked */
+	apr_status_t status = apr_shm_create (&shm_p, sizeof (apr_uint32_t), NULL, pool_p);
+
+	if (status == APR_SUCCESS)
+		{
+			s_shared_generation_p = (volatile apr_uint32_t *) apr_shm_baseaddr_get (shm_p);
+			apr_atomic_set32 (s_shared_generation_p, 0);
+		}
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, status, pool_p, "Failed to create shared memory for the metadata cache, metadata changes will only be seen straight away by the child process that makes them");
+			s_shared_generation_p = NULL;
+		}
+
+	return status;
+}
+
+
+apr_status_t InitMetadataCache (apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	/* Each entry counts as 1 so the caches are limited by their number of entries */
+	s_cache_p = AllocateLRUCache ((apr_size_t) s_cache_max_entries, FreeMetadataCacheEntry, pool_p);
+	s_facet_cache_p = AllocateLRUCache ((apr_size_t) s_cache_max_entries, FreeMetadataCacheEntry, pool_p);
+
+	if (! (s_cache_p && s_facet_cache_p))
+		{
+			status = APR_ENOMEM;
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to create metadata cache");
+
+			s_cache_p = NULL;
+			s_facet_cache_p = NULL;
+		}
+	else
+		{
+			/*
+			 * Registered after the caches' own cleanups so that it runs
+			 * before them and nothing can use them once they are cleared.
+			 */
+			apr_pool_cleanup_register (pool_p, NULL, ClearMetadataCache, apr_pool_cleanup_null);
+
+			if (s_shared_generation_p)
+				{
+					apr_atomic_set32 (&s_generation, apr_atomic_read32 (s_shared_generation_p));
+				}
+		}
+
+	return status;
+}
+
+
+apr_array_header_t *GetCachedMetadata (const objType_t object_type, const char *id_s, const char *coll_name_s, const char *username_s, apr_pool_t *pool_p)
+{
+	apr_array_header_t *metadata_array_p = NULL;
+
+	if (s_cache_p && (s_cache_ttl > 0))
+		{
+			char *key_s = GetMetadataCacheKey (object_type, id_s, coll_name_s, username_s, pool_p);
+
+			CheckMetadataCacheGeneration ();
+
+			if (key_s)
+				{
+					apr_time_t expiry_time = 0;
+					MetadataCacheEntry *entry_p;
+
+					LockLRUCache (s_cache_p);
+
+					entry_p = (MetadataCacheEntry *) FindLRUCacheValue (s_cache_p, key_s, &expiry_time);
+
+					if (entry_p)
+						{
+							if (expiry_time > apr_time_now ())
+								{
+									metadata_array_p = apr_array_make (pool_p, entry_p -> mce_num_avus > 0 ? entry_p -> mce_num_avus : 1, sizeof (IrodsMetadata *));
+
+									if (metadata_array_p)
+										{
+											int i;
+											const IrodsMetadata *avu_p = entry_p -> mce_avus_p;
+
+											for (i = 0; i < entry_p -> mce_num_avus; ++ i, ++ avu_p)
+												{
+													IrodsMetadata *metadata_p = AllocateIrodsMetadata (avu_p -> im_key_s, avu_p -> im_value_s, avu_p -> im_units_s, pool_p);
+
+													if (metadata_p)
+														{
+															APR_ARRAY_PUSH (metadata_array_p, IrodsMetadata *) = metadata_p;
+														}
+													else
+														{
+															/* treat it as a cache miss */
+															metadata_array_p = NULL;
+															i = entry_p -> mce_num_avus;
+														}
+												}
+										}
+								}		/* if (expiry_time > apr_time_now ()) */
+							else
+								{
+									RemoveLRUCacheValue (s_cache_p, key_s);
+								}
+
+						}		/* if (entry_p) */
+
+					UnlockLRUCache (s_cache_p);
+				}		/* if (key_s) */
+
+		}		/* if (s_cache_p && (s_cache_ttl > 0)) */
+
+	return metadata_array_p;
+}
+
+
+void CacheMetadata (const objType_t object_type, const char *id_s, const char *coll_name_s, const char *username_s, const apr_array_header_t *metadata_array_p, apr_pool_t *pool_p)
+{
+	if (s_cache_p && (s_cache_ttl > 0) && metadata_array_p)
+		{
+			char *key_s = GetMetadataCacheKey (object_type, id_s, coll_name_s, username_s, pool_p);
+
+			CheckMetadataCacheGeneration ();
+
+			if (key_s)
+				{
+					MetadataCacheEntry *entry_p = AllocateMetadataCacheEntry (metadata_array_p);
+
+					if (entry_p)
+						{
+							AddEntryToCache (s_cache_p, key_s, entry_p, s_cache_ttl);
+						}		/* if (entry_p) */
+					else
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to allocate metadata cache entry for \"%s\"", key_s);
+						}
+
+				}		/* if (key_s) */
+
+		}		/* if (s_cache_p && (s_cache_ttl > 0) && metadata_array_p) */
+}
+
+
+void InvalidateCachedMetadata (const objType_t object_type, const char *id_s, const char *path_s, apr_pool_t *pool_p)
+{
+	if (s_cache_p)
+		{
+			/*
+			 * An empty username gives us the "type:id:" prefix which
+			 * matches the entries for every user.
+			 */
+			char *id_prefix_s = GetMetadataCacheKey (object_type, id_s, NULL, "", pool_p);
+			char *path_prefix_s = GetMetadataCacheKey (object_type, NULL, path_s, "", pool_p);
+
+			if (id_prefix_s || path_prefix_s)
+				{
+					LockLRUCache (s_cache_p);
+
+					if (id_prefix_s)
+						{
+							RemoveLRUCacheValuesWithPrefix (s_cache_p, id_prefix_s);
+						}
+
+					if (path_prefix_s)
+						{
+							RemoveLRUCacheValuesWithPrefix (s_cache_p, path_prefix_s);
+						}
+
+					UnlockLRUCache (s_cache_p);
+
+					/*
+					 * We can't tell which facets the changed AVU contributed to,
+					 * so throw them all away.
+					 */
+					LockLRUCache (s_facet_cache_p);
+					RemoveLRUCacheValuesWithPrefix (s_facet_cache_p, "");
+					UnlockLRUCache (s_facet_cache_p);
+				}
+
+			/*
+			 * The other children can't tell which of their entries are
+			 * affected either, so they will clear all of them.
+			 */
+			if (s_shared_generation_p)
+				{
+					apr_atomic_inc32 (s_shared_generation_p);
+				}
+		}
+}
+
+
+char *GetCachedFacetCounts (const char *key_s, apr_pool_t *pool_p)
+{
+	char *data_s = NULL;
+
+	if (s_facet_cache_p && (s_facet_cache_ttl > 0))
+		{
+			apr_time_t expiry_time = 0;
+			MetadataCacheEntry *entry_p;
+
+			CheckMetadataCacheGeneration ();
+
+			LockLRUCache (s_facet_cache_p);
+
+			entry_p = (MetadataCacheEntry *) FindLRUCacheValue (s_facet_cache_p, key_s, &expiry_time);
+
+			if (entry_p)
+				{
+					if (expiry_time > apr_time_now ())
+						{
+							data_s = apr_pstrdup (pool_p, entry_p -> mce_data_s);
+						}
+					else
+						{
+							RemoveLRUCacheValue (s_facet_cache_p, key_s);
+						}
+				}
+
+			UnlockLRUCache (s_facet_cache_p);
+		}		/* if (s_facet_cache_p && (s_facet_cache_ttl > 0)) */
+
+	return data_s;
+}
+
+
+void CacheFacetCounts (const char *key_s, const char *data_s, apr_pool_t *pool_p)
+{
+	if (s_facet_cache_p && (s_facet_cache_ttl > 0) && data_s)
+		{
+			MetadataCacheEntry *entry_p = (MetadataCacheEntry *) calloc (1, sizeof (MetadataCacheEntry));
+
+			if (entry_p)
+				{
+					CheckMetadataCacheGeneration ();
+
+					entry_p -> mce_data_s = strdup (data_s);
+
+					if (entry_p -> mce_data_s)
+						{
+							AddEntryToCache (s_facet_cache_p, key_s, entry_p, s_facet_cache_ttl);
+						}
+					else
+						{
+							FreeMetadataCacheEntry (entry_p);
+							entry_p = NULL;
+						}
+				}
+
+			if (!entry_p)
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to allocate facet cache entry for \"%s\"", key_s);
+				}
+
+		}		/* if (s_facet_cache_p && (s_facet_cache_ttl > 0) && data_s) */
+}
+
+
+const char *SetMetadataCacheTTL (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	return ParseCacheTTL (arg_p, &s_cache_ttl, "The metadata cache TTL must be a number of seconds, or 0 to turn the cache off");
+}
+
+
+const char *SetMetadataFacetCacheTTL (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	return ParseCacheTTL (arg_p, &s_facet_cache_ttl, "The metadata facet cache TTL must be a number of seconds, or 0 to turn the cache off");
+}
+
+
+const char *SetMetadataCacheSize (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *error_s = NULL;
+	apr_int64_t size = apr_atoi64 (arg_p);
+
+	if ((size > 0) && (size <= INT_MAX))
+		{
+			s_cache_max_entries = (int) size;
+		}
+	else
+		{
+			error_s = "The metadata cache size must be greater than zero";
+		}
+
+	return error_s;
+}
+
+
+/*
+ * STATIC DEFINITIONS
+ */
+
+static char *GetMetadataCacheKey (const objType_t object_type, const char *id_s, const char *coll_name_s, const char *username_s, apr_pool_t *pool_p)
+{
+	char *key_s = NULL;
+
+	if (username_s)
+		{
+			if (id_s && (*id_s != '\0'))
+				{
+					/* Use the minor id so that "1.1234" and "1234" refer to the same entry */
+					const char *minor_id_s = GetMinorId (id_s);
+
+					key_s = apr_psprintf (pool_p, "%d:%s:%s", object_type, minor_id_s ? minor_id_s : id_s, username_s);
+				}
+			else if (coll_name_s && (*coll_name_s != '\0'))
+				{
+					key_s = apr_psprintf (pool_p, "%d:%s:%s", object_type, coll_name_s, username_s);
+				}
+		}
+
+	return key_s;
+}
+
+
+static const char *ParseCacheTTL (const char *arg_p, int *ttl_p, const char *error_s)
+{
+	apr_int64_t ttl = apr_atoi64 (arg_p);
+
+	if ((ttl >= 0) && (ttl <= INT_MAX))
+		{
+			*ttl_p = (int) ttl;
+			error_s = NULL;
+		}
+
+	return error_s;
+}
+
+
+static MetadataCacheEntry *AllocateMetadataCacheEntry (const apr_array_header_t *metadata_array_p)
+{
+	MetadataCacheEntry *entry_p = (MetadataCacheEntry *) calloc (1, sizeof (MetadataCacheEntry));
+
+	if (entry_p)
+		{
+			const int num_avus = metadata_array_p -> nelts;
+			bool success_flag = true;
+
+			if (num_avus > 0)
+				{
+					entry_p -> mce_avus_p = (IrodsMetadata *) calloc (num_avus, sizeof (IrodsMetadata));
+
+					if (entry_p -> mce_avus_p)
+						{
+							int i;
+
+							for (i = 0; i < num_avus; ++ i)
+								{
+									const IrodsMetadata *src_p = APR_ARRAY_IDX (metadata_array_p, i, IrodsMetadata *);
+									IrodsMetadata *dest_p = (entry_p -> mce_avus_p) + i;
+
+									/* increment as we go so that FreeMetadataCacheEntry knows what to free */
+									++ (entry_p -> mce_num_avus);
+
+									dest_p -> im_key_s = strdup (src_p -> im_key_s);
+									dest_p -> im_value_s = strdup (src_p -> im_value_s);
+
+									if (src_p -> im_units_s)
+										{
+											dest_p -> im_units_s = strdup (src_p -> im_units_s);
+										}
+
+									if (! ((dest_p -> im_key_s) && (dest_p -> im_value_s) && ((src_p -> im_units_s == NULL) || (dest_p -> im_units_s))))
+										{
+											success_flag = false;
+											i = num_avus;
+										}
+								}
+						}
+					else
+						{
+							success_flag = false;
+						}
+				}
+
+			if (!success_flag)
+				{
+					FreeMetadataCacheEntry (entry_p);
+					entry_p = NULL;
+				}
+		}
+
+	return entry_p;
+}
+
+
+static void FreeMetadataCacheEntry (void *data_p)
+{
+	MetadataCacheEntry *entry_p = (MetadataCacheEntry *) data_p;
+
+	if (entry_p -> mce_avus_p)
+		{
+			int i;
+			IrodsMetadata *avu_p = entry_p -> mce_avus_p;
+
+			for (i = 0; i < entry_p -> mce_num_avus; ++ i, ++ avu_p)
+				{
+					free (avu_p -> im_key_s);
+					free (avu_p -> im_value_s);
+					free (avu_p -> im_units_s);
+				}
+
+			free (entry_p -> mce_avus_p);
+		}
+
+	free (entry_p -> mce_data_s);
+	free (entry_p);
+}
+
+
+/*
+ * Add an entry to a cache, replacing any existing entry with the same key.
+ * If the cache doesn't take the entry over, it is freed.
+ */
+static void AddEntryToCache (LRUCache *cache_p, const char *key_s, MetadataCacheEntry *entry_p, const int ttl)
+{
+	bool added_flag;
+
+	LockLRUCache (cache_p);
+	added_flag = AddLRUCacheValue (cache_p, key_s, entry_p, 1, apr_time_now () + apr_time_from_sec (ttl));
+	UnlockLRUCache (cache_p);
+
+	if (!added_flag)
+		{
+			FreeMetadataCacheEntry (entry_p);
+		}
+}
+
+
+static apr_status_t ClearMetadataCache (void *data_p)
+{
+	/* The caches free their entries in their own pool cleanups */
+	s_cache_p = NULL;
+	s_facet_cache_p = NULL;
+
+	return APR_SUCCESS;
+}
+
+
+/*
+ * Clear this child's caches if another child has changed
+ * any metadata since they were last checked.
+ */
+static void CheckMetadataCacheGeneration (void)
+{
+	if (s_shared_generation_p)
+		{
+			const apr_uint32_t shared_generation = apr_atomic_read32 (s_shared_generation_p);
+			const apr_uint32_t generation = apr_atomic_read32 (&s_generation);
+
+			/* Only one thread needs to do the clearing */
+			if ((shared_generation != generation) && (apr_atomic_cas32 (&s_generation, shared_generation, generation) == generation))
+				{
+					if (s_cache_p)
+						{
+							LockLRUCache (s_cache_p);
+							RemoveLRUCacheValuesWithPrefix (s_cache_p, "");
+							UnlockLRUCache (s_cache_p);
+						}
+
+					if (s_facet_cache_p)
+						{
+							LockLRUCache (s_facet_cache_p);
+							RemoveLRUCacheValuesWithPrefix (s_facet_cache_p, "");
+							UnlockLRUCache (s_facet_cache_p);
+						}
+				}
+		}
+}
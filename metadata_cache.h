@@ -0,0 +1,141 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * metadata_cache.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef METADATA_CACHE_H_
+#define METADATA_CACHE_H_
+
+#include "apr_pools.h"
+#include "apr_tables.h"
+
+#include "httpd.h"
+#include "http_config.h"
+
+#include "irods/rodsType.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create the counter that the child processes use to tell each other when
+ * metadata has changed, so that they all drop their cached AVUs rather
+ * than just the child that made the change. This should be called from
+ * the post_config hook so that the children inherit it.
+ *
+ * @param pool_p The configuration pool.
+ * @return APR_SUCCESS upon success or an APR error code upon failure, in
+ * which case each child's cache is only cleared by its own changes.
+ */
+apr_status_t InitSharedMetadataCache (apr_pool_t *pool_p);
+
+
+/**
+ * Create the per-child cache of AVU lists. This should be called
+ * once from the child_init hook.
+ *
+ * @param pool_p The child's memory pool. The cache will be cleaned up
+ * when this pool is destroyed.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t InitMetadataCache (apr_pool_t *pool_p);
+
+
+/**
+ * Get a copy of the cached AVUs for an iRODS object.
+ *
+ * @param object_type The type of the iRODS object.
+ * @param id_s The id of the iRODS object. This can be NULL or empty for collections.
+ * @param coll_name_s The collection name used when there is no id.
+ * @param username_s The iRODS user that the AVUs were fetched for.
+ * @param pool_p The memory pool to copy the IrodsMetadata entries into.
+ * @return An array of IrodsMetadata pointers or <code>NULL</code> if there is
+ * no valid cached entry.
+ */
+apr_array_header_t *GetCachedMetadata (const objType_t object_type, const char *id_s, const char *coll_name_s, const char *username_s, apr_pool_t *pool_p);
+
+
+/**
+ * Store a copy of the AVUs for an iRODS object in the cache.
+ *
+ * @param object_type The type of the iRODS object.
+ * @param id_s The id of the iRODS object.
+ * @param coll_name_s The collection name used when there is no id.
+ * @param username_s The iRODS user that the AVUs were fetched for.
+ * @param metadata_array_p The array of IrodsMetadata pointers to store.
+ * @param pool_p A memory pool to use for temporary allocations.
+ */
+void CacheMetadata (const objType_t object_type, const char *id_s, const char *coll_name_s, const char *username_s, const apr_array_header_t *metadata_array_p, apr_pool_t *pool_p);
+
+
+/**
+ * Remove all of the cached AVUs for an iRODS object, regardless of which
+ * user they were fetched for, along with all of the cached facet counts.
+ * This needs calling whenever the AVUs are modified.
+ *
+ * @param object_type The type of the iRODS object.
+ * @param id_s The id of the iRODS object. This can be NULL.
+ * @param path_s The full path of the iRODS object. This can be NULL.
+ * @param pool_p A memory pool to use for temporary allocations.
+ */
+void InvalidateCachedMetadata (const objType_t object_type, const char *id_s, const char *path_s, apr_pool_t *pool_p);
+
+
+/**
+ * Get a copy of the cached facet counts for a given query.
+ *
+ * @param key_s The key that uniquely identifies the facet query and the
+ * iRODS user that it was run for.
+ * @param pool_p The memory pool to copy the facet counts into.
+ * @return The facet counts or <code>NULL</code> if there is no valid
+ * cached entry.
+ */
+char *GetCachedFacetCounts (const char *key_s, apr_pool_t *pool_p);
+
+
+/**
+ * Store a copy of the facet counts for a given query in the cache.
+ * All of the cached facet counts are discarded whenever
+ * InvalidateCachedMetadata() is called.
+ *
+ * @param key_s The key that uniquely identifies the facet query and the
+ * iRODS user that it was run for.
+ * @param data_s The facet counts to store.
+ * @param pool_p A memory pool to use for logging errors.
+ */
+void CacheFacetCounts (const char *key_s, const char *data_s, apr_pool_t *pool_p);
+
+
+const char *SetMetadataCacheTTL (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetMetadataFacetCacheTTL (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetMetadataCacheSize (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* METADATA_CACHE_H_ */
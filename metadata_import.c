@@ -0,0 +1,1194 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * metadata_import.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "apr_file_io.h"
+#include "apr_general.h"
+#include "apr_strings.h"
+#include "apr_time.h"
+
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#include "apr_thread_pool.h"
+#endif
+
+#include "http_log.h"
+#include "http_protocol.h"
+
+#include "jansson.h"
+
+#include "metadata_import.h"
+#include "metadata_batch.h"
+#include "auth.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+/* The number of random bytes used for each job id, which is twice this many hex digits */
+#define JOB_ID_NUM_BYTES (16)
+
+
+#if APR_HAS_THREADS
+
+/*
+ * Each job has its own root memory pool since it outlives the request
+ * that started it. The job is run by a number of tasks on the child's
+ * thread pool, each with its own iRODS connection, that take turns to
+ * read the next chunk of rows from the manifest. The last task to finish
+ * writes the final status and frees the job.
+ *
+ * The connections are made by the request that starts the job, since
+ * logging in sets the process' environment which isn't safe to do from
+ * the background threads, and each task takes over one of them.
+ */
+typedef struct MetadataImportJob
+{
+	apr_pool_t *mij_pool_p;
+
+	/* Guards everything below it */
+	apr_thread_mutex_t *mij_mutex_p;
+
+	const char *mij_id_s;
+	const char *mij_username_s;
+
+	/* The connections that haven't been taken by a task yet */
+	rcComm_t **mij_connections_pp;
+	int mij_num_connections;
+
+	const char *mij_op_s;
+	char mij_separator;
+
+	const char *mij_manifest_path_s;
+	const char *mij_status_path_s;
+	const char *mij_errors_path_s;
+
+	apr_file_t *mij_manifest_p;
+	apr_file_t *mij_errors_p;
+
+	bool mij_eof_flag;
+	apr_int64_t mij_num_rows;
+	apr_int64_t mij_num_succeeded;
+	apr_int64_t mij_num_failed;
+	apr_int64_t mij_next_status_update;
+
+	int mij_num_running_tasks;
+
+	apr_time_t mij_start_time;
+} MetadataImportJob;
+
+#endif
+
+
+/*
+ * STATIC VARIABLES
+ */
+
+static const char *s_import_directory_s = NULL;
+
+/* The maximum number of threads in each child that run import jobs */
+static int s_import_max_threads = 4;
+
+/* The number of iRODS connections, and hence tasks, that each job uses */
+static int s_import_connections = 4;
+
+/* The number of manifest rows that each task reads and applies at a time */
+static const int S_ROWS_PER_CHUNK = 256;
+
+/* How many rows to process between updates of the status file */
+static const apr_int64_t S_STATUS_UPDATE_INTERVAL = 5000;
+
+/* The longest manifest row that can be read */
+static const int S_MAX_ROW_LENGTH = 8192;
+
+static const char * const S_STATUS_SUFFIX_S = ".status.json";
+static const char * const S_ERRORS_SUFFIX_S = ".errors.tsv";
+static const char * const S_MANIFEST_SUFFIX_S = ".manifest";
+
+
+#if APR_HAS_THREADS
+static apr_thread_pool_t *s_thread_pool_p = NULL;
+
+/*
+ * The ids of the jobs that are running in this child. The other children
+ * can tell that a job is still running since its manifest is locked.
+ */
+static apr_hash_t *s_running_jobs_p = NULL;
+
+static apr_thread_mutex_t *s_running_jobs_mutex_p = NULL;
+#endif
+
+
+/*
+ * STATIC DECLARATIONS
+ */
+
+static bool IsValidJobId (const char *job_id_s);
+
+static json_t *LoadJobStatus (const char *job_id_s, const char *username_s, apr_pool_t *pool_p);
+
+static char *GetJobFilename (const char *job_id_s, const char *suffix_s, apr_pool_t *pool_p);
+
+static bool IsOrphanedJob (const char *job_id_s, apr_pool_t *pool_p);
+
+static void SaveJobStatus (json_t *status_p, const char *path_s, apr_pool_t *pool_p);
+
+#if APR_HAS_THREADS
+static char *GenerateJobId (apr_pool_t *pool_p);
+
+static apr_status_t SaveRequestBody (request_rec *req_p, const char *path_s);
+
+static void *APR_THREAD_FUNC RunMetadataImportTask (apr_thread_t *thread_p, void *data_p);
+
+static int ReadManifestRows (MetadataImportJob *job_p, json_t *operations_p, apr_int64_t *rows_p);
+
+static int SplitManifestRow (char *row_s, const char separator, char **fields_ss, const int max_fields);
+
+static void RecordImportResults (MetadataImportJob *job_p, const json_t *operations_p, const json_t *results_p, const apr_int64_t *rows_p, const char *default_error_s);
+
+static void WriteImportError (MetadataImportJob *job_p, const apr_int64_t row, const char *target_s, const char *key_s, const char *error_s);
+
+static void WriteImportStatus (MetadataImportJob *job_p, const char *state_s);
+
+static void FinishMetadataImport (MetadataImportJob *job_p);
+
+static void SetJobRunning (const char *job_id_s, const bool running_flag);
+#endif
+
+
+/*
+ * API DEFINITIONS
+ */
+
+apr_status_t InitMetadataImports (apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	if (s_import_directory_s)
+		{
+			#if APR_HAS_THREADS
+			s_running_jobs_p = apr_hash_make (pool_p);
+			status = s_running_jobs_p ? apr_thread_mutex_create (&s_running_jobs_mutex_p, APR_THREAD_MUTEX_DEFAULT, pool_p) : APR_ENOMEM;
+
+			if (status == APR_SUCCESS)
+				{
+					status = apr_thread_pool_create (&s_thread_pool_p, 0, s_import_max_threads, pool_p);
+				}
+
+			if (status != APR_SUCCESS)
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to create thread pool for metadata imports");
+					s_thread_pool_p = NULL;
+				}
+			#else
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, APR_ENOTIMPL, pool_p, "Metadata imports need APR thread support so are disabled");
+			#endif
+		}
+
+	return status;
+}
+
+
+const char *StartMetadataImport (request_rec *req_p, const davrods_dir_conf_t *conf_p, const char separator, const char *op_s, const char *username_s, const char *password_s)
+{
+	const char *job_id_s = NULL;
+
+	#if APR_HAS_THREADS
+	if (s_thread_pool_p)
+		{
+			apr_pool_t *pool_p = NULL;
+			apr_status_t status = apr_pool_create (&pool_p, NULL);
+
+			if (status == APR_SUCCESS)
+				{
+					MetadataImportJob *job_p = (MetadataImportJob *) apr_pcalloc (pool_p, sizeof (MetadataImportJob));
+					bool started_flag = false;
+
+					apr_pool_tag (pool_p, "metadata import");
+
+					if (job_p)
+						{
+							job_p -> mij_pool_p = pool_p;
+							job_p -> mij_id_s = GenerateJobId (pool_p);
+							job_p -> mij_username_s = apr_pstrdup (pool_p, username_s);
+							job_p -> mij_op_s = apr_pstrdup (pool_p, op_s);
+							job_p -> mij_separator = separator;
+							job_p -> mij_next_status_update = S_STATUS_UPDATE_INTERVAL;
+							job_p -> mij_start_time = apr_time_now ();
+							job_p -> mij_connections_pp = (rcComm_t **) apr_pcalloc (pool_p, s_import_connections * sizeof (rcComm_t *));
+
+							if (job_p -> mij_id_s)
+								{
+									job_p -> mij_manifest_path_s = GetJobFilename (job_p -> mij_id_s, S_MANIFEST_SUFFIX_S, pool_p);
+									job_p -> mij_status_path_s = GetJobFilename (job_p -> mij_id_s, S_STATUS_SUFFIX_S, pool_p);
+									job_p -> mij_errors_path_s = GetJobFilename (job_p -> mij_id_s, S_ERRORS_SUFFIX_S, pool_p);
+								}
+						}
+
+					if (job_p && job_p -> mij_manifest_path_s && job_p -> mij_status_path_s && job_p -> mij_errors_path_s && job_p -> mij_connections_pp)
+						{
+							int i;
+
+							for (i = 0; i < s_import_connections; ++ i)
+								{
+									rcComm_t *connection_p = NULL;
+
+									if (LoginToIRods (conf_p, username_s, password_s, &connection_p, req_p -> pool) == AUTH_GRANTED)
+										{
+											* (job_p -> mij_connections_pp + job_p -> mij_num_connections) = connection_p;
+											++ (job_p -> mij_num_connections);
+										}
+									else
+										{
+											ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, req_p, "Failed to connect to iRODS as \"%s\" for metadata import job %s", username_s, job_p -> mij_id_s);
+
+											if (connection_p)
+												{
+													rcDisconnect (connection_p);
+												}
+
+											i = s_import_connections;
+										}
+								}
+
+							/* Run the job with however many connections we managed to make */
+							status = (job_p -> mij_num_connections > 0) ? SaveRequestBody (req_p, job_p -> mij_manifest_path_s) : APR_EGENERAL;
+
+							if (status == APR_SUCCESS)
+								{
+									status = apr_file_open (& (job_p -> mij_manifest_p), job_p -> mij_manifest_path_s, APR_FOPEN_READ | APR_FOPEN_BUFFERED, APR_FPROT_OS_DEFAULT, pool_p);
+
+									if (status == APR_SUCCESS)
+										{
+											status = apr_file_open (& (job_p -> mij_errors_p), job_p -> mij_errors_path_s, APR_FOPEN_CREATE | APR_FOPEN_WRITE | APR_FOPEN_TRUNCATE | APR_FOPEN_BUFFERED, APR_FPROT_UREAD | APR_FPROT_UWRITE, pool_p);
+
+											if (status == APR_SUCCESS)
+												{
+													/*
+													 * The lock lasts until the job finishes or this process
+													 * stops, which is how the other children can tell whether
+													 * the job is still running. See IsOrphanedJob ().
+													 */
+													status = apr_file_lock (job_p -> mij_manifest_p, APR_FLOCK_SHARED);
+
+													if (status == APR_SUCCESS)
+														{
+															status = apr_thread_mutex_create (& (job_p -> mij_mutex_p), APR_THREAD_MUTEX_DEFAULT, pool_p);
+														}
+
+													if (status == APR_SUCCESS)
+														{
+															SetJobRunning (job_p -> mij_id_s, true);
+															WriteImportStatus (job_p, "running");
+
+															/*
+															 * Hold the lock whilst adding the tasks so that none of them
+															 * can finish the job before we know how many were added.
+															 */
+															apr_thread_mutex_lock (job_p -> mij_mutex_p);
+
+															for (i = job_p -> mij_num_connections; i > 0; -- i)
+																{
+																	status = apr_thread_pool_push (s_thread_pool_p, RunMetadataImportTask, job_p, APR_THREAD_TASK_PRIORITY_NORMAL, job_p);
+
+																	if (status == APR_SUCCESS)
+																		{
+																			++ (job_p -> mij_num_running_tasks);
+																		}
+																	else
+																		{
+																			ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to add task for metadata import job %s", job_p -> mij_id_s);
+																			i = 0;
+																		}
+																}
+
+															started_flag = (job_p -> mij_num_running_tasks > 0);
+
+															/* Close any connections that are left over as their tasks couldn't be added */
+															while (started_flag && (job_p -> mij_num_connections > job_p -> mij_num_running_tasks))
+																{
+																	-- (job_p -> mij_num_connections);
+																	rcDisconnect (* (job_p -> mij_connections_pp + job_p -> mij_num_connections));
+																}
+
+															if (started_flag)
+																{
+																	/* Copy the id since the job, and its pool, may be gone by the time that we return */
+																	job_id_s = apr_pstrdup (req_p -> pool, job_p -> mij_id_s);
+																}
+
+															apr_thread_mutex_unlock (job_p -> mij_mutex_p);
+														}
+													else
+														{
+															ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to lock \"%s\" for metadata import", job_p -> mij_manifest_path_s);
+														}
+
+													if (!started_flag)
+														{
+															SetJobRunning (job_p -> mij_id_s, false);
+															apr_file_close (job_p -> mij_errors_p);
+															apr_file_remove (job_p -> mij_errors_path_s, pool_p);
+															apr_file_remove (job_p -> mij_status_path_s, pool_p);
+														}
+												}
+											else
+												{
+													ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to create \"%s\"", job_p -> mij_errors_path_s);
+												}
+
+											if (!started_flag)
+												{
+													apr_file_close (job_p -> mij_manifest_p);
+												}
+										}
+									else
+										{
+											ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to open \"%s\"", job_p -> mij_manifest_path_s);
+										}
+
+									if (!started_flag)
+										{
+											apr_file_remove (job_p -> mij_manifest_path_s, pool_p);
+										}
+
+								}		/* if (status == APR_SUCCESS) */
+
+							/* If the job didn't start, the connections are still ours to close */
+							if (!started_flag)
+								{
+									while (job_p -> mij_num_connections > 0)
+										{
+											-- (job_p -> mij_num_connections);
+											rcDisconnect (* (job_p -> mij_connections_pp + job_p -> mij_num_connections));
+										}
+								}
+
+						}		/* if (job_p && job_p -> mij_manifest_path_s && job_p -> mij_status_path_s && job_p -> mij_errors_path_s) */
+					else
+						{
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, req_p, "Failed to allocate metadata import job");
+						}
+
+					if (!started_flag)
+						{
+							apr_pool_destroy (pool_p);
+						}
+
+				}		/* if (status == APR_SUCCESS) */
+			else
+				{
+					ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to create memory pool for metadata import");
+				}
+
+		}		/* if (s_thread_pool_p) */
+	else
+		{
+			ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOTIMPL, req_p, "Metadata imports are not enabled");
+		}
+	#else
+	ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOTIMPL, req_p, "Metadata imports need APR thread support");
+	#endif
+
+	return job_id_s;
+}
+
+
+char *GetMetadataImportStatus (const char *job_id_s, const char *username_s, apr_pool_t *pool_p)
+{
+	char *status_s = NULL;
+	json_t *status_p = LoadJobStatus (job_id_s, username_s, pool_p);
+
+	if (status_p)
+		{
+			char *dump_s = json_dumps (status_p, JSON_INDENT (2));
+
+			if (dump_s)
+				{
+					status_s = apr_pstrdup (pool_p, dump_s);
+					free (dump_s);
+				}
+
+			json_decref (status_p);
+		}
+
+	return status_s;
+}
+
+
+const char *GetMetadataImportErrorsPath (const char *job_id_s, const char *username_s, apr_pool_t *pool_p)
+{
+	const char *path_s = NULL;
+	json_t *status_p = LoadJobStatus (job_id_s, username_s, pool_p);
+
+	if (status_p)
+		{
+			path_s = GetJobFilename (job_id_s, S_ERRORS_SUFFIX_S, pool_p);
+			json_decref (status_p);
+		}
+
+	return path_s;
+}
+
+
+const char *SetMetadataImportDirectory (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	s_import_directory_s = arg_p;
+
+	return NULL;
+}
+
+
+const char *SetMetadataImportThreads (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *error_s = NULL;
+	apr_int64_t num_threads = apr_atoi64 (arg_p);
+
+	if ((num_threads > 0) && (num_threads <= INT_MAX))
+		{
+			s_import_max_threads = (int) num_threads;
+		}
+	else
+		{
+			error_s = "The number of metadata import threads must be greater than zero";
+		}
+
+	return error_s;
+}
+
+
+const char *SetMetadataImportConnections (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *error_s = NULL;
+	apr_int64_t num_connections = apr_atoi64 (arg_p);
+
+	if ((num_connections > 0) && (num_connections <= INT_MAX))
+		{
+			s_import_connections = (int) num_connections;
+		}
+	else
+		{
+			error_s = "The number of iRODS connections for each metadata import must be greater than zero";
+		}
+
+	return error_s;
+}
+
+
+/*
+ * STATIC DEFINITIONS
+ */
+
+static bool IsValidJobId (const char *job_id_s)
+{
+	bool valid_flag = false;
+
+	/* Only allow the ids that we generate since they are used in filenames */
+	if (job_id_s && (strlen (job_id_s) == 2 * JOB_ID_NUM_BYTES))
+		{
+			valid_flag = true;
+
+			while (valid_flag && (*job_id_s != '\0'))
+				{
+					if (isxdigit ((unsigned char) *job_id_s))
+						{
+							++ job_id_s;
+						}
+					else
+						{
+							valid_flag = false;
+						}
+				}
+		}
+
+	return valid_flag;
+}
+
+
+static char *GetJobFilename (const char *job_id_s, const char *suffix_s, apr_pool_t *pool_p)
+{
+	char *filename_s = NULL;
+
+	if (s_import_directory_s && IsValidJobId (job_id_s))
+		{
+			char *path_s = NULL;
+
+			if (apr_filepath_merge (&path_s, s_import_directory_s, job_id_s, APR_FILEPATH_SECUREROOT, pool_p) == APR_SUCCESS)
+				{
+					filename_s = apr_pstrcat (pool_p, path_s, suffix_s, NULL);
+				}
+		}
+
+	return filename_s;
+}
+
+
+static json_t *LoadJobStatus (const char *job_id_s, const char *username_s, apr_pool_t *pool_p)
+{
+	json_t *status_p = NULL;
+	const char *path_s = GetJobFilename (job_id_s, S_STATUS_SUFFIX_S, pool_p);
+
+	if (path_s && username_s)
+		{
+			json_error_t error;
+
+			status_p = json_load_file (path_s, 0, &error);
+
+			if (status_p)
+				{
+					const char *job_user_s = json_string_value (json_object_get (status_p, "user"));
+					const char *state_s = json_string_value (json_object_get (status_p, "state"));
+
+					if (!job_user_s || (strcmp (job_user_s, username_s) != 0))
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, APR_EACCES, pool_p, "User \"%s\" is not allowed to see metadata import job %s", username_s, job_id_s);
+							json_decref (status_p);
+							status_p = NULL;
+						}
+					else if (state_s && (strcmp (state_s, "running") == 0) && IsOrphanedJob (job_id_s, pool_p))
+						{
+							/* The process running the job stopped before it could finish */
+							if ((json_object_set_new (status_p, "state", json_string ("failed")) == 0) &&
+									(json_object_set_new (status_p, "error", json_string ("The server process running this job stopped before it finished")) == 0))
+								{
+									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, APR_SUCCESS, pool_p, "Marking orphaned metadata import job %s as failed", job_id_s);
+									SaveJobStatus (status_p, path_s, pool_p);
+								}
+						}
+				}
+		}
+
+	return status_p;
+}
+
+
+/*
+ * A job is orphaned if it isn't running in this child and no other child
+ * holds the lock on its manifest, which the operating system releases
+ * when a process stops. The lock has to be checked from a different
+ * process since a process' own locks never conflict with each other.
+ * Nothing else opens the manifest since closing any handle to a file
+ * would release its process' lock on it.
+ */
+static bool IsOrphanedJob (const char *job_id_s, apr_pool_t *pool_p)
+{
+	bool orphaned_flag = false;
+	bool running_here_flag = false;
+
+	#if APR_HAS_THREADS
+	if (s_running_jobs_p)
+		{
+			apr_thread_mutex_lock (s_running_jobs_mutex_p);
+			running_here_flag = (apr_hash_get (s_running_jobs_p, job_id_s, APR_HASH_KEY_STRING) != NULL);
+			apr_thread_mutex_unlock (s_running_jobs_mutex_p);
+		}
+	#endif
+
+	if (!running_here_flag)
+		{
+			const char *path_s = GetJobFilename (job_id_s, S_MANIFEST_SUFFIX_S, pool_p);
+
+			if (path_s)
+				{
+					apr_file_t *file_p = NULL;
+
+					/* An exclusive lock needs the file to be open for writing */
+					if (apr_file_open (&file_p, path_s, APR_FOPEN_READ | APR_FOPEN_WRITE, APR_FPROT_OS_DEFAULT, pool_p) == APR_SUCCESS)
+						{
+							if (apr_file_lock (file_p, APR_FLOCK_EXCLUSIVE | APR_FLOCK_NONBLOCK) == APR_SUCCESS)
+								{
+									orphaned_flag = true;
+									apr_file_unlock (file_p);
+								}
+
+							apr_file_close (file_p);
+						}
+					else
+						{
+							/* The manifest is only removed once the job has completed */
+							orphaned_flag = true;
+						}
+				}
+		}
+
+	return orphaned_flag;
+}
+
+
+/*
+ * Write the status to a temporary file and then rename it so that
+ * readers never see a partially-written file.
+ */
+static void SaveJobStatus (json_t *status_p, const char *path_s, apr_pool_t *pool_p)
+{
+	char *temp_path_s = NULL;
+	apr_file_t *temp_file_p = NULL;
+
+	/* Each writer needs its own temporary file as another child may be marking the job as orphaned */
+	temp_path_s = apr_pstrcat (pool_p, path_s, ".XXXXXX", NULL);
+
+	if (temp_path_s && (apr_file_mktemp (&temp_file_p, temp_path_s, APR_FOPEN_CREATE | APR_FOPEN_WRITE | APR_FOPEN_EXCL, pool_p) == APR_SUCCESS))
+		{
+			char *dump_s = json_dumps (status_p, JSON_INDENT (2));
+			apr_status_t status = APR_ENOMEM;
+
+			if (dump_s)
+				{
+					apr_size_t num_written = 0;
+
+					status = apr_file_write_full (temp_file_p, dump_s, strlen (dump_s), &num_written);
+					free (dump_s);
+				}
+
+			if (apr_file_close (temp_file_p) != APR_SUCCESS)
+				{
+					status = APR_EGENERAL;
+				}
+
+			if (status == APR_SUCCESS)
+				{
+					status = apr_file_rename (temp_path_s, path_s, pool_p);
+
+					if (status != APR_SUCCESS)
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to rename \"%s\" to \"%s\"", temp_path_s, path_s);
+						}
+				}
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to write \"%s\"", temp_path_s);
+				}
+
+			if (status != APR_SUCCESS)
+				{
+					apr_file_remove (temp_path_s, pool_p);
+				}
+		}
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to create temporary file for \"%s\"", path_s);
+		}
+}
+
+
+#if APR_HAS_THREADS
+
+static char *GenerateJobId (apr_pool_t *pool_p)
+{
+	char *id_s = NULL;
+	unsigned char bytes [JOB_ID_NUM_BYTES];
+
+	if (apr_generate_random_bytes (bytes, JOB_ID_NUM_BYTES) == APR_SUCCESS)
+		{
+			id_s = (char *) apr_palloc (pool_p, (2 * JOB_ID_NUM_BYTES) + 1);
+
+			if (id_s)
+				{
+					int i;
+
+					for (i = 0; i < JOB_ID_NUM_BYTES; ++ i)
+						{
+							sprintf (id_s + (2 * i), "%02x", bytes [i]);
+						}
+				}
+		}
+
+	return id_s;
+}
+
+
+static apr_status_t SaveRequestBody (request_rec *req_p, const char *path_s)
+{
+	apr_file_t *file_p = NULL;
+	apr_status_t status = apr_file_open (&file_p, path_s, APR_FOPEN_CREATE | APR_FOPEN_WRITE | APR_FOPEN_TRUNCATE | APR_FOPEN_BUFFERED, APR_FPROT_UREAD | APR_FPROT_UWRITE, req_p -> pool);
+
+	if (status == APR_SUCCESS)
+		{
+			status = APR_EGENERAL;
+
+			if (ap_setup_client_block (req_p, REQUEST_CHUNKED_DECHUNK) == OK)
+				{
+					if (ap_should_client_block (req_p))
+						{
+							char buffer [HUGE_STRING_LEN];
+							bool loop_flag = true;
+
+							while (loop_flag)
+								{
+									long num_read = ap_get_client_block (req_p, buffer, HUGE_STRING_LEN);
+
+									if (num_read > 0)
+										{
+											apr_size_t num_written = 0;
+
+											if (apr_file_write_full (file_p, buffer, (apr_size_t) num_read, &num_written) != APR_SUCCESS)
+												{
+													ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, req_p, "Failed to write to \"%s\"", path_s);
+													loop_flag = false;
+												}
+										}
+									else
+										{
+											if (num_read == 0)
+												{
+													status = APR_SUCCESS;
+												}
+
+											loop_flag = false;
+										}
+								}
+						}
+				}
+
+			if (apr_file_close (file_p) != APR_SUCCESS)
+				{
+					status = APR_EGENERAL;
+				}
+
+			if (status != APR_SUCCESS)
+				{
+					ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to save manifest to \"%s\"", path_s);
+					apr_file_remove (path_s, req_p -> pool);
+				}
+		}
+	else
+		{
+			ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to create \"%s\"", path_s);
+		}
+
+	return status;
+}
+
+
+static void *APR_THREAD_FUNC RunMetadataImportTask (apr_thread_t *thread_p, void *data_p)
+{
+	MetadataImportJob *job_p = (MetadataImportJob *) data_p;
+	apr_pool_t *pool_p = NULL;
+	bool last_task_flag = false;
+
+	/* Pools aren't thread-safe so each task has its own */
+	if (apr_pool_create (&pool_p, NULL) == APR_SUCCESS)
+		{
+			rcComm_t *connection_p = NULL;
+			const char *connection_error_s = NULL;
+			apr_int64_t *rows_p = (apr_int64_t *) apr_palloc (pool_p, S_ROWS_PER_CHUNK * sizeof (apr_int64_t));
+
+			/* Take over one of the connections that the request made for us */
+			apr_thread_mutex_lock (job_p -> mij_mutex_p);
+
+			if (job_p -> mij_num_connections > 0)
+				{
+					-- (job_p -> mij_num_connections);
+					connection_p = * (job_p -> mij_connections_pp + job_p -> mij_num_connections);
+				}
+
+			apr_thread_mutex_unlock (job_p -> mij_mutex_p);
+
+			if (!connection_p)
+				{
+					/*
+					 * Keep reading rows so that they get reported as failures
+					 * rather than the job never finishing.
+					 */
+					connection_error_s = "Failed to connect to iRODS";
+				}
+
+			if (rows_p)
+				{
+					bool loop_flag = true;
+
+					while (loop_flag)
+						{
+							apr_pool_t *chunk_pool_p = NULL;
+							json_t *operations_p = json_array ();
+
+							if (operations_p && (apr_pool_create (&chunk_pool_p, pool_p) == APR_SUCCESS))
+								{
+									int num_rows;
+
+									apr_thread_mutex_lock (job_p -> mij_mutex_p);
+									num_rows = ReadManifestRows (job_p, operations_p, rows_p);
+									apr_thread_mutex_unlock (job_p -> mij_mutex_p);
+
+									if (num_rows > 0)
+										{
+											json_t *results_p = connection_p ? RunMetadataOperations (operations_p, connection_p, chunk_pool_p) : NULL;
+
+											apr_thread_mutex_lock (job_p -> mij_mutex_p);
+											RecordImportResults (job_p, operations_p, results_p, rows_p, connection_error_s ? connection_error_s : "Failed to run metadata operations");
+											apr_thread_mutex_unlock (job_p -> mij_mutex_p);
+
+											if (results_p)
+												{
+													json_decref (results_p);
+												}
+										}
+									else if (num_rows == 0)
+										{
+											loop_flag = false;
+										}
+
+									apr_pool_destroy (chunk_pool_p);
+								}
+							else
+								{
+									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to allocate memory for metadata import job %s", job_p -> mij_id_s);
+									loop_flag = false;
+								}
+
+							if (operations_p)
+								{
+									json_decref (operations_p);
+								}
+
+						}		/* while (loop_flag) */
+
+				}		/* if (rows_p) */
+
+			if (connection_p)
+				{
+					rcDisconnect (connection_p);
+				}
+
+			apr_pool_destroy (pool_p);
+		}		/* if (apr_pool_create (&pool_p, NULL) == APR_SUCCESS) */
+
+	apr_thread_mutex_lock (job_p -> mij_mutex_p);
+	-- (job_p -> mij_num_running_tasks);
+	last_task_flag = (job_p -> mij_num_running_tasks == 0);
+	apr_thread_mutex_unlock (job_p -> mij_mutex_p);
+
+	if (last_task_flag)
+		{
+			FinishMetadataImport (job_p);
+		}
+
+	return NULL;
+}
+
+
+/*
+ * Read up to S_ROWS_PER_CHUNK valid rows into operations_p and store their
+ * row numbers in rows_p. Invalid rows are reported straight away. This must
+ * be called with the job's mutex held. It returns the number of rows that
+ * were added, which is 0 once the whole manifest has been read.
+ */
+static int ReadManifestRows (MetadataImportJob *job_p, json_t *operations_p, apr_int64_t *rows_p)
+{
+	int num_rows = 0;
+	char *row_s = (char *) malloc (S_MAX_ROW_LENGTH);
+
+	if (row_s)
+		{
+			while ((num_rows < S_ROWS_PER_CHUNK) && (!job_p -> mij_eof_flag))
+				{
+					apr_status_t status = apr_file_gets (row_s, S_MAX_ROW_LENGTH, job_p -> mij_manifest_p);
+
+					if (status == APR_SUCCESS)
+						{
+							size_t l = strlen (row_s);
+							const apr_int64_t row = ++ (job_p -> mij_num_rows);
+							bool complete_flag = true;
+
+							if ((l > 0) && (* (row_s + l - 1) == '\n'))
+								{
+									* (row_s + (-- l)) = '\0';
+								}
+							else if (l == (size_t) (S_MAX_ROW_LENGTH - 1))
+								{
+									/* The row is too long, so skip the rest of it */
+									char c = '\0';
+
+									while ((c != '\n') && (apr_file_getc (&c, job_p -> mij_manifest_p) == APR_SUCCESS))
+										{
+										}
+
+									complete_flag = false;
+								}
+
+							if ((l > 0) && (* (row_s + l - 1) == '\r'))
+								{
+									* (row_s + (-- l)) = '\0';
+								}
+
+							if (!complete_flag)
+								{
+									WriteImportError (job_p, row, "", "", "Row is too long");
+								}
+							else if ((l > 0) && (*row_s != '#'))
+								{
+									char *fields_ss [4] = { NULL, NULL, NULL, NULL };
+									const int num_fields = SplitManifestRow (row_s, job_p -> mij_separator, fields_ss, 4);
+
+									/* Skip any header row */
+									if ((row == 1) && ((strcasecmp (fields_ss [0], "path") == 0) || (strcasecmp (fields_ss [0], "id") == 0)))
+										{
+										}
+									else if (num_fields >= 3)
+										{
+											json_t *operation_p = json_pack ("{s:s,s:s,s:s,s:s}",
+																											 "op", job_p -> mij_op_s,
+																											 (*fields_ss [0] == '/') ? "path" : "id", fields_ss [0],
+																											 "key", fields_ss [1],
+																											 "value", fields_ss [2]);
+
+											if (operation_p && (num_fields > 3) && (*fields_ss [3] != '\0'))
+												{
+													if (json_object_set_new (operation_p, "units", json_string (fields_ss [3])) != 0)
+														{
+															json_decref (operation_p);
+															operation_p = NULL;
+														}
+												}
+
+											if (operation_p && (json_array_append_new (operations_p, operation_p) == 0))
+												{
+													* (rows_p + num_rows) = row;
+													++ num_rows;
+												}
+											else
+												{
+													WriteImportError (job_p, row, fields_ss [0], fields_ss [1], "Failed to parse row");
+												}
+										}
+									else
+										{
+											WriteImportError (job_p, row, fields_ss [0], num_fields > 1 ? fields_ss [1] : "", "Rows need a path or id, key and value");
+										}
+								}
+						}
+					else
+						{
+							if (status != APR_EOF)
+								{
+									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, job_p -> mij_pool_p, "Failed to read \"%s\"", job_p -> mij_manifest_path_s);
+								}
+
+							job_p -> mij_eof_flag = true;
+						}
+
+				}		/* while ((num_rows < S_ROWS_PER_CHUNK) && (!job_p -> mij_eof_flag)) */
+
+			free (row_s);
+		}
+	else
+		{
+			num_rows = -1;
+		}
+
+	return num_rows;
+}
+
+
+/*
+ * Split a row in place. For comma-separated rows, fields can be enclosed
+ * in double quotes, with any double quotes within them doubled.
+ */
+static int SplitManifestRow (char *row_s, const char separator, char **fields_ss, const int max_fields)
+{
+	int num_fields = 0;
+	char *read_p = row_s;
+	int i;
+
+	while ((num_fields < max_fields) && read_p)
+		{
+			char *write_p = read_p;
+
+			* (fields_ss + num_fields) = write_p;
+			++ num_fields;
+
+			if ((separator == ',') && (*read_p == '"'))
+				{
+					bool quoted_flag = true;
+
+					++ read_p;
+
+					while (*read_p != '\0')
+						{
+							if (quoted_flag && (*read_p == '"'))
+								{
+									if (* (read_p + 1) == '"')
+										{
+											*write_p = '"';
+											++ write_p;
+											read_p += 2;
+										}
+									else
+										{
+											quoted_flag = false;
+											++ read_p;
+										}
+								}
+							else if ((!quoted_flag) && (*read_p == separator))
+								{
+									break;
+								}
+							else
+								{
+									*write_p = *read_p;
+									++ write_p;
+									++ read_p;
+								}
+						}
+				}
+			else
+				{
+					while ((*read_p != '\0') && (*read_p != separator))
+						{
+							++ read_p;
+						}
+
+					write_p = read_p;
+				}
+
+			if (*read_p == separator)
+				{
+					*write_p = '\0';
+					++ read_p;
+				}
+			else
+				{
+					*write_p = '\0';
+					read_p = NULL;
+				}
+		}
+
+	/* Fill any missing fields so that callers can always read them */
+	for (i = num_fields; i < max_fields; ++ i)
+		{
+			* (fields_ss + i) = "";
+		}
+
+	return num_fields;
+}
+
+
+/*
+ * This must be called with the job's mutex held.
+ */
+static void RecordImportResults (MetadataImportJob *job_p, const json_t *operations_p, const json_t *results_p, const apr_int64_t *rows_p, const char *default_error_s)
+{
+	const size_t num_ops = json_array_size (operations_p);
+	size_t i;
+
+	for (i = 0; i < num_ops; ++ i)
+		{
+			const json_t *result_p = results_p ? json_array_get (results_p, i) : NULL;
+
+			if (result_p && json_is_true (json_object_get (result_p, "success")))
+				{
+					++ (job_p -> mij_num_succeeded);
+				}
+			else
+				{
+					const json_t *operation_p = json_array_get (operations_p, i);
+					const char *target_s = json_string_value (json_object_get (operation_p, "path"));
+					const char *error_s = result_p ? json_string_value (json_object_get (result_p, "error")) : NULL;
+
+					if (!target_s)
+						{
+							target_s = json_string_value (json_object_get (operation_p, "id"));
+						}
+
+					WriteImportError (job_p, * (rows_p + i), target_s, json_string_value (json_object_get (operation_p, "key")), error_s ? error_s : default_error_s);
+				}
+		}
+
+	if (job_p -> mij_num_succeeded + job_p -> mij_num_failed >= job_p -> mij_next_status_update)
+		{
+			WriteImportStatus (job_p, "running");
+			job_p -> mij_next_status_update += S_STATUS_UPDATE_INTERVAL;
+		}
+}
+
+
+/*
+ * This must be called with the job's mutex held.
+ */
+static void WriteImportError (MetadataImportJob *job_p, const apr_int64_t row, const char *target_s, const char *key_s, const char *error_s)
+{
+	++ (job_p -> mij_num_failed);
+
+	apr_file_printf (job_p -> mij_errors_p, "%" APR_INT64_T_FMT "\t%s\t%s\t%s\n", row, target_s ? target_s : "", key_s ? key_s : "", error_s ? error_s : "");
+}
+
+
+/*
+ * This must be called with the job's mutex held, if it has one.
+ */
+static void WriteImportStatus (MetadataImportJob *job_p, const char *state_s)
+{
+	json_t *status_p = json_pack ("{s:s,s:s,s:s,s:I,s:I,s:I,s:I}",
+																"job", job_p -> mij_id_s,
+																"user", job_p -> mij_username_s,
+																"state", state_s,
+																"rows", (json_int_t) (job_p -> mij_num_rows),
+																"succeeded", (json_int_t) (job_p -> mij_num_succeeded),
+																"failed", (json_int_t) (job_p -> mij_num_failed),
+																"started", (json_int_t) apr_time_sec (job_p -> mij_start_time));
+
+	if (status_p)
+		{
+			SaveJobStatus (status_p, job_p -> mij_status_path_s, job_p -> mij_pool_p);
+			json_decref (status_p);
+		}
+}
+
+
+static void FinishMetadataImport (MetadataImportJob *job_p)
+{
+	/*
+	 * Write the final status before closing the manifest, and so
+	 * releasing its lock, so that the job never looks orphaned.
+	 */
+	apr_file_flush (job_p -> mij_errors_p);
+	WriteImportStatus (job_p, "completed");
+
+	apr_file_close (job_p -> mij_errors_p);
+	apr_file_close (job_p -> mij_manifest_p);
+	apr_file_remove (job_p -> mij_manifest_path_s, job_p -> mij_pool_p);
+
+	SetJobRunning (job_p -> mij_id_s, false);
+
+	ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_INFO, APR_SUCCESS, job_p -> mij_pool_p, "Metadata import job %s for \"%s\" finished: %" APR_INT64_T_FMT " rows succeeded and %" APR_INT64_T_FMT " failed",
+								 job_p -> mij_id_s, job_p -> mij_username_s, job_p -> mij_num_succeeded, job_p -> mij_num_failed);
+
+	apr_thread_mutex_destroy (job_p -> mij_mutex_p);
+	apr_pool_destroy (job_p -> mij_pool_p);
+}
+
+
+static void SetJobRunning (const char *job_id_s, const bool running_flag)
+{
+	apr_thread_mutex_lock (s_running_jobs_mutex_p);
+	apr_hash_set (s_running_jobs_p, job_id_s, APR_HASH_KEY_STRING, running_flag ? job_id_s : NULL);
+	apr_thread_mutex_unlock (s_running_jobs_mutex_p);
+}
+
+#endif		/* #if APR_HAS_THREADS */
@@ -0,0 +1,112 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * metadata_import.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef METADATA_IMPORT_H_
+#define METADATA_IMPORT_H_
+
+#include "apr_pools.h"
+
+#include "httpd.h"
+#include "http_config.h"
+
+#include "config.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create the per-child thread pool that runs the metadata import jobs.
+ * This should be called once from the child_init hook.
+ *
+ * @param pool_p The child's memory pool. The thread pool will be cleaned up
+ * when this pool is destroyed.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t InitMetadataImports (apr_pool_t *pool_p);
+
+
+/**
+ * Store the body of a request as a metadata import manifest and start
+ * a background job to apply it.
+ *
+ * Each row of the manifest has the path or id of a data object or collection,
+ * the key, the value and optionally the units of an AVU.
+ *
+ * The job's iRODS connections are made on the calling thread, before this
+ * returns, and are handed over to the background tasks.
+ *
+ * @param req_p The request whose body is the manifest.
+ * @param conf_p The module configuration with the iRODS server details.
+ * @param separator The column separator, either ',' or '\t'.
+ * @param op_s The operation to apply for each row, either "add" or "set".
+ * @param username_s The iRODS user to run the job as.
+ * @param password_s The password for the iRODS user.
+ * @return The id of the new job, which is made from random bytes so that it
+ * can't be guessed, or <code>NULL</code> upon error.
+ */
+const char *StartMetadataImport (request_rec *req_p, const davrods_dir_conf_t *conf_p, const char separator, const char *op_s, const char *username_s, const char *password_s);
+
+
+/**
+ * Get the current status of a metadata import job.
+ *
+ * @param job_id_s The id of the job.
+ * @param username_s The iRODS user making the request. Only the user
+ * that started the job can get its status.
+ * @param pool_p The memory pool to allocate the status from.
+ * @return The status as a JSON string or <code>NULL</code> if the job
+ * could not be found for this user.
+ */
+char *GetMetadataImportStatus (const char *job_id_s, const char *username_s, apr_pool_t *pool_p);
+
+
+/**
+ * Get the path to the error report for a metadata import job. This is a
+ * tab-separated file with the row number, path or id, key and error message
+ * for each row that could not be imported.
+ *
+ * @param job_id_s The id of the job.
+ * @param username_s The iRODS user making the request. Only the user
+ * that started the job can get its error report.
+ * @param pool_p The memory pool to allocate the path from.
+ * @return The path or <code>NULL</code> if the job could not be found
+ * for this user.
+ */
+const char *GetMetadataImportErrorsPath (const char *job_id_s, const char *username_s, apr_pool_t *pool_p);
+
+
+const char *SetMetadataImportDirectory (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetMetadataImportThreads (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetMetadataImportConnections (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* METADATA_IMPORT_H_ */
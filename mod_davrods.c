@@ -26,6 +26,12 @@
 #include "auth.h"
 #include "common.h"
 #include "rest.h"
+#include "metadata_cache.h"
+#include "metadata_import.h"
+#include "listing_cache.h"
+#include "checksum_queue.h"
+#include "section_cache.h"
+#include "curl_util.h"
 #include "http_request.h"
 
 #include <curl/curl.h>
@@ -41,6 +47,8 @@ APLOG_USE_MODULE(davrods);
 
 
 
+static int EIRodsDavPostConfig (apr_pool_t *config_pool_p, apr_pool_t *log_pool_p, apr_pool_t *temp_pool_p, server_rec *server_p);
+
 static void EIRodsDavChildInit (apr_pool_t *pool_p, server_rec *server_p);
 
 static apr_status_t EIRodsDavChildFinalize (void *data_p);
@@ -51,6 +59,7 @@ static void register_davrods_hooks(apr_pool_t *p) {
     davrods_auth_register(p);
     davrods_dav_register(p);
 
+    ap_hook_post_config (EIRodsDavPostConfig, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_child_init (EIRodsDavChildInit, NULL, NULL, APR_HOOK_FIRST);
     ap_hook_fixups (EIRodsDavFixUps, NULL, NULL, APR_HOOK_FIRST);
 
@@ -78,6 +87,15 @@ module AP_MODULE_DECLARE_DATA davrods_module = {
 
 
 
+static int EIRodsDavPostConfig (apr_pool_t *config_pool_p, apr_pool_t *log_pool_p, apr_pool_t *temp_pool_p, server_rec *server_p)
+{
+	/* The cache still works without this, just per child, so it isn't fatal */
+	InitSharedMetadataCache (config_pool_p);
+
+	return OK;
+}
+
+
 static void EIRodsDavChildInit (apr_pool_t *pool_p, server_rec *server_p)
 {
 	CURLcode res = curl_global_init (CURL_GLOBAL_DEFAULT);
@@ -85,11 +103,42 @@ static void EIRodsDavChildInit (apr_pool_t *pool_p, server_rec *server_p)
 	if (res == CURLE_OK)
 		{
 			apr_pool_cleanup_register (pool_p, NULL, EIRodsDavChildFinalize, apr_pool_cleanup_null);
+
+			/* This must come after the above so that its handles are cleaned up before curl itself */
+			if (InitCurlUtil (pool_p) != APR_SUCCESS)
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to initialise curl handle pool");
+				}
 		}
 	else
 		{
 			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to initialise CURL library");
 		}
+
+	if (InitMetadataCache (pool_p) != APR_SUCCESS)
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to initialise metadata cache");
+		}
+
+	if (InitListingCache (pool_p) != APR_SUCCESS)
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to initialise listing cache");
+		}
+
+	if (InitMetadataImports (pool_p) != APR_SUCCESS)
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to initialise metadata imports");
+		}
+
+	if (InitChecksumQueue (pool_p) != APR_SUCCESS)
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to initialise checksum queue");
+		}
+
+	if (InitSectionCache (pool_p) != APR_SUCCESS)
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to initialise section cache");
+		}
 }
 
 
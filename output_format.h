@@ -29,6 +29,7 @@ typedef enum OutputFormat
 	OF_JSON,
 	OF_TSV,
 	OF_CSV,
+	OF_JSON_LINES,
 	OF_NUM_FORMATS
 } OutputFormat;
 
@@ -0,0 +1,196 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * output_stream.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include "apr_strings.h"
+
+#include "http_log.h"
+#include "util_filter.h"
+
+#include "output_stream.h"
+#include "common.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+/* The default amount of output to buffer before FlushOutputStreamIfFull () sends it on */
+static const apr_off_t S_DEFAULT_FLUSH_THRESHOLD = 16384;
+
+
+static int WriteJSONChunk (const char *buffer_s, size_t size, void *data_p);
+
+
+OutputStream *AllocateOutputStream (request_rec *req_p, const OutputFormat format)
+{
+	apr_bucket_brigade *bb_p = apr_brigade_create (req_p -> pool, req_p -> connection -> bucket_alloc);
+
+	if (bb_p)
+		{
+			OutputStream *stream_p = (OutputStream *) apr_palloc (req_p -> pool, sizeof (OutputStream));
+
+			if (stream_p)
+				{
+					stream_p -> os_req_p = req_p;
+					stream_p -> os_bb_p = bb_p;
+					stream_p -> os_format = format;
+					stream_p -> os_num_values = 0;
+					stream_p -> os_flush_threshold = S_DEFAULT_FLUSH_THRESHOLD;
+
+					return stream_p;
+				}
+
+			apr_brigade_destroy (bb_p);
+		}
+
+	ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, req_p, "Failed to allocate output stream");
+
+	return NULL;
+}
+
+
+apr_status_t StartOutputStreamList (OutputStream *stream_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	stream_p -> os_num_values = 0;
+
+	if (stream_p -> os_format != OF_JSON_LINES)
+		{
+			status = apr_brigade_puts (stream_p -> os_bb_p, ap_filter_flush, stream_p -> os_req_p -> output_filters, "[\n");
+		}
+
+	return status;
+}
+
+
+apr_status_t WriteJSONToOutputStream (OutputStream *stream_p, const json_t *value_p)
+{
+	apr_status_t status = APR_SUCCESS;
+	size_t flags = JSON_INDENT (2);
+
+	if (stream_p -> os_format == OF_JSON_LINES)
+		{
+			flags = JSON_COMPACT;
+		}
+	else if (stream_p -> os_num_values > 0)
+		{
+			status = apr_brigade_puts (stream_p -> os_bb_p, ap_filter_flush, stream_p -> os_req_p -> output_filters, ",\n");
+		}
+
+	if (status == APR_SUCCESS)
+		{
+			if (json_dump_callback (value_p, WriteJSONChunk, stream_p, flags) == 0)
+				{
+					++ (stream_p -> os_num_values);
+
+					if (stream_p -> os_format == OF_JSON_LINES)
+						{
+							status = apr_brigade_putc (stream_p -> os_bb_p, ap_filter_flush, stream_p -> os_req_p -> output_filters, '\n');
+						}
+				}
+			else
+				{
+					status = APR_EGENERAL;
+				}
+		}
+
+	return status;
+}
+
+
+apr_status_t EndOutputStreamList (OutputStream *stream_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	if (stream_p -> os_format != OF_JSON_LINES)
+		{
+			status = apr_brigade_puts (stream_p -> os_bb_p, ap_filter_flush, stream_p -> os_req_p -> output_filters, "\n]\n");
+		}
+
+	return status;
+}
+
+
+apr_status_t FlushOutputStream (OutputStream *stream_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	if (!APR_BRIGADE_EMPTY (stream_p -> os_bb_p))
+		{
+			status = ap_pass_brigade (stream_p -> os_req_p -> output_filters, stream_p -> os_bb_p);
+			apr_brigade_cleanup (stream_p -> os_bb_p);
+		}
+
+	return status;
+}
+
+
+apr_status_t FlushOutputStreamIfFull (OutputStream *stream_p)
+{
+	apr_status_t status = APR_SUCCESS;
+	apr_off_t length = 0;
+
+	/* Only count the buckets whose lengths are already known rather than reading any in */
+	if (apr_brigade_length (stream_p -> os_bb_p, 0, &length) == APR_SUCCESS)
+		{
+			if ((length < 0) || (length >= stream_p -> os_flush_threshold))
+				{
+					status = FlushOutputStream (stream_p);
+				}
+		}
+
+	return status;
+}
+
+
+apr_status_t CloseOutputStream (OutputStream *stream_p)
+{
+	apr_status_t status;
+
+	CloseBucketsStream (stream_p -> os_bb_p);
+
+	status = ap_pass_brigade (stream_p -> os_req_p -> output_filters, stream_p -> os_bb_p);
+
+	if (status != APR_SUCCESS)
+		{
+			ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, stream_p -> os_req_p, "Failed to close output stream");
+		}
+
+	apr_brigade_destroy (stream_p -> os_bb_p);
+	stream_p -> os_bb_p = NULL;
+
+	return status;
+}
+
+
+/*
+ * The callback for json_dump_callback () which writes each piece
+ * of the serialised JSON straight into the brigade, passing it on
+ * to the output filters whenever its buffer fills up.
+ */
+static int WriteJSONChunk (const char *buffer_s, size_t size, void *data_p)
+{
+	OutputStream *stream_p = (OutputStream *) data_p;
+	apr_status_t status = apr_brigade_write (stream_p -> os_bb_p, ap_filter_flush, stream_p -> os_req_p -> output_filters, buffer_s, size);
+
+	return (status == APR_SUCCESS) ? 0 : -1;
+}
@@ -0,0 +1,150 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * output_stream.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef OUTPUT_STREAM_H_
+#define OUTPUT_STREAM_H_
+
+#include "apr_buckets.h"
+
+#include "httpd.h"
+
+#include "jansson.h"
+
+#include "output_format.h"
+
+
+/**
+ * An OutputStream writes a response straight into a request's output
+ * filter chain as it is generated rather than building the whole response
+ * in memory first.
+ */
+typedef struct OutputStream
+{
+	request_rec *os_req_p;
+
+	/**
+	 * The brigade to write to. Anything written here is sent on the next
+	 * time that the stream is flushed or closed.
+	 */
+	apr_bucket_brigade *os_bb_p;
+
+	OutputFormat os_format;
+
+	/** The number of values written to the current list so far. */
+	size_t os_num_values;
+
+	/**
+	 * The amount of buffered output, in bytes, at which
+	 * FlushOutputStreamIfFull () will send it on.
+	 */
+	apr_off_t os_flush_threshold;
+} OutputStream;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create an OutputStream for a request.
+ *
+ * @param req_p The request to send the output to.
+ * @param format The format of the output. For OF_JSON, lists are written as
+ * JSON arrays and for OF_JSON_LINES as a compact JSON value on each line.
+ * @return The new OutputStream, allocated from the request's pool, or
+ * <code>NULL</code> upon error.
+ */
+OutputStream *AllocateOutputStream (request_rec *req_p, const OutputFormat format);
+
+
+/**
+ * Write the opening of a list of JSON values.
+ *
+ * @param stream_p The OutputStream to write to.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t StartOutputStreamList (OutputStream *stream_p);
+
+
+/**
+ * Write a JSON value to the output. If a list has been started, this will
+ * be added as the next entry of it.
+ *
+ * The value is serialised directly into the output using
+ * json_dump_callback () so no intermediate string is created.
+ *
+ * @param stream_p The OutputStream to write to.
+ * @param value_p The JSON value to write.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t WriteJSONToOutputStream (OutputStream *stream_p, const json_t *value_p);
+
+
+/**
+ * Write the closing of a list of JSON values.
+ *
+ * @param stream_p The OutputStream to write to.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t EndOutputStreamList (OutputStream *stream_p);
+
+
+/**
+ * Send everything that has been written so far on through the
+ * output filters.
+ *
+ * @param stream_p The OutputStream to flush.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t FlushOutputStream (OutputStream *stream_p);
+
+
+/**
+ * Send everything that has been written so far on through the output
+ * filters if it has reached the stream's flush threshold. This lets
+ * callers write many small pieces of output, such as the rows of a
+ * listing, without holding all of them in memory or sending each
+ * one separately.
+ *
+ * @param stream_p The OutputStream to flush.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t FlushOutputStreamIfFull (OutputStream *stream_p);
+
+
+/**
+ * Send any remaining output along with the end of stream marker.
+ * The stream must not be used after this.
+ *
+ * @param stream_p The OutputStream to close.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t CloseOutputStream (OutputStream *stream_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OUTPUT_STREAM_H_ */
@@ -0,0 +1,490 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * parallel_query.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "apr_strings.h"
+
+#if APR_HAS_THREADS
+#include "apr_thread_cond.h"
+#include "apr_thread_mutex.h"
+#include "apr_thread_proc.h"
+#endif
+
+#include "http_log.h"
+
+#include "parallel_query.h"
+#include "auth.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+#if APR_HAS_THREADS
+
+/*
+ * The number of pages that are read ahead for each query
+ * before its connection waits for them to be used.
+ */
+#define S_PAGES_AHEAD (4)
+
+
+/* The pages that have been read for a single query */
+typedef struct QueryPages
+{
+	genQueryOut_t *qp_pages_pp [S_PAGES_AHEAD];
+	size_t qp_first_page;
+	size_t qp_num_pages;
+
+	/* Once the query has finished, its iRODS status */
+	bool qp_done_flag;
+	int qp_status;
+} QueryPages;
+
+
+struct ParallelQueries
+{
+	genQueryInp_t *pq_queries_p;
+	size_t pq_num_queries;
+
+	/* Guards everything below it */
+	apr_thread_mutex_t *pq_mutex_p;
+
+	/* Signalled whenever a page is added or used and when a query finishes */
+	apr_thread_cond_t *pq_cond_p;
+
+	QueryPages *pq_pages_p;
+
+	/* The index of the next query to start */
+	size_t pq_next_query;
+
+	bool pq_stop_flag;
+
+	rcComm_t **pq_connections_pp;
+	apr_thread_t **pq_threads_pp;
+	int pq_num_threads;
+	apr_pool_t *pq_threads_pool_p;
+};
+
+
+typedef struct QueryWorker
+{
+	ParallelQueries *qw_queries_p;
+	rcComm_t *qw_connection_p;
+} QueryWorker;
+
+#else
+
+struct ParallelQueries
+{
+	size_t pq_num_queries;
+};
+
+#endif
+
+
+/*
+ * STATIC VARIABLES
+ */
+
+static int s_tree_walk_connections = 1;
+
+
+/*
+ * STATIC DECLARATIONS
+ */
+
+#if APR_HAS_THREADS
+static void *APR_THREAD_FUNC RunQueries (apr_thread_t *thread_p, void *data_p);
+
+static bool GetNextQueryIndex (ParallelQueries *queries_p, size_t *index_p);
+
+static bool AddQueryPage (ParallelQueries *queries_p, const size_t index, genQueryOut_t *results_p);
+
+static void FinishQuery (ParallelQueries *queries_p, const size_t index, const int status);
+#endif
+
+
+/*
+ * API DEFINITIONS
+ */
+
+int GetTreeWalkConnections (void)
+{
+	return s_tree_walk_connections;
+}
+
+
+ParallelQueries *StartParallelQueries (genQueryInp_t *queries_p, const size_t num_queries, const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s, apr_pool_t *pool_p)
+{
+	ParallelQueries *parallel_queries_p = NULL;
+
+	#if APR_HAS_THREADS
+	const int num_connections = ((size_t) s_tree_walk_connections < num_queries) ? s_tree_walk_connections : (int) num_queries;
+
+	if ((num_connections > 1) && username_s && password_s)
+		{
+			ParallelQueries *pq_p = (ParallelQueries *) apr_pcalloc (pool_p, sizeof (ParallelQueries));
+
+			if (pq_p)
+				{
+					pq_p -> pq_queries_p = queries_p;
+					pq_p -> pq_num_queries = num_queries;
+					pq_p -> pq_pages_p = (QueryPages *) apr_pcalloc (pool_p, num_queries * sizeof (QueryPages));
+					pq_p -> pq_connections_pp = (rcComm_t **) apr_pcalloc (pool_p, num_connections * sizeof (rcComm_t *));
+					pq_p -> pq_threads_pp = (apr_thread_t **) apr_pcalloc (pool_p, num_connections * sizeof (apr_thread_t *));
+
+					if ((pq_p -> pq_pages_p) && (pq_p -> pq_connections_pp) && (pq_p -> pq_threads_pp) &&
+						(apr_thread_mutex_create (& (pq_p -> pq_mutex_p), APR_THREAD_MUTEX_DEFAULT, pool_p) == APR_SUCCESS) &&
+						(apr_thread_cond_create (& (pq_p -> pq_cond_p), pool_p) == APR_SUCCESS))
+						{
+							int num_connected = 0;
+							int i;
+
+							/*
+							 * Log in before starting any threads so that we know
+							 * whether there are enough connections to be worth it.
+							 */
+							for (i = 0; i < num_connections; ++ i)
+								{
+									if (LoginToIRods (conf_p, username_s, password_s, (pq_p -> pq_connections_pp) + num_connected, pool_p) == AUTH_GRANTED)
+										{
+											++ num_connected;
+										}
+									else
+										{
+											ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, APR_EGENERAL, pool_p, "Failed to make connection %d of %d to iRODS as \"%s\" for parallel queries", i + 1, num_connections, username_s);
+										}
+								}
+
+							/*
+							 * The threads get a pool of their own rather than a subpool of
+							 * the request's one, since each thread's pool is destroyed from
+							 * that thread when it exits.
+							 */
+							if ((num_connected > 1) && (apr_pool_create (& (pq_p -> pq_threads_pool_p), NULL) == APR_SUCCESS))
+								{
+									/* Each thread uses the connection at the same index so stop at the first failure */
+									for (i = 0; (i < num_connected) && (pq_p -> pq_num_threads == i); ++ i)
+										{
+											QueryWorker *worker_p = (QueryWorker *) apr_palloc (pool_p, sizeof (QueryWorker));
+
+											if (worker_p)
+												{
+													worker_p -> qw_queries_p = pq_p;
+													worker_p -> qw_connection_p = * ((pq_p -> pq_connections_pp) + i);
+
+													if (apr_thread_create ((pq_p -> pq_threads_pp) + (pq_p -> pq_num_threads), NULL, RunQueries, worker_p, pq_p -> pq_threads_pool_p) == APR_SUCCESS)
+														{
+															++ (pq_p -> pq_num_threads);
+														}
+												}
+										}
+								}
+
+							if (pq_p -> pq_num_threads > 0)
+								{
+									/* Disconnect any connections that didn't get a thread */
+									for (i = pq_p -> pq_num_threads; i < num_connected; ++ i)
+										{
+											rcDisconnect (* ((pq_p -> pq_connections_pp) + i));
+											* ((pq_p -> pq_connections_pp) + i) = NULL;
+										}
+
+									parallel_queries_p = pq_p;
+								}
+							else
+								{
+									for (i = 0; i < num_connected; ++ i)
+										{
+											rcDisconnect (* ((pq_p -> pq_connections_pp) + i));
+										}
+
+									if (pq_p -> pq_threads_pool_p)
+										{
+											apr_pool_destroy (pq_p -> pq_threads_pool_p);
+										}
+								}
+
+						}
+				}
+		}
+	#endif
+
+	return parallel_queries_p;
+}
+
+
+genQueryOut_t *GetNextParallelQueryPage (ParallelQueries *queries_p, const size_t index, int *status_p)
+{
+	genQueryOut_t *results_p = NULL;
+
+	#if APR_HAS_THREADS
+	QueryPages *pages_p = (queries_p -> pq_pages_p) + index;
+
+	apr_thread_mutex_lock (queries_p -> pq_mutex_p);
+
+	while ((pages_p -> qp_num_pages == 0) && (! (pages_p -> qp_done_flag)))
+		{
+			apr_thread_cond_wait (queries_p -> pq_cond_p, queries_p -> pq_mutex_p);
+		}
+
+	if (pages_p -> qp_num_pages > 0)
+		{
+			results_p = pages_p -> qp_pages_pp [pages_p -> qp_first_page];
+			pages_p -> qp_first_page = ((pages_p -> qp_first_page) + 1) % S_PAGES_AHEAD;
+			-- (pages_p -> qp_num_pages);
+
+			*status_p = 0;
+
+			/* Let the query's connection read the next page */
+			apr_thread_cond_broadcast (queries_p -> pq_cond_p);
+		}
+	else
+		{
+			*status_p = pages_p -> qp_status;
+		}
+
+	apr_thread_mutex_unlock (queries_p -> pq_mutex_p);
+	#else
+	*status_p = SYS_NOT_SUPPORTED;
+	#endif
+
+	return results_p;
+}
+
+
+void FreeParallelQueries (ParallelQueries *queries_p)
+{
+	#if APR_HAS_THREADS
+	size_t i;
+	int j;
+
+	apr_thread_mutex_lock (queries_p -> pq_mutex_p);
+	queries_p -> pq_stop_flag = true;
+	apr_thread_cond_broadcast (queries_p -> pq_cond_p);
+	apr_thread_mutex_unlock (queries_p -> pq_mutex_p);
+
+	for (j = 0; j < queries_p -> pq_num_threads; ++ j)
+		{
+			apr_status_t thread_status;
+
+			apr_thread_join (&thread_status, * ((queries_p -> pq_threads_pp) + j));
+			rcDisconnect (* ((queries_p -> pq_connections_pp) + j));
+		}
+
+	/* Free any pages that weren't used */
+	for (i = 0; i < queries_p -> pq_num_queries; ++ i)
+		{
+			QueryPages *pages_p = (queries_p -> pq_pages_p) + i;
+
+			while (pages_p -> qp_num_pages > 0)
+				{
+					freeGenQueryOut (& (pages_p -> qp_pages_pp [pages_p -> qp_first_page]));
+					pages_p -> qp_first_page = ((pages_p -> qp_first_page) + 1) % S_PAGES_AHEAD;
+					-- (pages_p -> qp_num_pages);
+				}
+		}
+
+	apr_pool_destroy (queries_p -> pq_threads_pool_p);
+	apr_thread_cond_destroy (queries_p -> pq_cond_p);
+	apr_thread_mutex_destroy (queries_p -> pq_mutex_p);
+	#endif
+}
+
+
+const char *SetTreeWalkConnections (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *error_s = NULL;
+	apr_int64_t num_connections = apr_atoi64 (arg_p);
+
+	if ((num_connections > 0) && (num_connections <= INT_MAX))
+		{
+			s_tree_walk_connections = (int) num_connections;
+		}
+	else
+		{
+			error_s = "The number of tree walk connections must be greater than zero";
+		}
+
+	return error_s;
+}
+
+
+/*
+ * STATIC DEFINITIONS
+ */
+
+#if APR_HAS_THREADS
+
+/*
+ * Each thread keeps running the next query that hasn't been started
+ * yet until there are none left. Since they are started in order, the
+ * query whose pages are being used is always one of those running.
+ */
+static void *APR_THREAD_FUNC RunQueries (apr_thread_t *thread_p, void *data_p)
+{
+	QueryWorker *worker_p = (QueryWorker *) data_p;
+	ParallelQueries *queries_p = worker_p -> qw_queries_p;
+	size_t index;
+
+	while (GetNextQueryIndex (queries_p, &index))
+		{
+			genQueryInp_t *query_p = (queries_p -> pq_queries_p) + index;
+			int status = 0;
+			bool loop_flag = true;
+
+			while (loop_flag)
+				{
+					genQueryOut_t *results_p = NULL;
+
+					loop_flag = false;
+					status = rcGenQuery (worker_p -> qw_connection_p, query_p, &results_p);
+
+					if ((status == 0) && results_p)
+						{
+							/* Once the page has been added, it belongs to whoever uses it */
+							const int continue_index = results_p -> continueInx;
+
+							if (AddQueryPage (queries_p, index, results_p))
+								{
+									if (continue_index > 0)
+										{
+											query_p -> continueInx = continue_index;
+											loop_flag = true;
+										}
+									else
+										{
+											status = CAT_NO_ROWS_FOUND;
+										}
+								}
+							else
+								{
+									/* We have been told to stop, so close the query on the server */
+									freeGenQueryOut (&results_p);
+
+									if (continue_index > 0)
+										{
+											query_p -> continueInx = continue_index;
+											query_p -> maxRows = 0;
+											rcGenQuery (worker_p -> qw_connection_p, query_p, &results_p);
+
+											if (results_p)
+												{
+													freeGenQueryOut (&results_p);
+												}
+										}
+
+									status = CAT_NO_ROWS_FOUND;
+								}
+						}
+					else
+						{
+							if (results_p)
+								{
+									freeGenQueryOut (&results_p);
+								}
+
+							if (status == 0)
+								{
+									status = CAT_NO_ROWS_FOUND;
+								}
+						}
+
+				}		/* while (loop_flag) */
+
+			FinishQuery (queries_p, index, status);
+		}		/* while (GetNextQueryIndex (queries_p, &index)) */
+
+	apr_thread_exit (thread_p, APR_SUCCESS);
+
+	return NULL;
+}
+
+
+static bool GetNextQueryIndex (ParallelQueries *queries_p, size_t *index_p)
+{
+	bool got_flag = false;
+
+	apr_thread_mutex_lock (queries_p -> pq_mutex_p);
+
+	if ((! (queries_p -> pq_stop_flag)) && (queries_p -> pq_next_query < queries_p -> pq_num_queries))
+		{
+			*index_p = queries_p -> pq_next_query;
+			++ (queries_p -> pq_next_query);
+			got_flag = true;
+		}
+
+	apr_thread_mutex_unlock (queries_p -> pq_mutex_p);
+
+	return got_flag;
+}
+
+
+/*
+ * Wait until there is room for the page and then add it. This
+ * returns false, without adding the page, if the queries are
+ * being stopped.
+ */
+static bool AddQueryPage (ParallelQueries *queries_p, const size_t index, genQueryOut_t *results_p)
+{
+	bool added_flag = false;
+	QueryPages *pages_p = (queries_p -> pq_pages_p) + index;
+
+	apr_thread_mutex_lock (queries_p -> pq_mutex_p);
+
+	while ((pages_p -> qp_num_pages == S_PAGES_AHEAD) && (! (queries_p -> pq_stop_flag)))
+		{
+			apr_thread_cond_wait (queries_p -> pq_cond_p, queries_p -> pq_mutex_p);
+		}
+
+	if (! (queries_p -> pq_stop_flag))
+		{
+			pages_p -> qp_pages_pp [((pages_p -> qp_first_page) + (pages_p -> qp_num_pages)) % S_PAGES_AHEAD] = results_p;
+			++ (pages_p -> qp_num_pages);
+			added_flag = true;
+
+			apr_thread_cond_broadcast (queries_p -> pq_cond_p);
+		}
+
+	apr_thread_mutex_unlock (queries_p -> pq_mutex_p);
+
+	return added_flag;
+}
+
+
+static void FinishQuery (ParallelQueries *queries_p, const size_t index, const int status)
+{
+	QueryPages *pages_p = (queries_p -> pq_pages_p) + index;
+
+	apr_thread_mutex_lock (queries_p -> pq_mutex_p);
+
+	pages_p -> qp_done_flag = true;
+	pages_p -> qp_status = status;
+
+	apr_thread_cond_broadcast (queries_p -> pq_cond_p);
+	apr_thread_mutex_unlock (queries_p -> pq_mutex_p);
+}
+
+#endif		/* #if APR_HAS_THREADS */
@@ -0,0 +1,112 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * parallel_query.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef PARALLEL_QUERY_H_
+#define PARALLEL_QUERY_H_
+
+#include "apr_pools.h"
+
+#include "httpd.h"
+#include "http_config.h"
+
+#include "irods/rodsClient.h"
+
+#include "config.h"
+
+
+/**
+ * A set of paged GenQueries that are run at the same time, each
+ * one on a separate connection to iRODS.
+ */
+typedef struct ParallelQueries ParallelQueries;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Get the number of separate iRODS connections that each request
+ * may use to run the queries for a collection tree at the same time.
+ *
+ * @return The number of connections. If this is 1, the queries
+ * are all run on the request's own connection.
+ */
+int GetTreeWalkConnections (void);
+
+
+/**
+ * Start running a set of paged GenQueries at the same time over a
+ * bounded number of new connections to iRODS. The queries are started
+ * in order, with each connection moving on to the next query once it
+ * has finished its current one, and only a few pages of results are
+ * read ahead for each query, so the memory used doesn't depend upon
+ * the sizes of the results.
+ *
+ * @param queries_p The queries to run. These must stay valid until
+ * FreeParallelQueries() has been called.
+ * @param num_queries The number of queries.
+ * @param conf_p The module configuration with the iRODS server details.
+ * @param username_s The iRODS user to run the queries as.
+ * @param password_s The password for the iRODS user.
+ * @param pool_p The memory pool to use.
+ * @return The running queries or <code>NULL</code> if they could not be
+ * started, e.g. if threads are not available or fewer than two connections
+ * could be made, in which case the queries should be run in turn on the
+ * request's own connection instead.
+ */
+ParallelQueries *StartParallelQueries (genQueryInp_t *queries_p, const size_t num_queries, const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s, apr_pool_t *pool_p);
+
+
+/**
+ * Get the next page of results for one of the queries, waiting
+ * for it if it has not been read yet.
+ *
+ * @param queries_p The running queries.
+ * @param index The index of the query to get the page for.
+ * @param status_p Where the iRODS status of the query will be stored.
+ * This is CAT_NO_ROWS_FOUND once all of the pages have been got.
+ * @return The page which the caller must free with freeGenQueryOut(),
+ * or <code>NULL</code> if there are no more pages or upon error.
+ */
+genQueryOut_t *GetNextParallelQueryPage (ParallelQueries *queries_p, const size_t index, int *status_p);
+
+
+/**
+ * Stop any queries that are still running, wait for them to finish
+ * and close their connections to iRODS.
+ *
+ * @param queries_p The queries to free.
+ */
+void FreeParallelQueries (ParallelQueries *queries_p);
+
+
+const char *SetTreeWalkConnections (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PARALLEL_QUERY_H_ */
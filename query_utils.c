@@ -0,0 +1,178 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * query_utils.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <ctype.h>
+#include <limits.h>
+#include <string.h>
+
+#include "query_utils.h"
+
+
+/*
+ * API DEFINITIONS
+ */
+
+size_t GetListingPageIndex (const int64_t page, const size_t page_size)
+{
+	size_t page_index = 0;
+
+	/* The pages in the url start at 1 */
+	if ((page > 1) && (page_size > 0))
+		{
+			/*
+			 * The iCAT's row offsets are ints, so clamp the page to the last one
+			 * whose rows can be addressed. Any page past the end of the listing
+			 * is just empty.
+			 */
+			const size_t max_page = ((size_t) INT_MAX) / page_size;
+
+			if ((uint64_t) page <= (uint64_t) max_page)
+				{
+					page_index = (size_t) (page - 1);
+				}
+			else if (max_page > 0)
+				{
+					page_index = max_page - 1;
+				}
+		}
+
+	return page_index;
+}
+
+
+bool GetListingPageBounds (const size_t page_index, const size_t page_size, const size_t num_entries, size_t *start_p, size_t *end_p)
+{
+	size_t start = SIZE_MAX;
+	size_t end = SIZE_MAX;
+
+	if ((page_size == 0) || (page_index <= (SIZE_MAX / page_size)))
+		{
+			start = page_index * page_size;
+
+			if (page_size <= SIZE_MAX - start)
+				{
+					end = start + page_size;
+				}
+		}
+
+	*start_p = start;
+	*end_p = end;
+
+	return (end < num_entries);
+}
+
+
+bool IsReplicaOfPreviousDataObject (const char *previous_id_s, const char *id_s)
+{
+	return (previous_id_s && id_s && (strcmp (previous_id_s, id_s) == 0));
+}
+
+
+bool ShouldUseReplicaChecksum (const char *current_checksum_s, const char *replica_checksum_s)
+{
+	return (((!current_checksum_s) || (*current_checksum_s == '\0')) && replica_checksum_s && (*replica_checksum_s != '\0'));
+}
+
+
+bool DoesFingerprintLineMatch (const char *line_s, const char *fingerprint_s)
+{
+	const size_t fingerprint_length = strlen (fingerprint_s);
+
+	return ((strncmp (line_s, fingerprint_s, fingerprint_length) == 0) && (line_s [fingerprint_length] == '\n') && (line_s [fingerprint_length + 1] == '\0'));
+}
+
+
+SearchParameterType GetSearchConditionParameter (const char *name_s, const char *prefix_s, SearchConditionPart *part_p, size_t *index_p)
+{
+	SearchParameterType param_type = SPT_OTHER;
+	const size_t prefix_length = strlen (prefix_s);
+
+	if (strncmp (name_s, prefix_s, prefix_length) == 0)
+		{
+			const char * const part_names_ss [SCP_NUM_PARTS] = { "key", "value", "op" };
+			const char *suffix_s = NULL;
+			SearchConditionPart part;
+
+			name_s += prefix_length;
+
+			for (part = SCP_KEY; (part < SCP_NUM_PARTS) && (!suffix_s); ++ part)
+				{
+					const size_t part_length = strlen (part_names_ss [part]);
+
+					if (strncmp (name_s, part_names_ss [part], part_length) == 0)
+						{
+							suffix_s = name_s + part_length;
+							*part_p = part;
+						}
+				}
+
+			/* Anything like keyword is just another parameter */
+			if (suffix_s && ((*suffix_s == '\0') || isdigit ((unsigned char) *suffix_s)))
+				{
+					size_t index = 0;
+
+					param_type = SPT_CONDITION;
+
+					/* The numbers start at 1 without any leading zeros */
+					if (*suffix_s == '0')
+						{
+							param_type = SPT_INVALID;
+						}
+
+					while ((*suffix_s != '\0') && (param_type == SPT_CONDITION))
+						{
+							const size_t digit = (size_t) (*suffix_s - '0');
+
+							if (isdigit ((unsigned char) *suffix_s) && (index <= (SIZE_MAX - digit) / 10))
+								{
+									index = (index * 10) + digit;
+									++ suffix_s;
+								}
+							else
+								{
+									param_type = SPT_INVALID;
+								}
+						}
+
+					if (param_type == SPT_CONDITION)
+						{
+							*index_p = index;
+						}
+				}
+		}
+
+	return param_type;
+}
+
+
+size_t GetFirstIncompleteSearchCondition (const unsigned int *parts_p, const size_t num_conditions)
+{
+	const unsigned int required_parts = (1U << SCP_KEY) | (1U << SCP_VALUE);
+	size_t i = 0;
+
+	while ((i < num_conditions) && ((parts_p [i] & required_parts) == required_parts))
+		{
+			++ i;
+		}
+
+	return i;
+}
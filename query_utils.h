@@ -0,0 +1,175 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * query_utils.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef QUERY_UTILS_H_
+#define QUERY_UTILS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * These only depend upon the C library so that they can be
+ * tested without needing Apache or iRODS.
+ */
+
+
+/**
+ * The parameters that make up a search condition.
+ */
+typedef enum SearchConditionPart
+{
+	/** The key parameter, e.g. key or key1 */
+	SCP_KEY,
+
+	/** The value parameter, e.g. value or value1 */
+	SCP_VALUE,
+
+	/** The optional operator parameter, e.g. op or op1 */
+	SCP_OP,
+
+	/** The number of parts */
+	SCP_NUM_PARTS
+} SearchConditionPart;
+
+
+/**
+ * How a request parameter relates to the search conditions.
+ */
+typedef enum SearchParameterType
+{
+	/** The parameter isn't part of any search condition */
+	SPT_OTHER,
+
+	/** The parameter is part of a search condition */
+	SPT_CONDITION,
+
+	/**
+	 * The parameter looks like part of a search condition but its number
+	 * isn't valid, e.g. key0, key01 or key1x.
+	 */
+	SPT_INVALID
+} SearchParameterType;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Get the index of a listing page from the page number given in a url.
+ *
+ * @param page The page number, where the first page is 1.
+ * @param page_size The number of entries on each page. This must be greater than 0.
+ * @return The index of the page, starting at 0. Any page number less than 1
+ * gives the first page and, since the iCAT's row offsets are ints, any page
+ * after the last one whose rows can be addressed gives that page instead.
+ */
+size_t GetListingPageIndex (const int64_t page, const size_t page_size);
+
+
+/**
+ * Get the range of entries that are on a listing page.
+ *
+ * @param page_index The index of the page, starting at 0.
+ * @param page_size The number of entries on each page.
+ * @param num_entries The total number of entries in the listing.
+ * @param start_p Where the index of the first entry on the page will be stored.
+ * @param end_p Where the index just after the last entry on the page will be
+ * stored. This can be past the end of the listing.
+ * @return <code>true</code> if there are more entries after the page,
+ * <code>false</code> otherwise.
+ */
+bool GetListingPageBounds (const size_t page_index, const size_t page_size, const size_t num_entries, size_t *start_p, size_t *end_p);
+
+
+/**
+ * Check whether a row is for another replica of the data object in the previous row.
+ * The replicas of a data object are always in rows next to each other.
+ *
+ * @param previous_id_s The id of the data object in the previous row. This can be <code>NULL</code>.
+ * @param id_s The id of the data object in the current row. This can be <code>NULL</code>.
+ * @return <code>true</code> if both ids are set and the same, <code>false</code> otherwise.
+ */
+bool IsReplicaOfPreviousDataObject (const char *previous_id_s, const char *id_s);
+
+
+/**
+ * Check whether the checksum of a replica should be used instead of the one
+ * already held for its data object, since a replica that has a checksum is
+ * preferred.
+ *
+ * @param current_checksum_s The checksum already held. This can be <code>NULL</code>.
+ * @param replica_checksum_s The checksum of the replica. This can be <code>NULL</code>.
+ * @return <code>true</code> if the replica's checksum should be used, <code>false</code> otherwise.
+ */
+bool ShouldUseReplicaChecksum (const char *current_checksum_s, const char *replica_checksum_s);
+
+
+/**
+ * Check whether the first line of a cached file holds the given fingerprint.
+ *
+ * @param line_s The line, including its trailing newline.
+ * @param fingerprint_s The fingerprint.
+ * @return <code>true</code> if the line is the fingerprint followed by a
+ * newline and nothing else, <code>false</code> otherwise.
+ */
+bool DoesFingerprintLineMatch (const char *line_s, const char *fingerprint_s);
+
+
+/**
+ * Check whether a request parameter is part of a search condition. The first
+ * condition uses the key, value and op parameters and any further ones add
+ * their number to these, i.e. key1, value1, op1, key2, etc. All of the
+ * parameter names can have a prefix, e.g. filter_key.
+ *
+ * @param name_s The name of the parameter.
+ * @param prefix_s The prefix of the search condition parameters. This can be empty.
+ * @param part_p If the parameter is part of a search condition, which part it is will be stored here.
+ * @param index_p If the parameter is part of a search condition, the index of
+ * that condition will be stored here, where the first condition is 0.
+ * @return The type of the parameter.
+ */
+SearchParameterType GetSearchConditionParameter (const char *name_s, const char *prefix_s, SearchConditionPart *part_p, size_t *index_p);
+
+
+/**
+ * Find the first search condition that is missing its key or its value.
+ *
+ * @param parts_p The parts of the conditions that were given, one entry for
+ * each condition, with the bit <code>1 << part</code> set for each part.
+ * A condition with no parts is a gap between the numbered conditions.
+ * @param num_conditions The number of conditions, i.e. one more than the
+ * largest condition index that was given.
+ * @return The index of the first incomplete condition or
+ * <code>num_conditions</code> if they are all complete.
+ */
+size_t GetFirstIncompleteSearchCondition (const unsigned int *parts_p, const size_t num_conditions);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QUERY_UTILS_H_ */
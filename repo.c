@@ -1700,7 +1700,7 @@ static dav_error *dav_repo_deliver (const dav_resource *resource, ap_filter_t *o
 
 			if (IsFDDataPackageRequest (resource -> uri, conf_p))
 				{
-					if (DoesFDDataPackageExist (resource))
+					if (DoesFDDataPackageExist (resource) && (!IsSavedFDDataPackageStale (resource)))
 						{
 							request_rec *req_p = resource -> info -> r;
 
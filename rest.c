@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #define ALLOCATE_REST_CONSTANTS (1)
 #include "rest.h"
@@ -36,8 +37,14 @@
 
 
 #include "meta.h"
+#include "metadata_cache.h"
+#include "listing_cache.h"
+#include "metadata_batch.h"
+#include "metadata_import.h"
+#include "output_stream.h"
 #include "auth.h"
 #include "common.h"
+#include "query_utils.h"
 #include "listing.h"
 #include "repo.h"
 #include "theme.h"
@@ -83,17 +90,37 @@ static int GetMatchingMetadataKeys (const APICall *call_p, request_rec *req_p, a
 static int GetMatchingMetadataValues (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
 
 
+static int GetMetadataFacets (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
+
+static int RunBatchMetadataOperations (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
+
+static int StartMetadataImportJob (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
+
+static int GetMetadataImportJobStatus (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
+
+static int GetMetadataImportJobErrors (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
+
+static int ExportMetadataForTree (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
+
+
 static int GetInformationForEntry (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
 
 
 static int ListInformationForEntries (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
 
 
+static int ListCollection (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
+
+static apr_status_t PrintCollectionListingPage (IRodsObjectNode *root_node_p, const ListingPage *page_p, const char *path_s, const IRodsConfig *config_p, const OutputFormat format, request_rec *req_p);
+
+
 static int UploadFile (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
 
 
 static const char *GetIdParameter (apr_table_t *params_p, request_rec *req_p, rcComm_t *rods_connection_p, apr_pool_t *pool_p);
 
+static apr_status_t GetIdsFromParameter (const char *ids_s, apr_array_header_t **ids_pp, request_rec *req_p);
+
 
 static apr_status_t EasyModifyMetadataForEntry (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s, const char *command_s);
 
@@ -110,11 +137,19 @@ static apr_status_t AddDecodedJSONResponse (const APICall *call_p, apr_status_t
 
 static OutputFormat GetRequestedOutputFormat (apr_table_t *params_p, apr_pool_t *pool_p, OutputFormat default_format);
 
+static OutputFormat GetStreamedJSONFormat (apr_table_t *params_p, apr_pool_t *pool_p);
+
 
 static apr_status_t RunMetadataQuery (const int *where_columns_p, const char **where_values_ss, const SearchOperator *ops_p, const size_t num_where_columns, const int *select_columns_p, json_t *res_array_p, request_rec *req_p, davrods_dir_conf_t *config_p);
 
 
-static bool GetSearchParameters (const char **key_ss, const char **value_ss, SearchOperator *op_p, apr_table_t *params_p, request_rec *req_p);
+static int GetSearchParameters (apr_array_header_t **conditions_pp, apr_table_t *params_p, const char *prefix_s, request_rec *req_p);
+
+static bool GetSearchCondition (MetadataSearchCondition *condition_p, const char *prefix_s, const char *suffix_s, apr_table_t *params_p, request_rec *req_p);
+
+static char *GetFacetCountsAsJSON (const char *key_s, const apr_array_header_t *facets_array_p, apr_pool_t *pool_p);
+
+static char *GetFacetCacheKey (const char *username_s, const char *key_s, const apr_array_header_t *conditions_p, const char *specific_query_s, apr_pool_t *pool_p);
 
 
 static int GetVirtualListingAsHTML (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s);
@@ -123,8 +158,18 @@ static int GetSearchMetadataAsHTML (const APICall *call_p, request_rec *req_p, a
 
 static const char *GetFullPath (const char *path_s, request_rec *req_p, apr_pool_t *pool_p);
 
+static int GetMetadataForEntries (const char *ids_s, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, rcComm_t *rods_connection_p);
+
+static json_t *GetMetadataArrayAsJSONValue (const char *id_s, const apr_array_header_t *metadata_array_p, const OutputFormat format, const int editable_flag, davrods_dir_conf_t *config_p, request_rec *req_p);
+
 static void SetMimeTypeForOutputFormat (request_rec *req_p, const OutputFormat fmt);
 
+static bool IsJSONRequest (request_rec *req_p);
+
+static bool IsRawBodyRequest (request_rec *req_p);
+
+static char *ReadRequestBody (request_rec *req_p, const apr_size_t max_length);
+
 /*
  * STATIC VARIABLES
  */
@@ -138,9 +183,16 @@ static APICall S_REST_API_ACTIONS_P [] =
 	{ REST_METADATA_EDIT_S, EditMetadataForEntry },
 	{ REST_METADATA_MATCHING_KEYS_S, GetMatchingMetadataKeys },
 	{ REST_METADATA_MATCHING_VALUES_S, GetMatchingMetadataValues },
+	{ REST_METADATA_FACETS_S, GetMetadataFacets },
+	{ REST_METADATA_BATCH_S, RunBatchMetadataOperations },
+	{ REST_METADATA_IMPORT_STATUS_S, GetMetadataImportJobStatus },
+	{ REST_METADATA_IMPORT_ERRORS_S, GetMetadataImportJobErrors },
+	{ REST_METADATA_IMPORT_S, StartMetadataImportJob },
+	{ REST_METADATA_EXPORT_S, ExportMetadataForTree },
 
 	{ REST_GET_INFO_S, GetInformationForEntry },
 	{ REST_LIST_S, ListInformationForEntries },
+	{ REST_LIST_COLLECTION_S, ListCollection },
 
 	{ REST_UPLOAD_S, UploadFile },
 
@@ -161,6 +213,25 @@ static APICall S_VIEW_ACTIONS_P [] =
 static const char * const S_HANDLER_NAME_S = "davrods-rest-handler";
 static const char * const S_HANDLER_SET_VALUE_S = "true";
 
+/* The largest JSON request body that we will read, in bytes */
+static const apr_size_t S_MAX_JSON_BODY_LENGTH = 16 * 1024 * 1024;
+
+/*
+ * The largest number of ids that a single call can ask for. The client
+ * sends the ids in batches of 100 so this is only hit by other callers.
+ */
+static const int S_MAX_NUM_IDS = 1000;
+
+/* The content types of POST bodies that the API calls read themselves rather than as form data */
+static const char * const S_RAW_BODY_CONTENT_TYPES_SS [] =
+{
+	"application/json",
+	"text/csv",
+	"text/tab-separated-values",
+	"text/plain",
+	NULL
+};
+
 /*
  * API DEFINITIONS
  */
@@ -266,6 +337,15 @@ int EIRodsDavAPIHandler (request_rec *req_p)
 							ap_args_to_table (req_p, &params_p);
 							processed_flag = true;
 						}
+					else if ((req_p -> method_number == M_POST) && IsRawBodyRequest (req_p))
+						{
+							/*
+							 * Leave the body unread so that the API call can
+							 * parse it itself rather than as form data.
+							 */
+							ap_args_to_table (req_p, &params_p);
+							processed_flag = true;
+						}
 					else if (req_p -> method_number == M_POST)
 						{
 							apr_array_header_t *key_value_pairs_p = NULL;
@@ -364,7 +444,8 @@ int EIRodsDavAPIHandler (request_rec *req_p)
 																{
 																	res = call_p -> ac_callback_fn (call_p, req_p, params_p, config_p, davrods_path_s);
 
-																	if (res == OK)
+																	/* Keep any content type that the call has set for non-JSON output */
+																	if ((res == OK) && (!req_p -> content_type))
 																		{
 																			ap_set_content_type (req_p, CONTENT_TYPE_JSON_S);
 																		}
@@ -489,37 +570,58 @@ IRodsObjectNode *GetMatchingIds (request_rec *req_p, apr_table_t *params_p, davr
 
 			if (ids_s)
 				{
-					char *copied_ids_s = apr_pstrdup (pool_p, ids_s);
+					apr_array_header_t *ids_p = NULL;
+					apr_hash_t *objects_p = apr_hash_make (pool_p);
+					apr_status_t status = GetIdsFromParameter (ids_s, &ids_p, req_p);
 
-					if (copied_ids_s)
+					if ((status == APR_SUCCESS) && objects_p)
 						{
-							const char *sep_s = " ,";
-							char *id_s = apr_strtok (copied_ids_s, sep_s, &copied_ids_s);
-							IRodsObjectNode *current_node_p = NULL;
+							/*
+							 * Resolve all of the ids with a few bulk queries grouped by
+							 * object type rather than querying for each id in turn.
+							 */
+							status = GetIRodsObjectsForIds (ids_p, objects_p, rods_connection_p, pool_p);
 
-							while (id_s)
+							if (status == APR_SUCCESS)
 								{
-									IRodsObjectNode *node_p = GetIRodsObjectNodeForId (id_s, rods_connection_p, pool_p);
+									IRodsObjectNode *current_node_p = NULL;
+									int i;
 
-									if (node_p)
+									for (i = 0; i < ids_p -> nelts; ++ i)
 										{
-											if (current_node_p)
+											const char *given_id_s = APR_ARRAY_IDX (ids_p, i, const char *);
+											const IRodsObject *obj_p = (const IRodsObject *) apr_hash_get (objects_p, given_id_s, APR_HASH_KEY_STRING);
+
+											if (obj_p)
 												{
-													current_node_p -> ion_next_p = node_p;
+													IRodsObjectNode *node_p = AllocateIRodsObjectNode (obj_p -> io_obj_type, given_id_s, obj_p -> io_data_s, obj_p -> io_collection_s, obj_p -> io_owner_name_s, obj_p -> io_resource_s, obj_p -> io_last_modified_time_s, obj_p -> io_size, obj_p -> io_checksum_s, pool_p);
+
+													if (node_p)
+														{
+															if (current_node_p)
+																{
+																	current_node_p -> ion_next_p = node_p;
+																}
+															else
+																{
+																	root_node_p = node_p;
+																}
+
+															current_node_p = node_p;
+														}
 												}
 											else
 												{
-													root_node_p = node_p;
+													ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_DEBUG, APR_SUCCESS, req_p, "No iRODS object found for id \"%s\"", given_id_s);
 												}
-
-											current_node_p = node_p;
 										}
+								}
+							else
+								{
+									ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to resolve ids \"%s\"", ids_s);
+								}
 
-									id_s = apr_strtok (NULL, sep_s, &copied_ids_s);
-								}		/* while (id_s) */
-
-
-						}		/* if (copied_ids_s) */
+						}		/* if ((status == APR_SUCCESS) && objects_p) */
 
 				}		/* if (ids_s) */
 
@@ -539,75 +641,67 @@ IRodsObjectNode *GetMatchingIds (request_rec *req_p, apr_table_t *params_p, davr
 static int GetVirtualListingAsHTML (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
 {
 	int res = DECLINED;
-
 	rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
 
 	if (rods_connection_p)
 		{
-			IRodsObjectNode *root_node_p = GetMatchingIds (req_p, params_p, config_p);
 			apr_pool_t *pool_p = req_p -> pool;
-			char *result_s = NULL;
-			apr_size_t result_length = 0;
-			apr_bucket_brigade *bucket_brigade_p = apr_brigade_create (pool_p, req_p -> connection -> bucket_alloc);
+			OutputStream *stream_p = AllocateOutputStream (req_p, OF_HTML);
 
-			char *relative_uri_s = apr_pstrcat (pool_p, "the matching values", NULL);
-			char *marked_up_relative_uri_s = apr_pstrcat (pool_p, "the matching values for the listing", NULL);
-
-			const char *escaped_zone_s = config_p -> theme_p -> ht_zone_label_s ? config_p -> theme_p -> ht_zone_label_s : ap_escape_html (pool_p, config_p -> rods_zone);
+			if (stream_p)
+				{
+					IRodsObjectNode *root_node_p = GetMatchingIds (req_p, params_p, config_p);
+					apr_bucket_brigade *bucket_brigade_p = stream_p -> os_bb_p;
 
-			apr_status_t apr_status = PrintAllHTMLBeforeListing (NULL, escaped_zone_s, relative_uri_s, davrods_path_s, marked_up_relative_uri_s, NULL, rods_connection_p -> clientUser.userName, config_p, req_p, bucket_brigade_p, pool_p);
+					char *relative_uri_s = apr_pstrcat (pool_p, "the matching values", NULL);
+					char *marked_up_relative_uri_s = apr_pstrcat (pool_p, "the matching values for the listing", NULL);
 
+					const char *escaped_zone_s = config_p -> theme_p -> ht_zone_label_s ? config_p -> theme_p -> ht_zone_label_s : ap_escape_html (pool_p, config_p -> rods_zone);
 
-			char *metadata_root_link_s = apr_pstrcat (pool_p, davrods_path_s, config_p -> davrods_api_path_s, REST_METADATA_SEARCH_S, NULL);
+					apr_status_t apr_status = PrintAllHTMLBeforeListing (NULL, escaped_zone_s, relative_uri_s, davrods_path_s, marked_up_relative_uri_s, NULL, rods_connection_p -> clientUser.userName, config_p, req_p, bucket_brigade_p, pool_p);
 
-			const char *exposed_root_s = GetRodsExposedPath (req_p);
 
-			IRodsConfig irods_config;
+					char *metadata_root_link_s = apr_pstrcat (pool_p, davrods_path_s, config_p -> davrods_api_path_s, REST_METADATA_SEARCH_S, NULL);
 
-			apr_status = SetIRodsConfig (&irods_config, exposed_root_s, davrods_path_s, metadata_root_link_s);
+					const char *exposed_root_s = GetRodsExposedPath (req_p);
 
+					IRodsConfig irods_config;
 
-			if (root_node_p)
-				{
-					IRodsObjectNode *node_p = root_node_p;
-					unsigned int i;
+					apr_status = SetIRodsConfig (&irods_config, exposed_root_s, davrods_path_s, metadata_root_link_s);
 
-					while (node_p && (apr_status == APR_SUCCESS))
+					if (apr_status == APR_SUCCESS)
 						{
-							apr_status = PrintItem (config_p -> theme_p, node_p -> ion_object_p, &irods_config, i, bucket_brigade_p, pool_p, rods_connection_p, req_p);
-
-							node_p = node_p -> ion_next_p;
-							++ i;
+							apr_status = SetIRodsConfigEscapedRootPath (&irods_config, pool_p);
 						}
 
-					FreeIRodsObjectNodeList (root_node_p);
-				}		/* if (root_node_p) */
-
-			apr_status = PrintAllHTMLAfterListing (rods_connection_p -> clientUser.userName, escaped_zone_s, davrods_path_s, config_p, NULL, rods_connection_p, req_p, bucket_brigade_p, pool_p);
+					ap_set_content_type (req_p, "text/html");
 
+					if (root_node_p)
+						{
+							IRodsObjectNode *node_p = root_node_p;
+							unsigned int i = 0;
 
-			CloseBucketsStream (bucket_brigade_p);
+							while (node_p && (apr_status == APR_SUCCESS))
+								{
+									apr_status = PrintItem (config_p -> theme_p, node_p -> ion_object_p, &irods_config, i, bucket_brigade_p, pool_p, rods_connection_p, req_p);
 
-			apr_status = apr_brigade_pflatten (bucket_brigade_p, &result_s, &result_length, pool_p);
+									if (apr_status == APR_SUCCESS)
+										{
+											apr_status = FlushOutputStreamIfFull (stream_p);
+										}
 
-			if (result_s)
-				{
-					/*
-					 * Sometimes there is garbage at the end of this, and I don't know which apr_brigade_...
-					 * method I need to get the terminating '\0' so have to do it explicitly.
-					 */
-					if (* (result_s + result_length) != '\0')
-						{
-							* (result_s + result_length) = '\0';
-						}
+									node_p = node_p -> ion_next_p;
+									++ i;
+								}
 
-					apr_brigade_destroy (bucket_brigade_p);
+							FreeIRodsObjectNodeList (root_node_p);
+						}		/* if (root_node_p) */
 
-					ap_set_content_type (req_p, "text/html");
+					apr_status = PrintAllHTMLAfterListing (rods_connection_p -> clientUser.userName, escaped_zone_s, davrods_path_s, config_p, NULL, NULL, rods_connection_p, req_p, bucket_brigade_p, pool_p);
 
-					ap_rputs (result_s, req_p);
+					CloseOutputStream (stream_p);
 					res = OK;
-				}
+				}		/* if (stream_p) */
 
 		}		/* if (rods_connection_p) */
 
@@ -617,26 +711,29 @@ static int GetVirtualListingAsHTML (const APICall *call_p, request_rec *req_p, a
 
 static int GetSearchMetadataAsHTML (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
 {
-	int res = DECLINED;
-	const char *key_s = NULL;
-	const char *value_s = NULL;
-	SearchOperator op = SO_LIKE;
+	apr_array_header_t *conditions_p = NULL;
+	int res = GetSearchParameters (&conditions_p, params_p, "", req_p);
 
-	if (GetSearchParameters (&key_s, &value_s, &op, params_p, req_p))
+	if ((res == OK) && (!conditions_p))
+		{
+			res = DECLINED;
+		}
+
+	if (conditions_p)
 		{
 			rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
 
+			res = DECLINED;
+
 			if (rods_connection_p)
 				{
-					char *res_s = DoMetadataSearch (key_s, value_s, op, rods_connection_p, config_p, req_p, davrods_path_s);
-
-					if (res_s)
+					/* The page is streamed as it is generated so it can't be turned into an error page part way through */
+					if (DoMetadataSearch (conditions_p, rods_connection_p, config_p, req_p, davrods_path_s) != APR_SUCCESS)
 						{
-							ap_set_content_type (req_p, "text/html");
-
-							ap_rputs (res_s, req_p);
-							res = OK;
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, req_p, "Metadata search page for \"%s\" did not complete", req_p -> uri);
 						}
+
+					res = OK;
 				}
 		}
 
@@ -645,47 +742,172 @@ static int GetSearchMetadataAsHTML (const APICall *call_p, request_rec *req_p, a
 
 
 
-static bool GetSearchParameters (const char **key_ss, const char **value_ss, SearchOperator *op_p, apr_table_t *params_p, request_rec *req_p)
+/*
+ * The search conditions are given as key, value and op parameters for the
+ * first condition and then key1, value1, op1, key2, value2, op2, etc. for any
+ * further ones. All of the conditions need to match for an object to be a hit.
+ * If prefix_s is not empty, it is prepended to each of these parameter names.
+ *
+ * Searching with fewer conditions than were asked for would return objects
+ * that don't match, so rather than stopping at the first condition that is
+ * wrong, every condition parameter is checked and the request is rejected
+ * if any condition is missing its key or value, is missing altogether
+ * between two others, or has an unknown operator. If there are no condition
+ * parameters at all, *conditions_pp is set to NULL.
+ */
+static int GetSearchParameters (apr_array_header_t **conditions_pp, apr_table_t *params_p, const char *prefix_s, request_rec *req_p)
 {
-	bool success_flag = false;
+	int res = OK;
 	apr_pool_t *pool_p = req_p -> pool;
-	const char * const key_s = GetParameterValue (params_p, "key", pool_p);
+	const apr_array_header_t *fields_p = params_p ? apr_table_elts (params_p) : NULL;
 
-	if (key_s)
+	*conditions_pp = NULL;
+
+	if (fields_p && (fields_p -> nelts > 0))
 		{
-			const char * const value_s = GetParameterValue (params_p, "value", pool_p);
+			const apr_table_entry_t *entries_p = (const apr_table_entry_t *) (fields_p -> elts);
+
+			/*
+			 * Each condition needs at least two parameters, so any index past
+			 * the number of parameters must leave a gap.
+			 */
+			const size_t max_conditions = (size_t) (fields_p -> nelts);
+			unsigned int *parts_p = (unsigned int *) apr_pcalloc (pool_p, max_conditions * sizeof (unsigned int));
+			size_t num_conditions = 0;
+			int i;
+
+			if (!parts_p)
+				{
+					res = HTTP_INTERNAL_SERVER_ERROR;
+				}
 
-			if (value_s)
+			for (i = 0; (i < fields_p -> nelts) && (res == OK); ++ i)
 				{
-					SearchOperator op = SO_LIKE;
-					const char *op_s = apr_table_get (params_p, "op");
+					const char *name_s = (entries_p + i) -> key;
+					SearchConditionPart part;
+					size_t index;
 
-					*key_ss = key_s;
-					*value_ss = value_s;
+					switch (GetSearchConditionParameter (name_s, prefix_s, &part, &index))
+						{
+							case SPT_CONDITION:
+								if (index < max_conditions)
+									{
+										* (parts_p + index) |= (1U << part);
+
+										if (index >= num_conditions)
+											{
+												num_conditions = index + 1;
+											}
+									}
+								else
+									{
+										ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "Search condition parameter \"%s\" leaves a gap in the numbered conditions", name_s);
+										res = HTTP_BAD_REQUEST;
+									}
+								break;
+
+							case SPT_INVALID:
+								ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "Search condition parameter \"%s\" has an invalid number", name_s);
+								res = HTTP_BAD_REQUEST;
+								break;
+
+							default:
+								break;
+						}
+				}		/* for (i = 0; (i < fields_p -> nelts) && (res == OK); ++ i) */
+
+			if ((res == OK) && (num_conditions > 0))
+				{
+					const size_t incomplete_index = GetFirstIncompleteSearchCondition (parts_p, num_conditions);
 
-					if (op_s)
+					if (incomplete_index == num_conditions)
 						{
-							apr_status_t status = GetSearchOperatorFromString (op_s, &op);
+							apr_array_header_t *conditions_p = apr_array_make (pool_p, (int) num_conditions, sizeof (MetadataSearchCondition));
 
-							if (status == APR_SUCCESS)
+							if (conditions_p)
 								{
-									success_flag = true;
+									size_t j;
+
+									for (j = 0; (j < num_conditions) && (res == OK); ++ j)
+										{
+											const char *suffix_s = (j > 0) ? apr_ltoa (pool_p, (long) j) : "";
+											MetadataSearchCondition condition;
+
+											if (GetSearchCondition (&condition, prefix_s, suffix_s, params_p, req_p))
+												{
+													* (MetadataSearchCondition *) apr_array_push (conditions_p) = condition;
+												}
+											else
+												{
+													res = HTTP_BAD_REQUEST;
+												}
+										}
+
+									if (res == OK)
+										{
+											*conditions_pp = conditions_p;
+										}
 								}
 							else
 								{
-									ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "error %d: Unknown operator \"%s\"", status, op_s);
+									res = HTTP_INTERNAL_SERVER_ERROR;
 								}
 						}
 					else
 						{
-							success_flag = true;
+							const char *suffix_s = (incomplete_index > 0) ? apr_ltoa (pool_p, (long) incomplete_index) : "";
+
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "Search condition \"%skey%s\" is missing its key or value", prefix_s, suffix_s);
+							res = HTTP_BAD_REQUEST;
 						}
+				}		/* if ((res == OK) && (num_conditions > 0)) */
+
+		}		/* if (fields_p && (fields_p -> nelts > 0)) */
 
-					if (success_flag)
+	return res;
+}
+
+
+/*
+ * The key and value have already been checked by GetSearchParameters()
+ * so this only fails if the operator is unknown.
+ */
+static bool GetSearchCondition (MetadataSearchCondition *condition_p, const char *prefix_s, const char *suffix_s, apr_table_t *params_p, request_rec *req_p)
+{
+	bool success_flag = false;
+	apr_pool_t *pool_p = req_p -> pool;
+	const char * const key_s = GetParameterValue (params_p, apr_pstrcat (pool_p, prefix_s, "key", suffix_s, NULL), pool_p);
+	const char * const value_s = GetParameterValue (params_p, apr_pstrcat (pool_p, prefix_s, "value", suffix_s, NULL), pool_p);
+
+	if (key_s && value_s)
+		{
+			SearchOperator op = SO_LIKE;
+			const char *op_s = GetParameterValue (params_p, apr_pstrcat (pool_p, prefix_s, "op", suffix_s, NULL), pool_p);
+
+			if (op_s)
+				{
+					apr_status_t status = GetSearchOperatorFromString (op_s, &op);
+
+					if (status == APR_SUCCESS)
+						{
+							success_flag = true;
+						}
+					else
 						{
-							*op_p = op;
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "error %d: Unknown operator \"%s\" for \"%sop%s\"", status, op_s, prefix_s, suffix_s);
 						}
 				}
+			else
+				{
+					success_flag = true;
+				}
+
+			if (success_flag)
+				{
+					condition_p -> msc_key_s = key_s;
+					condition_p -> msc_value_s = value_s;
+					condition_p -> msc_op = op;
+				}
 		}
 
 	return success_flag;
@@ -697,22 +919,34 @@ static bool GetSearchParameters (const char **key_ss, const char **value_ss, Sea
 
 static int SearchMetadata (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
 {
-	int res = DECLINED;
 	apr_pool_t *pool_p = req_p -> pool;
-	const char *key_s = NULL;
-	const char *value_s = NULL;
-	SearchOperator op = SO_LIKE;
+	apr_array_header_t *conditions_p = NULL;
+	int res = GetSearchParameters (&conditions_p, params_p, "", req_p);
 
+	if ((res == OK) && (!conditions_p))
+		{
+			res = DECLINED;
+		}
 
-	if (GetSearchParameters (&key_s, &value_s, &op, params_p, req_p))
+	if (conditions_p)
 		{
 			rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
 
+			res = DECLINED;
+
 			if (rods_connection_p)
 				{
-					IRodsObjectNode *node_p = GetMatchingMetadataHits (key_s, value_s, op, rods_connection_p, pool_p);
+					const OutputFormat format = GetStreamedJSONFormat (params_p, pool_p);
+					apr_status_t search_status = APR_SUCCESS;
+					IRodsObjectNode *node_p = GetMatchingMetadataHitsForConditions (conditions_p, config_p -> eirods_dav_search_specific_query_s, rods_connection_p, &search_status, pool_p);
 
-					if (node_p)
+					SetMimeTypeForOutputFormat (req_p, format);
+
+					if (search_status != APR_SUCCESS)
+						{
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, search_status, req_p, "Metadata search for \"%s\" failed", req_p -> uri);
+						}
+					else if (node_p)
 						{
 							IRodsConfig irods_config;
 
@@ -723,15 +957,15 @@ static int SearchMetadata (const APICall *call_p, request_rec *req_p, apr_table_
 
 							SetIRodsConfig (&irods_config, exposed_root_s, davrods_path_s, metadata_root_link_s);
 
-							PrintIRodsObjectNodesToJSON (node_p, &irods_config, req_p);
+							PrintIRodsObjectNodesToJSON (node_p, &irods_config, format, req_p);
 							FreeIRodsObjectNodeList (node_p);
 						}
-					else
+					else if (format == OF_JSON)
 						{
 							ap_rputs ("[]", req_p);
 						}
 
-					res = OK;
+					res = (search_status == APR_SUCCESS) ? OK : HTTP_INTERNAL_SERVER_ERROR;
 				}		/* if (rods_connection_p) */
 
 		}
@@ -765,6 +999,28 @@ static OutputFormat GetRequestedOutputFormat (apr_table_t *params_p, apr_pool_t
 				{
 					format = OF_CSV;
 				}
+			else if ((strcmp (format_s, "jsonl") == 0) || (strcmp (format_s, "ndjson") == 0))
+				{
+					format = OF_JSON_LINES;
+				}
+		}
+
+	return format;
+}
+
+
+/*
+ * The calls that return lists of objects can either give a JSON array
+ * or, if the output_format parameter is "jsonl" or "ndjson", a JSON
+ * object per line.
+ */
+static OutputFormat GetStreamedJSONFormat (apr_table_t *params_p, apr_pool_t *pool_p)
+{
+	OutputFormat format = GetRequestedOutputFormat (params_p, pool_p, OF_JSON);
+
+	if (format != OF_JSON_LINES)
+		{
+			format = OF_JSON;
 		}
 
 	return format;
@@ -775,8 +1031,11 @@ static int ListInformationForEntries (const APICall *call_p, request_rec *req_p,
 {
 	int res = DECLINED;
 	apr_pool_t *pool_p = req_p -> pool;
+	const OutputFormat format = GetStreamedJSONFormat (params_p, pool_p);
 	IRodsObjectNode *root_node_p = GetMatchingIds (req_p, params_p, config_p);
 
+	SetMimeTypeForOutputFormat (req_p, format);
+
 	if (root_node_p)
 		{
 			IRodsConfig irods_config;
@@ -785,12 +1044,12 @@ static int ListInformationForEntries (const APICall *call_p, request_rec *req_p,
 
 			SetIRodsConfig (&irods_config, exposed_root_s, davrods_path_s, metadata_root_link_s);
 
-			PrintIRodsObjectNodesToJSON (root_node_p, &irods_config, req_p);
+			PrintIRodsObjectNodesToJSON (root_node_p, &irods_config, format, req_p);
 			FreeIRodsObjectNodeList (root_node_p);
 
 			res = OK;
 		}		/* if (root_node_p) */
-	else
+	else if (format == OF_JSON)
 		{
 			ap_rputs ("[]", req_p);
 		}
@@ -800,179 +1059,468 @@ static int ListInformationForEntries (const APICall *call_p, request_rec *req_p,
 }
 
 
-static int GetInformationForEntry (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
+static int ListCollection (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
 {
-	int res = DECLINED;
+	int res = HTTP_BAD_REQUEST;
 	apr_pool_t *pool_p = req_p -> pool;
-	rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
+	const char *path_s = GetParameterValue (params_p, "path", pool_p);
+	const OutputFormat format = GetStreamedJSONFormat (params_p, pool_p);
 
-	if (rods_connection_p)
+	if (path_s)
 		{
-			const char * const path_s = GetParameterValue (params_p, "path", pool_p);
+			rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
 
-			if (path_s)
+			res = DECLINED;
+
+			if (rods_connection_p)
 				{
 					const char *full_path_s = GetFullPath (path_s, req_p, pool_p);
+					rodsObjStat_t *stat_p = full_path_s ? GetObjectStat (full_path_s, rods_connection_p, pool_p) : NULL;
 
-					if (full_path_s)
-						{
-							rodsObjStat_t *stat_p = GetObjectStat (full_path_s, rods_connection_p, pool_p);
+					res = HTTP_NOT_FOUND;
 
-							if (stat_p)
+					if (stat_p)
+						{
+							if (stat_p -> objType == COLL_OBJ_T)
 								{
-									char *result_s = NULL;
+									ListingPage page;
+									IRodsObjectNode *root_node_p = NULL;
+									apr_status_t page_status = APR_EGENERAL;
 
-									json_t *obj_p = json_object ();
+									/* This endpoint is always paged */
+									GetListingPageFromParameters (&page, params_p, LISTING_DEFAULT_PAGE_SIZE, pool_p);
 
-									if (obj_p)
+									if (config_p -> eirods_dav_listing_specific_query_s)
 										{
-											char *id_s = NULL;
-											const char *type_s = "";
-											
-											switch (stat_p -> objType)
-												{
-													case DATA_OBJ_T:
-														type_s = "1.";
-														break;
-														
-													case COLL_OBJ_T:
-														type_s = "2.";
-														break;
-														
-													default:
-														break;
-												}
-																				
-											id_s = apr_pstrcat (pool_p, type_s, stat_p -> dataId, NULL);
+											page_status = GetCollectionListingPageUsingSpecificQuery (config_p -> eirods_dav_listing_specific_query_s, full_path_s, &page, &root_node_p, rods_connection_p, pool_p);
+										}
 
-											if (id_s)
-												{
-													if (json_object_set_new (obj_p, "id", json_string (id_s)) == 0)
-														{
-															if (json_object_set_new (obj_p, "path", json_string (path_s)) == 0)
-																{
-																	result_s = json_dumps (obj_p, JSON_INDENT (2));
+									if (page_status != APR_SUCCESS)
+										{
+											page_status = GetCollectionListingPage (full_path_s, &page, &root_node_p, rods_connection_p, pool_p);
+										}
 
-																	if (result_s)
-																		{
-																			ap_rputs (result_s, req_p);
-																			free (result_s);
-																		}
-																	else
-																		{
-																			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to dump json for %s", full_path_s);
-																		}
+									if (page_status == APR_SUCCESS)
+										{
+											IRodsConfig irods_config;
+											char *metadata_root_link_s = apr_pstrcat (pool_p, davrods_path_s, config_p -> eirods_dav_views_path_s, NULL);
+											const char *exposed_root_s = GetRodsExposedPath (req_p);
 
-																	res = OK;
-																}
-															else
-																{
-																	ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to add \"path\": \"%s\" to json object for %s", path_s, full_path_s);
-																}
-														}													
-													else
-														{
-															ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to add \"id\": \"%s\" to json object for %s", id_s, full_path_s);
-														}
-												}
-											else
+											SetIRodsConfig (&irods_config, exposed_root_s, davrods_path_s, metadata_root_link_s);
+											SetMimeTypeForOutputFormat (req_p, format);
+
+											/* Any failure is logged and the output will have been started */
+											PrintCollectionListingPage (root_node_p, &page, path_s, &irods_config, format, req_p);
+
+											if (root_node_p)
 												{
-													ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to create id string from \"%s\" and \"%s\" for %s", type_s, stat_p -> dataId, full_path_s);
+													FreeIRodsObjectNodeList (root_node_p);
 												}
 
-										}		/* if (obj_p) */
+											res = OK;
+										}
 									else
 										{
-											ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to create JSON object for %s", full_path_s);
+											ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to get page %" APR_SIZE_T_FMT " of \"%s\"", page.lp_page_index + 1, full_path_s);
+											res = HTTP_INTERNAL_SERVER_ERROR;
 										}
-
-									freeRodsObjStat (stat_p);
-								}		/* if (stat_p) */
+								}
 							else
 								{
-									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to  stat full path for \"%s\"", full_path_s);
+									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Collection listing requires a collection but \"%s\" is not one", full_path_s);
+									res = HTTP_BAD_REQUEST;
 								}
 
-						}		/* if (full_path_s) */
-					else
-						{
-							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to get full path for \"%s\"", path_s);
-						}
+							freeRodsObjStat (stat_p);
+						}		/* if (stat_p) */
 
-				}		/* if (path_s) */
-			else
-				{
-					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Missing path variable for %s", req_p -> uri);
-				}
-		}
+				}		/* if (rods_connection_p) */
+
+		}		/* if (path_s) */
 
 	return res;
 }
 
 
-
-static int GetMetadataForEntry (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
+/*
+ * For JSON, the page is an object with its details and an "entries" array.
+ * For JSON Lines, each entry is sent on its own line.
+ */
+static apr_status_t PrintCollectionListingPage (IRodsObjectNode *root_node_p, const ListingPage *page_p, const char *path_s, const IRodsConfig *config_p, const OutputFormat format, request_rec *req_p)
 {
-	int res = DECLINED;
+	apr_status_t status = APR_ENOMEM;
 	apr_pool_t *pool_p = req_p -> pool;
-	apr_bucket_brigade *bucket_brigade_p = apr_brigade_create (pool_p, req_p -> connection -> bucket_alloc);
+	OutputStream *stream_p = AllocateOutputStream (req_p, format);
 
-	if (bucket_brigade_p)
+	if (stream_p)
 		{
-			rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
+			json_t *page_json_p = NULL;
+			json_t *entries_p = NULL;
+			IRodsObjectNode *node_p = root_node_p;
 
-			if (rods_connection_p)
+			status = APR_SUCCESS;
+
+			if (format == OF_JSON)
 				{
-					const char * const id_s = GetIdParameter (params_p, req_p, rods_connection_p, pool_p);
+					page_json_p = json_pack ("{s:s,s:I,s:I,s:s,s:s,s:b}",
+						"path", path_s,
+						"page", (json_int_t) (page_p -> lp_page_index + 1),
+						"page_size", (json_int_t) (page_p -> lp_page_size),
+						"sort", GetListingSortKeyAsString (page_p -> lp_sort_key),
+						"order", page_p -> lp_descending_flag ? "desc" : "asc",
+						"more", page_p -> lp_has_more_flag ? 1 : 0);
 
-					if (id_s)
+					entries_p = json_array ();
+
+					if (page_json_p && entries_p && (json_object_set (page_json_p, "entries", entries_p) == 0))
 						{
-							OutputFormat format = GetRequestedOutputFormat (params_p, pool_p, OF_JSON);
-							int editable_flag = GetEditableFlag (config_p -> theme_p, params_p, pool_p);
+							/* The page object now holds its own reference to the array */
+						}
+					else
+						{
+							status = APR_ENOMEM;
+						}
+				}
 
-							apr_status_t status = GetMetadataTableForId ((char *) id_s, config_p, rods_connection_p, req_p, pool_p, bucket_brigade_p, format, editable_flag);
+			while (node_p && (status == APR_SUCCESS))
+				{
+					json_t *entry_p = GetIRodsObjectListingAsJSON (node_p -> ion_object_p, config_p, pool_p);
 
-							if (status == APR_SUCCESS)
+					if (entry_p)
+						{
+							if (entries_p)
 								{
-									apr_size_t len = 0;
-									char *result_s = NULL;
+									if (json_array_append_new (entries_p, entry_p) != 0)
+										{
+											status = APR_ENOMEM;
+										}
+								}
+							else
+								{
+									status = WriteJSONToOutputStream (stream_p, entry_p);
+									json_decref (entry_p);
+
+									if (status == APR_SUCCESS)
+										{
+											status = FlushOutputStreamIfFull (stream_p);
+										}
+								}
+						}
+					else
+						{
+							status = APR_ENOMEM;
+						}
 
-									CloseBucketsStream (bucket_brigade_p);
+					node_p = node_p -> ion_next_p;
+				}
 
-									apr_status_t apr_status = apr_brigade_pflatten (bucket_brigade_p, &result_s, &len, pool_p);
+			if ((status == APR_SUCCESS) && page_json_p)
+				{
+					status = WriteJSONToOutputStream (stream_p, page_json_p);
+				}
 
-									if (apr_status == APR_SUCCESS)
+			if (status != APR_SUCCESS)
+				{
+					ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to print the listing of \"%s\"", path_s);
+				}
+
+			if (entries_p)
+				{
+					json_decref (entries_p);
+				}
+
+			if (page_json_p)
+				{
+					json_decref (page_json_p);
+				}
+
+			CloseOutputStream (stream_p);
+		}		/* if (stream_p) */
+
+	return status;
+}
+
+
+static int GetInformationForEntry (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
+{
+	int res = DECLINED;
+	apr_pool_t *pool_p = req_p -> pool;
+	rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
+
+	if (rods_connection_p)
+		{
+			const char * const path_s = GetParameterValue (params_p, "path", pool_p);
+
+			if (path_s)
+				{
+					const char *full_path_s = GetFullPath (path_s, req_p, pool_p);
+
+					if (full_path_s)
+						{
+							rodsObjStat_t *stat_p = GetObjectStat (full_path_s, rods_connection_p, pool_p);
+
+							if (stat_p)
+								{
+									char *result_s = NULL;
+
+									json_t *obj_p = json_object ();
+
+									if (obj_p)
 										{
-											/*
-											 * Sometimes there is garbage at the end of this, and I don't know which apr_brigade_...
-											 * method I need to get the terminating '\0' so have to do it explicitly.
-											 */
-											if (* (result_s + len) != '\0')
+											char *id_s = NULL;
+											const char *type_s = "";
+											
+											switch (stat_p -> objType)
 												{
-													* (result_s + len) = '\0';
+													case DATA_OBJ_T:
+														type_s = "1.";
+														break;
+														
+													case COLL_OBJ_T:
+														type_s = "2.";
+														break;
+														
+													default:
+														break;
 												}
+																				
+											id_s = apr_pstrcat (pool_p, type_s, stat_p -> dataId, NULL);
+
+											if (id_s)
+												{
+													if (json_object_set_new (obj_p, "id", json_string (id_s)) == 0)
+														{
+															if (json_object_set_new (obj_p, "path", json_string (path_s)) == 0)
+																{
+																	result_s = json_dumps (obj_p, JSON_INDENT (2));
+
+																	if (result_s)
+																		{
+																			ap_rputs (result_s, req_p);
+																			free (result_s);
+																		}
+																	else
+																		{
+																			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to dump json for %s", full_path_s);
+																		}
 
-											if (result_s)
+																	res = OK;
+																}
+															else
+																{
+																	ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to add \"path\": \"%s\" to json object for %s", path_s, full_path_s);
+																}
+														}													
+													else
+														{
+															ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to add \"id\": \"%s\" to json object for %s", id_s, full_path_s);
+														}
+												}
+											else
 												{
-													ap_rputs (result_s, req_p);
+													ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to create id string from \"%s\" and \"%s\" for %s", type_s, stat_p -> dataId, full_path_s);
 												}
 
-											SetMimeTypeForOutputFormat (req_p, format);
+										}		/* if (obj_p) */
+									else
+										{
+											ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to create JSON object for %s", full_path_s);
+										}
+
+									freeRodsObjStat (stat_p);
+								}		/* if (stat_p) */
+							else
+								{
+									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to  stat full path for \"%s\"", full_path_s);
+								}
+
+						}		/* if (full_path_s) */
+					else
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Failed to get full path for \"%s\"", path_s);
+						}
+
+				}		/* if (path_s) */
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Missing path variable for %s", req_p -> uri);
+				}
+		}
+
+	return res;
+}
+
+
+
+static int GetMetadataForEntry (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
+{
+	int res = DECLINED;
+	apr_pool_t *pool_p = req_p -> pool;
+	rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
+
+	if (rods_connection_p)
+		{
+			const char * const ids_s = GetParameterValue (params_p, "ids", pool_p);
+			const char * const id_s = ids_s ? NULL : GetIdParameter (params_p, req_p, rods_connection_p, pool_p);
+
+			if (ids_s)
+				{
+					res = GetMetadataForEntries (ids_s, req_p, params_p, config_p, rods_connection_p);
+				}
+			else if (id_s)
+				{
+					OutputFormat format = GetRequestedOutputFormat (params_p, pool_p, OF_JSON);
+					OutputStream *stream_p = AllocateOutputStream (req_p, format);
+
+					if (stream_p)
+						{
+							int editable_flag = GetEditableFlag (config_p -> theme_p, params_p, pool_p);
+							apr_status_t status = GetMetadataTableForId ((char *) id_s, config_p, rods_connection_p, req_p, pool_p, stream_p -> os_bb_p, format, editable_flag);
+
+							if (status == APR_SUCCESS)
+								{
+									/* This needs setting before anything is sent to the client */
+									SetMimeTypeForOutputFormat (req_p, format);
 
+									if (CloseOutputStream (stream_p) == APR_SUCCESS)
+										{
 											res = OK;
 										}
 								}
 						}
-
-					apr_brigade_destroy (bucket_brigade_p);
 				}
+		}
+
+	return res;
+}
+
+
+
+/*
+ * Get the AVUs for a list of ids as a single JSON object keyed by id. Each
+ * value is an array of AVUs or, if the output_format is html, the same HTML
+ * fragment that the single id call gives. Ids that could not be found are
+ * left out.
+ */
+static int GetMetadataForEntries (const char *ids_s, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, rcComm_t *rods_connection_p)
+{
+	int res = HTTP_INTERNAL_SERVER_ERROR;
+	apr_pool_t *pool_p = req_p -> pool;
+	apr_array_header_t *ids_p = NULL;
+	apr_hash_t *metadata_arrays_p = apr_hash_make (pool_p);
+	apr_status_t status = GetIdsFromParameter (ids_s, &ids_p, req_p);
+
+	if (status == APR_EINVAL)
+		{
+			res = HTTP_BAD_REQUEST;
+		}
+	else if ((status == APR_SUCCESS) && metadata_arrays_p)
+		{
+			status = GetMetadataArraysForIds (ids_p, metadata_arrays_p, rods_connection_p, pool_p);
+
+			if (status == APR_SUCCESS)
+				{
+					json_t *res_p = json_object ();
+
+					if (res_p)
+						{
+							const OutputFormat format = GetRequestedOutputFormat (params_p, pool_p, OF_JSON);
+							const int editable_flag = GetEditableFlag (config_p -> theme_p, params_p, pool_p);
+							bool success_flag = true;
+							int i;
+
+							for (i = 0; (i < ids_p -> nelts) && success_flag; ++ i)
+								{
+									const char *given_id_s = APR_ARRAY_IDX (ids_p, i, const char *);
+									const apr_array_header_t *metadata_array_p = (const apr_array_header_t *) apr_hash_get (metadata_arrays_p, given_id_s, APR_HASH_KEY_STRING);
+
+									if (metadata_array_p)
+										{
+											json_t *value_p = GetMetadataArrayAsJSONValue (given_id_s, metadata_array_p, format, editable_flag, config_p, req_p);
+
+											if (value_p)
+												{
+													if (json_object_set_new (res_p, given_id_s, value_p) != 0)
+														{
+															success_flag = false;
+														}
+												}
+											else
+												{
+													success_flag = false;
+												}
+										}
+								}
+
+							if (success_flag)
+								{
+									char *result_s = json_dumps (res_p, JSON_INDENT (2));
+
+									if (result_s)
+										{
+											ap_set_content_type (req_p, CONTENT_TYPE_JSON_S);
+											ap_rputs (result_s, req_p);
+											free (result_s);
+											res = OK;
+										}
+									else
+										{
+											ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, req_p, "json_dumps failed");
+										}
+								}
+							else
+								{
+									ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, req_p, "Failed to build metadata for ids \"%s\"", ids_s);
+								}
 
+							json_decref (res_p);
+						}
+				}
+			else
+				{
+					ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, req_p, "Failed to get metadata for ids \"%s\"", ids_s);
+				}
 		}
 
 	return res;
 }
 
 
+static json_t *GetMetadataArrayAsJSONValue (const char *id_s, const apr_array_header_t *metadata_array_p, const OutputFormat format, const int editable_flag, davrods_dir_conf_t *config_p, request_rec *req_p)
+{
+	json_t *value_p = NULL;
+	apr_pool_t *pool_p = req_p -> pool;
+
+	if (format == OF_HTML)
+		{
+			apr_bucket_brigade *bb_p = apr_brigade_create (pool_p, req_p -> connection -> bucket_alloc);
+
+			if (bb_p)
+				{
+					char *metadata_link_s = GetDavrodsAPIPath (NULL, config_p, req_p);
+
+					if (PrintMetadata (id_s, metadata_array_p, config_p -> theme_p, editable_flag, bb_p, metadata_link_s, pool_p) == APR_SUCCESS)
+						{
+							char *html_s = NULL;
+							apr_size_t length = 0;
+
+							if (apr_brigade_pflatten (bb_p, &html_s, &length, pool_p) == APR_SUCCESS)
+								{
+									value_p = json_string (apr_pstrmemdup (pool_p, html_s, length));
+								}
+						}
+
+					apr_brigade_destroy (bb_p);
+				}
+		}
+	else
+		{
+			value_p = GetMetadataArrayAsJSONArray (metadata_array_p);
+		}
+
+	return value_p;
+}
+
 
 static int DeleteMetadataForEntry (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
 {
@@ -1143,6 +1691,10 @@ static void SetMimeTypeForOutputFormat (request_rec *req_p, const OutputFormat f
 				content_type_s = "text/tab-separated-values";
 				break;
 
+			case OF_JSON_LINES:
+				content_type_s = "application/x-ndjson";
+				break;
+
 			default:
 				break;
 		}
@@ -1237,6 +1789,10 @@ static apr_status_t ModifyMetadataForEntry (const APICall *call_p, request_rec *
 
 															if (status == 0)
 																{
+																	/* Make sure that nothing serves the old AVUs */
+																	InvalidateCachedMetadata (irods_obj.io_obj_type, irods_obj.io_id_s, full_name_s, pool_p);
+																	InvalidateCachedListingsForObject (full_name_s, pool_p);
+
 																	res = APR_SUCCESS;
 																}
 															else
@@ -1471,6 +2027,602 @@ static int GetMatchingMetadataValues (const APICall *call_p, request_rec *req_p,
 }
 
 
+/*
+ * Get the number of data objects and collections for each value of the
+ * "key" parameter. Any filter_key, filter_value and filter_op parameters
+ * (and filter_key1, etc.) restrict the counts to the objects that also
+ * match those conditions.
+ */
+static int GetMetadataFacets (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
+{
+	int res = DECLINED;
+	apr_pool_t *pool_p = req_p -> pool;
+	const char * const key_s = GetParameterValue (params_p, "key", pool_p);
+
+	if (key_s)
+		{
+			apr_array_header_t *conditions_p = NULL;
+			rcComm_t *rods_connection_p = NULL;
+
+			res = GetSearchParameters (&conditions_p, params_p, "filter_", req_p);
+
+			if (res == OK)
+				{
+					rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
+					res = DECLINED;
+				}
+
+			if (rods_connection_p)
+				{
+					char *cache_key_s = GetFacetCacheKey (rods_connection_p -> clientUser.userName, key_s, conditions_p, config_p -> eirods_dav_facet_specific_query_s, pool_p);
+					char *result_s = cache_key_s ? GetCachedFacetCounts (cache_key_s, pool_p) : NULL;
+
+					if (!result_s)
+						{
+							apr_array_header_t *facets_array_p = GetMetadataFacetCounts (key_s, conditions_p, config_p -> eirods_dav_facet_specific_query_s, rods_connection_p, pool_p);
+
+							if (facets_array_p)
+								{
+									result_s = GetFacetCountsAsJSON (key_s, facets_array_p, pool_p);
+
+									if (result_s && cache_key_s)
+										{
+											CacheFacetCounts (cache_key_s, result_s, pool_p);
+										}
+								}
+						}
+
+					if (result_s)
+						{
+							ap_set_content_type (req_p, CONTENT_TYPE_JSON_S);
+							ap_rputs (result_s, req_p);
+							res = OK;
+						}
+					else
+						{
+							/* The facet query failed rather than there being no facet */
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, req_p, "Failed to get the counts for facet \"%s\"", key_s);
+							res = HTTP_INTERNAL_SERVER_ERROR;
+						}
+
+				}		/* if (rods_connection_p) */
+
+		}		/* if (key_s) */
+
+	return res;
+}
+
+
+static int RunBatchMetadataOperations (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
+{
+	int res = DECLINED;
+	apr_pool_t *pool_p = req_p -> pool;
+	const char *operations_s = GetParameterValue (params_p, "operations", pool_p);
+
+	if (!operations_s && IsJSONRequest (req_p))
+		{
+			operations_s = ReadRequestBody (req_p, S_MAX_JSON_BODY_LENGTH);
+		}
+
+	if (operations_s)
+		{
+			json_error_t error;
+			json_t *input_p = json_loads (operations_s, 0, &error);
+
+			if (input_p)
+				{
+					/* Allow either a bare array or an object with an "operations" array */
+					json_t *operations_p = json_is_object (input_p) ? json_object_get (input_p, "operations") : input_p;
+
+					if (json_is_array (operations_p))
+						{
+							rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
+
+							if (rods_connection_p)
+								{
+									json_t *results_p = RunMetadataOperations (operations_p, rods_connection_p, pool_p);
+
+									if (results_p)
+										{
+											json_t *res_p = json_pack ("{s:o}", "results", results_p);
+
+											if (res_p)
+												{
+													char *result_s = json_dumps (res_p, JSON_INDENT (2));
+
+													if (result_s)
+														{
+															ap_rputs (result_s, req_p);
+															free (result_s);
+															res = OK;
+														}
+													else
+														{
+															ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, req_p, "json_dumps failed");
+														}
+
+													json_decref (res_p);
+												}
+										}
+
+								}		/* if (rods_connection_p) */
+							else
+								{
+									ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "Failed to get iRODS connection");
+								}
+						}
+					else
+						{
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "No array of metadata operations in request to \"%s\"", req_p -> uri);
+							res = HTTP_BAD_REQUEST;
+						}
+
+					json_decref (input_p);
+				}		/* if (input_p) */
+			else
+				{
+					ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "Failed to parse metadata operations at line %d: %s", error.line, error.text);
+					res = HTTP_BAD_REQUEST;
+				}
+
+		}		/* if (operations_s) */
+	else
+		{
+			ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "Failed to get metadata operations from \"%s\"", req_p -> uri);
+		}
+
+	return res;
+}
+
+
+static int StartMetadataImportJob (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
+{
+	int res = DECLINED;
+	apr_pool_t *pool_p = req_p -> pool;
+
+	if (req_p -> method_number == M_POST)
+		{
+			const char *format_s = GetParameterValue (params_p, "format", pool_p);
+			const char *op_s = GetParameterValue (params_p, "op", pool_p);
+			const char *content_type_s = apr_table_get (req_p -> headers_in, "Content-Type");
+			char separator = ',';
+
+			if (format_s)
+				{
+					if (strcasecmp (format_s, "tsv") == 0)
+						{
+							separator = '\t';
+						}
+				}
+			else if (content_type_s && (strncasecmp (content_type_s, "text/tab-separated-values", 25) == 0))
+				{
+					separator = '\t';
+				}
+
+			if (!op_s)
+				{
+					op_s = "add";
+				}
+
+			if ((strcmp (op_s, "add") == 0) || (strcmp (op_s, "set") == 0))
+				{
+					rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
+
+					if (rods_connection_p)
+						{
+							const char *username_s = NULL;
+							const char *password_s = NULL;
+
+							/*
+							 * The job makes its own connections so it needs the credentials, and
+							 * these must be for the same user that this request is running as.
+							 */
+							if ((GetIRodsCredentialsForRequest (req_p, config_p, &username_s, &password_s) == APR_SUCCESS) && (strcmp (username_s, rods_connection_p -> clientUser.userName) == 0))
+								{
+									const char *job_id_s = StartMetadataImport (req_p, config_p, separator, op_s, username_s, password_s);
+
+									if (job_id_s)
+										{
+											ap_rprintf (req_p, "{\n  \"job\": \"%s\"\n}", job_id_s);
+											res = OK;
+										}
+									else
+										{
+											res = HTTP_SERVICE_UNAVAILABLE;
+										}
+								}
+							else
+								{
+									ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EACCES, req_p, "Failed to get credentials for \"%s\" to run metadata import", rods_connection_p -> clientUser.userName);
+									res = HTTP_FORBIDDEN;
+								}
+
+						}		/* if (rods_connection_p) */
+					else
+						{
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "Failed to get iRODS connection");
+						}
+				}
+			else
+				{
+					ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "Invalid metadata import op \"%s\"", op_s);
+					res = HTTP_BAD_REQUEST;
+				}
+
+		}		/* if (req_p -> method_number == M_POST) */
+	else
+		{
+			res = HTTP_METHOD_NOT_ALLOWED;
+		}
+
+	return res;
+}
+
+
+static int GetMetadataImportJobStatus (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
+{
+	int res = DECLINED;
+	apr_pool_t *pool_p = req_p -> pool;
+	const char *job_id_s = GetParameterValue (params_p, "job", pool_p);
+
+	if (job_id_s)
+		{
+			rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
+
+			if (rods_connection_p)
+				{
+					char *status_s = GetMetadataImportStatus (job_id_s, rods_connection_p -> clientUser.userName, pool_p);
+
+					if (status_s)
+						{
+							ap_rputs (status_s, req_p);
+							res = OK;
+						}
+					else
+						{
+							res = HTTP_NOT_FOUND;
+						}
+				}
+		}
+
+	return res;
+}
+
+
+static int GetMetadataImportJobErrors (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
+{
+	int res = DECLINED;
+	apr_pool_t *pool_p = req_p -> pool;
+	const char *job_id_s = GetParameterValue (params_p, "job", pool_p);
+
+	if (job_id_s)
+		{
+			rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
+
+			if (rods_connection_p)
+				{
+					const char *path_s = GetMetadataImportErrorsPath (job_id_s, rods_connection_p -> clientUser.userName, pool_p);
+
+					res = HTTP_NOT_FOUND;
+
+					if (path_s)
+						{
+							apr_file_t *file_p = NULL;
+
+							if (apr_file_open (&file_p, path_s, APR_FOPEN_READ, APR_FPROT_OS_DEFAULT, pool_p) == APR_SUCCESS)
+								{
+									apr_finfo_t info;
+
+									if (apr_file_info_get (&info, APR_FINFO_SIZE, file_p) == APR_SUCCESS)
+										{
+											apr_size_t num_sent = 0;
+
+											SetMimeTypeForOutputFormat (req_p, OF_TSV);
+
+											if (info.size > 0)
+												{
+													ap_send_fd (file_p, req_p, 0, (apr_size_t) info.size, &num_sent);
+												}
+
+											res = OK;
+										}
+
+									/* The file is closed when the request's pool is cleaned up, after the output has been sent */
+								}
+						}
+				}
+		}
+
+	return res;
+}
+
+
+static int ExportMetadataForTree (const APICall *call_p, request_rec *req_p, apr_table_t *params_p, davrods_dir_conf_t *config_p, const char *davrods_path_s)
+{
+	int res = HTTP_BAD_REQUEST;
+	apr_pool_t *pool_p = req_p -> pool;
+	const char *path_s = GetParameterValue (params_p, "path", pool_p);
+	const OutputFormat format = GetRequestedOutputFormat (params_p, pool_p, OF_CSV);
+
+	if ((path_s) && ((format == OF_CSV) || (format == OF_JSON_LINES)))
+		{
+			rcComm_t *rods_connection_p = GetIRODSConnectionForAPI (req_p, config_p);
+
+			res = DECLINED;
+
+			if (rods_connection_p)
+				{
+					const char *full_path_s = GetFullPath (path_s, req_p, pool_p);
+					rodsObjStat_t *stat_p = full_path_s ? GetObjectStat (full_path_s, rods_connection_p, pool_p) : NULL;
+
+					res = HTTP_NOT_FOUND;
+
+					if (stat_p)
+						{
+							if (strchr (full_path_s, '\'') != NULL)
+								{
+									/* GenQuery conditions can't escape a quote so the path can't be queried */
+									ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "Metadata export cannot be run for \"%s\" since it contains a quote", full_path_s);
+									res = HTTP_BAD_REQUEST;
+								}
+							else if (stat_p -> objType == COLL_OBJ_T)
+								{
+									const char *username_s = NULL;
+									const char *password_s = NULL;
+
+									SetMimeTypeForOutputFormat (req_p, format);
+
+									/*
+									 * Any extra connections for exporting the subcollections at the
+									 * same time must be for the same user that this request is running as.
+									 */
+									if ((GetIRodsCredentialsForRequest (req_p, config_p, &username_s, &password_s) != APR_SUCCESS) || (strcmp (username_s, rods_connection_p -> clientUser.userName) != 0))
+										{
+											username_s = NULL;
+											password_s = NULL;
+										}
+
+									/*
+									 * Any failure part way through is logged by the export and the
+									 * output will have been started, so the status can't be changed.
+									 */
+									ExportMetadataForCollectionTree (full_path_s, format, config_p, username_s, password_s, rods_connection_p, req_p);
+
+									res = OK;
+								}
+							else
+								{
+									ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, pool_p, "Metadata export requires a collection but \"%s\" is not one", full_path_s);
+									res = HTTP_BAD_REQUEST;
+								}
+
+							freeRodsObjStat (stat_p);
+						}		/* if (stat_p) */
+
+				}		/* if (rods_connection_p) */
+
+		}		/* if ((path_s) && ((format == OF_CSV) || (format == OF_JSON_LINES))) */
+
+	return res;
+}
+
+
+static bool IsJSONRequest (request_rec *req_p)
+{
+	const char *content_type_s = apr_table_get (req_p -> headers_in, "Content-Type");
+
+	return (content_type_s && (strncasecmp (content_type_s, CONTENT_TYPE_JSON_S, strlen (CONTENT_TYPE_JSON_S)) == 0));
+}
+
+
+static bool IsRawBodyRequest (request_rec *req_p)
+{
+	bool raw_flag = false;
+	const char *content_type_s = apr_table_get (req_p -> headers_in, "Content-Type");
+
+	if (content_type_s)
+		{
+			const char * const *type_ss = S_RAW_BODY_CONTENT_TYPES_SS;
+
+			while ((*type_ss) && (!raw_flag))
+				{
+					if (strncasecmp (content_type_s, *type_ss, strlen (*type_ss)) == 0)
+						{
+							raw_flag = true;
+						}
+					else
+						{
+							++ type_ss;
+						}
+				}
+		}
+
+	return raw_flag;
+}
+
+
+static char *ReadRequestBody (request_rec *req_p, const apr_size_t max_length)
+{
+	char *body_s = NULL;
+
+	if (ap_setup_client_block (req_p, REQUEST_CHUNKED_DECHUNK) == OK)
+		{
+			if (ap_should_client_block (req_p))
+				{
+					apr_size_t capacity = HUGE_STRING_LEN;
+					apr_size_t length = 0;
+					char *buffer_s = (char *) apr_palloc (req_p -> pool, capacity + 1);
+					bool loop_flag = (buffer_s != NULL);
+
+					while (loop_flag)
+						{
+							long num_read;
+
+							if (length == capacity)
+								{
+									/* Grow the buffer */
+									if (capacity < max_length)
+										{
+											char *new_buffer_s;
+
+											capacity = (capacity * 2 < max_length) ? capacity * 2 : max_length;
+											new_buffer_s = (char *) apr_palloc (req_p -> pool, capacity + 1);
+
+											if (new_buffer_s)
+												{
+													memcpy (new_buffer_s, buffer_s, length);
+													buffer_s = new_buffer_s;
+												}
+											else
+												{
+													loop_flag = false;
+												}
+										}
+									else
+										{
+											ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_BADARG, req_p, "Request body is larger than %" APR_SIZE_T_FMT " bytes", max_length);
+											loop_flag = false;
+										}
+								}
+
+							if (loop_flag)
+								{
+									num_read = ap_get_client_block (req_p, buffer_s + length, capacity - length);
+
+									if (num_read > 0)
+										{
+											length += (apr_size_t) num_read;
+										}
+									else
+										{
+											if (num_read == 0)
+												{
+													* (buffer_s + length) = '\0';
+													body_s = buffer_s;
+												}
+
+											loop_flag = false;
+										}
+								}
+
+						}		/* while (loop_flag) */
+
+				}		/* if (ap_should_client_block (req_p)) */
+
+		}		/* if (ap_setup_client_block (req_p, REQUEST_CHUNKED_DECHUNK) == OK) */
+
+	return body_s;
+}
+
+
+static char *GetFacetCountsAsJSON (const char *key_s, const apr_array_header_t *facets_array_p, apr_pool_t *pool_p)
+{
+	char *result_s = NULL;
+	json_t *res_p = json_object ();
+
+	if (res_p)
+		{
+			json_t *facets_json_p = json_array ();
+
+			if (facets_json_p)
+				{
+					if (json_object_set_new (res_p, "facets", facets_json_p) == 0)
+						{
+							bool success_flag = (json_object_set_new (res_p, "key", json_string (key_s)) == 0);
+							int i;
+
+							for (i = 0; (i < facets_array_p -> nelts) && success_flag; ++ i)
+								{
+									const MetadataFacetCount *facet_p = APR_ARRAY_IDX (facets_array_p, i, MetadataFacetCount *);
+									json_t *facet_json_p = json_pack ("{s:s,s:I,s:I}", "value", facet_p -> mfc_value_s, "data_objects", (json_int_t) (facet_p -> mfc_num_data_objects), "collections", (json_int_t) (facet_p -> mfc_num_collections));
+
+									if (facet_json_p)
+										{
+											if (json_array_append_new (facets_json_p, facet_json_p) != 0)
+												{
+													success_flag = false;
+												}
+										}
+									else
+										{
+											success_flag = false;
+										}
+
+									if (!success_flag)
+										{
+											ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to add facet \"%s\" to JSON response", facet_p -> mfc_value_s);
+										}
+								}
+
+							if (success_flag)
+								{
+									char *dump_s = json_dumps (res_p, JSON_INDENT (2));
+
+									if (dump_s)
+										{
+											result_s = apr_pstrdup (pool_p, dump_s);
+											free (dump_s);
+										}
+									else
+										{
+											ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "json_dumps failed");
+										}
+								}
+
+						}		/* if (json_object_set_new (res_p, "facets", facets_json_p) == 0) */
+					else
+						{
+							json_decref (facets_json_p);
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to add JSON facets array to response");
+						}
+
+				}		/* if (facets_json_p) */
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to create JSON facets array for response");
+				}
+
+			json_decref (res_p);
+		}		/* if (res_p) */
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_EGENERAL, pool_p, "Failed to create JSON object for response");
+		}
+
+	return result_s;
+}
+
+
+/*
+ * Each part of the key is prefixed with its length so that values
+ * containing the separator can't make two different queries collide.
+ */
+/*
+ * The counts from the facet specific query and from GenQuery differ, so
+ * locations using different queries get separate entries.
+ */
+static char *GetFacetCacheKey (const char *username_s, const char *key_s, const apr_array_header_t *conditions_p, const char *specific_query_s, apr_pool_t *pool_p)
+{
+	const char *query_s = specific_query_s ? specific_query_s : "";
+	char *cache_key_s = apr_psprintf (pool_p, "%" APR_SIZE_T_FMT ":%s%" APR_SIZE_T_FMT ":%s%" APR_SIZE_T_FMT ":%s", strlen (query_s), query_s, strlen (username_s), username_s, strlen (key_s), key_s);
+
+	if (conditions_p)
+		{
+			int i;
+
+			for (i = 0; (i < conditions_p -> nelts) && cache_key_s; ++ i)
+				{
+					const MetadataSearchCondition *condition_p = & (APR_ARRAY_IDX (conditions_p, i, MetadataSearchCondition));
+
+					cache_key_s = apr_psprintf (pool_p, "%s|%d|%" APR_SIZE_T_FMT ":%s%" APR_SIZE_T_FMT ":%s", cache_key_s, condition_p -> msc_op,
+						strlen (condition_p -> msc_key_s), condition_p -> msc_key_s, strlen (condition_p -> msc_value_s), condition_p -> msc_value_s);
+				}
+		}
+
+	return cache_key_s;
+}
+
+
 static const char *GetFullPath (const char *path_s, request_rec *req_p, apr_pool_t *pool_p)
 {
 	const char *full_path_s = NULL;
@@ -1565,6 +2717,48 @@ static const char *GetIdParameter (apr_table_t *params_p, request_rec *req_p, rc
 }
 
 
+/*
+ * Split a comma or space separated list of ids into an array. Lists with
+ * more than S_MAX_NUM_IDS ids are rejected with APR_EINVAL.
+ */
+static apr_status_t GetIdsFromParameter (const char *ids_s, apr_array_header_t **ids_pp, request_rec *req_p)
+{
+	apr_status_t status = APR_ENOMEM;
+	apr_pool_t *pool_p = req_p -> pool;
+	char *copied_ids_s = apr_pstrdup (pool_p, ids_s);
+	apr_array_header_t *ids_p = apr_array_make (pool_p, 64, sizeof (const char *));
+
+	if (copied_ids_s && ids_p)
+		{
+			const char *sep_s = " ,";
+			char *id_s = apr_strtok (copied_ids_s, sep_s, &copied_ids_s);
+
+			status = APR_SUCCESS;
+
+			while (id_s && (status == APR_SUCCESS))
+				{
+					if (ids_p -> nelts < S_MAX_NUM_IDS)
+						{
+							APR_ARRAY_PUSH (ids_p, const char *) = id_s;
+							id_s = apr_strtok (NULL, sep_s, &copied_ids_s);
+						}
+					else
+						{
+							ap_log_rerror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_WARNING, APR_EINVAL, req_p, "Rejecting request for more than %d ids", S_MAX_NUM_IDS);
+							status = APR_EINVAL;
+						}
+				}		/* while (id_s && (status == APR_SUCCESS)) */
+
+			if (status == APR_SUCCESS)
+				{
+					*ids_pp = ids_p;
+				}
+		}
+
+	return status;
+}
+
+
 
 rcComm_t *GetIRODSConnectionForAPI (request_rec *req_p, davrods_dir_conf_t *config_p)
 {
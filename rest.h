@@ -48,9 +48,16 @@ REST_PREFIX const char REST_METADATA_ADD_S [] REST_VAL ("metadata/add");
 REST_PREFIX const char REST_METADATA_DELETE_S [] REST_VAL ("metadata/delete");
 REST_PREFIX const char REST_METADATA_MATCHING_KEYS_S [] REST_VAL ("metadata/keys");
 REST_PREFIX const char REST_METADATA_MATCHING_VALUES_S [] REST_VAL ("metadata/values");
+REST_PREFIX const char REST_METADATA_FACETS_S [] REST_VAL ("metadata/facets");
+REST_PREFIX const char REST_METADATA_BATCH_S [] REST_VAL ("metadata/batch");
+REST_PREFIX const char REST_METADATA_IMPORT_STATUS_S [] REST_VAL ("metadata/import/status");
+REST_PREFIX const char REST_METADATA_IMPORT_ERRORS_S [] REST_VAL ("metadata/import/errors");
+REST_PREFIX const char REST_METADATA_IMPORT_S [] REST_VAL ("metadata/import");
+REST_PREFIX const char REST_METADATA_EXPORT_S [] REST_VAL ("metadata/export");
 
 REST_PREFIX const char REST_GET_INFO_S [] REST_VAL ("general/info");
 REST_PREFIX const char REST_LIST_S [] REST_VAL ("general/list");
+REST_PREFIX const char REST_LIST_COLLECTION_S [] REST_VAL ("general/collection");
 
 //REST_PREFIX const char REST_UPLOAD_S [] REST_VAL ("general/upload");
 REST_PREFIX const char REST_UPLOAD_S [] REST_VAL ("/eirods-upload");
@@ -0,0 +1,646 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * section_cache.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "apr_atomic.h"
+#include "apr_file_info.h"
+#include "apr_file_io.h"
+#include "apr_hash.h"
+#include "apr_lib.h"
+#include "apr_strings.h"
+#include "apr_time.h"
+
+#include "http_log.h"
+
+#include "section_cache.h"
+#include "lru_cache.h"
+
+
+APLOG_USE_MODULE(davrods);
+
+
+/*
+ * Each entry is allocated with malloc rather than from a pool since
+ * entries are added and removed independently of each other for the
+ * lifetime of the child process.
+ */
+typedef struct SectionCacheEntry
+{
+	char *sce_body_s;
+	apr_size_t sce_length;
+
+	/* If this is set, the entry can be revalidated once it has expired */
+	char *sce_etag_s;
+} SectionCacheEntry;
+
+
+/*
+ * The contents of a file: section. This is shared by the cache and by the
+ * buckets of any requests that are still sending it, and it is freed once
+ * the last of these has let go of it. A newer version of the file can
+ * replace it in the cache while older requests are still using it.
+ */
+typedef struct FileSectionData
+{
+	volatile apr_uint32_t fsd_num_refs;
+	apr_size_t fsd_length;
+	char fsd_data_s [];
+} FileSectionData;
+
+
+/*
+ * A file: section, along with the details used to
+ * check whether the file has changed since it was read.
+ */
+typedef struct FileSectionEntry
+{
+	char *fse_filename_s;
+	FileSectionData *fse_data_p;
+	apr_time_t fse_mtime;
+	apr_off_t fse_size;
+} FileSectionEntry;
+
+
+/*
+ * STATIC VARIABLES
+ */
+
+/* The sections keyed by their addresses, limited by their number of bytes */
+static LRUCache *s_cache_p = NULL;
+
+/* The file: sections keyed by their paths. These share the lock of s_cache_p. */
+static apr_hash_t *s_files_p = NULL;
+
+/* The longest lifetime of a cache entry in seconds, 0 turns the cache off */
+static int s_cache_ttl = 0;
+
+static apr_size_t s_cache_max_bytes = 4 * 1024 * 1024;
+
+/* A single section can use at most this fraction of the cache */
+static const apr_size_t S_MAX_ENTRY_FRACTION = 4;
+
+
+/*
+ * STATIC DECLARATIONS
+ */
+
+static bool GetSectionLifetime (const char *cache_control_s, int *lifetime_p, apr_pool_t *pool_p);
+
+static int GetCacheControlSeconds (const char *directive_s, const char *name_s);
+
+static void FreeSectionCacheEntry (void *data_p);
+
+static apr_status_t ClearSectionCache (void *data_p);
+
+static FileSectionData *LoadFileSection (const char *filename_s, const apr_finfo_t *finfo_p, apr_pool_t *pool_p);
+
+static FileSectionData *GetFileSectionData (const char *filename_s, const apr_finfo_t *finfo_p, apr_pool_t *pool_p);
+
+static void ReleaseFileSectionData (void *data_p);
+
+
+/*
+ * API DEFINITIONS
+ */
+
+apr_status_t InitSectionCache (apr_pool_t *pool_p)
+{
+	apr_status_t status = APR_SUCCESS;
+
+	s_cache_p = AllocateLRUCache (s_cache_max_bytes, FreeSectionCacheEntry, pool_p);
+	s_files_p = apr_hash_make (pool_p);
+
+	if (s_cache_p && s_files_p)
+		{
+			/* This runs before the cleanup of s_cache_p since it is registered after it */
+			apr_pool_cleanup_register (pool_p, NULL, ClearSectionCache, apr_pool_cleanup_null);
+		}
+	else
+		{
+			status = APR_ENOMEM;
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to create section cache");
+			s_cache_p = NULL;
+			s_files_p = NULL;
+		}
+
+	return status;
+}
+
+
+char *GetCachedSection (const char *uri_s, char **etag_ss, apr_pool_t *pool_p)
+{
+	char *body_s = NULL;
+
+	*etag_ss = NULL;
+
+	if (s_cache_p && (s_cache_ttl > 0) && uri_s)
+		{
+			apr_time_t expiry_time = 0;
+			SectionCacheEntry *entry_p;
+
+			LockLRUCache (s_cache_p);
+
+			entry_p = (SectionCacheEntry *) FindLRUCacheValue (s_cache_p, uri_s, &expiry_time);
+
+			if (entry_p)
+				{
+					const bool fresh_flag = (expiry_time > apr_time_now ());
+
+					if (fresh_flag || (entry_p -> sce_etag_s))
+						{
+							body_s = apr_pstrmemdup (pool_p, entry_p -> sce_body_s, entry_p -> sce_length);
+
+							if (body_s && !fresh_flag)
+								{
+									*etag_ss = apr_pstrdup (pool_p, entry_p -> sce_etag_s);
+								}
+						}
+					else
+						{
+							RemoveLRUCacheValue (s_cache_p, uri_s);
+						}
+				}
+
+			UnlockLRUCache (s_cache_p);
+		}
+
+	return body_s;
+}
+
+
+void CacheSection (const char *uri_s, const char *body_s, const char *etag_s, const char *cache_control_s, apr_pool_t *pool_p)
+{
+	if (s_cache_p && (s_cache_ttl > 0) && uri_s && body_s)
+		{
+			int lifetime = s_cache_ttl;
+
+			/*
+			 * An entry that has to be revalidated straight away is
+			 * only worth keeping if it can be revalidated.
+			 */
+			if (GetSectionLifetime (cache_control_s, &lifetime, pool_p) && ((lifetime > 0) || etag_s))
+				{
+					const apr_size_t length = strlen (body_s);
+
+					if (length <= s_cache_max_bytes / S_MAX_ENTRY_FRACTION)
+						{
+							SectionCacheEntry *entry_p = (SectionCacheEntry *) calloc (1, sizeof (SectionCacheEntry));
+
+							if (entry_p)
+								{
+									bool success_flag = false;
+
+									entry_p -> sce_body_s = strdup (body_s);
+
+									if (entry_p -> sce_body_s)
+										{
+											if (etag_s)
+												{
+													entry_p -> sce_etag_s = strdup (etag_s);
+													success_flag = (entry_p -> sce_etag_s != NULL);
+												}
+											else
+												{
+													success_flag = true;
+												}
+										}
+
+									if (success_flag)
+										{
+											entry_p -> sce_length = length;
+
+											LockLRUCache (s_cache_p);
+											success_flag = AddLRUCacheValue (s_cache_p, uri_s, entry_p, length, apr_time_now () + apr_time_from_sec (lifetime));
+											UnlockLRUCache (s_cache_p);
+										}
+
+									if (!success_flag)
+										{
+											FreeSectionCacheEntry (entry_p);
+										}
+								}
+						}
+				}
+		}
+}
+
+
+void RefreshCachedSection (const char *uri_s, const char *cache_control_s, apr_pool_t *pool_p)
+{
+	if (s_cache_p && uri_s)
+		{
+			int lifetime = s_cache_ttl;
+			const bool store_flag = GetSectionLifetime (cache_control_s, &lifetime, pool_p);
+
+			LockLRUCache (s_cache_p);
+
+			if (store_flag)
+				{
+					SetLRUCacheValueExpiryTime (s_cache_p, uri_s, apr_time_now () + apr_time_from_sec (lifetime));
+				}
+			else
+				{
+					RemoveLRUCacheValue (s_cache_p, uri_s);
+				}
+
+			UnlockLRUCache (s_cache_p);
+		}
+}
+
+
+apr_status_t AddFileSectionToBrigade (const char *filename_s, apr_bucket_brigade *brigade_p, apr_pool_t *pool_p)
+{
+	apr_finfo_t finfo;
+
+	/* Checking the file is much cheaper than reading it */
+	apr_status_t status = apr_stat (&finfo, filename_s, APR_FINFO_MTIME | APR_FINFO_SIZE, pool_p);
+
+	if (status == APR_SUCCESS)
+		{
+			FileSectionData *data_p = GetFileSectionData (filename_s, &finfo, pool_p);
+
+			if (data_p)
+				{
+					if (data_p -> fsd_length > 0)
+						{
+							/*
+							 * The bucket takes over our reference to the data rather
+							 * than copying it and lets go of it once it has been sent.
+							 */
+							apr_bucket *bucket_p = apr_bucket_heap_create (data_p -> fsd_data_s, data_p -> fsd_length, ReleaseFileSectionData, brigade_p -> bucket_alloc);
+
+							if (bucket_p)
+								{
+									APR_BRIGADE_INSERT_TAIL (brigade_p, bucket_p);
+								}
+							else
+								{
+									ReleaseFileSectionData (data_p -> fsd_data_s);
+									status = APR_ENOMEM;
+								}
+						}
+					else
+						{
+							ReleaseFileSectionData (data_p -> fsd_data_s);
+						}
+				}
+			else
+				{
+					status = APR_EGENERAL;
+				}
+		}
+
+	return status;
+}
+
+
+const char *SetSectionCacheTTL (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *error_s = NULL;
+	apr_int64_t ttl = apr_atoi64 (arg_p);
+
+	if ((ttl >= 0) && (ttl <= INT_MAX))
+		{
+			s_cache_ttl = (int) ttl;
+		}
+	else
+		{
+			error_s = "The section cache TTL must be a number of seconds, or 0 to turn the cache off";
+		}
+
+	return error_s;
+}
+
+
+const char *SetSectionCacheSize (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *error_s = NULL;
+	apr_int64_t size = apr_atoi64 (arg_p);
+
+	if (size > 0)
+		{
+			s_cache_max_bytes = (apr_size_t) size;
+		}
+	else
+		{
+			error_s = "The section cache size must be a number of bytes greater than zero";
+		}
+
+	return error_s;
+}
+
+
+/*
+ * STATIC DEFINITIONS
+ */
+
+/*
+ * Work out how long a response can be cached for from its Cache-Control
+ * header. The lifetime is only ever reduced from the configured TTL and
+ * s-maxage takes precedence over max-age since this is a shared cache.
+ * Returns false if the response must not be stored at all.
+ */
+static bool GetSectionLifetime (const char *cache_control_s, int *lifetime_p, apr_pool_t *pool_p)
+{
+	bool store_flag = true;
+
+	if (cache_control_s)
+		{
+			char *copy_s = apr_pstrdup (pool_p, cache_control_s);
+
+			if (copy_s)
+				{
+					int max_age = -1;
+					int shared_max_age = -1;
+					bool no_cache_flag = false;
+					char *state_s = NULL;
+					char *directive_s = apr_strtok (copy_s, ",", &state_s);
+
+					while (directive_s)
+						{
+							while (apr_isspace (*directive_s))
+								{
+									++ directive_s;
+								}
+
+							if ((strncasecmp (directive_s, "no-store", 8) == 0) || (strncasecmp (directive_s, "private", 7) == 0))
+								{
+									/* The sections are shared between all users */
+									store_flag = false;
+								}
+							else if (strncasecmp (directive_s, "no-cache", 8) == 0)
+								{
+									/* The response can be stored but must be revalidated before each use */
+									no_cache_flag = true;
+								}
+							else if (strncasecmp (directive_s, "s-maxage=", 9) == 0)
+								{
+									shared_max_age = GetCacheControlSeconds (directive_s, "s-maxage=");
+								}
+							else if (strncasecmp (directive_s, "max-age=", 8) == 0)
+								{
+									max_age = GetCacheControlSeconds (directive_s, "max-age=");
+								}
+
+							directive_s = apr_strtok (NULL, ",", &state_s);
+						}		/* while (directive_s) */
+
+					if (no_cache_flag)
+						{
+							max_age = 0;
+						}
+					else if (shared_max_age >= 0)
+						{
+							max_age = shared_max_age;
+						}
+
+					if ((max_age >= 0) && (max_age < *lifetime_p))
+						{
+							*lifetime_p = max_age;
+						}
+				}
+		}
+
+	return store_flag;
+}
+
+
+static int GetCacheControlSeconds (const char *directive_s, const char *name_s)
+{
+	int seconds = 0;
+	apr_int64_t value = apr_atoi64 (directive_s + strlen (name_s));
+
+	if (value > 0)
+		{
+			seconds = (value <= INT_MAX) ? (int) value : INT_MAX;
+		}
+
+	return seconds;
+}
+
+
+static void FreeSectionCacheEntry (void *data_p)
+{
+	SectionCacheEntry *entry_p = (SectionCacheEntry *) data_p;
+
+	free (entry_p -> sce_etag_s);
+	free (entry_p -> sce_body_s);
+	free (entry_p);
+}
+
+
+/*
+ * Get the contents of a file: section, reading the file if it isn't
+ * cached or if it has changed. The caller gets its own reference to the
+ * data which it must give up with ReleaseFileSectionData().
+ */
+static FileSectionData *GetFileSectionData (const char *filename_s, const apr_finfo_t *finfo_p, apr_pool_t *pool_p)
+{
+	FileSectionData *data_p = NULL;
+
+	if (s_files_p)
+		{
+			FileSectionEntry *entry_p;
+
+			LockLRUCache (s_cache_p);
+
+			entry_p = (FileSectionEntry *) apr_hash_get (s_files_p, filename_s, APR_HASH_KEY_STRING);
+
+			if (entry_p && (entry_p -> fse_mtime == finfo_p -> mtime) && (entry_p -> fse_size == finfo_p -> size))
+				{
+					data_p = entry_p -> fse_data_p;
+					apr_atomic_inc32 (& (data_p -> fsd_num_refs));
+				}
+
+			UnlockLRUCache (s_cache_p);
+
+			if (!data_p)
+				{
+					/* Read the file without holding the lock */
+					data_p = LoadFileSection (filename_s, finfo_p, pool_p);
+
+					if (data_p)
+						{
+							LockLRUCache (s_cache_p);
+
+							if (!entry_p)
+								{
+									entry_p = (FileSectionEntry *) apr_hash_get (s_files_p, filename_s, APR_HASH_KEY_STRING);
+								}
+
+							if (!entry_p)
+								{
+									entry_p = (FileSectionEntry *) calloc (1, sizeof (FileSectionEntry));
+
+									if (entry_p)
+										{
+											entry_p -> fse_filename_s = strdup (filename_s);
+
+											if (entry_p -> fse_filename_s)
+												{
+													apr_hash_set (s_files_p, entry_p -> fse_filename_s, APR_HASH_KEY_STRING, entry_p);
+												}
+											else
+												{
+													free (entry_p);
+													entry_p = NULL;
+												}
+										}
+								}
+
+							if (entry_p)
+								{
+									/* The cache keeps its own reference to the newer version */
+									apr_atomic_inc32 (& (data_p -> fsd_num_refs));
+
+									if (entry_p -> fse_data_p)
+										{
+											ReleaseFileSectionData (entry_p -> fse_data_p -> fsd_data_s);
+										}
+
+									entry_p -> fse_data_p = data_p;
+									entry_p -> fse_mtime = finfo_p -> mtime;
+									entry_p -> fse_size = finfo_p -> size;
+								}
+
+							UnlockLRUCache (s_cache_p);
+						}
+				}
+		}
+	else
+		{
+			/* Without the cache, read the file for this request alone */
+			data_p = LoadFileSection (filename_s, finfo_p, pool_p);
+		}
+
+	return data_p;
+}
+
+
+/*
+ * Read a file into a newly-allocated FileSectionData with a single reference.
+ */
+static FileSectionData *LoadFileSection (const char *filename_s, const apr_finfo_t *finfo_p, apr_pool_t *pool_p)
+{
+	FileSectionData *data_p = NULL;
+	apr_file_t *file_p = NULL;
+	apr_status_t status = apr_file_open (&file_p, filename_s, APR_FOPEN_READ | APR_FOPEN_BINARY, APR_FPROT_OS_DEFAULT, pool_p);
+
+	if (status == APR_SUCCESS)
+		{
+			const apr_size_t length = (apr_size_t) (finfo_p -> size);
+
+			data_p = (FileSectionData *) malloc (offsetof (FileSectionData, fsd_data_s) + length + 1);
+
+			if (data_p)
+				{
+					apr_size_t num_read = 0;
+
+					if (length > 0)
+						{
+							status = apr_file_read_full (file_p, data_p -> fsd_data_s, length, &num_read);
+
+							/* The file may have been truncated since it was checked */
+							if (status == APR_EOF)
+								{
+									status = APR_SUCCESS;
+								}
+						}
+
+					if (status == APR_SUCCESS)
+						{
+							* (data_p -> fsd_data_s + num_read) = '\0';
+							data_p -> fsd_length = num_read;
+							data_p -> fsd_num_refs = 1;
+						}
+					else
+						{
+							ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to read \"%s\"", filename_s);
+							free (data_p);
+							data_p = NULL;
+						}
+				}
+			else
+				{
+					ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, APR_ENOMEM, pool_p, "Failed to allocate %" APR_SIZE_T_FMT " bytes for \"%s\"", length, filename_s);
+				}
+
+			apr_file_close (file_p);
+		}
+	else
+		{
+			ap_log_perror (__FILE__, __LINE__, APLOG_MODULE_INDEX, APLOG_ERR, status, pool_p, "Failed to open \"%s\"", filename_s);
+		}
+
+	return data_p;
+}
+
+
+/*
+ * Give up a reference to a file: section's data, freeing it if this was
+ * the last one. This is also the free function for the heap buckets that
+ * share the data, which is why it takes a pointer to the contents.
+ */
+static void ReleaseFileSectionData (void *data_p)
+{
+	FileSectionData *file_data_p = (FileSectionData *) (((char *) data_p) - offsetof (FileSectionData, fsd_data_s));
+
+	if (apr_atomic_dec32 (& (file_data_p -> fsd_num_refs)) == 0)
+		{
+			free (file_data_p);
+		}
+}
+
+
+static apr_status_t ClearSectionCache (void *data_p)
+{
+	/* The sections themselves are freed by the cleanup of s_cache_p */
+	s_cache_p = NULL;
+
+	if (s_files_p)
+		{
+			apr_hash_index_t *index_p;
+
+			for (index_p = apr_hash_first (NULL, s_files_p); index_p; index_p = apr_hash_next (index_p))
+				{
+					FileSectionEntry *entry_p = (FileSectionEntry *) apr_hash_this_val (index_p);
+
+					if (entry_p -> fse_data_p)
+						{
+							ReleaseFileSectionData (entry_p -> fse_data_p -> fsd_data_s);
+						}
+
+					free (entry_p -> fse_filename_s);
+					free (entry_p);
+				}
+
+			s_files_p = NULL;
+		}
+
+	return APR_SUCCESS;
+}
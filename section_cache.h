@@ -0,0 +1,115 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * section_cache.h
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#ifndef SECTION_CACHE_H_
+#define SECTION_CACHE_H_
+
+#include "apr_pools.h"
+#include "apr_buckets.h"
+
+#include "httpd.h"
+#include "http_config.h"
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/**
+ * Create the per-child cache of the http(s) sections used by themed
+ * listings. This should be called once from the child_init hook.
+ *
+ * @param pool_p The child's memory pool. The cache will be cleaned up
+ * when this pool is destroyed.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t InitSectionCache (apr_pool_t *pool_p);
+
+
+/**
+ * Get a copy of a cached section.
+ *
+ * @param uri_s The address of the section with all of its variables expanded.
+ * @param etag_ss If the entry has expired but it has an ETag, this will be set
+ * to a copy of the ETag so that the entry can be revalidated with the server
+ * and the stale body is still returned. Otherwise this is set to <code>NULL</code>.
+ * @param pool_p The memory pool to copy the section into.
+ * @return The section or <code>NULL</code> if there is no usable cached entry.
+ */
+char *GetCachedSection (const char *uri_s, char **etag_ss, apr_pool_t *pool_p);
+
+
+/**
+ * Add a section to the cache. How long it is kept for is the lower of the
+ * DavRodsSectionCacheTTL value and any max-age in its Cache-Control header,
+ * and it is not stored at all if the header has no-store or private.
+ *
+ * @param uri_s The address of the section with all of its variables expanded.
+ * @param body_s The section.
+ * @param etag_s The ETag of the response. This can be <code>NULL</code>.
+ * @param cache_control_s The Cache-Control header of the response. This can
+ * be <code>NULL</code>.
+ * @param pool_p A memory pool for any temporary allocations.
+ */
+void CacheSection (const char *uri_s, const char *body_s, const char *etag_s, const char *cache_control_s, apr_pool_t *pool_p);
+
+
+/**
+ * Mark a cached section as valid again after the server has said that
+ * it hasn't changed.
+ *
+ * @param uri_s The address of the section with all of its variables expanded.
+ * @param cache_control_s The Cache-Control header of the server's 304 response.
+ * This can be <code>NULL</code>.
+ * @param pool_p A memory pool for any temporary allocations.
+ */
+void RefreshCachedSection (const char *uri_s, const char *cache_control_s, apr_pool_t *pool_p);
+
+
+/**
+ * Add the contents of a file: section to a bucket brigade.
+ *
+ * Each file is only read when it is first used and whenever its modification
+ * time or size changes, so changes to it are still picked up without
+ * restarting Apache. The brigade gets a bucket that shares the child's copy
+ * of the file rather than a copy of its own.
+ *
+ * @param filename_s The path of the file.
+ * @param brigade_p The brigade to add the file to.
+ * @param pool_p A memory pool for any temporary allocations.
+ * @return APR_SUCCESS upon success or an APR error code upon failure.
+ */
+apr_status_t AddFileSectionToBrigade (const char *filename_s, apr_bucket_brigade *brigade_p, apr_pool_t *pool_p);
+
+
+const char *SetSectionCacheTTL (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetSectionCacheSize (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SECTION_CACHE_H_ */
@@ -0,0 +1,272 @@
+/*
+** Copyright 2014-2018 The Earlham Institute
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*
+ * test_query_utils.c
+ *
+ *  Created on: 19 Oct 2026
+ *      Author: billy
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+
+#include "query_utils.h"
+
+
+/*
+ * STATIC DECLARATIONS
+ */
+
+static void TestPageIndex (void);
+
+static void TestPageBounds (void);
+
+static void TestReplicaMerging (void);
+
+static void TestReplicaChecksums (void);
+
+static void TestFingerprintLines (void);
+
+static void TestSearchConditionParameters (void);
+
+static void TestIncompleteSearchConditions (void);
+
+
+/*
+ * API DEFINITIONS
+ */
+
+int main (void)
+{
+	TestPageIndex ();
+	TestPageBounds ();
+	TestReplicaMerging ();
+	TestReplicaChecksums ();
+	TestFingerprintLines ();
+	TestSearchConditionParameters ();
+	TestIncompleteSearchConditions ();
+
+	printf ("All query_utils tests passed\n");
+
+	return 0;
+}
+
+
+/*
+ * STATIC DEFINITIONS
+ */
+
+static void TestPageIndex (void)
+{
+	const size_t max_page = ((size_t) INT_MAX) / 100;
+
+	/* The pages in the url start at 1 */
+	assert (GetListingPageIndex (1, 100) == 0);
+	assert (GetListingPageIndex (2, 100) == 1);
+	assert (GetListingPageIndex (10, 25) == 9);
+
+	/* Anything before the first page is the first page */
+	assert (GetListingPageIndex (0, 100) == 0);
+	assert (GetListingPageIndex (-5, 100) == 0);
+	assert (GetListingPageIndex (INT64_MIN, 100) == 0);
+
+	/* The pages are clamped so that their row offsets fit in an int */
+	assert (GetListingPageIndex ((int64_t) max_page, 100) == max_page - 1);
+	assert (GetListingPageIndex ((int64_t) max_page + 1, 100) == max_page - 1);
+	assert (GetListingPageIndex (INT64_MAX, 100) == max_page - 1);
+	assert ((max_page - 1) * 100 <= (size_t) INT_MAX);
+	assert (GetListingPageIndex (INT64_MAX, 1) == ((size_t) INT_MAX) - 1);
+
+	/* A page larger than every offset only has the first page */
+	assert (GetListingPageIndex (3, ((size_t) INT_MAX) + 1) == 0);
+	assert (GetListingPageIndex (3, 0) == 0);
+}
+
+
+static void TestPageBounds (void)
+{
+	size_t start = 0;
+	size_t end = 0;
+
+	/* A full first page with more after it */
+	assert (GetListingPageBounds (0, 10, 25, &start, &end));
+	assert ((start == 0) && (end == 10));
+
+	/* The last page is partly filled */
+	assert (!GetListingPageBounds (2, 10, 25, &start, &end));
+	assert ((start == 20) && (end == 30));
+
+	/* A page that ends exactly at the end of the listing has nothing after it */
+	assert (!GetListingPageBounds (1, 10, 20, &start, &end));
+	assert ((start == 10) && (end == 20));
+
+	/* A page past the end of the listing is just empty */
+	assert (!GetListingPageBounds (5, 10, 20, &start, &end));
+	assert (start >= 20);
+
+	assert (!GetListingPageBounds (0, 10, 0, &start, &end));
+	assert ((start == 0) && (end == 10));
+
+	/* The offsets saturate rather than wrap around */
+	assert (!GetListingPageBounds (SIZE_MAX, 2, 10, &start, &end));
+	assert ((start == SIZE_MAX) && (end == SIZE_MAX));
+
+	assert (!GetListingPageBounds (1, SIZE_MAX, 10, &start, &end));
+	assert ((start == SIZE_MAX) && (end == SIZE_MAX));
+}
+
+
+static void TestReplicaMerging (void)
+{
+	/* Only rows with the same data id are replicas of each other */
+	assert (IsReplicaOfPreviousDataObject ("10021", "10021"));
+	assert (!IsReplicaOfPreviousDataObject ("10021", "10022"));
+	assert (!IsReplicaOfPreviousDataObject ("1002", "10021"));
+	assert (!IsReplicaOfPreviousDataObject ("10021", "1002"));
+
+	/* The first row, or one without an id, is never a replica */
+	assert (!IsReplicaOfPreviousDataObject (NULL, "10021"));
+	assert (!IsReplicaOfPreviousDataObject ("10021", NULL));
+	assert (!IsReplicaOfPreviousDataObject (NULL, NULL));
+}
+
+
+static void TestReplicaChecksums (void)
+{
+	/* A replica with a checksum is preferred over one without */
+	assert (ShouldUseReplicaChecksum (NULL, "sha2:abc"));
+	assert (ShouldUseReplicaChecksum ("", "sha2:abc"));
+
+	/* but an existing checksum is kept */
+	assert (!ShouldUseReplicaChecksum ("sha2:abc", "sha2:def"));
+	assert (!ShouldUseReplicaChecksum ("sha2:abc", NULL));
+	assert (!ShouldUseReplicaChecksum ("sha2:abc", ""));
+
+	/* and a missing one isn't replaced by another missing one */
+	assert (!ShouldUseReplicaChecksum (NULL, NULL));
+	assert (!ShouldUseReplicaChecksum (NULL, ""));
+	assert (!ShouldUseReplicaChecksum ("", ""));
+}
+
+
+static void TestFingerprintLines (void)
+{
+	const char *fingerprint_s = "5f2b51ca2fdc5baa31ec02e002f69aec";
+
+	assert (DoesFingerprintLineMatch ("5f2b51ca2fdc5baa31ec02e002f69aec\n", fingerprint_s));
+
+	/* The line must end straight after the fingerprint */
+	assert (!DoesFingerprintLineMatch ("5f2b51ca2fdc5baa31ec02e002f69aec", fingerprint_s));
+	assert (!DoesFingerprintLineMatch ("5f2b51ca2fdc5baa31ec02e002f69aecff\n", fingerprint_s));
+	assert (!DoesFingerprintLineMatch ("5f2b51ca2fdc5baa31ec02e002f69aec \n", fingerprint_s));
+	assert (!DoesFingerprintLineMatch ("5f2b51ca2fdc5baa31ec02e002f69aec\n{", fingerprint_s));
+
+	/* A prefix of the fingerprint, or a different one, doesn't match */
+	assert (!DoesFingerprintLineMatch ("5f2b51ca\n", fingerprint_s));
+	assert (!DoesFingerprintLineMatch ("", fingerprint_s));
+	assert (!DoesFingerprintLineMatch ("\n", fingerprint_s));
+	assert (!DoesFingerprintLineMatch ("6f2b51ca2fdc5baa31ec02e002f69aec\n", fingerprint_s));
+}
+
+
+static void TestSearchConditionParameters (void)
+{
+	SearchConditionPart part = SCP_NUM_PARTS;
+	size_t index = 0;
+
+	/* The first condition has no number */
+	assert (GetSearchConditionParameter ("key", "", &part, &index) == SPT_CONDITION);
+	assert ((part == SCP_KEY) && (index == 0));
+
+	assert (GetSearchConditionParameter ("value", "", &part, &index) == SPT_CONDITION);
+	assert ((part == SCP_VALUE) && (index == 0));
+
+	assert (GetSearchConditionParameter ("op", "", &part, &index) == SPT_CONDITION);
+	assert ((part == SCP_OP) && (index == 0));
+
+	/* and the further ones are numbered from 1 */
+	assert (GetSearchConditionParameter ("key1", "", &part, &index) == SPT_CONDITION);
+	assert ((part == SCP_KEY) && (index == 1));
+
+	assert (GetSearchConditionParameter ("value12", "", &part, &index) == SPT_CONDITION);
+	assert ((part == SCP_VALUE) && (index == 12));
+
+	assert (GetSearchConditionParameter ("op3", "", &part, &index) == SPT_CONDITION);
+	assert ((part == SCP_OP) && (index == 3));
+
+	/* The facet filters use a prefix */
+	assert (GetSearchConditionParameter ("filter_key2", "filter_", &part, &index) == SPT_CONDITION);
+	assert ((part == SCP_KEY) && (index == 2));
+
+	assert (GetSearchConditionParameter ("key", "filter_", &part, &index) == SPT_OTHER);
+	assert (GetSearchConditionParameter ("filter_key", "", &part, &index) == SPT_OTHER);
+
+	/* Other parameters are left alone */
+	assert (GetSearchConditionParameter ("keyword", "", &part, &index) == SPT_OTHER);
+	assert (GetSearchConditionParameter ("values", "", &part, &index) == SPT_OTHER);
+	assert (GetSearchConditionParameter ("options", "", &part, &index) == SPT_OTHER);
+	assert (GetSearchConditionParameter ("output_format", "", &part, &index) == SPT_OTHER);
+	assert (GetSearchConditionParameter ("ke", "", &part, &index) == SPT_OTHER);
+	assert (GetSearchConditionParameter ("", "", &part, &index) == SPT_OTHER);
+
+	/* but badly numbered conditions are rejected */
+	assert (GetSearchConditionParameter ("key0", "", &part, &index) == SPT_INVALID);
+	assert (GetSearchConditionParameter ("key01", "", &part, &index) == SPT_INVALID);
+	assert (GetSearchConditionParameter ("value1x", "", &part, &index) == SPT_INVALID);
+	assert (GetSearchConditionParameter ("op99999999999999999999999999", "", &part, &index) == SPT_INVALID);
+}
+
+
+static void TestIncompleteSearchConditions (void)
+{
+	const unsigned int key = 1U << SCP_KEY;
+	const unsigned int value = 1U << SCP_VALUE;
+	const unsigned int op = 1U << SCP_OP;
+	unsigned int parts [4];
+
+	/* Complete conditions, with or without their operators */
+	parts [0] = key | value;
+	parts [1] = key | value | op;
+	parts [2] = key | value;
+	assert (GetFirstIncompleteSearchCondition (parts, 3) == 3);
+	assert (GetFirstIncompleteSearchCondition (parts, 0) == 0);
+
+	/* A key without its value */
+	parts [1] = key | op;
+	assert (GetFirstIncompleteSearchCondition (parts, 3) == 1);
+
+	/* A value without its key */
+	parts [1] = value;
+	assert (GetFirstIncompleteSearchCondition (parts, 3) == 1);
+
+	/* Just an operator */
+	parts [1] = key | value;
+	parts [2] = op;
+	assert (GetFirstIncompleteSearchCondition (parts, 3) == 2);
+
+	/* A gap, e.g. key1 followed by key3 */
+	parts [2] = 0;
+	parts [3] = key | value;
+	assert (GetFirstIncompleteSearchCondition (parts, 4) == 2);
+
+	/* Numbered conditions without the first one */
+	parts [0] = 0;
+	parts [2] = key | value;
+	assert (GetFirstIncompleteSearchCondition (parts, 4) == 0);
+}
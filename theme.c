@@ -20,6 +20,11 @@
  *      Author: billy
  */
 
+#include <limits.h>
+
+#include "apr_hash.h"
+#include "apr_lib.h"
+
 #define ALLOCATE_THEME_CONSTANTS (1)
 #include "theme.h"
 #include "meta.h"
@@ -32,6 +37,10 @@
 #include "listing.h"
 
 #include "frictionless_data_package.h"
+#include "listing_cache.h"
+#include "checksum_queue.h"
+
+#include "util_script.h"
 
 
 static const char *S_FILE_PREFIX_S = "file:";
@@ -52,6 +61,48 @@ static const char *S_OWNER_CLASS_S = "owner";
 static const char *S_PROPERTIES_CLASS_S = "properties";
 static const char *S_CHECKSUM_CLASS_S = "checksum";
 
+/*
+ * A themed listing is sent on to the client whenever this many rows
+ * or bytes have been printed since it was last sent.
+ */
+static unsigned int s_listing_flush_rows = 256;
+static apr_off_t s_listing_flush_bytes = 65536;
+
+/*
+ * The number of entries on each page of a themed listing.
+ * If this is 0, the whole collection is listed unless the
+ * client asks for a page.
+ */
+static apr_size_t s_listing_page_size = 0;
+
+
+
+/*
+ * Everything that PrintListingNodes () needs, so that it can be
+ * called for each batch of a listing by PrintListingBatch ().
+ */
+typedef struct ListingBatchPrinter
+{
+	const davrods_dir_conf_t *lbp_conf_p;
+	const IRodsConfig *lbp_config_p;
+	int *lbp_row_index_p;
+	apr_bucket_brigade *lbp_bucket_brigade_p;
+	ap_filter_t *lbp_output_p;
+	unsigned int *lbp_num_pending_rows_p;
+	apr_pool_t *lbp_rows_pool_p;
+	ListingCapture *lbp_capture_p;
+	const char *lbp_checksum_username_s;
+	const char *lbp_checksum_password_s;
+	rcComm_t *lbp_connection_p;
+	request_rec *lbp_req_p;
+
+	/* The result of sending the rows on to the client */
+	apr_status_t lbp_flush_status;
+
+	/* The number of batches that have been printed */
+	apr_size_t lbp_num_batches;
+} ListingBatchPrinter;
+
 
 /************************************/
 
@@ -63,6 +114,10 @@ static apr_status_t PrintMetadataEditor (struct HtmlTheme *theme_p, request_rec
 
 static apr_status_t PrintSection (const char *value_s, char *current_id_s, rcComm_t *connection_p, request_rec *req_p, apr_bucket_brigade *bucket_brigade_p);
 
+static int IsWebSection (const char *value_s);
+
+static apr_status_t PrefetchWebSections (const struct HtmlTheme *theme_p, char *current_id_s, rcComm_t *connection_p, request_rec *req_p);
+
 static apr_status_t PrintBreadcrumbs (struct dav_resource_private *davrods_resource_p, const char * const user_s, davrods_dir_conf_t *conf_p, request_rec *req_p, apr_bucket_brigade *bucket_brigade_p, apr_pool_t *pool_p);
 
 
@@ -72,6 +127,28 @@ static apr_status_t PrintTableHeader (const char *heading_s, const char *default
 
 static int IsColumnDisplayed (const char *heading_s);
 
+static int IsResourceShown (const struct HtmlTheme *theme_p, const IRodsObject *irods_obj_p);
+
+static apr_status_t FlushListingRows (apr_bucket_brigade *bucket_brigade_p, ap_filter_t *output_p, unsigned int *num_pending_rows_p, apr_pool_t *rows_pool_p, ListingCapture *capture_p);
+
+static apr_status_t PrintListingNodes (const davrods_dir_conf_t *conf_p, IRodsObjectNode *node_p, const IRodsConfig *config_p, int *row_index_p, apr_bucket_brigade *bucket_brigade_p, ap_filter_t *output_p, unsigned int *num_pending_rows_p, apr_pool_t *rows_pool_p, ListingCapture *capture_p, const char *checksum_username_s, const char *checksum_password_s, rcComm_t *connection_p, request_rec *req_p);
+
+static apr_status_t PrintListingBatch (IRodsObjectNode *root_node_p, void *data_p);
+
+static unsigned int GetThemeHash (const struct HtmlTheme *theme_p, const char *zone_s, apr_pool_t *pool_p);
+
+static void QueueMissingChecksum (IRodsObject *irods_obj_p, const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s, apr_pool_t *pool_p);
+
+static apr_status_t PrintListingPageLinks (const ListingPage *page_p, request_rec *req_p, apr_bucket_brigade *bucket_brigade_p, apr_pool_t *pool_p);
+
+static char *GetOtherListingParameters (const char *args_s, apr_pool_t *pool_p);
+
+static char *GetListingPageLink (const ListingPage *page_p, const apr_size_t page_index, const char *other_params_s, apr_pool_t *pool_p);
+
+static ListingRowPlan *CompileListingRowPlan (const struct HtmlTheme *theme_p, apr_pool_t *pool_p);
+
+static const char *GetEscapedIconForRow (const ListingRowPlan *plan_p, const struct HtmlTheme *theme_p, const IRodsObject *irods_obj_p);
+
 
 /*************************************/
 
@@ -158,6 +235,9 @@ struct HtmlTheme *AllocateHtmlTheme (apr_pool_t *pool_p)
 
 			theme_p -> ht_fd_save_datapackages_flag = 0;
 
+			theme_p -> ht_fd_cache_dir_s = NULL;
+
+			theme_p -> ht_row_plan_p = NULL;
 		}
 
 	return theme_p;
@@ -177,13 +257,76 @@ dav_error *DeliverThemedDirectory (const dav_resource *resource_p, ap_filter_t *
 
 	const char * const user_s = davrods_resource_p -> rods_conn -> clientUser.userName;
 
-	char *current_id_s = GetCollectionId (davrods_resource_p -> rods_path, davrods_resource_p -> rods_conn, pool_p);
+	/* A single stat gets both the collection's id and its modify time for the listing cache */
+	rodsObjStat_t *stat_p = GetObjectStat (davrods_resource_p -> rods_path, davrods_resource_p -> rods_conn, pool_p);
+	char *current_id_s = NULL;
+	char *cache_key_s = NULL;
+	char *cached_listing_s = NULL;
+	apr_size_t cached_listing_length = 0;
+	ListingCapture *capture_p = NULL;
 	const char *escaped_zone_s = conf_p -> theme_p -> ht_zone_label_s ? conf_p -> theme_p -> ht_zone_label_s : ap_escape_html (pool_p, conf_p -> rods_zone);
 	const char *davrods_path_s = GetDavrodsAPIPath (davrods_resource_p, conf_p, req_p);
+	apr_table_t *params_p = NULL;
+	ListingPage listing_page;
+	int paged_flag;
 
 	// Make brigade.
 	apr_status_t apr_status = APR_EGENERAL;
 
+	ap_args_to_table (req_p, &params_p);
+	paged_flag = GetListingPageFromParameters (&listing_page, params_p, s_listing_page_size, pool_p) ? 1 : 0;
+
+	/*
+	 * Let the iCAT filter the replicas by resource and, unless the resource
+	 * column is shown, only send one row for each data object.
+	 */
+	listing_page.lp_resources_ss = theme_p -> ht_resources_ss;
+	listing_page.lp_collapse_replicas_flag = (theme_p -> ht_show_resource_flag <= 0);
+
+	if (stat_p)
+		{
+			current_id_s = (* (stat_p -> dataId) != '\0') ? apr_pstrdup (pool_p, stat_p -> dataId) : GetCollectionId (davrods_resource_p -> rods_path, davrods_resource_p -> rods_conn, pool_p);
+
+			if (IsListingCacheEnabled ())
+				{
+					const char *contents_modify_time_s = GetCollectionContentsModifyTime (davrods_resource_p -> rods_path, davrods_resource_p -> rods_conn, pool_p);
+
+					/* The request's uri doesn't include the query string so the page needs adding to the key */
+					const char *page_s = paged_flag ? apr_psprintf (pool_p, "%" APR_SIZE_T_FMT " %" APR_SIZE_T_FMT " %d %d", listing_page.lp_page_index, listing_page.lp_page_size, (int) listing_page.lp_sort_key, listing_page.lp_descending_flag ? 1 : 0) : NULL;
+
+					cache_key_s = GetListingCacheKey (davrods_resource_p -> rods_path, req_p -> uri, stat_p -> modifyTime, contents_modify_time_s, user_s, GetThemeHash (theme_p, conf_p -> rods_zone, pool_p), page_s, pool_p);
+
+					if (cache_key_s)
+						{
+							cached_listing_s = GetCachedListing (cache_key_s, &cached_listing_length, pool_p);
+
+							/*
+							 * A paged listing's rows are followed by a single character
+							 * saying whether there are further pages, since the links
+							 * after the rows depend upon it.
+							 */
+							if (cached_listing_s && paged_flag)
+								{
+									if (cached_listing_length > 0)
+										{
+											-- cached_listing_length;
+											listing_page.lp_has_more_flag = (cached_listing_s [cached_listing_length] == '1');
+										}
+									else
+										{
+											cached_listing_s = NULL;
+										}
+								}
+						}
+				}
+
+			freeRodsObjStat (stat_p);
+		}
+	else
+		{
+			current_id_s = GetCollectionId (davrods_resource_p -> rods_path, davrods_resource_p -> rods_conn, pool_p);
+		}
+
 	/*
 		The current id is only the minor the id so we need to add
 		the prefix. Since this is a collection we know it's "2."
@@ -196,8 +339,26 @@ dav_error *DeliverThemedDirectory (const dav_resource *resource_p, ap_filter_t *
 
 	memset (&collection_handle, 0, sizeof (collHandle_t));
 
-	// Open the collection
-	status = rclOpenCollection (davrods_resource_p -> rods_conn, davrods_resource_p -> rods_path, DATA_QUERY_FIRST_FG | LONG_METADATA_FG | NO_TRIM_REPL_FG, &collection_handle);
+	// Open the collection, unless we already have its rendered rows
+	if (cached_listing_s)
+		{
+			status = 0;
+		}
+	else
+		{
+			/*
+			 * Each replica only needs its own row if the resources are shown
+			 * or some of the replicas are going to be filtered out.
+			 */
+			int flags = DATA_QUERY_FIRST_FG | LONG_METADATA_FG;
+
+			if ((theme_p -> ht_show_resource_flag > 0) || (theme_p -> ht_resources_ss))
+				{
+					flags |= NO_TRIM_REPL_FG;
+				}
+
+			status = rclOpenCollection (davrods_resource_p -> rods_conn, davrods_resource_p -> rods_path, flags, &collection_handle);
+		}
 
 	if (status >= 0)
 		{
@@ -205,8 +366,20 @@ dav_error *DeliverThemedDirectory (const dav_resource *resource_p, ap_filter_t *
 			apr_bucket_brigade *bucket_brigade_p = apr_brigade_create (pool_p, output_p -> c -> bucket_alloc);
 			apr_status = PrintAllHTMLBeforeListing (davrods_resource_p, escaped_zone_s, NULL, davrods_path_s, NULL, current_id_s, user_s, conf_p, req_p, bucket_brigade_p, pool_p);
 
-
+			/* Send the top of the page straight away rather than waiting for the listing */
 			if (apr_status == APR_SUCCESS)
+				{
+					apr_status = ap_fflush (output_p, bucket_brigade_p);
+				}
+
+			if ((apr_status == APR_SUCCESS) && cached_listing_s)
+				{
+					/* Send the rows exactly as they were rendered last time */
+					apr_bucket *bucket_p = apr_bucket_pool_create (cached_listing_s, cached_listing_length, pool_p, output_p -> c -> bucket_alloc);
+
+					APR_BRIGADE_INSERT_TAIL (bucket_brigade_p, bucket_p);
+				}
+			else if (apr_status == APR_SUCCESS)
 				{
 					IRodsConfig irods_config;
 
@@ -214,11 +387,44 @@ dav_error *DeliverThemedDirectory (const dav_resource *resource_p, ap_filter_t *
 						{
 							int row_index = 0;
 							collEnt_t coll_entry;
+							int done_listing_flag = 0;
+							unsigned int num_pending_rows = 0;
+							apr_status_t flush_status = APR_SUCCESS;
+							const char *checksum_username_s = NULL;
+							const char *checksum_password_s = NULL;
+
+							/*
+							 * The memory for each row is only needed until it has been
+							 * sent, so it's taken from a pool that is cleared every time
+							 * the listing is flushed.
+							 */
+							apr_pool_t *rows_pool_p = NULL;
+
+							if (apr_pool_create (&rows_pool_p, pool_p) != APR_SUCCESS)
+								{
+									rows_pool_p = NULL;
+								}
+
+							/* Keep a copy of the rows as they are sent so that they can be cached */
+							capture_p = StartListingCapture (cache_key_s, pool_p);
+
+							/*
+							 * Any missing checksums are calculated in the background
+							 * as this user rather than holding up the listing.
+							 */
+							if (theme_p -> ht_show_checksums_flag > 0)
+								{
+									if (GetIRodsCredentialsForRequest (req_p, conf_p, &checksum_username_s, &checksum_password_s) != APR_SUCCESS)
+										{
+											checksum_username_s = NULL;
+											checksum_password_s = NULL;
+										}
+								}
 
 							/*
 							 * Add the datapackage.json entry to the listing?
 							 */
-							if (theme_p -> ht_show_fd_data_packages_flag > 0)
+							if ((theme_p -> ht_show_fd_data_packages_flag > 0) && ((!paged_flag) || (listing_page.lp_page_index == 0)))
 								{
 									/*
 									 * Don't add it if it already exists
@@ -258,7 +464,7 @@ dav_error *DeliverThemedDirectory (const dav_resource *resource_p, ap_filter_t *
 													status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"time\"></td>");
 												}
 
-											if (IsColumnDisplayed (theme_p -> ht_checksum_heading_s))
+											if ((theme_p -> ht_show_checksums_flag > 0) && IsColumnDisplayed (theme_p -> ht_checksum_heading_s))
 												{
 													status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<td class=\"checksum\"></td>");
 												}
@@ -274,148 +480,657 @@ dav_error *DeliverThemedDirectory (const dav_resource *resource_p, ap_filter_t *
 
 								}
 
-							memset (&coll_entry, 0, sizeof (collEnt_t));
-
-							// Actually print the directory listing, one table row at a time.
-							do
-								{
-									status = rclReadCollection (davrods_resource_p -> rods_conn, &collection_handle, &coll_entry);
+							/*
+							 * Has the client asked for a single sorted page of the listing?
+							 */
+							if (paged_flag)
+								{
+									IRodsObjectNode *root_node_p = NULL;
+									apr_status_t page_status = APR_EGENERAL;
+
+									/* Use the listing specific query, if there is one, so the AVUs come with the page */
+									if (conf_p -> eirods_dav_listing_specific_query_s)
+										{
+											page_status = GetCollectionListingPageUsingSpecificQuery (conf_p -> eirods_dav_listing_specific_query_s, davrods_resource_p -> rods_path, &listing_page, &root_node_p, davrods_resource_p -> rods_conn, pool_p);
+										}
+
+									if (page_status != APR_SUCCESS)
+										{
+											page_status = GetCollectionListingPage (davrods_resource_p -> rods_path, &listing_page, &root_node_p, davrods_resource_p -> rods_conn, pool_p);
+										}
+
+									if (page_status == APR_SUCCESS)
+										{
+											flush_status = PrintListingNodes (conf_p, root_node_p, &irods_config, &row_index, bucket_brigade_p, output_p, &num_pending_rows, rows_pool_p, capture_p, checksum_username_s, checksum_password_s, davrods_resource_p -> rods_conn, req_p);
+
+											if (root_node_p)
+												{
+													FreeIRodsObjectNodeList (root_node_p);
+												}
+
+											done_listing_flag = 1;
+										}
+									else
+										{
+											/* The whole listing is sent instead, which mustn't be cached as this page */
+											FinishListingCapture (capture_p, false, pool_p);
+											capture_p = NULL;
+
+											paged_flag = 0;
+										}
+								}		/* if (paged_flag) */
+
+							/*
+							 * Can we get the listing and all of the AVUs in one go?
+							 */
+							if ((!done_listing_flag) && (conf_p -> eirods_dav_listing_specific_query_s))
+								{
+									IRodsObjectNode *root_node_p = NULL;
+
+									if (GetCollectionListingUsingSpecificQuery (conf_p -> eirods_dav_listing_specific_query_s, davrods_resource_p -> rods_path, &root_node_p, davrods_resource_p -> rods_conn, pool_p) == APR_SUCCESS)
+										{
+											flush_status = PrintListingNodes (conf_p, root_node_p, &irods_config, &row_index, bucket_brigade_p, output_p, &num_pending_rows, rows_pool_p, capture_p, checksum_username_s, checksum_password_s, davrods_resource_p -> rods_conn, req_p);
+
+											if (root_node_p)
+												{
+													FreeIRodsObjectNodeList (root_node_p);
+												}
+
+											done_listing_flag = 1;
+										}
+								}		/* if ((!done_listing_flag) && (conf_p -> eirods_dav_listing_specific_query_s)) */
+
+							/*
+							 * If only the replicas on particular resources are shown, get the
+							 * listing a page at a time from the iCAT so that the replicas on
+							 * the other resources are never read at all.
+							 */
+							if ((!done_listing_flag) && (theme_p -> ht_resources_ss))
+								{
+									ListingPage filtered_page = listing_page;
+									ListingBatchPrinter printer;
+									apr_status_t list_status;
+
+									filtered_page.lp_sort_key = LSK_NAME;
+									filtered_page.lp_descending_flag = false;
+
+									printer.lbp_conf_p = conf_p;
+									printer.lbp_config_p = &irods_config;
+									printer.lbp_row_index_p = &row_index;
+									printer.lbp_bucket_brigade_p = bucket_brigade_p;
+									printer.lbp_output_p = output_p;
+									printer.lbp_num_pending_rows_p = &num_pending_rows;
+									printer.lbp_rows_pool_p = rows_pool_p;
+									printer.lbp_capture_p = capture_p;
+									printer.lbp_checksum_username_s = checksum_username_s;
+									printer.lbp_checksum_password_s = checksum_password_s;
+									printer.lbp_connection_p = davrods_resource_p -> rods_conn;
+									printer.lbp_req_p = req_p;
+									printer.lbp_flush_status = APR_SUCCESS;
+									printer.lbp_num_batches = 0;
+
+									list_status = ForEachCollectionListingBatch (davrods_resource_p -> rods_path, &filtered_page, PrintListingBatch, &printer, davrods_resource_p -> rods_conn, pool_p);
+									flush_status = printer.lbp_flush_status;
+
+									if ((list_status == APR_SUCCESS) || (flush_status != APR_SUCCESS))
+										{
+											done_listing_flag = 1;
+										}
+									else if (printer.lbp_num_batches > 0)
+										{
+											/* Some of the rows have already been sent, so we can't start again */
+											ap_log_rerror (APLOG_MARK, APLOG_ERR, list_status, req_p, "Failed to get the rest of the filtered listing of \"%s\"", davrods_resource_p -> rods_path);
+
+											res_p = dav_new_error (pool_p, HTTP_INTERNAL_SERVER_ERROR, 0, list_status, "Could not read the rest of the collection from the iCAT.");
+											done_listing_flag = 1;
+										}
+									else
+										{
+											/* Nothing has been printed yet so read the whole collection instead */
+											ap_log_rerror (APLOG_MARK, APLOG_WARNING, list_status, req_p, "Failed to get the filtered listing of \"%s\" from the iCAT, reading the whole collection instead", davrods_resource_p -> rods_path);
+										}
+								}		/* if ((!done_listing_flag) && (theme_p -> ht_resources_ss)) */
+
+							if (!done_listing_flag)
+								{
+									memset (&coll_entry, 0, sizeof (collEnt_t));
+
+									// Actually print the directory listing, one table row at a time.
+									do
+										{
+											status = rclReadCollection (davrods_resource_p -> rods_conn, &collection_handle, &coll_entry);
+
+											if (status >= 0)
+												{
+													IRodsObject irods_obj;
+
+													apr_pool_t *row_pool_p = rows_pool_p ? rows_pool_p : pool_p;
+
+													apr_status = SetIRodsObjectFromCollEntry (&irods_obj, &coll_entry, davrods_resource_p -> rods_conn, row_pool_p);
+
+													if (apr_status == APR_SUCCESS)
+														{
+															if (IsResourceShown (theme_p, &irods_obj))
+																{
+																	if (checksum_username_s)
+																		{
+																			QueueMissingChecksum (&irods_obj, conf_p, checksum_username_s, checksum_password_s, row_pool_p);
+																		}
+
+																	apr_status = PrintItem (conf_p -> theme_p, &irods_obj, &irods_config, row_index, bucket_brigade_p, row_pool_p, resource_p -> info -> rods_conn, req_p);
+																	++ row_index;
+
+																	flush_status = FlushListingRows (bucket_brigade_p, output_p, &num_pending_rows, rows_pool_p, capture_p);
+																}
+
+															if (apr_status != APR_SUCCESS)
+																{
+																	const char *collection_s = coll_entry.collName ? coll_entry.collName : "";
+																	const char *data_object_s = coll_entry.dataName ? coll_entry.dataName : "";
+
+																	ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "Failed to PrintItem for \"%s\":\"%s\"", collection_s, data_object_s);
+																}
+														}
+													else
+														{
+															const char *collection_s = coll_entry.collName ? coll_entry.collName : "";
+															const char *data_object_s = coll_entry.dataName ? coll_entry.dataName : "";
+
+															ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "Failed to SetIRodsObjectFromCollEntry for \"%s\":\"%s\"", collection_s, data_object_s);
+														}
+
+												}		/* if (status >= 0) */
+											else
+												{
+													if (status == CAT_NO_ROWS_FOUND)
+														{
+															// End of collection.
+														}
+													else
+														{
+															ap_log_rerror(APLOG_MARK, APLOG_ERR, APR_SUCCESS,
+																						req_p,
+																						"rcReadCollection failed for collection <%s> with error <%s>",
+																						davrods_resource_p->rods_path, get_rods_error_msg(status));
+
+															res_p = dav_new_error(pool_p, HTTP_INTERNAL_SERVER_ERROR,
+																									 0, 0, "Could not read a collection entry from a collection.");
+														}
+												}
+										}
+									while ((status >= 0) && (flush_status == APR_SUCCESS));
+								}		/* if (!done_listing_flag) */
+
+							if (flush_status != APR_SUCCESS)
+								{
+									ap_log_rerror (APLOG_MARK, APLOG_INFO, flush_status, req_p, "Stopped listing \"%s\" as it could not be sent to the client", davrods_resource_p -> rods_path);
+								}
+
+							/* Add the rows that haven't been sent yet */
+							CaptureListingRows (capture_p, bucket_brigade_p);
+
+							if (paged_flag)
+								{
+									CaptureListingData (capture_p, listing_page.lp_has_more_flag ? "1" : "0", 1);
+								}
+
+							FinishListingCapture (capture_p, (res_p == NULL) && (flush_status == APR_SUCCESS), pool_p);
+
+							if (rows_pool_p)
+								{
+									apr_pool_destroy (rows_pool_p);
+								}
+
+						}		/* if (InitIRodsConfig (&irods_config, davrods_resource_p) == APR_SUCCESS) */
+					else
+						{
+							ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "InitIRodsConfig failed");
+						}
+
+				}		/* if (apr_status == APR_SUCCESS) */
+			else
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "PrintAllHTMLBeforeListing failed");
+				}
+
+			apr_status = PrintAllHTMLAfterListing (user_s, escaped_zone_s, davrods_path_s, conf_p, current_id_s, paged_flag ? &listing_page : NULL, davrods_resource_p -> rods_conn, req_p, bucket_brigade_p, pool_p);
+			if (apr_status != APR_SUCCESS)
+				{
+					ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "PrintAllHTMLAfterListing failed");
+				}
+
+			CloseBucketsStream (bucket_brigade_p);
+
+			if ((status = ap_pass_brigade (output_p, bucket_brigade_p)) != APR_SUCCESS)
+				{
+					res_p = dav_new_error(pool_p, HTTP_INTERNAL_SERVER_ERROR, 0, status,
+															 "Could not write content to filter.");
+				}
+
+			apr_brigade_destroy(bucket_brigade_p);
+
+			if (!cached_listing_s)
+				{
+					rclCloseCollection (&collection_handle);
+				}
+		}		/* if (collection_handle >= 0) */
+	else
+		{
+			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, req_p, "rcOpenCollection failed: %d = %s", status, get_rods_error_msg (status));
+
+			res_p = dav_new_error (pool_p, HTTP_INTERNAL_SERVER_ERROR, 0, status, "Could not open a collection");
+		}
+
+	return res_p;
+}
+
+
+/*
+ * Count a printed row and send the listing so far on to the client if
+ * enough rows or bytes have built up since it was last sent.
+ */
+static apr_status_t FlushListingRows (apr_bucket_brigade *bucket_brigade_p, ap_filter_t *output_p, unsigned int *num_pending_rows_p, apr_pool_t *rows_pool_p, ListingCapture *capture_p)
+{
+	apr_status_t status = APR_SUCCESS;
+	int flush_flag = 0;
+
+	++ (*num_pending_rows_p);
+
+	if (*num_pending_rows_p >= s_listing_flush_rows)
+		{
+			flush_flag = 1;
+		}
+	else
+		{
+			apr_off_t length = 0;
+
+			/* Only count the buckets whose lengths are already known */
+			if ((apr_brigade_length (bucket_brigade_p, 0, &length) == APR_SUCCESS) && (length >= s_listing_flush_bytes))
+				{
+					flush_flag = 1;
+				}
+		}
+
+	if (flush_flag)
+		{
+			CaptureListingRows (capture_p, bucket_brigade_p);
+
+			status = ap_fflush (output_p, bucket_brigade_p);
+
+			*num_pending_rows_p = 0;
+
+			if (rows_pool_p)
+				{
+					apr_pool_clear (rows_pool_p);
+				}
+		}
+
+	return status;
+}
+
+
+/*
+ * Print the entries from a list got from a single query, sending
+ * them on to the client as the listing builds up.
+ */
+static apr_status_t PrintListingNodes (const davrods_dir_conf_t *conf_p, IRodsObjectNode *node_p, const IRodsConfig *config_p, int *row_index_p, apr_bucket_brigade *bucket_brigade_p, ap_filter_t *output_p, unsigned int *num_pending_rows_p, apr_pool_t *rows_pool_p, ListingCapture *capture_p, const char *checksum_username_s, const char *checksum_password_s, rcComm_t *connection_p, request_rec *req_p)
+{
+	apr_status_t flush_status = APR_SUCCESS;
+	struct HtmlTheme *theme_p = conf_p -> theme_p;
+
+	while (node_p && (flush_status == APR_SUCCESS))
+		{
+			if (IsResourceShown (theme_p, node_p -> ion_object_p))
+				{
+					apr_status_t apr_status;
+
+					if (checksum_username_s)
+						{
+							QueueMissingChecksum (node_p -> ion_object_p, conf_p, checksum_username_s, checksum_password_s, rows_pool_p ? rows_pool_p : req_p -> pool);
+						}
+
+					apr_status = PrintItem (theme_p, node_p -> ion_object_p, config_p, *row_index_p, bucket_brigade_p, rows_pool_p ? rows_pool_p : req_p -> pool, connection_p, req_p);
+					++ (*row_index_p);
+
+					if (apr_status != APR_SUCCESS)
+						{
+							ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "Failed to PrintItem for \"%s\":\"%s\"", node_p -> ion_object_p -> io_collection_s, node_p -> ion_object_p -> io_data_s ? node_p -> ion_object_p -> io_data_s : "");
+						}
+
+					flush_status = FlushListingRows (bucket_brigade_p, output_p, num_pending_rows_p, rows_pool_p, capture_p);
+				}
+
+			node_p = node_p -> ion_next_p;
+		}
+
+	return flush_status;
+}
+
+
+static apr_status_t PrintListingBatch (IRodsObjectNode *root_node_p, void *data_p)
+{
+	ListingBatchPrinter *printer_p = (ListingBatchPrinter *) data_p;
+
+	printer_p -> lbp_flush_status = PrintListingNodes (printer_p -> lbp_conf_p, root_node_p, printer_p -> lbp_config_p, printer_p -> lbp_row_index_p, printer_p -> lbp_bucket_brigade_p, printer_p -> lbp_output_p,
+		printer_p -> lbp_num_pending_rows_p, printer_p -> lbp_rows_pool_p, printer_p -> lbp_capture_p, printer_p -> lbp_checksum_username_s, printer_p -> lbp_checksum_password_s, printer_p -> lbp_connection_p, printer_p -> lbp_req_p);
+	++ (printer_p -> lbp_num_batches);
+
+	return printer_p -> lbp_flush_status;
+}
+
+
+/*
+ * Rather than have the server read the whole of a data object that
+ * has no checksum whilst the listing waits, ask for its checksum to be
+ * calculated in the background. It is shown as pending until then, or
+ * as missing if it couldn't be queued.
+ */
+static void QueueMissingChecksum (IRodsObject *irods_obj_p, const davrods_dir_conf_t *conf_p, const char *username_s, const char *password_s, apr_pool_t *pool_p)
+{
+	if ((irods_obj_p -> io_obj_type == DATA_OBJ_T) && (irods_obj_p -> io_collection_s) && (irods_obj_p -> io_data_s))
+		{
+			if ((! (irods_obj_p -> io_checksum_s)) || (* (irods_obj_p -> io_checksum_s) == '\0'))
+				{
+					char *path_s = apr_pstrcat (pool_p, irods_obj_p -> io_collection_s, "/", irods_obj_p -> io_data_s, NULL);
+
+					if (path_s)
+						{
+							irods_obj_p -> io_checksum_pending_flag = QueueChecksum (path_s, conf_p, username_s, password_s);
+						}
+				}
+		}
+}
+
+
+/*
+ * Get a hash of all of the theme settings that change how the
+ * rows of a listing are rendered, for use in the listing cache keys.
+ */
+static unsigned int GetThemeHash (const struct HtmlTheme *theme_p, const char *zone_s, apr_pool_t *pool_p)
+{
+	const char * const values_ss [] =
+		{
+			theme_p -> ht_collection_icon_s,
+			theme_p -> ht_object_icon_s,
+			theme_p -> ht_listing_class_s,
+			theme_p -> ht_add_metadata_icon_s,
+			theme_p -> ht_edit_metadata_icon_s,
+			theme_p -> ht_delete_metadata_icon_s,
+			theme_p -> ht_download_metadata_icon_s,
+			theme_p -> ht_download_metadata_as_csv_icon_s,
+			theme_p -> ht_download_metadata_as_json_icon_s,
+			theme_p -> ht_view_metadata_icon_s,
+			theme_p -> ht_rest_api_s,
+			theme_p -> ht_name_heading_s,
+			theme_p -> ht_size_heading_s,
+			theme_p -> ht_owner_heading_s,
+			theme_p -> ht_date_heading_s,
+			theme_p -> ht_properties_heading_s,
+			theme_p -> ht_checksum_heading_s,
+			theme_p -> ht_fd_resource_data_package_icon_s,
+			zone_s
+		};
+	const size_t num_values = sizeof (values_ss) / sizeof (values_ss [0]);
+	char *settings_s = apr_psprintf (pool_p, "%d|%d|%d|%d|%d|%d|%d", theme_p -> ht_show_metadata_flag, theme_p -> ht_metadata_editable_flag, theme_p -> ht_show_download_metadata_links_flag,
+		theme_p -> ht_show_resource_flag, theme_p -> ht_show_ids_flag, theme_p -> ht_show_checksums_flag, theme_p -> ht_show_fd_data_packages_flag);
+	apr_ssize_t length;
+	size_t i;
+
+	for (i = 0; i < num_values; ++ i)
+		{
+			settings_s = apr_pstrcat (pool_p, settings_s, "|", values_ss [i] ? values_ss [i] : "", NULL);
+		}
+
+	if (theme_p -> ht_resources_ss)
+		{
+			char **resource_ss;
+
+			for (resource_ss = theme_p -> ht_resources_ss; *resource_ss; ++ resource_ss)
+				{
+					settings_s = apr_pstrcat (pool_p, settings_s, "|r:", *resource_ss, NULL);
+				}
+		}
+
+	if (theme_p -> ht_icons_map_p)
+		{
+			const apr_array_header_t *icons_p = apr_table_elts (theme_p -> ht_icons_map_p);
+			const apr_table_entry_t *entry_p = (const apr_table_entry_t *) (icons_p -> elts);
+			int j;
+
+			for (j = 0; j < icons_p -> nelts; ++ j, ++ entry_p)
+				{
+					settings_s = apr_pstrcat (pool_p, settings_s, "|i:", entry_p -> key, "=", entry_p -> val, NULL);
+				}
+		}
+
+	length = APR_HASH_KEY_STRING;
+
+	return apr_hashfunc_default (settings_s, &length);
+}
+
+
+static apr_status_t PrintListingPageLinks (const ListingPage *page_p, request_rec *req_p, apr_bucket_brigade *bucket_brigade_p, apr_pool_t *pool_p)
+{
+	/* Keep any other parameters, such as the resource filter, on the links */
+	const char *other_params_s = GetOtherListingParameters (req_p -> args, pool_p);
+	apr_status_t status = apr_brigade_puts (bucket_brigade_p, NULL, NULL, "<nav class=\"listing_pages\">\n");
+
+	if ((status == APR_SUCCESS) && (page_p -> lp_page_index > 0))
+		{
+			status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<a class=\"previous_page\" href=\"%s\">Previous</a>\n", GetListingPageLink (page_p, page_p -> lp_page_index - 1, other_params_s, pool_p));
+		}
+
+	if (status == APR_SUCCESS)
+		{
+			status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<span class=\"current_page\">Page %" APR_SIZE_T_FMT "</span>\n", page_p -> lp_page_index + 1);
+		}
+
+	if ((status == APR_SUCCESS) && (page_p -> lp_has_more_flag))
+		{
+			status = apr_brigade_printf (bucket_brigade_p, NULL, NULL, "<a class=\"next_page\" href=\"%s\">Next</a>\n", GetListingPageLink (page_p, page_p -> lp_page_index + 1, other_params_s, pool_p));
+		}
+
+	if (status == APR_SUCCESS)
+		{
+			status = apr_brigade_puts (bucket_brigade_p, NULL, NULL, "</nav>\n");
+		}
+
+	return status;
+}
+
+
+/*
+ * Get the parameters of the query string other than the ones that
+ * GetListingPageLink() sets, still url-encoded and each starting with "&".
+ */
+static char *GetOtherListingParameters (const char *args_s, apr_pool_t *pool_p)
+{
+	char *other_params_s = "";
+
+	if (args_s)
+		{
+			const char * const paging_params_ss [] = { "page", "page_size", "sort", "order", NULL };
+			char *copied_args_s = apr_pstrdup (pool_p, args_s);
+			char *param_s = apr_strtok (copied_args_s, "&", &copied_args_s);
+
+			while (param_s)
+				{
+					const char * const *paging_param_ss = paging_params_ss;
+					const size_t name_length = strcspn (param_s, "=");
+					int paging_flag = 0;
+
+					while ((*paging_param_ss) && (!paging_flag))
+						{
+							if ((strlen (*paging_param_ss) == name_length) && (strncmp (param_s, *paging_param_ss, name_length) == 0))
+								{
+									paging_flag = 1;
+								}
+							else
+								{
+									++ paging_param_ss;
+								}
+						}
+
+					if ((!paging_flag) && (name_length > 0))
+						{
+							other_params_s = apr_pstrcat (pool_p, other_params_s, "&", param_s, NULL);
+						}
 
-									if (status >= 0)
-										{
-											IRodsObject irods_obj;
+					param_s = apr_strtok (NULL, "&", &copied_args_s);
+				}
+		}
 
-											if ((coll_entry.objType == DATA_OBJ_T) && (theme_p -> ht_show_checksums_flag > 0))
-												{
-													size_t l = coll_entry.chksum ? strlen (coll_entry.chksum) : 0;
+	return other_params_s;
+}
 
-													if (l == 0)
-														{
-															GetChecksum (&coll_entry, davrods_resource_p -> rods_conn, pool_p);
-														}
-												}		/* if ((coll_entry_p -> objType = DATA_OBJ_T) && (theme_p -> ht_show_checksums_flag)) */
 
+static char *GetListingPageLink (const ListingPage *page_p, const apr_size_t page_index, const char *other_params_s, apr_pool_t *pool_p)
+{
+	char *link_s = apr_psprintf (pool_p, "?page=%" APR_SIZE_T_FMT "&page_size=%" APR_SIZE_T_FMT "&sort=%s&order=%s%s",
+		page_index + 1, page_p -> lp_page_size, GetListingSortKeyAsString (page_p -> lp_sort_key), page_p -> lp_descending_flag ? "desc" : "asc", other_params_s);
 
-											apr_status = SetIRodsObjectFromCollEntry (&irods_obj, &coll_entry, davrods_resource_p -> rods_conn, pool_p);
+	return ap_escape_html (pool_p, link_s);
+}
 
-											if (apr_status == APR_SUCCESS)
-												{
-													int show_item_flag = 1;
 
-													if (irods_obj.io_obj_type == DATA_OBJ_T)
-														{
-															if (theme_p -> ht_resources_ss)
-																{
-																	char **resources_ss = theme_p -> ht_resources_ss;
-																	int loop_flag = 1;
+static ListingRowPlan *CompileListingRowPlan (const struct HtmlTheme *theme_p, apr_pool_t *pool_p)
+{
+	ListingRowPlan *plan_p = (ListingRowPlan *) apr_pcalloc (pool_p, sizeof (ListingRowPlan));
 
-																	show_item_flag = 0;
+	if (plan_p)
+		{
+			plan_p -> lrp_show_name_flag = IsColumnDisplayed (theme_p -> ht_name_heading_s);
+			plan_p -> lrp_show_size_flag = IsColumnDisplayed (theme_p -> ht_size_heading_s);
+			plan_p -> lrp_show_owner_flag = IsColumnDisplayed (theme_p -> ht_owner_heading_s);
+			plan_p -> lrp_show_date_flag = IsColumnDisplayed (theme_p -> ht_date_heading_s);
+			/* The table header only has a checksum column if they are shown */
+			plan_p -> lrp_show_checksum_flag = (theme_p -> ht_show_checksums_flag > 0) ? IsColumnDisplayed (theme_p -> ht_checksum_heading_s) : 0;
 
-																	while (loop_flag)
-																		{
-																			if (strcmp (irods_obj.io_resource_s, *resources_ss) == 0)
-																				{
-																					show_item_flag = 1;
-																					loop_flag = 0;
-																				}
-																			else
-																				{
-																					++ resources_ss;
-																					loop_flag = (*resources_ss != NULL) ? 1 : 0;
-																				}
-																		}
-																}
+			if (theme_p -> ht_collection_icon_s)
+				{
+					plan_p -> lrp_escaped_collection_icon_s = ap_escape_html (pool_p, theme_p -> ht_collection_icon_s);
+				}
 
-														}
+			if (theme_p -> ht_object_icon_s)
+				{
+					plan_p -> lrp_escaped_object_icon_s = ap_escape_html (pool_p, theme_p -> ht_object_icon_s);
+				}
 
-													if (show_item_flag)
-														{
-															apr_status = PrintItem (conf_p -> theme_p, &irods_obj, &irods_config, row_index, bucket_brigade_p, pool_p, resource_p -> info -> rods_conn, req_p);
-															++ row_index;
-														}
+			if (theme_p -> ht_fd_resource_data_package_icon_s)
+				{
+					plan_p -> lrp_escaped_data_package_icon_s = ap_escape_html (pool_p, theme_p -> ht_fd_resource_data_package_icon_s);
+				}
 
-													if (apr_status != APR_SUCCESS)
-														{
-															const char *collection_s = coll_entry.collName ? coll_entry.collName : "";
-															const char *data_object_s = coll_entry.dataName ? coll_entry.dataName : "";
+			if (theme_p -> ht_icons_map_p)
+				{
+					const apr_array_header_t *icons_p = apr_table_elts (theme_p -> ht_icons_map_p);
 
-															ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "Failed to PrintItem for \"%s\":\"%s\"", collection_s, data_object_s);
-														}
-												}
-											else
-												{
-													const char *collection_s = coll_entry.collName ? coll_entry.collName : "";
-													const char *data_object_s = coll_entry.dataName ? coll_entry.dataName : "";
+					if (icons_p -> nelts > 0)
+						{
+							plan_p -> lrp_icons_p = apr_hash_make (pool_p);
 
-													ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "Failed to SetIRodsObjectFromCollEntry for \"%s\":\"%s\"", collection_s, data_object_s);
-												}
+							if (plan_p -> lrp_icons_p)
+								{
+									const apr_table_entry_t *entry_p = (const apr_table_entry_t *) (icons_p -> elts);
+									int i;
 
-										}		/* if (status >= 0) */
-									else
+									for (i = 0; i < icons_p -> nelts; ++ i, ++ entry_p)
 										{
-											if (status == CAT_NO_ROWS_FOUND)
-												{
-													// End of collection.
-												}
-											else
-												{
-													ap_log_rerror(APLOG_MARK, APLOG_ERR, APR_SUCCESS,
-																				req_p,
-																				"rcReadCollection failed for collection <%s> with error <%s>",
-																				davrods_resource_p->rods_path, get_rods_error_msg(status));
+											/*
+											 * apr_table_get () ignores case and uses the first
+											 * matching entry, so do the same here.
+											 */
+											char *key_s = apr_pstrdup (pool_p, entry_p -> key);
 
-													apr_brigade_destroy(bucket_brigade_p);
+											ap_str_tolower (key_s);
 
-													res_p = dav_new_error(pool_p, HTTP_INTERNAL_SERVER_ERROR,
-																							 0, 0, "Could not read a collection entry from a collection.");
+											if (!apr_hash_get (plan_p -> lrp_icons_p, key_s, APR_HASH_KEY_STRING))
+												{
+													apr_hash_set (plan_p -> lrp_icons_p, key_s, APR_HASH_KEY_STRING, ap_escape_html (pool_p, entry_p -> val));
 												}
 										}
 								}
-							while (status >= 0);
-
-						}		/* if (InitIRodsConfig (&irods_config, davrods_resource_p) == APR_SUCCESS) */
-					else
-						{
-							ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "InitIRodsConfig failed");
 						}
-
-				}		/* if (apr_status == APR_SUCCESS) */
-			else
-				{
-					ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "PrintAllHTMLBeforeListing failed");
 				}
+		}
 
-			apr_status = PrintAllHTMLAfterListing (user_s, escaped_zone_s, davrods_path_s, conf_p, current_id_s, davrods_resource_p -> rods_conn, req_p, bucket_brigade_p, pool_p);
-			if (apr_status != APR_SUCCESS)
+	return plan_p;
+}
+
+
+static const char *GetEscapedIconForRow (const ListingRowPlan *plan_p, const struct HtmlTheme *theme_p, const IRodsObject *irods_obj_p)
+{
+	const char *icon_s = NULL;
+
+	if ((theme_p -> ht_show_fd_data_packages_flag > 0) && (irods_obj_p -> io_obj_type == DATA_OBJ_T))
+		{
+			if (strcmp (irods_obj_p -> io_data_s, GetDataPackageFilename ()) == 0)
 				{
-					ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "PrintAllHTMLAfterListing failed");
+					icon_s = plan_p -> lrp_escaped_data_package_icon_s;
 				}
+		}
 
-			CloseBucketsStream (bucket_brigade_p);
+	if ((!icon_s) && (plan_p -> lrp_icons_p))
+		{
+			const char *key_s = NULL;
 
-			if ((status = ap_pass_brigade (output_p, bucket_brigade_p)) != APR_SUCCESS)
+			switch (irods_obj_p -> io_obj_type)
 				{
-					apr_brigade_destroy (bucket_brigade_p);
-					res_p = dav_new_error(pool_p, HTTP_INTERNAL_SERVER_ERROR, 0, status,
-															 "Could not write content to filter.");
+					case DATA_OBJ_T:
+						key_s = strrchr (irods_obj_p -> io_data_s, '.');
+						break;
+
+					case COLL_OBJ_T:
+						key_s = get_basename (irods_obj_p -> io_collection_s);
+						break;
+
+					default:
+						break;
 				}
 
-			apr_brigade_destroy(bucket_brigade_p);
+			if (key_s)
+				{
+					char buffer_s [256];
+					size_t l = strlen (key_s);
 
-			rclCloseCollection (&collection_handle);
-		}		/* if (collection_handle >= 0) */
-	else
+					if (l < sizeof (buffer_s))
+						{
+							size_t i;
+
+							for (i = 0; i < l; ++ i)
+								{
+									buffer_s [i] = apr_tolower (key_s [i]);
+								}
+
+							buffer_s [l] = '\0';
+
+							icon_s = (const char *) apr_hash_get (plan_p -> lrp_icons_p, buffer_s, l);
+						}
+				}
+		}
+
+	if (!icon_s)
 		{
-			ap_log_rerror (APLOG_MARK, APLOG_ERR, APR_SUCCESS, req_p, "rcOpenCollection failed: %d = %s", status, get_rods_error_msg (status));
+			switch (irods_obj_p -> io_obj_type)
+				{
+					case DATA_OBJ_T:
+						icon_s = plan_p -> lrp_escaped_object_icon_s;
+						break;
 
-			res_p = dav_new_error (pool_p, HTTP_INTERNAL_SERVER_ERROR, 0, status, "Could not open a collection");
+					case COLL_OBJ_T:
+						icon_s = plan_p -> lrp_escaped_collection_icon_s;
+						break;
+
+					default:
+						break;
+				}
 		}
 
-	return res_p;
+	return icon_s;
 }
 
 
-apr_status_t PrintAllHTMLAfterListing (const char *user_s, const char *escaped_zone_s, const char *davrods_path_s, const davrods_dir_conf_t *conf_p, char *current_id_s, rcComm_t *connection_p, request_rec *req_p, apr_bucket_brigade *bucket_brigade_p, apr_pool_t *pool_p)
+apr_status_t PrintAllHTMLAfterListing (const char *user_s, const char *escaped_zone_s, const char *davrods_path_s, const davrods_dir_conf_t *conf_p, char *current_id_s, const ListingPage *page_p, rcComm_t *connection_p, request_rec *req_p, apr_bucket_brigade *bucket_brigade_p, apr_pool_t *pool_p)
 {
 	const char * const table_end_s = "</tbody>\n</table>\n";
 	struct HtmlTheme *theme_p = conf_p -> theme_p;
@@ -424,6 +1139,15 @@ apr_status_t PrintAllHTMLAfterListing (const char *user_s, const char *escaped_z
 
 	if (apr_status == APR_SUCCESS)
 		{
+			if (page_p)
+				{
+					if ((apr_status = PrintListingPageLinks (page_p, req_p, bucket_brigade_p, pool_p)) != APR_SUCCESS)
+						{
+							ap_log_rerror (APLOG_MARK, APLOG_ERR, apr_status, req_p, "PrintListingPageLinks failed");
+							return apr_status;
+						}
+				}
+
 			if (theme_p -> ht_post_table_html_s)
 				{
 					if ((apr_status = PrintSection (theme_p -> ht_post_table_html_s, current_id_s, connection_p, req_p, bucket_brigade_p)) != APR_SUCCESS)
@@ -588,7 +1312,7 @@ static apr_status_t PrintSection (const char *value_s, char *current_id_s, rcCom
 				{
 					status = PrintFileToBucketBrigade (value_s + l, bucket_brigade_p, req_p, __FILE__, __LINE__);
 				}
-			else if ((strncmp (S_HTTP_PREFIX_S, value_s, l) == 0) || (strncmp (S_HTTPS_PREFIX_S, value_s, l) == 0))
+			else if (IsWebSection (value_s))
 				{
 					status = PrintWebResponseToBucketBrigade (value_s, current_id_s, bucket_brigade_p, connection_p, req_p, __FILE__, __LINE__);
 				}
@@ -602,6 +1326,47 @@ static apr_status_t PrintSection (const char *value_s, char *current_id_s, rcCom
 }
 
 
+static int IsWebSection (const char *value_s)
+{
+	return ((strncmp (S_HTTP_PREFIX_S, value_s, strlen (S_HTTP_PREFIX_S)) == 0) || (strncmp (S_HTTPS_PREFIX_S, value_s, strlen (S_HTTPS_PREFIX_S)) == 0));
+}
+
+
+static apr_status_t PrefetchWebSections (const struct HtmlTheme *theme_p, char *current_id_s, rcComm_t *connection_p, request_rec *req_p)
+{
+	apr_status_t status = APR_SUCCESS;
+	const char *sections_ss [] =
+		{
+			theme_p -> ht_head_s,
+			theme_p -> ht_top_s,
+			theme_p -> ht_pre_table_html_s,
+			theme_p -> ht_post_table_html_s,
+			theme_p -> ht_bottom_s,
+			theme_p -> ht_pre_close_body_html_s
+		};
+	const size_t num_sections = sizeof (sections_ss) / sizeof (sections_ss [0]);
+	const char *uris_ss [sizeof (sections_ss) / sizeof (sections_ss [0])];
+	size_t num_uris = 0;
+	size_t i;
+
+	for (i = 0; i < num_sections; ++ i)
+		{
+			if ((sections_ss [i]) && (IsWebSection (sections_ss [i])))
+				{
+					uris_ss [num_uris] = sections_ss [i];
+					++ num_uris;
+				}
+		}
+
+	if (num_uris > 0)
+		{
+			status = FetchWebSections (uris_ss, num_uris, current_id_s, connection_p, req_p);
+		}
+
+	return status;
+}
+
+
 char *GetDavrodsAPIPath (struct dav_resource_private *davrods_resource_p, davrods_dir_conf_t *conf_p, request_rec *req_p)
 {
 	char *full_path_s = NULL;
@@ -692,6 +1457,12 @@ apr_status_t PrintAllHTMLBeforeListing (struct dav_resource_private *davrods_res
 			connection_p  = GetIRODSConnectionFromPool (davrods_pool_p);
 		}
 
+	/*
+	 * Get any http(s) sections for the whole page now so that
+	 * those which aren't cached are downloaded together.
+	 */
+	PrefetchWebSections (theme_p, current_id_s, connection_p, req_p);
+
 
 	if (davrods_resource_p)
 		{
@@ -919,6 +1690,27 @@ static int IsColumnDisplayed (const char *heading_s)
 }
 
 
+/*
+ * If the theme only shows the replicas on particular resources,
+ * check whether the given object is on one of them.
+ *
+ * Data objects without a resource have come from a query that was
+ * restricted to the theme's resources and had their replicas collapsed
+ * into a single row, so they are always shown.
+ */
+static int IsResourceShown (const struct HtmlTheme *theme_p, const IRodsObject *irods_obj_p)
+{
+	int show_item_flag = 1;
+
+	if ((irods_obj_p -> io_obj_type == DATA_OBJ_T) && (theme_p -> ht_resources_ss) && (irods_obj_p -> io_resource_s))
+		{
+			show_item_flag = IsResourceInList (irods_obj_p -> io_resource_s, theme_p -> ht_resources_ss) ? 1 : 0;
+		}
+
+	return show_item_flag;
+}
+
+
 static apr_status_t PrintTableHeader (const char *heading_s, const char *default_heading_s, const char *class_s, apr_bucket_brigade *bucket_brigade_p)
 {
 	apr_status_t apr_status = APR_SUCCESS;
@@ -1020,15 +1812,26 @@ static apr_status_t PrintBreadcrumbs (struct dav_resource_private *davrods_resou
 apr_status_t PrintItem (struct HtmlTheme *theme_p, const IRodsObject *irods_obj_p, const IRodsConfig *config_p, unsigned int row_index, apr_bucket_brigade *bb_p, apr_pool_t *pool_p, rcComm_t *connection_p, request_rec *req_p)
 {
 	apr_status_t status = APR_SUCCESS;
-	const char *link_suffix_s = irods_obj_p -> io_obj_type == COLL_OBJ_T ? "/" : NULL;
+	const ListingRowPlan *plan_p = theme_p -> ht_row_plan_p;
 	const char *name_s = GetIRodsObjectDisplayName (irods_obj_p);
-	char *timestamp_s = GetIRodsObjectLastModifiedTime (irods_obj_p, pool_p);
-	char *size_s = GetIRodsObjectSizeAsString (irods_obj_p, pool_p);
-	const char *checksum_s = GetIRodsObjectChecksum (irods_obj_p);
 
 	const char * const row_classes_ss [] = { "odd", "even" };
 	const char *row_class_s = row_classes_ss [(row_index % 2 == 0) ? 0 : 1];
 
+	/*
+	 * The plan is compiled when the configs are merged so this is only
+	 * needed for a theme that hasn't been through a merge.
+	 */
+	if (!plan_p)
+		{
+			plan_p = CompileListingRowPlan (theme_p, pool_p);
+
+			if (!plan_p)
+				{
+					return APR_ENOMEM;
+				}
+		}
+
 	status = apr_brigade_printf (bb_p, NULL, NULL, "<tr class=\"%s\" id=\"%d.%s\">", row_class_s, irods_obj_p -> io_obj_type, irods_obj_p -> io_id_s);
 
 
@@ -1040,57 +1843,59 @@ apr_status_t PrintItem (struct HtmlTheme *theme_p, const IRodsObject *irods_obj_
 
 	if (name_s)
 		{
-			const char *icon_s = GetIRodsObjectIcon (irods_obj_p, theme_p);
-			const char *alt_s = GetIRodsObjectAltText (irods_obj_p);
-			char *relative_link_s = GetIRodsObjectRelativeLink (irods_obj_p, config_p, pool_p);
+			const char *escaped_icon_s = GetEscapedIconForRow (plan_p, theme_p, irods_obj_p);
 
-			// Collection links need a trailing slash for the '..' links to work correctly.
-			if (icon_s)
+			if (escaped_icon_s)
 				{
-					apr_brigade_printf (bb_p, NULL, NULL, "<td class=\"icon\"><img src=\"%s\"", ap_escape_html (pool_p, icon_s));
+					const char *alt_s = GetIRodsObjectAltText (irods_obj_p);
 
 					if (alt_s)
 						{
-							apr_brigade_printf (bb_p, NULL, NULL, " alt=\"%s\"", alt_s);
+							status = apr_brigade_putstrs (bb_p, NULL, NULL, "<td class=\"icon\"><img src=\"", escaped_icon_s, "\" alt=\"", alt_s, "\" /></td>", NULL);
+						}
+					else
+						{
+							status = apr_brigade_putstrs (bb_p, NULL, NULL, "<td class=\"icon\"><img src=\"", escaped_icon_s, "\" /></td>", NULL);
 						}
 
-					status = PrintBasicStringToBucketBrigade (" /></td>", bb_p, req_p, __FILE__, __LINE__);
 					if (status != APR_SUCCESS)
 						{
 							return status;
 						}
 				}
 
-			if (IsColumnDisplayed (theme_p -> ht_name_heading_s))
+			if (plan_p -> lrp_show_name_flag)
 				{
-					apr_brigade_printf(bb_p, NULL, NULL,
-														 "<td class=\"name\"><a href=\"%s\">%s%s</a></td>",
-														 relative_link_s,
-														 ap_escape_html (pool_p, name_s),
-														 link_suffix_s ? link_suffix_s : "");
+					const char *relative_link_s = GetIRodsObjectRelativeLink (irods_obj_p, config_p, pool_p);
+
+					// Collection links need a trailing slash for the '..' links to work correctly.
+					const char *link_suffix_s = irods_obj_p -> io_obj_type == COLL_OBJ_T ? "/" : "";
+
+					status = apr_brigade_putstrs (bb_p, NULL, NULL, "<td class=\"name\"><a href=\"", relative_link_s ? relative_link_s : "", "\">",
+																				ap_escape_html (pool_p, name_s), link_suffix_s, "</a></td>", NULL);
+
+					if (status != APR_SUCCESS)
+						{
+							return status;
+						}
 				}
 
 		}		/* if (name_s) */
 
 	// Print data object size.
-	if (IsColumnDisplayed (theme_p -> ht_size_heading_s))
+	if (plan_p -> lrp_show_size_flag)
 		{
-			status = PrintBasicStringToBucketBrigade ("<td class=\"size\">", bb_p, req_p, __FILE__, __LINE__);
-			if (status != APR_SUCCESS)
-				{
-					return status;
-				}
+			const char *size_s = GetIRodsObjectSizeAsString (irods_obj_p, pool_p);
 
 			if (size_s)
 				{
-					apr_brigade_printf (bb_p, NULL, NULL, "%sB", size_s);
+					status = apr_brigade_putstrs (bb_p, NULL, NULL, "<td class=\"size\">", size_s, "B</td>", NULL);
 				}
-			else if (irods_obj_p -> io_obj_type == DATA_OBJ_T)
+			else
 				{
-					apr_brigade_printf(bb_p, NULL, NULL, "%luB", irods_obj_p -> io_size);
+					status = apr_brigade_puts (bb_p, NULL, NULL, "<td class=\"size\"></td>");
 				}
 
-			status = PrintBasicStringToBucketBrigade ("</td>", bb_p, req_p, __FILE__, __LINE__);
 			if (status != APR_SUCCESS)
 				{
 					return status;
@@ -1100,47 +1905,64 @@ apr_status_t PrintItem (struct HtmlTheme *theme_p, const IRodsObject *irods_obj_
 
 	if (theme_p -> ht_show_resource_flag > 0)
 		{
-			apr_brigade_printf (bb_p, NULL, NULL, "<td class=\"resource\">%s</td>", (irods_obj_p -> io_resource_s) ? ap_escape_html (pool_p, irods_obj_p -> io_resource_s) : "");
+			status = apr_brigade_putstrs (bb_p, NULL, NULL, "<td class=\"resource\">", (irods_obj_p -> io_resource_s) ? ap_escape_html (pool_p, irods_obj_p -> io_resource_s) : "", "</td>", NULL);
+
+			if (status != APR_SUCCESS)
+				{
+					return status;
+				}
 		}
 
 	// Print owner
-	if (IsColumnDisplayed (theme_p -> ht_owner_heading_s))
+	if (plan_p -> lrp_show_owner_flag)
 		{
-			apr_brigade_printf (bb_p, NULL, NULL, "<td class=\"owner\">%s</td>", ap_escape_html (pool_p, irods_obj_p -> io_owner_name_s));
-		}
+			status = apr_brigade_putstrs (bb_p, NULL, NULL, "<td class=\"owner\">", (irods_obj_p -> io_owner_name_s) ? ap_escape_html (pool_p, irods_obj_p -> io_owner_name_s) : "", "</td>", NULL);
 
-	if (IsColumnDisplayed (theme_p -> ht_date_heading_s))
-		{
-			if (timestamp_s)
+			if (status != APR_SUCCESS)
 				{
-					apr_brigade_printf (bb_p, NULL, NULL, "<td class=\"time\">%s</td>", timestamp_s);
+					return status;
 				}
-			else
+		}
+
+	if (plan_p -> lrp_show_date_flag)
+		{
+			const char *timestamp_s = GetIRodsObjectLastModifiedTime (irods_obj_p, pool_p);
+
+			status = apr_brigade_putstrs (bb_p, NULL, NULL, "<td class=\"time\">", timestamp_s ? timestamp_s : "", "</td>", NULL);
+
+			if (status != APR_SUCCESS)
 				{
-					status = PrintBasicStringToBucketBrigade ("<td class=\"time\"></td>", bb_p, req_p, __FILE__, __LINE__);
-					if (status != APR_SUCCESS)
-						{
-							return status;
-						}
+					return status;
 				}
 		}
 
 
 	// Print checksum.
-	if (IsColumnDisplayed (theme_p -> ht_checksum_heading_s))
+	if (plan_p -> lrp_show_checksum_flag)
 		{
-			status = PrintBasicStringToBucketBrigade ("<td class=\"checksum\">", bb_p, req_p, __FILE__, __LINE__);
-			if (status != APR_SUCCESS)
+			const char *checksum_s = GetIRodsObjectChecksum (irods_obj_p);
+
+			if (checksum_s && (*checksum_s != '\0'))
 				{
-					return status;
+					status = apr_brigade_putstrs (bb_p, NULL, NULL, "<td class=\"checksum\">", checksum_s, "</td>", NULL);
 				}
-
-			if (checksum_s)
+			else if ((irods_obj_p -> io_obj_type == DATA_OBJ_T) && (theme_p -> ht_show_checksums_flag > 0))
+				{
+					/* Is it being calculated in the background? */
+					if (irods_obj_p -> io_checksum_pending_flag)
+						{
+							status = apr_brigade_puts (bb_p, NULL, NULL, "<td class=\"checksum pending\">pending</td>");
+						}
+					else
+						{
+							status = apr_brigade_puts (bb_p, NULL, NULL, "<td class=\"checksum missing\">missing</td>");
+						}
+				}
+			else
 				{
-					apr_brigade_printf (bb_p, NULL, NULL, "%s", checksum_s);
+					status = apr_brigade_puts (bb_p, NULL, NULL, "<td class=\"checksum\"></td>");
 				}
 
-			status = PrintBasicStringToBucketBrigade ("</td>", bb_p, req_p, __FILE__, __LINE__);
 			if (status != APR_SUCCESS)
 				{
 					return status;
@@ -1528,6 +2350,36 @@ const char *SetViewsPath (cmd_parms *cmd_p, void *config_p, const char *arg_p)
 }
 
 
+const char *SetListingSpecificQuery (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+
+	conf_p -> eirods_dav_listing_specific_query_s = arg_p;
+
+	return NULL;
+}
+
+
+const char *SetSearchSpecificQuery (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+
+	conf_p -> eirods_dav_search_specific_query_s = arg_p;
+
+	return NULL;
+}
+
+
+const char *SetFacetSpecificQuery (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+
+	conf_p -> eirods_dav_facet_specific_query_s = arg_p;
+
+	return NULL;
+}
+
+
 
 const char *SetDefaultUsername (cmd_parms *cmd_p, void *config_p, const char *arg_p)
 {
@@ -1813,6 +2665,8 @@ void MergeThemeConfigs (davrods_dir_conf_t *conf_p, davrods_dir_conf_t *parent_p
 
 	DAVRODS_PROP_MERGE (theme_p -> ht_fd_save_datapackages_flag);
 
+	DAVRODS_PROP_MERGE (theme_p -> ht_fd_cache_dir_s);
+
 	conf_p -> theme_p -> ht_icons_map_p = MergeAPRTables (parent_p -> theme_p -> ht_icons_map_p, child_p -> theme_p -> ht_icons_map_p, pool_p);
 
 
@@ -1899,6 +2753,8 @@ void MergeThemeConfigs (davrods_dir_conf_t *conf_p, davrods_dir_conf_t *parent_p
 		{
 			conf_p -> theme_p -> ht_show_metadata_flag = child_p -> theme_p -> ht_show_metadata_flag;
 		}
+
+	conf_p -> theme_p -> ht_row_plan_p = CompileListingRowPlan (conf_p -> theme_p, pool_p);
 }
 
 
@@ -2143,3 +2999,67 @@ const char *SetFDDataPackageImage (cmd_parms *cmd_p, void *config_p, const char
 
 	return NULL;
 }
+
+
+const char *SetFDCacheDir (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	davrods_dir_conf_t *conf_p = (davrods_dir_conf_t*) config_p;
+
+	conf_p -> theme_p -> ht_fd_cache_dir_s = arg_p;
+
+	return NULL;
+}
+
+
+const char *SetListingFlushRows (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *error_s = NULL;
+	apr_int64_t num_rows = apr_atoi64 (arg_p);
+
+	if ((num_rows > 0) && (num_rows <= INT_MAX))
+		{
+			s_listing_flush_rows = (unsigned int) num_rows;
+		}
+	else
+		{
+			error_s = "The number of rows between flushes of a listing must be greater than zero";
+		}
+
+	return error_s;
+}
+
+
+const char *SetListingFlushBytes (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *error_s = NULL;
+	apr_int64_t num_bytes = apr_atoi64 (arg_p);
+
+	if (num_bytes > 0)
+		{
+			s_listing_flush_bytes = (apr_off_t) num_bytes;
+		}
+	else
+		{
+			error_s = "The number of bytes between flushes of a listing must be greater than zero";
+		}
+
+	return error_s;
+}
+
+
+const char *SetListingPageSize (cmd_parms *cmd_p, void *config_p, const char *arg_p)
+{
+	const char *error_s = NULL;
+	apr_int64_t page_size = apr_atoi64 (arg_p);
+
+	if ((page_size >= 0) && (page_size <= LISTING_MAX_PAGE_SIZE))
+		{
+			s_listing_page_size = (apr_size_t) page_size;
+		}
+	else
+		{
+			error_s = apr_psprintf (cmd_p -> pool, "The listing page size must be between 0 and %d", LISTING_MAX_PAGE_SIZE);
+		}
+
+	return error_s;
+}
@@ -26,6 +26,7 @@
 #include "mod_dav.h"
 #include "apr_buckets.h"
 #include "apr_tables.h"
+#include "apr_hash.h"
 
 //#include "irods/rodsType.h"
 //#include "irods/rodsConnect.h"
@@ -58,6 +59,38 @@ typedef enum Placement
 
 
 
+/**
+ * The parts of each row of a listing that only depend upon the theme.
+ * These are worked out once when the configs are merged rather than
+ * for every row that is printed.
+ */
+typedef struct ListingRowPlan
+{
+	int lrp_show_name_flag;
+
+	int lrp_show_size_flag;
+
+	int lrp_show_owner_flag;
+
+	int lrp_show_date_flag;
+
+	int lrp_show_checksum_flag;
+
+	/**
+	 * The HTML-escaped icons keyed by data object suffix or collection name.
+	 * This is NULL if there are no icons for particular suffixes.
+	 */
+	apr_hash_t *lrp_icons_p;
+
+	const char *lrp_escaped_collection_icon_s;
+
+	const char *lrp_escaped_object_icon_s;
+
+	const char *lrp_escaped_data_package_icon_s;
+} ListingRowPlan;
+
+
+
 struct HtmlTheme
 {
 	const char *ht_head_s;
@@ -160,6 +193,14 @@ struct HtmlTheme
 	const char *ht_fd_resource_data_package_icon_s;
 
 	int ht_fd_save_datapackages_flag;
+
+	/*
+	 * The local directory to cache the generated datapackage.json
+	 * files in, or NULL to not cache them on disk.
+	 */
+	const char *ht_fd_cache_dir_s;
+
+	ListingRowPlan *ht_row_plan_p;
 };
 
 
@@ -198,7 +239,7 @@ apr_status_t PrintItem (struct HtmlTheme *theme_p, const IRodsObject *irods_obj_
 
 apr_status_t PrintAllHTMLBeforeListing (struct dav_resource_private *davrods_resource_p, const char *escaped_zone_s, const char * const page_title_s, const char *davrods_path_s, const char * const marked_up_page_title_s, char *current_id_s, const char * const user_s, davrods_dir_conf_t *conf_p, request_rec *req_p, apr_bucket_brigade *bucket_brigade_p, apr_pool_t *pool_p);
 
-apr_status_t PrintAllHTMLAfterListing (const char *user_s, const char *escaped_zone_s, const char *davrods_path_s, const davrods_dir_conf_t *conf_p, char *current_id_s, rcComm_t *connection_p, request_rec *req_p, apr_bucket_brigade *bucket_brigade_p, apr_pool_t *pool_p);
+apr_status_t PrintAllHTMLAfterListing (const char *user_s, const char *escaped_zone_s, const char *davrods_path_s, const davrods_dir_conf_t *conf_p, char *current_id_s, const ListingPage *page_p, rcComm_t *connection_p, request_rec *req_p, apr_bucket_brigade *bucket_brigade_p, apr_pool_t *pool_p);
 
 void MergeThemeConfigs (davrods_dir_conf_t *conf_p, davrods_dir_conf_t *parent_p, davrods_dir_conf_t *child_p, apr_pool_t *pool_p);
 
@@ -258,6 +299,12 @@ const char *SetAPIPath (cmd_parms *cmd_p, void *config_p, const char *arg_p);
 
 const char *SetViewsPath (cmd_parms *cmd_p, void *config_p, const char *arg_p);
 
+const char *SetListingSpecificQuery (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetSearchSpecificQuery (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetFacetSpecificQuery (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
 const char *SetDefaultUsername (cmd_parms *cmd_p, void *config_p, const char *arg_p);
 
 const char *SetDefaultPassword (cmd_parms *cmd_p, void *config_p, const char *arg_p);
@@ -314,6 +361,14 @@ const char *SetFDDataPackageImage (cmd_parms *cmd_p, void *config_p, const char
 
 const char *SetSaveFDDataPackages (cmd_parms *cmd_p, void *config_p, const char *arg_p);
 
+const char *SetFDCacheDir (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetListingFlushRows (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetListingFlushBytes (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
+const char *SetListingPageSize (cmd_parms *cmd_p, void *config_p, const char *arg_p);
+
 
 #ifdef __cplusplus
 }